@@ -21,7 +21,11 @@ func getBatchSize(parallel int) (int, error) {
 	return batchSize, nil
 }
 
-func processBatch(count int, batchSize int, process func(index int, wg *sync.WaitGroup)) time.Duration {
+func processBatch(count int, batchSize int, rate float64, process func(index int, wg *sync.WaitGroup)) time.Duration {
+	if rate > 0 {
+		return processRate(count, rate, process)
+	}
+
 	batches := count / batchSize
 	remainder := count % batchSize
 	processed := 0
@@ -60,3 +64,33 @@ func processBatch(count int, batchSize int, process func(index int, wg *sync.Wai
 	logf("Batch processing completed in %.3fs", duration.Seconds())
 	return duration
 }
+
+// processRate starts the processing of each item at a fixed rate per second, whether or not the
+// previous ones completed (open-loop).
+func processRate(count int, rate float64, process func(index int, wg *sync.WaitGroup)) time.Duration {
+	interval := time.Duration(float64(time.Second) / rate)
+	wg := sync.WaitGroup{}
+	nextStat := 1
+
+	logf("Rate processing start (%.3f/s)", rate)
+	timeStart := time.Now()
+
+	for i := 0; i < count; i++ {
+		// Schedule from the start time so that delays don't lower the rate.
+		time.Sleep(time.Until(timeStart.Add(time.Duration(i) * interval)))
+
+		wg.Add(1)
+		go process(i, &wg)
+
+		if i+1 >= nextStat {
+			logf("Started %d operations in %.3fs", i+1, time.Since(timeStart).Seconds())
+			nextStat = nextStat * 2
+		}
+	}
+
+	wg.Wait()
+
+	duration := time.Since(timeStart)
+	logf("Rate processing completed in %.3fs", duration.Seconds())
+	return duration
+}
@@ -37,7 +37,7 @@ func PrintServerInfo(c lxd.ContainerServer) error {
 }
 
 // LaunchContainers launches a set of containers.
-func LaunchContainers(c lxd.ContainerServer, count int, parallel int, image string, privileged bool, start bool, freeze bool) (time.Duration, error) {
+func LaunchContainers(c lxd.ContainerServer, count int, parallel int, rate float64, image string, privileged bool, start bool, freeze bool) (time.Duration, error) {
 	var duration time.Duration
 
 	batchSize, err := getBatchSize(parallel)
@@ -45,7 +45,7 @@ func LaunchContainers(c lxd.ContainerServer, count int, parallel int, image stri
 		return duration, err
 	}
 
-	printTestConfig(count, batchSize, image, privileged, freeze)
+	printTestConfig(count, batchSize, rate, image, privileged, freeze)
 
 	fingerprint, err := ensureImage(c, image)
 	if err != nil {
@@ -80,12 +80,12 @@ func LaunchContainers(c lxd.ContainerServer, count int, parallel int, image stri
 		}
 	}
 
-	duration = processBatch(count, batchSize, batchStart)
+	duration = processBatch(count, batchSize, rate, batchStart)
 	return duration, nil
 }
 
 // CreateContainers create the specified number of containers.
-func CreateContainers(c lxd.ContainerServer, count int, parallel int, fingerprint string, privileged bool) (time.Duration, error) {
+func CreateContainers(c lxd.ContainerServer, count int, parallel int, rate float64, fingerprint string, privileged bool) (time.Duration, error) {
 	var duration time.Duration
 
 	batchSize, err := getBatchSize(parallel)
@@ -105,7 +105,7 @@ func CreateContainers(c lxd.ContainerServer, count int, parallel int, fingerprin
 		}
 	}
 
-	duration = processBatch(count, batchSize, batchCreate)
+	duration = processBatch(count, batchSize, rate, batchCreate)
 
 	return duration, nil
 }
@@ -129,7 +129,7 @@ func GetContainers(c lxd.ContainerServer) ([]api.Container, error) {
 }
 
 // StartContainers starts containers created by the benchmark.
-func StartContainers(c lxd.ContainerServer, containers []api.Container, parallel int) (time.Duration, error) {
+func StartContainers(c lxd.ContainerServer, containers []api.Container, parallel int, rate float64) (time.Duration, error) {
 	var duration time.Duration
 
 	batchSize, err := getBatchSize(parallel)
@@ -153,12 +153,12 @@ func StartContainers(c lxd.ContainerServer, containers []api.Container, parallel
 		}
 	}
 
-	duration = processBatch(count, batchSize, batchStart)
+	duration = processBatch(count, batchSize, rate, batchStart)
 	return duration, nil
 }
 
 // StopContainers stops containers created by the benchmark.
-func StopContainers(c lxd.ContainerServer, containers []api.Container, parallel int) (time.Duration, error) {
+func StopContainers(c lxd.ContainerServer, containers []api.Container, parallel int, rate float64) (time.Duration, error) {
 	var duration time.Duration
 
 	batchSize, err := getBatchSize(parallel)
@@ -182,12 +182,12 @@ func StopContainers(c lxd.ContainerServer, containers []api.Container, parallel
 		}
 	}
 
-	duration = processBatch(count, batchSize, batchStop)
+	duration = processBatch(count, batchSize, rate, batchStop)
 	return duration, nil
 }
 
 // DeleteContainers removes containers created by the benchmark.
-func DeleteContainers(c lxd.ContainerServer, containers []api.Container, parallel int) (time.Duration, error) {
+func DeleteContainers(c lxd.ContainerServer, containers []api.Container, parallel int, rate float64) (time.Duration, error) {
 	var duration time.Duration
 
 	batchSize, err := getBatchSize(parallel)
@@ -218,10 +218,159 @@ func DeleteContainers(c lxd.ContainerServer, containers []api.Container, paralle
 		}
 	}
 
-	duration = processBatch(count, batchSize, batchDelete)
+	duration = processBatch(count, batchSize, rate, batchDelete)
 	return duration, nil
 }
 
+// ExecContainers runs a command in the running containers created by the benchmark, count times in total.
+func ExecContainers(c lxd.ContainerServer, containers []api.Container, count int, parallel int, rate float64, command []string) (time.Duration, error) {
+	var duration time.Duration
+
+	batchSize, err := getBatchSize(parallel)
+	if err != nil {
+		return duration, err
+	}
+
+	containers = activeContainers(containers)
+	if len(containers) == 0 {
+		return duration, fmt.Errorf("No running benchmark containers")
+	}
+
+	logf("Running %d commands", count)
+
+	batchExec := func(index int, wg *sync.WaitGroup) {
+		defer wg.Done()
+
+		name := containers[index%len(containers)].Name
+		err := execContainer(c, name, command)
+		if err != nil {
+			logf("Failed to run command in container '%s': %s", name, err)
+			return
+		}
+	}
+
+	duration = processBatch(count, batchSize, rate, batchExec)
+	return duration, nil
+}
+
+// TransferFiles pushes a file of the given size to the running containers created by the
+// benchmark and pulls it back, count times in total.
+func TransferFiles(c lxd.ContainerServer, containers []api.Container, count int, parallel int, rate float64, size int) (time.Duration, error) {
+	var duration time.Duration
+
+	batchSize, err := getBatchSize(parallel)
+	if err != nil {
+		return duration, err
+	}
+
+	containers = activeContainers(containers)
+	if len(containers) == 0 {
+		return duration, fmt.Errorf("No running benchmark containers")
+	}
+
+	logf("Transferring %d files of %d bytes", count, size)
+
+	content := make([]byte, size)
+
+	batchTransfer := func(index int, wg *sync.WaitGroup) {
+		defer wg.Done()
+
+		name := containers[index%len(containers)].Name
+		path := fmt.Sprintf("/root/lxd-benchmark-%d", index)
+
+		err := pushFile(c, name, path, content)
+		if err != nil {
+			logf("Failed to push file to container '%s': %s", name, err)
+			return
+		}
+
+		err = pullFile(c, name, path)
+		if err != nil {
+			logf("Failed to pull file from container '%s': %s", name, err)
+			return
+		}
+
+		err = c.DeleteContainerFile(name, path)
+		if err != nil {
+			logf("Failed to delete file from container '%s': %s", name, err)
+			return
+		}
+	}
+
+	duration = processBatch(count, batchSize, rate, batchTransfer)
+	return duration, nil
+}
+
+// SnapshotContainers creates and deletes a snapshot of each container created by the benchmark.
+func SnapshotContainers(c lxd.ContainerServer, containers []api.Container, parallel int, rate float64) (time.Duration, error) {
+	var duration time.Duration
+
+	batchSize, err := getBatchSize(parallel)
+	if err != nil {
+		return duration, err
+	}
+
+	count := len(containers)
+	logf("Snapshotting %d containers", count)
+
+	batchSnapshot := func(index int, wg *sync.WaitGroup) {
+		defer wg.Done()
+
+		name := containers[index].Name
+
+		err := createSnapshot(c, name, "lxd-benchmark")
+		if err != nil {
+			logf("Failed to snapshot container '%s': %s", name, err)
+			return
+		}
+
+		err = deleteSnapshot(c, name, "lxd-benchmark")
+		if err != nil {
+			logf("Failed to delete snapshot of container '%s': %s", name, err)
+			return
+		}
+	}
+
+	duration = processBatch(count, batchSize, rate, batchSnapshot)
+	return duration, nil
+}
+
+// ScrapeMetrics retrieves the server metrics count times.
+func ScrapeMetrics(c lxd.ContainerServer, count int, parallel int, rate float64) (time.Duration, error) {
+	var duration time.Duration
+
+	batchSize, err := getBatchSize(parallel)
+	if err != nil {
+		return duration, err
+	}
+
+	logf("Scraping metrics %d times", count)
+
+	batchScrape := func(index int, wg *sync.WaitGroup) {
+		defer wg.Done()
+
+		err := scrapeMetrics(c)
+		if err != nil {
+			logf("Failed to scrape metrics: %s", err)
+			return
+		}
+	}
+
+	duration = processBatch(count, batchSize, rate, batchScrape)
+	return duration, nil
+}
+
+func activeContainers(containers []api.Container) []api.Container {
+	active := []api.Container{}
+	for _, container := range containers {
+		if container.IsActive() {
+			active = append(active, container)
+		}
+	}
+
+	return active
+}
+
 func ensureImage(c lxd.ContainerServer, image string) (string, error) {
 	var fingerprint string
 
@@ -0,0 +1,113 @@
+package benchmark
+
+import (
+	"encoding/json"
+	"fmt"
+	"math"
+	"os"
+	"slices"
+	"sync"
+	"time"
+)
+
+// LatencySummary is the latency distribution of a phase of the benchmarked operations.
+type LatencySummary struct {
+	Phase string `json:"phase"`
+	Count int    `json:"count"`
+
+	// Latencies in nanoseconds.
+	P50 time.Duration `json:"p50"`
+	P95 time.Duration `json:"p95"`
+	P99 time.Duration `json:"p99"`
+	Max time.Duration `json:"max"`
+}
+
+// LatencyReport is the JSON latency report of a benchmark run.
+type LatencyReport struct {
+	Label     string           `json:"label"`
+	Timestamp time.Time        `json:"timestamp"`
+	Phases    []LatencySummary `json:"phases"`
+}
+
+// latencyRecorder records the latency of every operation, per phase.
+type latencyRecorder struct {
+	mu      sync.Mutex
+	phases  []string
+	samples map[string][]time.Duration
+}
+
+var latencies = latencyRecorder{samples: map[string][]time.Duration{}}
+
+func (l *latencyRecorder) record(phase string, latency time.Duration) {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+
+	_, ok := l.samples[phase]
+	if !ok {
+		l.phases = append(l.phases, phase)
+	}
+
+	l.samples[phase] = append(l.samples[phase], latency)
+}
+
+func (l *latencyRecorder) summaries() []LatencySummary {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+
+	summaries := make([]LatencySummary, 0, len(l.phases))
+	for _, phase := range l.phases {
+		samples := slices.Clone(l.samples[phase])
+		slices.Sort(samples)
+
+		summaries = append(summaries, LatencySummary{
+			Phase: phase,
+			Count: len(samples),
+			P50:   percentile(samples, 0.50),
+			P95:   percentile(samples, 0.95),
+			P99:   percentile(samples, 0.99),
+			Max:   samples[len(samples)-1],
+		})
+	}
+
+	return summaries
+}
+
+// percentile returns the nearest-rank percentile of the sorted samples.
+func percentile(samples []time.Duration, p float64) time.Duration {
+	rank := int(math.Ceil(p * float64(len(samples))))
+	return samples[max(rank, 1)-1]
+}
+
+// LatencySummaries returns the latency distribution of each phase of the operations run so far.
+//
+// Phases are named after the API calls, the time the LXD operation of a call spent running on
+// the server (from its creation to its last update) being recorded as the "/server" sub-phase.
+func LatencySummaries() []LatencySummary {
+	return latencies.summaries()
+}
+
+// PrintLatencies prints out the latency distributions.
+func PrintLatencies(summaries []LatencySummary) {
+	fmt.Println("Latencies:")
+	for _, s := range summaries {
+		fmt.Printf("  %s: count=%d p50=%s p95=%s p99=%s max=%s\n", s.Phase, s.Count, s.P50, s.P95, s.P99, s.Max)
+	}
+
+	fmt.Println("")
+}
+
+// WriteLatencies writes the latency distributions to a JSON report file.
+func WriteLatencies(filename string, label string, summaries []LatencySummary) error {
+	data, err := json.MarshalIndent(LatencyReport{Label: label, Timestamp: time.Now(), Phases: summaries}, "", "  ")
+	if err != nil {
+		return err
+	}
+
+	err = os.WriteFile(filename, append(data, '\n'), 0640)
+	if err != nil {
+		return err
+	}
+
+	logf("Written latency report file %s", filename)
+	return nil
+}
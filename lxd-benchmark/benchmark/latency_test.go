@@ -0,0 +1,51 @@
+package benchmark
+
+import (
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestLatencySummaries(t *testing.T) {
+	recorder := latencyRecorder{samples: map[string][]time.Duration{}}
+
+	for i := 100; i > 0; i-- {
+		recorder.record("start", time.Duration(i)*time.Millisecond)
+	}
+
+	recorder.record("start/server", time.Second)
+
+	summaries := recorder.summaries()
+	require.Equal(t, []LatencySummary{
+		{Phase: "start", Count: 100, P50: 50 * time.Millisecond, P95: 95 * time.Millisecond, P99: 99 * time.Millisecond, Max: 100 * time.Millisecond},
+		{Phase: "start/server", Count: 1, P50: time.Second, P95: time.Second, P99: time.Second, Max: time.Second},
+	}, summaries)
+}
+
+func TestProcessRate(t *testing.T) {
+	started := make(chan int, 5)
+	release := make(chan struct{})
+
+	go func() {
+		// Operations block until all of them started, which only happens if starting them
+		// doesn't wait for the previous ones to complete.
+		for i := 0; i < 5; i++ {
+			select {
+			case <-started:
+			case <-time.After(10 * time.Second):
+				t.Error("Timed out waiting for operations to start")
+			}
+		}
+
+		close(release)
+	}()
+
+	processRate(5, 1000, func(index int, wg *sync.WaitGroup) {
+		defer wg.Done()
+
+		started <- index
+		<-release
+	})
+}
@@ -1,10 +1,39 @@
 package benchmark
 
 import (
+	"bytes"
+	"io"
+	"time"
+
 	"github.com/canonical/lxd/client"
 	"github.com/canonical/lxd/shared/api"
 )
 
+// runOperation calls the API and waits for the resulting operation, recording the latency of the
+// successful ones under the phase, along with the time the operation spent running on the server.
+func runOperation(phase string, call func() (lxd.Operation, error)) error {
+	timeStart := time.Now()
+
+	op, err := call()
+	if err != nil {
+		return err
+	}
+
+	err = op.Wait()
+	if err != nil {
+		return err
+	}
+
+	latencies.record(phase, time.Since(timeStart))
+
+	info := op.Get()
+	if !info.CreatedAt.IsZero() && info.UpdatedAt.After(info.CreatedAt) {
+		latencies.record(phase+"/server", info.UpdatedAt.Sub(info.CreatedAt))
+	}
+
+	return nil
+}
+
 func createContainer(c lxd.ContainerServer, fingerprint string, name string, privileged bool) error {
 	config := map[string]string{}
 	if privileged {
@@ -23,17 +52,37 @@ func createContainer(c lxd.ContainerServer, fingerprint string, name string, pri
 
 	req.Config = config
 
-	op, err := c.CreateContainer(req)
-	if err != nil {
-		return err
-	}
-
-	return op.Wait()
+	return runOperation("create", func() (lxd.Operation, error) {
+		return c.CreateContainer(req)
+	})
 }
 
 func startContainer(c lxd.ContainerServer, name string) error {
-	op, err := c.UpdateContainerState(
-		name, api.ContainerStatePut{Action: "start", Timeout: -1}, "")
+	return runOperation("start", func() (lxd.Operation, error) {
+		return c.UpdateContainerState(name, api.ContainerStatePut{Action: "start", Timeout: -1}, "")
+	})
+}
+
+func stopContainer(c lxd.ContainerServer, name string) error {
+	return runOperation("stop", func() (lxd.Operation, error) {
+		return c.UpdateContainerState(name, api.ContainerStatePut{Action: "stop", Timeout: -1, Force: true}, "")
+	})
+}
+
+func freezeContainer(c lxd.ContainerServer, name string) error {
+	return runOperation("freeze", func() (lxd.Operation, error) {
+		return c.UpdateContainerState(name, api.ContainerStatePut{Action: "freeze", Timeout: -1}, "")
+	})
+}
+
+func deleteContainer(c lxd.ContainerServer, name string) error {
+	return runOperation("delete", func() (lxd.Operation, error) {
+		return c.DeleteContainer(name)
+	})
+}
+
+func copyImage(c lxd.ContainerServer, s lxd.ImageServer, image api.Image) error {
+	op, err := c.CopyImage(s, image, nil)
 	if err != nil {
 		return err
 	}
@@ -41,40 +90,68 @@ func startContainer(c lxd.ContainerServer, name string) error {
 	return op.Wait()
 }
 
-func stopContainer(c lxd.ContainerServer, name string) error {
-	op, err := c.UpdateContainerState(
-		name, api.ContainerStatePut{Action: "stop", Timeout: -1, Force: true}, "")
+func execContainer(c lxd.ContainerServer, name string, command []string) error {
+	return runOperation("exec", func() (lxd.Operation, error) {
+		return c.ExecContainer(name, api.ContainerExecPost{Command: command}, nil)
+	})
+}
+
+func pushFile(c lxd.ContainerServer, name string, path string, content []byte) error {
+	timeStart := time.Now()
+
+	err := c.CreateContainerFile(name, path, lxd.ContainerFileArgs{
+		Content:   bytes.NewReader(content),
+		Mode:      0600,
+		Type:      "file",
+		WriteMode: "overwrite",
+	})
 	if err != nil {
 		return err
 	}
 
-	return op.Wait()
+	latencies.record("file-push", time.Since(timeStart))
+	return nil
 }
 
-func freezeContainer(c lxd.ContainerServer, name string) error {
-	op, err := c.UpdateContainerState(
-		name, api.ContainerStatePut{Action: "freeze", Timeout: -1}, "")
+func pullFile(c lxd.ContainerServer, name string, path string) error {
+	timeStart := time.Now()
+
+	content, _, err := c.GetContainerFile(name, path)
 	if err != nil {
 		return err
 	}
 
-	return op.Wait()
-}
+	defer func() { _ = content.Close() }()
 
-func deleteContainer(c lxd.ContainerServer, name string) error {
-	op, err := c.DeleteContainer(name)
+	_, err = io.Copy(io.Discard, content)
 	if err != nil {
 		return err
 	}
 
-	return op.Wait()
+	latencies.record("file-pull", time.Since(timeStart))
+	return nil
 }
 
-func copyImage(c lxd.ContainerServer, s lxd.ImageServer, image api.Image) error {
-	op, err := c.CopyImage(s, image, nil)
+func createSnapshot(c lxd.ContainerServer, name string, snapshotName string) error {
+	return runOperation("snapshot-create", func() (lxd.Operation, error) {
+		return c.CreateContainerSnapshot(name, api.ContainerSnapshotsPost{Name: snapshotName})
+	})
+}
+
+func deleteSnapshot(c lxd.ContainerServer, name string, snapshotName string) error {
+	return runOperation("snapshot-delete", func() (lxd.Operation, error) {
+		return c.DeleteContainerSnapshot(name, snapshotName)
+	})
+}
+
+func scrapeMetrics(c lxd.ContainerServer) error {
+	timeStart := time.Now()
+
+	_, err := c.GetMetrics()
 	if err != nil {
 		return err
 	}
 
-	return op.Wait()
+	latencies.record("metrics", time.Since(timeStart))
+	return nil
 }
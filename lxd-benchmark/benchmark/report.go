@@ -92,6 +92,31 @@ func (r *CSVReport) AddRecord(label string, elapsed time.Duration) error {
 	return r.addRecord(record)
 }
 
+// AddLatencyRecords adds a record for each percentile of the latency distributions to the report,
+// labeled "<label>/<phase>/<percentile>".
+func (r *CSVReport) AddLatencyRecords(label string, summaries []LatencySummary) error {
+	for _, s := range summaries {
+		percentiles := []struct {
+			name    string
+			latency time.Duration
+		}{
+			{"p50", s.P50},
+			{"p95", s.P95},
+			{"p99", s.P99},
+			{"max", s.Max},
+		}
+
+		for _, p := range percentiles {
+			err := r.AddRecord(fmt.Sprintf("%s/%s/%s", label, s.Phase, p.name), p.latency)
+			if err != nil {
+				return err
+			}
+		}
+	}
+
+	return nil
+}
+
 func (r *CSVReport) addRecord(record []string) error {
 	if len(record) != len(csvFields) {
 		return fmt.Errorf("Invalid number of fields : %q", record)
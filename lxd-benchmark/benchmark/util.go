@@ -14,7 +14,7 @@ func logf(format string, args ...any) {
 	fmt.Printf(fmt.Sprintf("[%s] %s\n", time.Now().Format(time.StampMilli), format), args...)
 }
 
-func printTestConfig(count int, batchSize int, image string, privileged bool, freeze bool) {
+func printTestConfig(count int, batchSize int, rate float64, image string, privileged bool, freeze bool) {
 	privilegedStr := "unprivileged"
 	if privileged {
 		privilegedStr = "privileged"
@@ -32,8 +32,13 @@ func printTestConfig(count int, batchSize int, image string, privileged bool, fr
 	fmt.Println("  Container mode:", privilegedStr)
 	fmt.Println("  Startup mode:", mode)
 	fmt.Println("  Image:", image)
-	fmt.Println("  Batches:", batches)
-	fmt.Println("  Batch size:", batchSize)
-	fmt.Println("  Remainder:", remainder)
+	if rate > 0 {
+		fmt.Printf("  Rate: %.3f/s\n", rate)
+	} else {
+		fmt.Println("  Batches:", batches)
+		fmt.Println("  Batch size:", batchSize)
+		fmt.Println("  Remainder:", remainder)
+	}
+
 	fmt.Println("")
 }
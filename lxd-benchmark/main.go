@@ -14,8 +14,10 @@ import (
 
 type cmdGlobal struct {
 	flagHelp        bool
+	flagLatencyFile string
 	flagParallel    int
 	flagProject     string
+	flagRate        float64
 	flagReportFile  string
 	flagReportLabel string
 	flagVersion     bool
@@ -55,9 +57,9 @@ func (c *cmdGlobal) Run(cmd *cobra.Command, args []string) error {
 }
 
 func (c *cmdGlobal) Teardown(cmd *cobra.Command, args []string) error {
-	// Nothing to do with not reporting
-	if c.report == nil {
-		return nil
+	latencies := benchmark.LatencySummaries()
+	if len(latencies) > 0 {
+		benchmark.PrintLatencies(latencies)
 	}
 
 	label := cmd.Name()
@@ -65,11 +67,28 @@ func (c *cmdGlobal) Teardown(cmd *cobra.Command, args []string) error {
 		label = c.flagReportLabel
 	}
 
+	if c.flagLatencyFile != "" {
+		err := benchmark.WriteLatencies(c.flagLatencyFile, label, latencies)
+		if err != nil {
+			return err
+		}
+	}
+
+	// Nothing to do with not reporting
+	if c.report == nil {
+		return nil
+	}
+
 	err := c.report.AddRecord(label, c.reportDuration)
 	if err != nil {
 		return err
 	}
 
+	err = c.report.AddLatencyRecords(label, latencies)
+	if err != nil {
+		return err
+	}
+
 	err = c.report.Write()
 	if err != nil {
 		return err
@@ -91,7 +110,8 @@ func main() {
   compare performance on different servers or for performance tracking
   when doing changes to the LXD codebase.
 
-  A CSV report can be produced to be consumed by graphing software.
+  A CSV report can be produced to be consumed by graphing software,
+  along with a JSON report of the latency distribution of each API call.
 `
 	app.Example = `  # Spawn 20 Ubuntu containers in batches of 4
   lxd-benchmark launch --count 20 --parallel 4
@@ -99,6 +119,9 @@ func main() {
   # Create 50 Ubuntu Minimal 24.04 containers in batches of 10
   lxd-benchmark init --count 50 --parallel 10 ubuntu-minimal:24.04
 
+  # Run 1000 commands in the running test containers, 50 per second
+  lxd-benchmark exec --count 1000 --rate 50 -- true
+
   # Delete all test containers using dynamic batch size
   lxd-benchmark delete`
 	app.SilenceUsage = true
@@ -111,6 +134,8 @@ func main() {
 	app.PersistentFlags().BoolVar(&globalCmd.flagVersion, "version", false, "Print version number")
 	app.PersistentFlags().BoolVarP(&globalCmd.flagHelp, "help", "h", false, "Print help")
 	app.PersistentFlags().IntVarP(&globalCmd.flagParallel, "parallel", "P", -1, "Number of threads to use"+"``")
+	app.PersistentFlags().Float64Var(&globalCmd.flagRate, "rate", 0, "Number of operations to start per second, regardless of their completion (overrides --parallel)"+"``")
+	app.PersistentFlags().StringVar(&globalCmd.flagLatencyFile, "latency-file", "", "Path to the JSON latency report file"+"``")
 	app.PersistentFlags().StringVar(&globalCmd.flagReportFile, "report-file", "", "Path to the CSV report file"+"``")
 	app.PersistentFlags().StringVar(&globalCmd.flagReportLabel, "report-label", "", "Label for the new entry in the report [default=ACTION]"+"``")
 	app.PersistentFlags().StringVar(&globalCmd.flagProject, "project", "default", "Project to use")
@@ -139,6 +164,22 @@ func main() {
 	deleteCmd := cmdDelete{global: &globalCmd}
 	app.AddCommand(deleteCmd.Command())
 
+	// exec sub-command
+	execCmd := cmdExec{global: &globalCmd}
+	app.AddCommand(execCmd.Command())
+
+	// file sub-command
+	fileCmd := cmdFile{global: &globalCmd}
+	app.AddCommand(fileCmd.Command())
+
+	// snapshot sub-command
+	snapshotCmd := cmdSnapshot{global: &globalCmd}
+	app.AddCommand(snapshotCmd.Command())
+
+	// metrics sub-command
+	metricsCmd := cmdMetrics{global: &globalCmd}
+	app.AddCommand(metricsCmd.Command())
+
 	// Run the main command and handle errors
 	err := app.Execute()
 	if err != nil {
@@ -0,0 +1,47 @@
+package main
+
+import (
+	"github.com/spf13/cobra"
+
+	"github.com/canonical/lxd/lxd-benchmark/benchmark"
+)
+
+type cmdExec struct {
+	global *cmdGlobal
+
+	flagCount int
+}
+
+func (c *cmdExec) Command() *cobra.Command {
+	cmd := &cobra.Command{}
+	cmd.Use = "exec [--] <command>..."
+	cmd.Short = "Run commands in containers"
+	cmd.Args = cobra.MinimumNArgs(1)
+	cmd.RunE = c.Run
+	cmd.Flags().IntVarP(&c.flagCount, "count", "C", 0, "Number of commands to run [default=one per container]"+"``")
+
+	return cmd
+}
+
+func (c *cmdExec) Run(cmd *cobra.Command, args []string) error {
+	// Get the containers
+	containers, err := benchmark.GetContainers(c.global.srv)
+	if err != nil {
+		return err
+	}
+
+	count := c.flagCount
+	if count < 1 {
+		count = len(containers)
+	}
+
+	// Run the test
+	duration, err := benchmark.ExecContainers(c.global.srv, containers, count, c.global.flagParallel, c.global.flagRate, args)
+	if err != nil {
+		return err
+	}
+
+	c.global.reportDuration = duration
+
+	return nil
+}
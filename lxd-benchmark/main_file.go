@@ -0,0 +1,48 @@
+package main
+
+import (
+	"github.com/spf13/cobra"
+
+	"github.com/canonical/lxd/lxd-benchmark/benchmark"
+)
+
+type cmdFile struct {
+	global *cmdGlobal
+
+	flagCount int
+	flagSize  int
+}
+
+func (c *cmdFile) Command() *cobra.Command {
+	cmd := &cobra.Command{}
+	cmd.Use = "file"
+	cmd.Short = "Push and pull files to and from containers"
+	cmd.RunE = c.Run
+	cmd.Flags().IntVarP(&c.flagCount, "count", "C", 0, "Number of files to transfer [default=one per container]"+"``")
+	cmd.Flags().IntVar(&c.flagSize, "size", 1024*1024, "Size of the files in bytes"+"``")
+
+	return cmd
+}
+
+func (c *cmdFile) Run(cmd *cobra.Command, args []string) error {
+	// Get the containers
+	containers, err := benchmark.GetContainers(c.global.srv)
+	if err != nil {
+		return err
+	}
+
+	count := c.flagCount
+	if count < 1 {
+		count = len(containers)
+	}
+
+	// Run the test
+	duration, err := benchmark.TransferFiles(c.global.srv, containers, count, c.global.flagParallel, c.global.flagRate, c.flagSize)
+	if err != nil {
+		return err
+	}
+
+	c.global.reportDuration = duration
+
+	return nil
+}
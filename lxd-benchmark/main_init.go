@@ -32,7 +32,7 @@ func (c *cmdInit) Run(cmd *cobra.Command, args []string) error {
 	}
 
 	// Run the test
-	duration, err := benchmark.LaunchContainers(c.global.srv, c.flagCount, c.global.flagParallel, image, c.flagPrivileged, false, false)
+	duration, err := benchmark.LaunchContainers(c.global.srv, c.flagCount, c.global.flagParallel, c.global.flagRate, image, c.flagPrivileged, false, false)
 	if err != nil {
 		return err
 	}
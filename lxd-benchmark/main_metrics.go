@@ -0,0 +1,35 @@
+package main
+
+import (
+	"github.com/spf13/cobra"
+
+	"github.com/canonical/lxd/lxd-benchmark/benchmark"
+)
+
+type cmdMetrics struct {
+	global *cmdGlobal
+
+	flagCount int
+}
+
+func (c *cmdMetrics) Command() *cobra.Command {
+	cmd := &cobra.Command{}
+	cmd.Use = "metrics"
+	cmd.Short = "Scrape the server metrics"
+	cmd.RunE = c.Run
+	cmd.Flags().IntVarP(&c.flagCount, "count", "C", 1, "Number of scrapes"+"``")
+
+	return cmd
+}
+
+func (c *cmdMetrics) Run(cmd *cobra.Command, args []string) error {
+	// Run the test
+	duration, err := benchmark.ScrapeMetrics(c.global.srv, c.flagCount, c.global.flagParallel, c.global.flagRate)
+	if err != nil {
+		return err
+	}
+
+	c.global.reportDuration = duration
+
+	return nil
+}
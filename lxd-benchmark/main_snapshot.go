@@ -0,0 +1,38 @@
+package main
+
+import (
+	"github.com/spf13/cobra"
+
+	"github.com/canonical/lxd/lxd-benchmark/benchmark"
+)
+
+type cmdSnapshot struct {
+	global *cmdGlobal
+}
+
+func (c *cmdSnapshot) Command() *cobra.Command {
+	cmd := &cobra.Command{}
+	cmd.Use = "snapshot"
+	cmd.Short = "Create and delete snapshots of containers"
+	cmd.RunE = c.Run
+
+	return cmd
+}
+
+func (c *cmdSnapshot) Run(cmd *cobra.Command, args []string) error {
+	// Get the containers
+	containers, err := benchmark.GetContainers(c.global.srv)
+	if err != nil {
+		return err
+	}
+
+	// Run the test
+	duration, err := benchmark.SnapshotContainers(c.global.srv, containers, c.global.flagParallel, c.global.flagRate)
+	if err != nil {
+		return err
+	}
+
+	c.global.reportDuration = duration
+
+	return nil
+}
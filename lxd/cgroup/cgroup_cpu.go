@@ -4,18 +4,24 @@ import (
 	"fmt"
 	"strconv"
 	"strings"
+	"sync/atomic"
 )
 
 // DeviceSchedRebalance channel for scheduling a CPU rebalance.
-var DeviceSchedRebalance = make(chan []string, 2)
+var DeviceSchedRebalance = make(chan []string, 64)
+
+// DeviceSchedRebalanceDropped is set when a rebalance event got dropped, the next rebalance then
+// has to cover all instances.
+var DeviceSchedRebalanceDropped atomic.Bool
 
 // TaskSchedulerTrigger triggers a CPU rebalance.
-func TaskSchedulerTrigger(srcType string, srcName string, srcStatus string) {
+func TaskSchedulerTrigger(srcType string, srcProject string, srcName string, srcStatus string) {
 	// Spawn a go routine which then triggers the scheduler
 	select {
-	case DeviceSchedRebalance <- []string{srcType, srcName, srcStatus}:
+	case DeviceSchedRebalance <- []string{srcType, srcProject, srcName, srcStatus}:
 	default:
 		// Channel is full, drop the event
+		DeviceSchedRebalanceDropped.Store(true)
 	}
 }
 
@@ -74,6 +74,7 @@ import (
 	"github.com/canonical/lxd/shared/cancel"
 	"github.com/canonical/lxd/shared/entity"
 	"github.com/canonical/lxd/shared/logger"
+	"github.com/canonical/lxd/shared/netutils"
 	"github.com/canonical/lxd/shared/version"
 )
 
@@ -112,6 +113,9 @@ type Daemon struct {
 	gateway   *cluster.Gateway
 	seccomp   *seccomp.Server
 
+	// Cache of the network state of the instances' network namespaces.
+	netnsIfaddrs *netutils.NetnsIfaddrsCache
+
 	proxy func(req *http.Request) (*url.URL, error)
 
 	oidcVerifier *oidc.Verifier
@@ -163,6 +167,9 @@ type Daemon struct {
 	syslogSocketCancel context.CancelFunc
 }
 
+// netnsIfaddrsCacheMaxAge bounds how stale the interface counters in the instance state can get.
+const netnsIfaddrsCacheMaxAge = 5 * time.Second
+
 // DaemonConfig holds configuration values for Daemon.
 type DaemonConfig struct {
 	Group              string        // Group name the local unix socket should be chown'ed to
@@ -498,6 +505,7 @@ func (d *Daemon) State() *state.State {
 		BGP:                 d.bgp,
 		DNS:                 d.dns,
 		OS:                  d.os,
+		NetnsIfaddrs:        d.netnsIfaddrs,
 		Endpoints:           d.endpoints,
 		Events:              d.events,
 		DevlxdEvents:        d.devlxdEvents,
@@ -942,6 +950,11 @@ func (d *Daemon) init() error {
 	d.os.NetnsGetifaddrs = canUseNetnsGetifaddrs()
 	if d.os.NetnsGetifaddrs {
 		logger.Info(" - netnsid-based network retrieval: yes")
+
+		d.netnsIfaddrs, err = netutils.NewNetnsIfaddrsCache(netnsIfaddrsCacheMaxAge)
+		if err != nil {
+			logger.Warn("Failed to set up the network state cache", logger.Ctx{"err": err})
+		}
 	} else {
 		logger.Info(" - netnsid-based network retrieval: no")
 	}
@@ -1939,6 +1952,10 @@ func (d *Daemon) Stop(ctx context.Context, sig os.Signal) error {
 		trackError(d.seccomp.Stop(), "Stop seccomp")
 	}
 
+	if d.netnsIfaddrs != nil {
+		trackError(d.netnsIfaddrs.Close(), "Stop network state cache")
+	}
+
 	n = len(errs)
 	if n > 0 {
 		format := "%v"
@@ -51,6 +51,8 @@ type proxyProcInfo struct {
 	securityUID    string
 	securityGID    string
 	proxyProtocol  string
+	listeners      string
+	cpuSteering    string
 	inheritFds     []*os.File
 }
 
@@ -159,6 +161,24 @@ func (d *proxy) validateConfig(instConf instance.ConfigReader) error {
 		//  required: no
 		//  shortdesc: Whether to use the HAProxy PROXY protocol
 		"proxy_protocol": validate.Optional(validate.IsBool),
+		// lxdmeta:generate(entities=device-proxy; group=device-conf; key=listeners)
+		// When set above 1, this many `SO_REUSEPORT` sockets are opened for each TCP or UDP listen address,
+		// each served by its own thread so that accepting and relaying connections scale across CPUs.
+		// ---
+		//  type: integer
+		//  defaultdesc: `1`
+		//  required: no
+		//  shortdesc: Number of listening sockets per address
+		"listeners": validate.Optional(validate.IsInRange(1, 64)),
+		// lxdmeta:generate(entities=device-proxy; group=device-conf; key=listeners.cpu_steering)
+		// This option attaches a BPF program to the listening sockets which hands new connections and
+		// datagrams to the socket of the CPU that received them, and pins the thread of each socket to its CPU.
+		// ---
+		//  type: bool
+		//  defaultdesc: `false`
+		//  required: no
+		//  shortdesc: Whether to steer connections to the listener of the receiving CPU
+		"listeners.cpu_steering": validate.Optional(validate.IsBool),
 	}
 
 	err := d.config.Validate(rules)
@@ -194,6 +214,12 @@ func (d *proxy) validateConfig(instConf instance.ConfigReader) error {
 		return fmt.Errorf("The PROXY header can only be sent to tcp servers in non-nat mode")
 	}
 
+	// A single listener without CPU steering is what unix and NAT proxies do anyway.
+	listeners, _ := strconv.ParseInt(d.config["listeners"], 10, 64)
+	if (listeners > 1 || shared.IsTrue(d.config["listeners.cpu_steering"])) && (listenAddr.ConnType == "unix" || shared.IsTrue(d.config["nat"])) {
+		return fmt.Errorf("Only TCP and UDP proxy devices in non-nat mode can use multiple listeners")
+	}
+
 	if (!strings.HasPrefix(d.config["listen"], "unix:") || strings.HasPrefix(d.config["listen"], "unix:@")) &&
 		(d.config["uid"] != "" || d.config["gid"] != "" || d.config["mode"] != "") {
 		return fmt.Errorf("Only proxy devices for non-abstract unix sockets can carry uid, gid, or mode properties")
@@ -333,6 +359,8 @@ func (d *proxy) Start() (*deviceConfig.RunConfig, error) {
 				proxyValues.securityGID,
 				proxyValues.securityUID,
 				proxyValues.proxyProtocol,
+				proxyValues.listeners,
+				proxyValues.cpuSteering,
 			}
 
 			p, err := subprocess.NewProcess(command, forkproxyargs, logPath, logPath)
@@ -629,6 +657,11 @@ func (d *proxy) setupProxyProcInfo() (*proxyProcInfo, error) {
 		listenAddrMode = d.config["mode"]
 	}
 
+	listeners := "1"
+	if d.config["listeners"] != "" {
+		listeners = d.config["listeners"]
+	}
+
 	p := &proxyProcInfo{
 		listenPid:      listenPid,
 		listenPidFd:    listenPidFd,
@@ -642,6 +675,8 @@ func (d *proxy) setupProxyProcInfo() (*proxyProcInfo, error) {
 		securityGID:    d.config["security.gid"],
 		securityUID:    d.config["security.uid"],
 		proxyProtocol:  d.config["proxy_protocol"],
+		listeners:      listeners,
+		cpuSteering:    d.config["listeners.cpu_steering"],
 		inheritFds:     inheritFd,
 	}
 
@@ -33,13 +33,17 @@ static int get_hidraw_devinfo(int fd, struct hidraw_devinfo *info)
 import "C"
 
 import (
+	"bytes"
 	"fmt"
 	"os"
 	"path"
 	"path/filepath"
+	"slices"
 	"sort"
 	"strconv"
 	"strings"
+	"sync"
+	"time"
 
 	"golang.org/x/sys/unix"
 
@@ -54,30 +58,59 @@ import (
 	"github.com/canonical/lxd/shared/logger"
 )
 
-type deviceTaskCPU struct {
-	id    int64
-	strID string
-	count *int
+// ueventBatchSize is the number of uevents read by a single recvmmsg call.
+const ueventBatchSize = 32
+
+// ueventRcvBuf is the receive buffer size of the uevent socket, large enough to absorb udev storms.
+const ueventRcvBuf = 8 * 1024 * 1024
+
+// deviceRebalanceDelay is how long the scheduler waits for more rebalance events before handling them.
+const deviceRebalanceDelay = 100 * time.Millisecond
+
+// deviceRebalanceMaxDelay is the longest a rebalance event can be delayed by the ones following it.
+const deviceRebalanceMaxDelay = time.Second
+
+// ueventFilter is a socket filter dropping the kernel uevents which are never acted on before they
+// reach userspace. The kernel doesn't put the subsystem at a fixed offset so this goes by the action
+// at the start of the message instead: CPU events are "online" and "offline", network and USB events
+// are only handled for "add" and "remove". udev events, starting with "libudev", are all kept.
+var ueventFilter = []unix.SockFilter{
+	{Code: unix.BPF_LD | unix.BPF_W | unix.BPF_ABS, K: 0},
+	{Code: unix.BPF_JMP | unix.BPF_JEQ | unix.BPF_K, Jt: 5, K: 0x6c696275}, // "libu"
+	{Code: unix.BPF_JMP | unix.BPF_JEQ | unix.BPF_K, Jt: 4, K: 0x61646440}, // "add@"
+	{Code: unix.BPF_JMP | unix.BPF_JEQ | unix.BPF_K, Jt: 3, K: 0x72656d6f}, // "remo"
+	{Code: unix.BPF_JMP | unix.BPF_JEQ | unix.BPF_K, Jt: 2, K: 0x6f6e6c69}, // "onli"
+	{Code: unix.BPF_JMP | unix.BPF_JEQ | unix.BPF_K, Jt: 1, K: 0x6f66666c}, // "offl"
+	{Code: unix.BPF_RET | unix.BPF_K, K: 0},
+	{Code: unix.BPF_RET | unix.BPF_K, K: 0xffffffff},
 }
 
-type deviceTaskCPUs []deviceTaskCPU
-
-func (c deviceTaskCPUs) Len() int           { return len(c) }
-func (c deviceTaskCPUs) Less(i, j int) bool { return *c[i].count < *c[j].count }
-func (c deviceTaskCPUs) Swap(i, j int)      { c[i], c[j] = c[j], c[i] }
-
 func deviceNetlinkListener() (chan []string, chan []string, chan device.USBEvent, chan device.UnixHotplugEvent, error) {
 	NETLINK_KOBJECT_UEVENT := 15 //nolint:revive
 	UEVENT_BUFFER_SIZE := 2048   //nolint:revive
 
 	fd, err := unix.Socket(
-		unix.AF_NETLINK, unix.SOCK_RAW|unix.SOCK_CLOEXEC,
+		unix.AF_NETLINK, unix.SOCK_RAW|unix.SOCK_CLOEXEC|unix.SOCK_NONBLOCK,
 		NETLINK_KOBJECT_UEVENT,
 	)
 	if err != nil {
 		return nil, nil, nil, nil, err
 	}
 
+	// Best effort, a larger buffer and the filter only make dropping events less likely.
+	err = unix.SetsockoptInt(fd, unix.SOL_SOCKET, unix.SO_RCVBUFFORCE, ueventRcvBuf)
+	if err != nil {
+		_ = unix.SetsockoptInt(fd, unix.SOL_SOCKET, unix.SO_RCVBUF, ueventRcvBuf)
+	}
+
+	err = unix.SetsockoptSockFprog(fd, unix.SOL_SOCKET, unix.SO_ATTACH_FILTER, &unix.SockFprog{
+		Len:    uint16(len(ueventFilter)),
+		Filter: &ueventFilter[0],
+	})
+	if err != nil {
+		logger.Warn("Failed attaching uevent socket filter", logger.Ctx{"err": err})
+	}
+
 	nl := unix.SockaddrNetlink{
 		Family: unix.AF_NETLINK,
 		Pid:    uint32(os.Getpid()),
@@ -86,6 +119,15 @@ func deviceNetlinkListener() (chan []string, chan []string, chan device.USBEvent
 
 	err = unix.Bind(fd, &nl)
 	if err != nil {
+		_ = unix.Close(fd)
+		return nil, nil, nil, nil, err
+	}
+
+	// Hand the socket to the runtime poller so batches can be read through a RawConn.
+	file := os.NewFile(uintptr(fd), "uevent")
+	rawConn, err := file.SyscallConn()
+	if err != nil {
+		_ = file.Close()
 		return nil, nil, nil, nil, err
 	}
 
@@ -95,346 +137,425 @@ func deviceNetlinkListener() (chan []string, chan []string, chan device.USBEvent
 	chUnix := make(chan device.UnixHotplugEvent)
 
 	go func(chCPU chan []string, chNetwork chan []string, chUSB chan device.USBEvent, chUnix chan device.UnixHotplugEvent) {
-		b := make([]byte, UEVENT_BUFFER_SIZE*2)
+		batch := newMmsgBatch(ueventBatchSize, UEVENT_BUFFER_SIZE*2)
+		ev := &uevent{}
+
 		for {
-			r, err := unix.Read(fd, b)
-			if err != nil {
+			n, err := batch.recv(rawConn)
+			if err == unix.ENOBUFS {
+				logger.Warn("Uevent socket overflowed, some device events were lost")
 				continue
 			}
 
-			ueventBuf := make([]byte, r)
-			copy(ueventBuf, b)
-
-			udevEvent := false
-			if strings.HasPrefix(string(ueventBuf), "libudev") {
-				udevEvent = true
-				// Skip the header that libudev prepends
-				ueventBuf = ueventBuf[40 : len(ueventBuf)-1]
-			}
-
-			ueventLen := 0
-			ueventParts := strings.Split(string(ueventBuf), "\x00")
-			for i, part := range ueventParts {
-				if strings.HasPrefix(part, "SEQNUM=") {
-					ueventParts = append(ueventParts[:i], ueventParts[i+1:]...)
-					break
-				}
+			if err != nil {
+				continue
 			}
 
-			props := map[string]string{}
-			for _, part := range ueventParts {
-				// libudev string prefix distinguishes udev events from kernel uevents
-				if strings.HasPrefix(part, "libudev") {
-					udevEvent = true
-					continue
-				}
-
-				ueventLen += len(part) + 1
-
-				fields := strings.SplitN(part, "=", 2)
-				if len(fields) != 2 {
+			for i := 0; i < n; i++ {
+				if !ev.parse(batch.bufs[i][:batch.msgs[i].len]) {
 					continue
 				}
 
-				props[fields[0]] = fields[1]
+				ueventDispatch(ev, chCPU, chNetwork, chUSB, chUnix)
 			}
+		}
+	}(chCPU, chNetwork, chUSB, chUnix)
 
-			ueventLen--
+	return chCPU, chNetwork, chUSB, chUnix, nil
+}
 
-			if udevEvent {
-				// The kernel always prepends this and udev expects it.
-				kernelPrefix := fmt.Sprintf("%s@%s", props["ACTION"], props["DEVPATH"])
-				ueventParts = append([]string{kernelPrefix}, ueventParts...)
-				ueventLen += len(kernelPrefix)
-			}
+// ueventDispatch sends the uevent to the channel of its handler.
+func ueventDispatch(ev *uevent, chCPU chan []string, chNetwork chan []string, chUSB chan device.USBEvent, chUnix chan device.UnixHotplugEvent) {
+	udevEvent := ev.udev
+	subsystem, _ := ev.lookup("SUBSYSTEM")
 
-			if props["SUBSYSTEM"] == "cpu" && !udevEvent {
-				if props["DRIVER"] != "processor" {
-					continue
-				}
+	// Kernel events are only handled for a few subsystems, skip the others without looking further.
+	if !udevEvent && string(subsystem) != "cpu" && string(subsystem) != "net" && string(subsystem) != "usb" {
+		return
+	}
 
-				if props["ACTION"] != "offline" && props["ACTION"] != "online" {
-					continue
-				}
+	action, _ := ev.lookup("ACTION")
 
-				// As CPU re-balancing affects all containers, no need to queue them
-				select {
-				case chCPU <- []string{path.Base(props["DEVPATH"]), props["ACTION"]}:
-				default:
-					// Channel is full, drop the event
-				}
-			}
+	if string(subsystem) == "cpu" && !udevEvent {
+		if !ev.is("DRIVER", "processor") {
+			return
+		}
 
-			if props["SUBSYSTEM"] == "net" && !udevEvent {
-				if props["ACTION"] != "add" && props["ACTION"] != "removed" {
-					continue
-				}
+		if string(action) != "offline" && string(action) != "online" {
+			return
+		}
 
-				if !shared.PathExists(fmt.Sprintf("/sys/class/net/%s", props["INTERFACE"])) {
-					continue
-				}
+		// As CPU re-balancing affects all containers, no need to queue them
+		select {
+		case chCPU <- []string{path.Base(ev.value("DEVPATH")), string(action)}:
+		default:
+			// Channel is full, drop the event
+		}
+	}
 
-				// Network balancing is interface specific, so queue everything
-				chNetwork <- []string{props["INTERFACE"], props["ACTION"]}
-			}
+	if string(subsystem) == "net" && !udevEvent {
+		if string(action) != "add" && string(action) != "removed" {
+			return
+		}
 
-			if props["SUBSYSTEM"] == "usb" && !udevEvent {
-				parts := strings.Split(props["PRODUCT"], "/")
-				if len(parts) < 2 {
-					continue
-				}
+		iface := ev.value("INTERFACE")
+		if !shared.PathExists(fmt.Sprintf("/sys/class/net/%s", iface)) {
+			return
+		}
 
-				serial, ok := props["SERIAL"]
-				if !ok {
-					continue
-				}
+		// Network balancing is interface specific, so queue everything
+		chNetwork <- []string{iface, string(action)}
+	}
 
-				major, ok := props["MAJOR"]
-				if !ok {
-					continue
-				}
+	if string(subsystem) == "usb" && !udevEvent {
+		parts := strings.Split(ev.value("PRODUCT"), "/")
+		if len(parts) < 2 {
+			return
+		}
 
-				minor, ok := props["MINOR"]
-				if !ok {
-					continue
-				}
+		props, ok := ev.values("SERIAL", "MAJOR", "MINOR", "BUSNUM", "DEVNUM", "DEVNAME")
+		if !ok {
+			return
+		}
 
-				devname, ok := props["DEVNAME"]
-				if !ok {
-					continue
-				}
+		zeroPad := func(s string, l int) string {
+			return strings.Repeat("0", l-len(s)) + s
+		}
 
-				busnum, ok := props["BUSNUM"]
-				if !ok {
-					continue
-				}
+		ueventParts, ueventLen := ev.strings()
+
+		usb, err := device.USBNewEvent(
+			string(action),
+			/* udev doesn't zero pad these, while
+			 * everything else does, so let's zero pad them
+			 * for consistency
+			 */
+			zeroPad(parts[0], 4),
+			zeroPad(parts[1], 4),
+			props[0],
+			props[1],
+			props[2],
+			props[3],
+			props[4],
+			props[5],
+			ueventParts,
+			ueventLen,
+		)
+		if err != nil {
+			logger.Error("Error reading usb device", logger.Ctx{"err": err, "path": ev.value("PHYSDEVPATH")})
+			return
+		}
 
-				devnum, ok := props["DEVNUM"]
-				if !ok {
-					continue
-				}
+		chUSB <- usb
+	}
 
-				zeroPad := func(s string, l int) string {
-					return strings.Repeat("0", l-len(s)) + s
-				}
+	// unix hotplug device events rely on information added by udev
+	if udevEvent {
+		if string(action) != "add" && string(action) != "remove" {
+			return
+		}
 
-				usb, err := device.USBNewEvent(
-					props["ACTION"],
-					/* udev doesn't zero pad these, while
-					 * everything else does, so let's zero pad them
-					 * for consistency
-					 */
-					zeroPad(parts[0], 4),
-					zeroPad(parts[1], 4),
-					serial,
-					major,
-					minor,
-					busnum,
-					devnum,
-					devname,
-					ueventParts[:len(ueventParts)-1],
-					ueventLen,
-				)
-				if err != nil {
-					logger.Error("Error reading usb device", logger.Ctx{"err": err, "path": props["PHYSDEVPATH"]})
-					continue
-				}
+		props, ok := ev.values("SUBSYSTEM", "DEVNAME", "MAJOR", "MINOR")
+		if !ok {
+			return
+		}
 
-				chUSB <- usb
+		subsystem, devname, major, minor := props[0], props[1], props[2], props[3]
+
+		vendor := ""
+		product := ""
+		if string(action) == "add" {
+			vendor, product, ok = ueventParseVendorProduct(ev, subsystem, devname)
+			if !ok {
+				return
 			}
+		}
 
-			// unix hotplug device events rely on information added by udev
-			if udevEvent {
-				action := props["ACTION"]
-				if action != "add" && action != "remove" {
-					continue
-				}
+		zeroPad := func(s string, l int) string {
+			return strings.Repeat("0", l-len(s)) + s
+		}
 
-				subsystem, ok := props["SUBSYSTEM"]
-				if !ok {
-					continue
-				}
+		// zeropad
+		if len(vendor) < 4 {
+			vendor = zeroPad(vendor, 4)
+		}
 
-				devname, ok := props["DEVNAME"]
-				if !ok {
-					continue
-				}
+		if len(product) < 4 {
+			product = zeroPad(product, 4)
+		}
 
-				major, ok := props["MAJOR"]
-				if !ok {
-					continue
-				}
+		ueventParts, ueventLen := ev.strings()
+
+		unix, err := device.UnixHotplugNewEvent(
+			string(action),
+			/* udev doesn't zero pad these, while
+			 * everything else does, so let's zero pad them
+			 * for consistency
+			 */
+			vendor,
+			product,
+			major,
+			minor,
+			subsystem,
+			devname,
+			ueventParts,
+			ueventLen,
+		)
+		if err != nil {
+			logger.Error("Error reading unix device", logger.Ctx{"err": err, "path": ev.value("PHYSDEVPATH")})
+			return
+		}
 
-				minor, ok := props["MINOR"]
-				if !ok {
-					continue
-				}
+		chUnix <- unix
+	}
+}
 
-				vendor := ""
-				product := ""
-				if action == "add" {
-					vendor, product, ok = ueventParseVendorProduct(props, subsystem, devname)
-					if !ok {
-						continue
-					}
-				}
+// uevent is a uevent parsed in place. Its parts point into the receive buffer and are only valid
+// until the buffer gets reused, values are only copied into strings once an event gets dispatched.
+type uevent struct {
+	udev  bool
+	parts [][]byte
+}
 
-				zeroPad := func(s string, l int) string {
-					return strings.Repeat("0", l-len(s)) + s
-				}
+// parse splits a message into its parts, returning false if it's malformed.
+func (e *uevent) parse(buf []byte) bool {
+	e.udev = false
+	e.parts = e.parts[:0]
 
-				// zeropad
-				if len(vendor) < 4 {
-					vendor = zeroPad(vendor, 4)
-				}
+	if bytes.HasPrefix(buf, []byte("libudev")) {
+		// Skip the header that libudev prepends
+		if len(buf) <= 40 {
+			return false
+		}
 
-				if len(product) < 4 {
-					product = zeroPad(product, 4)
-				}
+		e.udev = true
+		buf = buf[40 : len(buf)-1]
+	}
 
-				unix, err := device.UnixHotplugNewEvent(
-					action,
-					/* udev doesn't zero pad these, while
-					 * everything else does, so let's zero pad them
-					 * for consistency
-					 */
-					vendor,
-					product,
-					major,
-					minor,
-					subsystem,
-					devname,
-					ueventParts[:len(ueventParts)-1],
-					ueventLen,
-				)
-				if err != nil {
-					logger.Error("Error reading unix device", logger.Ctx{"err": err, "path": props["PHYSDEVPATH"]})
-					continue
-				}
+	for {
+		end := bytes.IndexByte(buf, 0)
+		if end < 0 {
+			e.parts = append(e.parts, buf)
+			break
+		}
 
-				chUnix <- unix
-			}
+		e.parts = append(e.parts, buf[:end])
+		buf = buf[end+1:]
+	}
+
+	// The sequence number is dropped as events get a new one when injected into instances.
+	for i, part := range e.parts {
+		if bytes.HasPrefix(part, []byte("SEQNUM=")) {
+			e.parts = append(e.parts[:i], e.parts[i+1:]...)
+			break
 		}
-	}(chCPU, chNetwork, chUSB, chUnix)
+	}
 
-	return chCPU, chNetwork, chUSB, chUnix, nil
+	for _, part := range e.parts {
+		// libudev string prefix distinguishes udev events from kernel uevents
+		if bytes.HasPrefix(part, []byte("libudev")) {
+			e.udev = true
+		}
+	}
+
+	return true
 }
 
-/*
- * fillFixedInstances fills the `fixedInstances` map with the instances that have been pinned to specific CPUs.
- * The `fixedInstances` map is a map of CPU IDs to a list of instances that have been pinned to that CPU.
- * The `targetCPUPool` is a list of CPU IDs that are available for pinning.
- * The `targetCPUNum` is the number of CPUs that are required for pinning.
- * The `loadBalancing` flag indicates whether the CPU pinning should be load balanced or not (e.g, NUMA placement when `limits.cpu` is a single number which means
- * a required number of vCPUs per instance that can be chosen within a CPU pool).
- */
-func fillFixedInstances(fixedInstances map[int64][]instance.Instance, inst instance.Instance, effectiveCpus []int64, targetCPUPool []int64, targetCPUNum int, loadBalancing bool) {
-	if len(targetCPUPool) < targetCPUNum {
-		diffCount := len(targetCPUPool) - targetCPUNum
-		logger.Warnf("%v CPUs have been required for pinning, but %v CPUs won't be allocated", len(targetCPUPool), -diffCount)
-		targetCPUNum = len(targetCPUPool)
-	}
-
-	// If the `targetCPUPool` has been manually specified (explicit CPU IDs/ranges specified with `limits.cpu`)
-	if len(targetCPUPool) == targetCPUNum && !loadBalancing {
-		for _, nr := range targetCPUPool {
-			if !shared.ValueInSlice(nr, effectiveCpus) {
-				continue
-			}
+// lookup returns the value of a property, the last one winning if it's repeated.
+func (e *uevent) lookup(key string) ([]byte, bool) {
+	for i := len(e.parts) - 1; i >= 0; i-- {
+		part := e.parts[i]
+		if len(part) <= len(key) || part[len(key)] != '=' || string(part[:len(key)]) != key {
+			continue
+		}
 
-			_, ok := fixedInstances[nr]
-			if ok {
-				fixedInstances[nr] = append(fixedInstances[nr], inst)
-			} else {
-				fixedInstances[nr] = []instance.Instance{inst}
-			}
+		if bytes.HasPrefix(part, []byte("libudev")) {
+			continue
 		}
 
-		return
+		return part[len(key)+1:], true
 	}
 
-	// If we need to load-balance the instance across the CPUs of `targetCPUPool` (e.g, NUMA placement),
-	// the heuristic is to sort the `targetCPUPool` by usage (number of instances already pinned to each CPU)
-	// and then assign the instance to the first `desiredCpuNum` least used CPUs.
-	usage := map[int64]deviceTaskCPU{}
-	for _, id := range targetCPUPool {
-		cpu := deviceTaskCPU{}
-		cpu.id = id
-		cpu.strID = fmt.Sprintf("%d", id)
+	return nil, false
+}
 
-		count := 0
-		_, ok := fixedInstances[id]
-		if ok {
-			count = len(fixedInstances[id])
+// is returns whether the property is set to the given value.
+func (e *uevent) is(key string, value string) bool {
+	v, ok := e.lookup(key)
+	return ok && string(v) == value
+}
+
+// value returns the value of a property or an empty string if it isn't set.
+func (e *uevent) value(key string) string {
+	v, _ := e.lookup(key)
+	return string(v)
+}
+
+// values returns the values of all the given properties, failing if any of them isn't set.
+func (e *uevent) values(keys ...string) ([]string, bool) {
+	values := make([]string, 0, len(keys))
+	for _, key := range keys {
+		v, ok := e.lookup(key)
+		if !ok {
+			return nil, false
 		}
 
-		cpu.count = &count
-		usage[id] = cpu
+		values = append(values, string(v))
 	}
 
-	sortedUsage := make(deviceTaskCPUs, 0)
-	for _, value := range usage {
-		sortedUsage = append(sortedUsage, value)
+	return values, true
+}
+
+// strings returns the parts and length of the event as injected into instances by forkuevent.
+func (e *uevent) strings() ([]string, int) {
+	parts := make([]string, 0, len(e.parts)+1)
+	length := -1
+
+	if e.udev {
+		// The kernel always prepends this and udev expects it.
+		kernelPrefix := fmt.Sprintf("%s@%s", e.value("ACTION"), e.value("DEVPATH"))
+		parts = append(parts, kernelPrefix)
+		length += len(kernelPrefix)
 	}
 
-	sort.Sort(sortedUsage)
-	count := 0
-	for _, cpu := range sortedUsage {
-		if count == targetCPUNum {
-			break
+	for _, part := range e.parts {
+		if !bytes.HasPrefix(part, []byte("libudev")) {
+			length += len(part) + 1
 		}
 
-		id := cpu.id
-		_, ok := fixedInstances[id]
+		parts = append(parts, string(part))
+	}
+
+	return parts[:len(parts)-1], length
+}
+
+// cpuLoad is the number of instances pinned to each of the CPUs available for pinning.
+type cpuLoad map[int64]int
+
+// add adds delta to the load of the CPUs, ignoring the ones which aren't available.
+func (l cpuLoad) add(cpus []int64, delta int) {
+	for _, id := range cpus {
+		_, ok := l[id]
 		if ok {
-			fixedInstances[id] = append(fixedInstances[id], inst)
-		} else {
-			fixedInstances[id] = []instance.Instance{inst}
+			l[id] += delta
+		}
+	}
+}
+
+// leastLoaded returns up to count of the least loaded available CPUs of the pool, sorted by ID.
+func (l cpuLoad) leastLoaded(pool []int64, count int) []int64 {
+	candidates := make([]int64, 0, len(pool))
+	seen := make(map[int64]struct{}, len(pool))
+	for _, id := range pool {
+		_, available := l[id]
+		_, duplicate := seen[id]
+		if !available || duplicate {
+			continue
+		}
+
+		seen[id] = struct{}{}
+		candidates = append(candidates, id)
+	}
+
+	sort.Slice(candidates, func(i int, j int) bool {
+		if l[candidates[i]] != l[candidates[j]] {
+			return l[candidates[i]] < l[candidates[j]]
 		}
 
-		count++
+		return candidates[i] < candidates[j]
+	})
+
+	if count < len(candidates) {
+		candidates = candidates[:count]
 	}
+
+	slices.Sort(candidates)
+
+	return candidates
 }
 
-// deviceTaskBalance is used to balance the CPU load across instances running on a host.
-// It first checks if CGroup support is available and returns if it isn't.
-// It then retrieves the effective CPU list (the CPUs that are guaranteed to be online) and isolates any isolated CPUs.
-// After that, it loads all instances running on the node and iterates through them.
-//
-// For each instance, it checks its CPU limits and determines whether it is pinned to specific CPUs or can use the load-balancing mechanism.
-// If it is pinned, the function adds it to the fixedInstances map with the CPU numbers it is pinned to.
-// If not, the instance will be included in the load-balancing calculation,
-// and the number of CPUs it can use is determined by taking the minimum of its assigned CPUs and the available CPUs. Note that if
-// NUMA placement is enabled (`limits.cpu.nodes` is not empty), we apply a similar load-balancing logic to the `fixedInstances` map
-// with a constraint being the number of vCPUs and the CPU pool being the CPUs pinned to a set of NUMA nodes.
-//
-// Next, the function balance the CPU usage by iterating over all the CPUs and dividing the instances into those that
-// are pinned to a specific CPU and those that are load-balanced. For the pinned instances,
-// it adds them to the pinning map with the CPU number it's pinned to.
-// For the load-balanced instances, it sorts the available CPUs based on their usage count and assigns them to instances
-// in ascending order until the required number of CPUs have been assigned.
-// Finally, the pinning map is used to set the new CPU pinning for each instance, updating it to the new balanced state.
-//
-// Overall, this function ensures that the CPU resources of the host are utilized effectively amongst all the instances running on it.
-func deviceTaskBalance(s *state.State) {
-	min := func(x, y int) int {
-		if x < y {
-			return x
+// leastLoadedNUMA returns the count least loaded CPUs of the NUMA node with the lowest load that
+// has enough of them, so the instance isn't spread across nodes. If no node is large enough, the
+// CPUs are taken from all the available ones.
+func (l cpuLoad) leastLoadedNUMA(numaNodeToCPU map[int64][]int64, all []int64, count int) []int64 {
+	nodes := make([]int64, 0, len(numaNodeToCPU))
+	for node := range numaNodeToCPU {
+		nodes = append(nodes, node)
+	}
+
+	slices.Sort(nodes)
+
+	var best []int64
+	bestLoad := -1
+	for _, node := range nodes {
+		cpus := l.leastLoaded(numaNodeToCPU[node], count)
+		if len(cpus) < count {
+			continue
+		}
+
+		load := 0
+		for _, id := range cpus {
+			load += l[id]
 		}
 
-		return y
+		if bestLoad < 0 || load < bestLoad {
+			best = cpus
+			bestLoad = load
+		}
 	}
 
-	// Don't bother running when CGroup support isn't there
-	if !s.OS.CGInfo.Supports(cgroup.CPUSet, nil) {
-		return
+	if best == nil {
+		return l.leastLoaded(all, count)
 	}
 
+	return best
+}
+
+// cpuRequest is what an instance asks for, either specific CPUs or a number of CPUs. The latter
+// can be restricted to a pool, the CPUs of the NUMA nodes set in `limits.cpu.nodes`.
+type cpuRequest struct {
+	pinned []int64
+	pool   []int64
+	count  int
+}
+
+// cpuBalancerEntry is the pinning of a running instance.
+type cpuBalancerEntry struct {
+	inst    instance.Instance
+	cpus    []int64
+	applied bool
+}
+
+// cpuBalancer keeps track of the CPU pinning of the running instances.
+//
+// A full rebalance recomputes the pinning of all instances, which happens when LXD starts and when
+// CPUs go online or offline. Instances starting, stopping or having their limits changed are then
+// placed or removed on their own, on the least loaded CPUs, leaving the other instances where they are.
+// In both cases the pinning is only applied to the instances whose CPUs actually changed.
+type cpuBalancer struct {
+	mu sync.Mutex
+
+	// CPUs available for pinning, the effective cpuset without the isolated CPUs.
+	cpus          []int64
+	effectiveCpus string
+	numaNodeToCPU map[int64][]int64
+
+	load      cpuLoad
+	instances map[string]*cpuBalancerEntry
+}
+
+var deviceCPUBalancer = &cpuBalancer{}
+
+func cpuBalancerKey(projectName string, instanceName string) string {
+	return projectName + "/" + instanceName
+}
+
+// refresh loads the CPUs available for pinning and their NUMA nodes.
+func (b *cpuBalancer) refresh() error {
 	// Get effective cpus list - those are all guaranteed to be online
 	cg, err := cgroup.NewFileReadWriter(1, true)
 	if err != nil {
-		logger.Errorf("Unable to load cgroup writer: %v", err)
-		return
+		return fmt.Errorf("Unable to load cgroup writer: %w", err)
 	}
 
 	effectiveCpus, err := cg.GetEffectiveCpuset()
@@ -442,46 +563,31 @@ func deviceTaskBalance(s *state.State) {
 		// Older kernel - use cpuset.cpus
 		effectiveCpus, err = cg.GetCpuset()
 		if err != nil {
-			logger.Errorf("Error reading host's cpuset.cpus")
-			return
+			return fmt.Errorf("Error reading host's cpuset.cpus: %w", err)
 		}
 	}
 
 	effectiveCpusInt, err := resources.ParseCpuset(effectiveCpus)
 	if err != nil {
-		logger.Errorf("Error parsing effective CPU set")
-		return
+		return fmt.Errorf("Error parsing effective CPU set: %w", err)
 	}
 
 	isolatedCpusInt := resources.GetCPUIsolated()
+	cpus := []int64{}
 	effectiveCpusSlice := []string{}
 	for _, id := range effectiveCpusInt {
 		if shared.ValueInSlice(id, isolatedCpusInt) {
 			continue
 		}
 
+		cpus = append(cpus, id)
 		effectiveCpusSlice = append(effectiveCpusSlice, fmt.Sprintf("%d", id))
 	}
 
-	effectiveCpus = strings.Join(effectiveCpusSlice, ",")
-	cpus, err := resources.ParseCpuset(effectiveCpus)
-	if err != nil {
-		logger.Error("Error parsing host's cpu set", logger.Ctx{"cpuset": effectiveCpus, "err": err})
-		return
-	}
-
-	// Iterate through the instances
-	instances, err := instance.LoadNodeAll(s, instancetype.Any)
-	if err != nil {
-		logger.Error("Problem loading instances list", logger.Ctx{"err": err})
-		return
-	}
-
 	// Get CPU topology.
 	cpusTopology, err := resources.GetCPU()
 	if err != nil {
-		logger.Errorf("Unable to load system CPUs information: %v", err)
-		return
+		return fmt.Errorf("Unable to load system CPUs information: %w", err)
 	}
 
 	// Build a map of NUMA node to CPU threads.
@@ -494,132 +600,275 @@ func deviceTaskBalance(s *state.State) {
 		}
 	}
 
-	fixedInstances := map[int64][]instance.Instance{}
-	balancedInstances := map[instance.Instance]int{}
-	for _, c := range instances {
-		conf := c.ExpandedConfig()
-		cpuNodes := conf["limits.cpu.nodes"]
-		var numaCpus []int64
-		if cpuNodes != "" {
-			numaNodeSet, err := resources.ParseNumaNodeSet(cpuNodes)
-			if err != nil {
-				logger.Error("Error parsing numa node set", logger.Ctx{"numaNodes": cpuNodes, "err": err})
-				return
-			}
+	b.cpus = cpus
+	b.effectiveCpus = strings.Join(effectiveCpusSlice, ",")
+	b.numaNodeToCPU = numaNodeToCPU
 
-			for _, numaNode := range numaNodeSet {
-				numaCpus = append(numaCpus, numaNodeToCPU[numaNode]...)
-			}
+	return nil
+}
+
+// request returns the CPUs asked for by the instance configuration.
+func (b *cpuBalancer) request(inst instance.Instance) (*cpuRequest, error) {
+	conf := inst.ExpandedConfig()
+
+	var numaCpus []int64
+	cpuNodes := conf["limits.cpu.nodes"]
+	if cpuNodes != "" {
+		numaNodeSet, err := resources.ParseNumaNodeSet(cpuNodes)
+		if err != nil {
+			return nil, err
 		}
 
-		cpulimit, ok := conf["limits.cpu"]
-		if !ok || cpulimit == "" {
-			// For VMs empty limits.cpu means 1,
-			// but for containers it means "unlimited"
-			if c.Type() == instancetype.VM {
-				cpulimit = "1"
-			} else {
-				cpulimit = effectiveCpus
+		for _, numaNode := range numaNodeSet {
+			numaCpus = append(numaCpus, b.numaNodeToCPU[numaNode]...)
+		}
+	}
+
+	cpulimit := conf["limits.cpu"]
+	if cpulimit == "" {
+		// For VMs empty limits.cpu means 1,
+		// but for containers it means "unlimited"
+		if inst.Type() == instancetype.VM {
+			cpulimit = "1"
+		} else {
+			cpulimit = b.effectiveCpus
+		}
+	}
+
+	count, err := strconv.Atoi(cpulimit)
+	if err == nil {
+		// Load-balance
+		return &cpuRequest{pool: numaCpus, count: min(count, len(b.cpus))}, nil
+	}
+
+	// Pinned
+	instanceCpus, err := resources.ParseCpuset(cpulimit)
+	if err != nil {
+		return nil, err
+	}
+
+	if len(numaCpus) > 0 {
+		logger.Warnf("The pinned CPUs: %v, override the NUMA configuration with the CPUs: %v", instanceCpus, numaCpus)
+	}
+
+	return &cpuRequest{pinned: instanceCpus}, nil
+}
+
+// assign picks the CPUs of the instance according to the current load and records them.
+func (b *cpuBalancer) assign(inst instance.Instance, req *cpuRequest) *cpuBalancerEntry {
+	var cpus []int64
+	if req.pinned != nil {
+		for _, id := range req.pinned {
+			_, ok := b.load[id]
+			if ok {
+				cpus = append(cpus, id)
 			}
 		}
 
+		slices.Sort(cpus)
+	} else if len(req.pool) > 0 {
+		cpus = b.load.leastLoaded(req.pool, req.count)
+		if len(cpus) < req.count {
+			logger.Warnf("%v CPUs have been required for pinning, but %v CPUs won't be allocated", req.count, req.count-len(cpus))
+		}
+	} else {
+		cpus = b.load.leastLoadedNUMA(b.numaNodeToCPU, b.cpus, req.count)
+	}
+
+	b.load.add(cpus, 1)
+
+	e := &cpuBalancerEntry{inst: inst, cpus: cpus}
+	b.instances[cpuBalancerKey(inst.Project().Name, inst.Name())] = e
+
+	return e
+}
+
+// apply sets the pinning of the instance.
+func (b *cpuBalancer) apply(e *cpuBalancerEntry) {
+	if len(e.cpus) == 0 {
+		return
+	}
+
+	set := make([]string, 0, len(e.cpus))
+	for _, id := range e.cpus {
+		set = append(set, fmt.Sprintf("%d", id))
+	}
+
+	err := e.inst.SetAffinity(set)
+	if err != nil {
+		logger.Error("Error setting CPU affinity for the instance", logger.Ctx{"project": e.inst.Project().Name, "instance": e.inst.Name(), "err": err})
+		return
+	}
+
+	e.applied = true
+}
+
+// unchanged returns whether the instance was already pinned to the CPUs of the entry.
+func (e *cpuBalancerEntry) unchanged(previous *cpuBalancerEntry) bool {
+	return previous != nil && previous.applied && slices.Equal(previous.cpus, e.cpus)
+}
+
+// rebalance recomputes the pinning of all running instances.
+func (b *cpuBalancer) rebalance(s *state.State) {
+	err := b.refresh()
+	if err != nil {
+		logger.Error("Failed loading CPUs for balancing", logger.Ctx{"err": err})
+		return
+	}
+
+	// Iterate through the instances
+	instances, err := instance.LoadNodeAll(s, instancetype.Any)
+	if err != nil {
+		logger.Error("Problem loading instances list", logger.Ctx{"err": err})
+		return
+	}
+
+	sort.Slice(instances, func(i int, j int) bool {
+		return cpuBalancerKey(instances[i].Project().Name, instances[i].Name()) < cpuBalancerKey(instances[j].Project().Name, instances[j].Name())
+	})
+
+	previous := b.instances
+	b.instances = map[string]*cpuBalancerEntry{}
+	b.load = make(cpuLoad, len(b.cpus))
+	for _, id := range b.cpus {
+		b.load[id] = 0
+	}
+
+	// Instances with fixed CPUs (pinned or restricted to NUMA nodes) go first, the others then
+	// get balanced around them.
+	type balancedInstance struct {
+		inst instance.Instance
+		req  *cpuRequest
+	}
+
+	balanced := []balancedInstance{}
+	for _, inst := range instances {
 		// Check that the instance is running.
 		// We use InitPID here rather than IsRunning because this task can be triggered during the container's
 		// onStart hook, which is during the time that the start lock is held, which causes IsRunning to
 		// return false (because the container hasn't fully started yet) but it is sufficiently started to
 		// have its cgroup CPU limits set.
-		if c.InitPID() <= 0 {
+		if inst.InitPID() <= 0 {
 			continue
 		}
 
-		count, err := strconv.Atoi(cpulimit)
-		if err == nil {
-			// Load-balance
-			count = min(count, len(cpus))
-			if len(numaCpus) > 0 {
-				fillFixedInstances(fixedInstances, c, cpus, numaCpus, count, true)
-			} else {
-				balancedInstances[c] = count
-			}
-		} else {
-			// Pinned
-			instanceCpus, err := resources.ParseCpuset(cpulimit)
-			if err != nil {
-				return
-			}
+		req, err := b.request(inst)
+		if err != nil {
+			logger.Error("Failed parsing instance CPU limits", logger.Ctx{"project": inst.Project().Name, "instance": inst.Name(), "err": err})
+			continue
+		}
 
-			if len(numaCpus) > 0 {
-				logger.Warnf("The pinned CPUs: %v, override the NUMA configuration with the CPUs: %v", instanceCpus, numaCpus)
-			}
+		if req.pinned == nil && len(req.pool) == 0 {
+			balanced = append(balanced, balancedInstance{inst: inst, req: req})
+			continue
+		}
 
-			fillFixedInstances(fixedInstances, c, cpus, instanceCpus, len(instanceCpus), false)
+		b.assign(inst, req)
+	}
+
+	for _, entry := range balanced {
+		b.assign(entry.inst, entry.req)
+	}
+
+	// Set the new pinning
+	for key, e := range b.instances {
+		if e.unchanged(previous[key]) {
+			e.applied = true
+			continue
 		}
+
+		b.apply(e)
 	}
+}
 
-	// Balance things
-	pinning := map[instance.Instance][]string{}
-	usage := map[int64]deviceTaskCPU{}
+// update places or removes a single instance according to its status ("started", "stopped" or
+// "changed"). The CPUs of started instances are always set as their cgroup is new.
+func (b *cpuBalancer) update(s *state.State, projectName string, instanceName string, status string) {
+	key := cpuBalancerKey(projectName, instanceName)
 
-	for _, id := range cpus {
-		cpu := deviceTaskCPU{}
-		cpu.id = id
-		cpu.strID = fmt.Sprintf("%d", id)
-		count := 0
-		cpu.count = &count
+	previous := b.instances[key]
+	if previous != nil {
+		b.load.add(previous.cpus, -1)
+		delete(b.instances, key)
+	}
 
-		usage[id] = cpu
+	if status == "stopped" {
+		return
 	}
 
-	for cpu, ctns := range fixedInstances {
-		c, ok := usage[cpu]
-		if !ok {
-			logger.Errorf("Internal error: instance using unavailable cpu")
-			continue
-		}
+	inst, err := instance.LoadByProjectAndName(s, projectName, instanceName)
+	if err != nil {
+		logger.Debug("Failed loading instance for CPU balancing", logger.Ctx{"project": projectName, "instance": instanceName, "err": err})
+		return
+	}
 
-		id := c.strID
-		for _, ctn := range ctns {
-			_, ok := pinning[ctn]
-			if ok {
-				pinning[ctn] = append(pinning[ctn], id)
-			} else {
-				pinning[ctn] = []string{id}
-			}
-			*c.count += 1
-		}
+	if inst.InitPID() <= 0 {
+		return
 	}
 
-	sortedUsage := make(deviceTaskCPUs, 0)
-	for _, value := range usage {
-		sortedUsage = append(sortedUsage, value)
+	req, err := b.request(inst)
+	if err != nil {
+		logger.Error("Failed parsing instance CPU limits", logger.Ctx{"project": projectName, "instance": instanceName, "err": err})
+		return
 	}
 
-	for ctn, count := range balancedInstances {
-		sort.Sort(sortedUsage)
-		for _, cpu := range sortedUsage {
-			if count == 0 {
-				break
-			}
+	e := b.assign(inst, req)
+	if status != "started" && e.unchanged(previous) {
+		e.applied = true
+		return
+	}
 
-			count -= 1
+	b.apply(e)
+}
 
-			id := cpu.strID
-			_, ok := pinning[ctn]
-			if ok {
-				pinning[ctn] = append(pinning[ctn], id)
-			} else {
-				pinning[ctn] = []string{id}
-			}
-			*cpu.count += 1
-		}
+// deviceTaskBalance is used to balance the CPU load across instances running on a host.
+// It recomputes the pinning of all running instances, see cpuBalancer.
+func deviceTaskBalance(s *state.State) {
+	// Don't bother running when CGroup support isn't there
+	if !s.OS.CGInfo.Supports(cgroup.CPUSet, nil) {
+		return
 	}
 
-	// Set the new pinning
-	for inst, set := range pinning {
-		err = inst.SetAffinity(set)
-		if err != nil {
-			logger.Error("Error setting CPU affinity for the instance", logger.Ctx{"project": inst.Project().Name, "instance": inst.Name(), "err": err})
+	deviceCPUBalancer.mu.Lock()
+	defer deviceCPUBalancer.mu.Unlock()
+
+	deviceCPUBalancer.rebalance(s)
+}
+
+// deviceTaskBalanceInstances places or removes the given instances, keyed by project and name with
+// their last status, without moving the other instances. It falls back to a full rebalance if
+// none was done yet.
+func deviceTaskBalanceInstances(s *state.State, changes map[[2]string]string) {
+	if !s.OS.CGInfo.Supports(cgroup.CPUSet, nil) {
+		return
+	}
+
+	deviceCPUBalancer.mu.Lock()
+	defer deviceCPUBalancer.mu.Unlock()
+
+	if deviceCPUBalancer.load == nil {
+		deviceCPUBalancer.rebalance(s)
+		return
+	}
+
+	keys := make([][2]string, 0, len(changes))
+	for key := range changes {
+		keys = append(keys, key)
+	}
+
+	// Free up the CPUs of stopped instances before placing the others.
+	sort.Slice(keys, func(i int, j int) bool {
+		iStopped := changes[keys[i]] == "stopped"
+		jStopped := changes[keys[j]] == "stopped"
+		if iStopped != jStopped {
+			return iStopped
 		}
+
+		return keys[i][0] < keys[j][0] || (keys[i][0] == keys[j][0] && keys[i][1] < keys[j][1])
+	})
+
+	for _, key := range keys {
+		deviceCPUBalancer.update(s, key[0], key[1], changes[key])
 	}
 }
 
@@ -632,8 +881,39 @@ func deviceEventListener(stateFunc func() *state.State) {
 		return
 	}
 
+	// Rebalance events come in bursts (e.g. many instances starting at once or CPUs going online
+	// one by one), they are merged until things are quiet for a bit and then handled at once.
+	var rebalanceTimer <-chan time.Time
+	var rebalanceSince time.Time
+	var rebalanceFull bool
+	rebalanceInstances := map[[2]string]string{}
+
+	scheduleRebalance := func() {
+		now := time.Now()
+		if rebalanceTimer == nil {
+			rebalanceSince = now
+		}
+
+		delay := min(deviceRebalanceDelay, time.Until(rebalanceSince.Add(deviceRebalanceMaxDelay)))
+		rebalanceTimer = time.After(max(delay, 0))
+	}
+
 	for {
 		select {
+		case <-rebalanceTimer:
+			rebalanceTimer = nil
+			s := stateFunc()
+
+			if rebalanceFull || cgroup.DeviceSchedRebalanceDropped.Swap(false) {
+				logger.Debugf("Scheduler: re-balancing all instances")
+				deviceTaskBalance(s)
+			} else {
+				logger.Debugf("Scheduler: re-balancing %d instances", len(rebalanceInstances))
+				deviceTaskBalanceInstances(s, rebalanceInstances)
+			}
+
+			rebalanceFull = false
+			rebalanceInstances = map[[2]string]string{}
 		case e := <-chNetlinkCPU:
 			if len(e) != 2 {
 				logger.Errorf("Scheduler: received an invalid cpu hotplug event")
@@ -647,7 +927,8 @@ func deviceEventListener(stateFunc func() *state.State) {
 			}
 
 			logger.Debugf("Scheduler: cpu: %s is now %s: re-balancing", e[0], e[1])
-			deviceTaskBalance(s)
+			rebalanceFull = true
+			scheduleRebalance()
 		case e := <-chNetlinkNetwork:
 			if len(e) != 2 {
 				logger.Errorf("Scheduler: received an invalid network hotplug event")
@@ -672,7 +953,7 @@ func deviceEventListener(stateFunc func() *state.State) {
 		case e := <-chUnix:
 			device.UnixHotplugRunHandlers(stateFunc(), &e)
 		case e := <-cgroup.DeviceSchedRebalance:
-			if len(e) != 3 {
+			if len(e) != 4 {
 				logger.Errorf("Scheduler: received an invalid rebalance event")
 				continue
 			}
@@ -683,8 +964,14 @@ func deviceEventListener(stateFunc func() *state.State) {
 				continue
 			}
 
-			logger.Debugf("Scheduler: %s %s %s: re-balancing", e[0], e[1], e[2])
-			deviceTaskBalance(s)
+			logger.Debugf("Scheduler: %s %s/%s %s: re-balancing", e[0], e[1], e[2], e[3])
+			// A change doesn't override an earlier start or stop of the same instance.
+			key := [2]string{e[1], e[2]}
+			if e[3] != "changed" || rebalanceInstances[key] == "" {
+				rebalanceInstances[key] = e[3]
+			}
+
+			scheduleRebalance()
 		}
 	}
 }
@@ -713,12 +1000,10 @@ func getHidrawDevInfo(fd int) (vendor string, product string, err error) {
 	return fmt.Sprintf("%04x", info.vendor), fmt.Sprintf("%04x", info.product), nil
 }
 
-func ueventParseVendorProduct(props map[string]string, subsystem string, devname string) (vendor string, product string, ok bool) {
-	vendor, vendorOk := props["ID_VENDOR_ID"]
-	product, productOk := props["ID_MODEL_ID"]
-
-	if vendorOk && productOk {
-		return vendor, product, true
+func ueventParseVendorProduct(ev *uevent, subsystem string, devname string) (vendor string, product string, ok bool) {
+	props, ok := ev.values("ID_VENDOR_ID", "ID_MODEL_ID")
+	if ok {
+		return props[0], props[1], true
 	}
 
 	if subsystem != "hidraw" {
@@ -0,0 +1,88 @@
+package main
+
+import (
+	"strings"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+func TestUeventParseKernel(t *testing.T) {
+	msg := []byte("add@/devices/virtual/net/veth0\x00ACTION=add\x00DEVPATH=/devices/virtual/net/veth0\x00SUBSYSTEM=net\x00INTERFACE=veth0\x00SEQNUM=1234\x00")
+
+	ev := &uevent{}
+	require.True(t, ev.parse(msg))
+	require.False(t, ev.udev)
+
+	require.True(t, ev.is("SUBSYSTEM", "net"))
+	require.False(t, ev.is("SUBSYSTEM", "ne"))
+	require.Equal(t, "veth0", ev.value("INTERFACE"))
+
+	_, ok := ev.lookup("SEQNUM")
+	require.False(t, ok)
+
+	_, ok = ev.lookup("DEVNAME")
+	require.False(t, ok)
+
+	parts, length := ev.strings()
+	require.Equal(t, []string{"add@/devices/virtual/net/veth0", "ACTION=add", "DEVPATH=/devices/virtual/net/veth0", "SUBSYSTEM=net", "INTERFACE=veth0"}, parts)
+	require.Equal(t, len(strings.Join(parts, "\x00"))+1, length)
+}
+
+func TestUeventParseUdev(t *testing.T) {
+	header := make([]byte, 40)
+	copy(header, "libudev\x00")
+
+	msg := append(header, []byte("ACTION=add\x00DEVPATH=/devices/usb1/1-1\x00SUBSYSTEM=hidraw\x00DEVNAME=/dev/hidraw0\x00MAJOR=240\x00MINOR=0\x00SEQNUM=5\x00ID_VENDOR_ID=046d\x00ID_MODEL_ID=c52b\x00")...)
+
+	ev := &uevent{}
+	require.True(t, ev.parse(msg))
+	require.True(t, ev.udev)
+
+	values, ok := ev.values("SUBSYSTEM", "DEVNAME", "MAJOR", "MINOR")
+	require.True(t, ok)
+	require.Equal(t, []string{"hidraw", "/dev/hidraw0", "240", "0"}, values)
+
+	_, ok = ev.values("SUBSYSTEM", "SERIAL")
+	require.False(t, ok)
+
+	vendor, product, ok := ueventParseVendorProduct(ev, "hidraw", "/dev/hidraw0")
+	require.True(t, ok)
+	require.Equal(t, "046d", vendor)
+	require.Equal(t, "c52b", product)
+
+	parts, _ := ev.strings()
+	require.Equal(t, "add@/devices/usb1/1-1", parts[0])
+	require.Equal(t, "ID_VENDOR_ID=046d", parts[len(parts)-1])
+
+	// Too short to hold the libudev header.
+	require.False(t, ev.parse([]byte("libudev\x00")))
+}
+
+func TestCPULoadLeastLoaded(t *testing.T) {
+	load := cpuLoad{0: 2, 1: 0, 2: 1, 3: 0}
+
+	// Ties are broken by CPU ID and the result is sorted.
+	require.Equal(t, []int64{1, 2, 3}, load.leastLoaded([]int64{0, 1, 2, 3}, 3))
+
+	// Unavailable and duplicate CPUs are skipped.
+	require.Equal(t, []int64{0, 2}, load.leastLoaded([]int64{2, 2, 0, 7}, 4))
+
+	load.add([]int64{1, 3, 7}, 1)
+	require.Equal(t, cpuLoad{0: 2, 1: 1, 2: 1, 3: 1}, load)
+}
+
+func TestCPULoadLeastLoadedNUMA(t *testing.T) {
+	numaNodeToCPU := map[int64][]int64{0: {0, 1}, 1: {2, 3}}
+	all := []int64{0, 1, 2, 3}
+	load := cpuLoad{0: 1, 1: 0, 2: 0, 3: 0}
+
+	// The instance fits on the least loaded node.
+	require.Equal(t, []int64{2, 3}, load.leastLoadedNUMA(numaNodeToCPU, all, 2))
+
+	// A single CPU goes to the least loaded one, whatever its node.
+	require.Equal(t, []int64{1}, load.leastLoadedNUMA(numaNodeToCPU, all, 1))
+
+	// No node is large enough, the instance is spread across them.
+	require.Equal(t, []int64{1, 2, 3}, load.leastLoadedNUMA(numaNodeToCPU, all, 3))
+}
@@ -0,0 +1,139 @@
+//go:build linux && cgo
+
+package idmap
+
+import (
+	"sort"
+)
+
+// idmapRange maps the ids from start (included) to end (excluded) onto target and up.
+type idmapRange struct {
+	start  int64
+	end    int64
+	target int64
+}
+
+// idmapRanges is a list of non-overlapping ranges sorted by start.
+type idmapRanges []idmapRange
+
+// add adds the parts of the given range which aren't covered yet. Ranges added first take
+// precedence, the same way the first matching entry wins in IdmapSet.ShiftIntoNs.
+func (r idmapRanges) add(start int64, target int64, size int64) idmapRanges {
+	if size <= 0 {
+		return r
+	}
+
+	end := start + size
+	pos := start
+	pieces := idmapRanges{}
+	for _, existing := range r {
+		if existing.end <= pos {
+			continue
+		}
+
+		if existing.start >= end {
+			break
+		}
+
+		if existing.start > pos {
+			pieces = append(pieces, idmapRange{start: pos, end: existing.start, target: target + pos - start})
+		}
+
+		pos = existing.end
+	}
+
+	if pos < end {
+		pieces = append(pieces, idmapRange{start: pos, end: end, target: target + pos - start})
+	}
+
+	if len(pieces) == 0 {
+		return r
+	}
+
+	r = append(r, pieces...)
+	sort.Slice(r, func(i int, j int) bool { return r[i].start < r[j].start })
+
+	// Merge the ranges which continue each other.
+	merged := r[:1]
+	for _, next := range r[1:] {
+		last := &merged[len(merged)-1]
+		if last.end == next.start && last.target+last.end-last.start == next.target {
+			last.end = next.end
+			continue
+		}
+
+		merged = append(merged, next)
+	}
+
+	return merged
+}
+
+// shift returns the id mapped to id or -1 if no range contains it.
+func (r idmapRanges) shift(id int64) int64 {
+	low, high := 0, len(r)
+	for low < high {
+		mid := int(uint(low+high) >> 1)
+		if r[mid].end <= id {
+			low = mid + 1
+		} else {
+			high = mid
+		}
+	}
+
+	if low < len(r) && r[low].start <= id {
+		return id - r[low].start + r[low].target
+	}
+
+	return -1
+}
+
+// CompiledIdmapSet is an immutable form of an IdmapSet for translating large numbers of ids.
+// It holds sorted, non-overlapping ranges for each direction and id type which are looked up
+// with a binary search rather than by walking all entries.
+type CompiledIdmapSet struct {
+	uidsIn  idmapRanges
+	gidsIn  idmapRanges
+	uidsOut idmapRanges
+	gidsOut idmapRanges
+}
+
+// Compile returns the compiled form of the set, it doesn't reflect later changes to the set.
+func (m *IdmapSet) Compile() *CompiledIdmapSet {
+	c := &CompiledIdmapSet{}
+	if m == nil {
+		return c
+	}
+
+	for _, e := range m.Idmap {
+		if e.Isuid {
+			c.uidsIn = c.uidsIn.add(e.Nsid, e.Hostid, e.Maprange)
+			c.uidsOut = c.uidsOut.add(e.Hostid, e.Nsid, e.Maprange)
+		}
+
+		if e.Isgid {
+			c.gidsIn = c.gidsIn.add(e.Nsid, e.Hostid, e.Maprange)
+			c.gidsOut = c.gidsOut.add(e.Hostid, e.Nsid, e.Maprange)
+		}
+	}
+
+	return c
+}
+
+// ranges returns the uid and gid ranges for shifting in the given direction ("in" or "out").
+func (c *CompiledIdmapSet) ranges(how string) (idmapRanges, idmapRanges) {
+	if how == "out" {
+		return c.uidsOut, c.gidsOut
+	}
+
+	return c.uidsIn, c.gidsIn
+}
+
+// ShiftIntoNs shifts a uid and gid from the host into the namespace, -1 being returned for unmapped ids.
+func (c *CompiledIdmapSet) ShiftIntoNs(uid int64, gid int64) (int64, int64) {
+	return c.uidsIn.shift(uid), c.gidsIn.shift(gid)
+}
+
+// ShiftFromNs shifts a uid and gid from the namespace back to the host, -1 being returned for unmapped ids.
+func (c *CompiledIdmapSet) ShiftFromNs(uid int64, gid int64) (int64, int64) {
+	return c.uidsOut.shift(uid), c.gidsOut.shift(gid)
+}
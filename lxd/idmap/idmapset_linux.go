@@ -627,93 +627,20 @@ func (set *IdmapSet) doUidshiftIntoContainer(dir string, testmode bool, how stri
 	dir = filepath.Join(tmp, filepath.Base(dir))
 	dir = strings.TrimRight(dir, "/")
 
-	hardLinks := []uint64{}
-	convert := func(path string, fi os.FileInfo, err error) (e error) {
-		if err != nil {
-			return err
-		}
-
-		if skipper != nil && skipper(dir, path, fi) {
-			return filepath.SkipDir
-		}
-
-		intUID, intGID, _, _, inode, nlink, err := shared.GetFileStat(path)
-		if err != nil {
-			return err
-		}
-
-		if nlink >= 2 {
-			for _, linkInode := range hardLinks {
-				// File was already shifted through hardlink
-				if linkInode == inode {
-					return nil
-				}
-			}
-
-			hardLinks = append(hardLinks, inode)
-		}
-
-		uid := int64(intUID)
-		gid := int64(intGID)
-		caps := []byte{}
-
-		var newuid, newgid int64
-		switch how {
-		case "in":
-			newuid, newgid = set.ShiftIntoNs(uid, gid)
-		case "out":
-			newuid, newgid = set.ShiftFromNs(uid, gid)
-		}
-
-		if testmode {
-			fmt.Printf("I would shift %q to %d %d\n", path, newuid, newgid)
-		} else {
-			// Dump capabilities
-			if fi.Mode()&os.ModeSymlink == 0 {
-				caps, err = GetCaps(path)
-				if err != nil {
-					return err
-				}
-			}
-
-			// Shift owner
-			err = ShiftOwner(dir, path, int(newuid), int(newgid))
-			if err != nil {
-				return err
-			}
-
-			if fi.Mode()&os.ModeSymlink == 0 {
-				// Shift POSIX ACLs
-				err = ShiftACL(path, func(uid int64, gid int64) (int64, int64) { return set.doShiftIntoNs(uid, gid, how) })
-				if err != nil {
-					return err
-				}
+	if !shared.PathExists(dir) {
+		return fmt.Errorf("No such file or directory: %q", dir)
+	}
 
-				// Shift capabilities
-				if len(caps) != 0 {
-					rootUID := int64(0)
-					if how == "in" {
-						rootUID, _ = set.ShiftIntoNs(0, 0)
-					}
-
-					if how != "in" || atomic.LoadInt32(&VFS3Fscaps) == VFS3FscapsSupported {
-						err = SetCaps(path, caps, rootUID)
-						if err != nil {
-							logger.Warnf("Unable to set file capabilities on %q: %v", path, err)
-						}
-					}
-				}
-			}
-		}
+	compiled := set.Compile()
 
-		return nil
+	rootUID := int64(0)
+	if how == "in" {
+		rootUID, _ = compiled.ShiftIntoNs(0, 0)
 	}
 
-	if !shared.PathExists(dir) {
-		return fmt.Errorf("No such file or directory: %q", dir)
-	}
+	restoreCaps := how != "in" || atomic.LoadInt32(&VFS3Fscaps) == VFS3FscapsSupported
 
-	return filepath.Walk(dir, convert)
+	return compiled.shiftTree(dir, testmode, how, skipper, restoreCaps, rootUID)
 }
 
 func (set *IdmapSet) UidshiftIntoContainer(dir string, testmode bool) error {
@@ -3,12 +3,22 @@
 package idmap
 
 import (
+	"encoding/binary"
+	"flag"
 	"fmt"
+	"os"
+	"path/filepath"
+	"syscall"
 	"testing"
 
 	"github.com/stretchr/testify/assert"
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/shared/benchutil"
 )
 
+var benchInodes = flag.Int("idmap.inodes", 1000000, "Number of inodes of the tree shifted by BenchmarkShiftRootfs")
+
 func TestIdmapSetAddSafe_split(t *testing.T) {
 	orig := IdmapSet{Idmap: []IdmapEntry{{Isuid: true, Hostid: 1000, Nsid: 0, Maprange: 1000}}}
 
@@ -202,3 +212,212 @@ func TestIdmapHostIDMapRange(t *testing.T) {
 	assert.Equal(t, false, combinedEntry.HostIDsCoveredBy(nil, allowedCombinedMaps))
 	assert.Equal(t, true, combinedEntry.HostIDsCoveredBy(allowedCombinedMaps, allowedCombinedMaps))
 }
+
+func TestIdmapSetShiftRootfs(t *testing.T) {
+	if os.Geteuid() != 0 {
+		t.Skip("Shifting requires root")
+	}
+
+	rootfs := filepath.Join(t.TempDir(), "rootfs")
+	for _, dir := range []string{"a/b", "c", "skipped/d"} {
+		err := os.MkdirAll(filepath.Join(rootfs, dir), 0755)
+		assert.NoError(t, err)
+	}
+
+	for i := 0; i < 2*shiftBatchSize; i++ {
+		err := os.WriteFile(filepath.Join(rootfs, "a/b", fmt.Sprintf("%d", i)), nil, 0644)
+		assert.NoError(t, err)
+	}
+
+	assert.NoError(t, os.Chown(filepath.Join(rootfs, "c"), 1000, 1000))
+	assert.NoError(t, os.Symlink("/etc/passwd", filepath.Join(rootfs, "c/link")))
+	assert.NoError(t, os.Link(filepath.Join(rootfs, "a/b/0"), filepath.Join(rootfs, "c/hardlink")))
+
+	owner := func(path string) []uint32 {
+		var st unix.Stat_t
+		err := unix.Lstat(filepath.Join(rootfs, path), &st)
+		assert.NoError(t, err)
+
+		return []uint32{st.Uid, st.Gid}
+	}
+
+	set := IdmapSet{Idmap: []IdmapEntry{{Isuid: true, Isgid: true, Hostid: 100000, Nsid: 0, Maprange: 65536}}}
+	skipper := func(dir string, absPath string, fi os.FileInfo) bool {
+		st, ok := fi.Sys().(*syscall.Stat_t)
+		assert.True(t, ok)
+		assert.Equal(t, fi.Size(), st.Size)
+
+		return fi.IsDir() && absPath == filepath.Join(dir, "skipped")
+	}
+
+	err := set.ShiftRootfs(rootfs, skipper)
+	assert.NoError(t, err)
+
+	for _, path := range []string{"", "a", "a/b", "a/b/0", "a/b/1023", "c/link"} {
+		assert.Equal(t, []uint32{100000, 100000}, owner(path), path)
+	}
+
+	assert.Equal(t, []uint32{101000, 101000}, owner("c"))
+	assert.Equal(t, []uint32{0, 0}, owner("skipped"))
+	assert.Equal(t, []uint32{0, 0}, owner("skipped/d"))
+
+	err = set.UnshiftRootfs(rootfs, skipper)
+	assert.NoError(t, err)
+
+	for _, path := range []string{"", "a/b", "a/b/0", "c/link"} {
+		assert.Equal(t, []uint32{0, 0}, owner(path), path)
+	}
+
+	assert.Equal(t, []uint32{1000, 1000}, owner("c"))
+}
+
+func TestUnshiftACL(t *testing.T) {
+	// ACL_USER_OBJ, ACL_USER 101000, ACL_GROUP 100033, ACL_GROUP 5 (unmapped), ACL_MASK and ACL_OTHER.
+	entries := [][]uint32{{0x01, 7, 0xffffffff}, {0x02, 7, 101000}, {0x08, 5, 100033}, {0x08, 5, 5}, {0x10, 7, 0xffffffff}, {0x20, 5, 0xffffffff}}
+	value := binary.LittleEndian.AppendUint32(nil, 2)
+	for _, entry := range entries {
+		value = binary.LittleEndian.AppendUint16(value, uint16(entry[0]))
+		value = binary.LittleEndian.AppendUint16(value, uint16(entry[1]))
+		value = binary.LittleEndian.AppendUint32(value, entry[2])
+	}
+
+	set := (&IdmapSet{Idmap: []IdmapEntry{{Isuid: true, Isgid: true, Hostid: 100000, Nsid: 0, Maprange: 65536}}}).Compile()
+	unshifted, err := UnshiftACL(string(value), set)
+	assert.NoError(t, err)
+
+	ids := []uint32{}
+	for offset := 4; offset < len(unshifted); offset += 8 {
+		ids = append(ids, binary.LittleEndian.Uint32([]byte(unshifted[offset+4:])))
+	}
+
+	assert.Equal(t, []uint32{0xffffffff, 1000, 33, 5, 0xffffffff, 0xffffffff}, ids)
+
+	_, err = UnshiftACL(string(value[:4]), set)
+	assert.Error(t, err)
+
+	_, err = UnshiftACL(string(value[:10]), set)
+	assert.Error(t, err)
+}
+
+func TestIdmapSetCompile(t *testing.T) {
+	// Overlapping and adjacent entries, the first matching entry wins.
+	set := IdmapSet{Idmap: []IdmapEntry{
+		{Isuid: true, Hostid: 1000, Nsid: 1000, Maprange: 1},
+		{Isuid: true, Isgid: true, Hostid: 100000, Nsid: 0, Maprange: 65536},
+		{Isgid: true, Hostid: 200000, Nsid: 500, Maprange: 10},
+		{Isuid: true, Hostid: 165536, Nsid: 65536, Maprange: 100},
+		{Isuid: true, Hostid: 300000, Nsid: 65600, Maprange: 1000},
+	}}
+
+	compiled := set.Compile()
+	for _, id := range []int64{-1, 0, 1, 499, 500, 509, 510, 999, 1000, 1001, 65535, 65536, 65599, 65600, 65635, 66599, 66600, 100000, 101000, 165536, 165635, 200005, 300000, 1000000} {
+		uid, gid := set.ShiftIntoNs(id, id)
+		cuid, cgid := compiled.ShiftIntoNs(id, id)
+		assert.Equal(t, []int64{uid, gid}, []int64{cuid, cgid}, fmt.Sprintf("into %d", id))
+
+		uid, gid = set.ShiftFromNs(id, id)
+		cuid, cgid = compiled.ShiftFromNs(id, id)
+		assert.Equal(t, []int64{uid, gid}, []int64{cuid, cgid}, fmt.Sprintf("from %d", id))
+	}
+
+	// The adjacent 65536 long and 100 long uid ranges are merged.
+	assert.Equal(t, 4, len(compiled.uidsIn))
+}
+
+func BenchmarkShiftOwner(b *testing.B) {
+	if os.Geteuid() != 0 {
+		b.Skip("Shifting requires root")
+	}
+
+	dir := b.TempDir()
+	err := os.WriteFile(filepath.Join(dir, "file"), nil, 0644)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	i := 0
+	benchutil.Run(b, func() {
+		i++
+		err := ShiftOwner(dir, filepath.Join(dir, "file"), 100000+i%2, 100000+i%2)
+		if err != nil {
+			b.Fatal(err)
+		}
+	})
+}
+
+func BenchmarkShiftRootfs(b *testing.B) {
+	if os.Geteuid() != 0 {
+		b.Skip("Shifting requires root")
+	}
+
+	// A thousand entries per directory.
+	rootfs := filepath.Join(b.TempDir(), "rootfs")
+	for i := 0; i < *benchInodes; i++ {
+		dir := filepath.Join(rootfs, fmt.Sprintf("%d", i/1000))
+		if i%1000 == 0 {
+			err := os.MkdirAll(dir, 0755)
+			if err != nil {
+				b.Fatal(err)
+			}
+
+			continue
+		}
+
+		err := os.WriteFile(filepath.Join(dir, fmt.Sprintf("%d", i)), nil, 0644)
+		if err != nil {
+			b.Fatal(err)
+		}
+	}
+
+	set := IdmapSet{Idmap: []IdmapEntry{{Isuid: true, Isgid: true, Hostid: 100000, Nsid: 0, Maprange: 65536}}}
+
+	// The tree is shared by the runs of the sub-benchmark, which shift it back and forth, each
+	// operation being a full walk.
+	shifted := false
+	b.Run(fmt.Sprintf("inodes=%d", *benchInodes), func(b *testing.B) {
+		benchutil.Run(b, func() {
+			var err error
+			if shifted {
+				err = set.UnshiftRootfs(rootfs, nil)
+			} else {
+				err = set.ShiftRootfs(rootfs, nil)
+			}
+
+			if err != nil {
+				b.Fatal(err)
+			}
+
+			shifted = !shifted
+		})
+
+		b.ReportMetric(float64(b.Elapsed().Nanoseconds())/float64(b.N)/float64(*benchInodes), "ns/inode")
+	})
+}
+
+func BenchmarkUnshiftACL(b *testing.B) {
+	// ACL_USER_OBJ, 30 ACL_USER and ACL_GROUP entries, ACL_MASK and ACL_OTHER.
+	value := binary.LittleEndian.AppendUint32(nil, 2)
+	value = binary.LittleEndian.AppendUint64(value, 0xffffffff00070001)
+	for i := 0; i < 30; i++ {
+		tag := uint16(0x02)
+		if i%2 == 1 {
+			tag = 0x08
+		}
+
+		value = binary.LittleEndian.AppendUint16(value, tag)
+		value = binary.LittleEndian.AppendUint16(value, 7)
+		value = binary.LittleEndian.AppendUint32(value, uint32(101000+i))
+	}
+
+	value = binary.LittleEndian.AppendUint64(value, 0xffffffff00070010)
+	value = binary.LittleEndian.AppendUint64(value, 0xffffffff00050020)
+
+	set := (&IdmapSet{Idmap: []IdmapEntry{{Isuid: true, Isgid: true, Hostid: 100000, Nsid: 0, Maprange: 65536}}}).Compile()
+
+	benchutil.Run(b, func() {
+		_, err := UnshiftACL(string(value), set)
+		if err != nil {
+			b.Fatal(err)
+		}
+	})
+}
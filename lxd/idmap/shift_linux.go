@@ -2,7 +2,6 @@
 
 package idmap
 
-// #cgo LDFLAGS: -lacl
 /*
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE 1
@@ -28,7 +27,6 @@ package idmap
 #include "../../lxd/include/syscall_wrappers.h"
 
 // Needs to be included at the end
-#include <sys/acl.h>
 #include <sys/xattr.h>
 
 #ifndef VFS_CAP_REVISION_1
@@ -67,21 +65,6 @@ struct vfs_ns_cap_data {
 #error Expected endianess macro to be set
 #endif
 
-static __le32 native_to_le32(int n)
-{
-	return cpu_to_le32(n);
-}
-
-static int le16_to_native(__le16 n)
-{
-	return le16_to_cpu(n);
-}
-
-static int le32_to_native(__le32 n)
-{
-	return le32_to_cpu(n);
-}
-
 static int set_vfs_ns_caps(char *path, void *caps, ssize_t len, uint32_t uid)
 {
 	// Works because vfs_ns_cap_data is a superset of vfs_cap_data (rootid
@@ -256,6 +239,221 @@ static void *posix_entry_next(void *value)
 	return (void *)(entry + 1);
 }
 
+// Sorted, non-overlapping ranges of a single id type in the direction of the
+// shift, as compiled by IdmapSet.Compile().
+struct shift_range {
+	int64_t start;
+	int64_t end;
+	int64_t target;
+};
+
+struct shift_map {
+	struct shift_range *uid;
+	size_t nr_uid;
+	struct shift_range *gid;
+	size_t nr_gid;
+
+	// File capabilities are rewritten for this root uid after the chown.
+	int restore_caps;
+	uint32_t root_uid;
+};
+
+#define SHIFT_STEP_OPEN		1
+#define SHIFT_STEP_GET_CAPS	2
+#define SHIFT_STEP_CHOWN	3
+#define SHIFT_STEP_CHMOD	4
+#define SHIFT_STEP_ACL		5
+
+// A directory entry to shift. name is an offset into the names buffer of the
+// batch, the result of the shift is reported in the other fields.
+struct shift_entry {
+	uint32_t name;
+	int32_t step;
+	int32_t error;
+	int32_t caps_error;
+};
+
+static int64_t shift_map_id(const struct shift_range *ranges, size_t nr, int64_t id)
+{
+	size_t low = 0, high = nr;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (ranges[mid].end <= id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < nr && ranges[low].start <= id)
+		return id - ranges[low].start + ranges[low].target;
+
+	return -1;
+}
+
+// Shift the user and group entries of a raw POSIX ACL xattr in place, unmapped
+// ids are left alone. The xattr is only written back if an id changed.
+static int shift_acl_xattr(const char *path, const char *name, const struct shift_map *map)
+{
+	__do_free char *heap_buf = NULL;
+	char stack_buf[sizeof(struct posix_acl_xattr_header) + 32 * sizeof(struct posix_acl_xattr_entry)];
+	struct posix_acl_xattr_header *header;
+	void *entry, *end;
+	char *buf = stack_buf;
+	ssize_t size;
+	int count, update = 0;
+
+	size = getxattr(path, name, buf, sizeof(stack_buf));
+	if (size < 0 && errno == ERANGE) {
+		size = getxattr(path, name, NULL, 0);
+		if (size > 0) {
+			heap_buf = malloc(size);
+			if (!heap_buf)
+				return -ENOMEM;
+
+			buf = heap_buf;
+			size = getxattr(path, name, buf, size);
+		}
+	}
+
+	if (size < 0) {
+		if (errno == ENODATA || errno == ENOTSUP)
+			return 0;
+
+		return -errno;
+	}
+
+	header = (struct posix_acl_xattr_header *)buf;
+	count = posix_acl_xattr_count(size);
+	if (count < 0 || header->a_version != cpu_to_le32(POSIX_ACL_XATTR_VERSION))
+		return -EINVAL;
+
+	entry = posix_entry_start(header);
+	end = posix_entry_end(entry, count);
+	for (; entry != end; entry = posix_entry_next(entry)) {
+		struct posix_acl_xattr_entry *e = entry;
+		int64_t id = le32_to_cpu(e->e_id);
+		int64_t new_id;
+
+		switch (le16_to_cpu(e->e_tag)) {
+		case ACL_USER:
+			new_id = shift_map_id(map->uid, map->nr_uid, id);
+			break;
+		case ACL_GROUP:
+			new_id = shift_map_id(map->gid, map->nr_gid, id);
+			break;
+		default:
+			continue;
+		}
+
+		if (new_id < 0 || new_id == id)
+			continue;
+
+		e->e_id = cpu_to_le32(new_id);
+		update = 1;
+	}
+
+	if (!update)
+		return 0;
+
+	if (setxattr(path, name, buf, size, XATTR_REPLACE) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int shift_entry_do(int dirfd, const char *name, const struct shift_map *map, struct shift_entry *e)
+{
+	__do_close int fd = -EBADF;
+	char fdpath[64];
+	struct vfs_ns_cap_data caps;
+	ssize_t caps_len = -1;
+	struct stat sb;
+	int64_t uid, gid;
+	int ret;
+
+	fd = openat(dirfd, name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		e->step = SHIFT_STEP_OPEN;
+		goto out_errno;
+	}
+
+	ret = fstat(fd, &sb);
+	if (ret < 0) {
+		e->step = SHIFT_STEP_OPEN;
+		goto out_errno;
+	}
+
+	// O_PATH file descriptors can't be used for xattrs and chmod so go
+	// through procfs for those.
+	snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%d", fd);
+
+	// The capabilities are dropped by the kernel on chown.
+	if (!S_ISLNK(sb.st_mode)) {
+		caps_len = getxattr(fdpath, "security.capability", &caps, sizeof(caps));
+		if (caps_len < 0 && errno != ENODATA && errno != ENOTSUP) {
+			e->step = SHIFT_STEP_GET_CAPS;
+			goto out_errno;
+		}
+	}
+
+	uid = shift_map_id(map->uid, map->nr_uid, sb.st_uid);
+	gid = shift_map_id(map->gid, map->nr_gid, sb.st_gid);
+	if ((uid >= 0 && uid != sb.st_uid) || (gid >= 0 && gid != sb.st_gid)) {
+		ret = fchownat(fd, "", (uid_t)uid, (gid_t)gid, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
+		if (ret < 0) {
+			e->step = SHIFT_STEP_CHOWN;
+			goto out_errno;
+		}
+
+		// Restore the setuid and setgid bits.
+		if (!S_ISLNK(sb.st_mode)) {
+			ret = chmod(fdpath, sb.st_mode);
+			if (ret < 0) {
+				e->step = SHIFT_STEP_CHMOD;
+				goto out_errno;
+			}
+		}
+	}
+
+	if (S_ISLNK(sb.st_mode))
+		return 0;
+
+	ret = shift_acl_xattr(fdpath, "system.posix_acl_access", map);
+	if (ret == 0 && S_ISDIR(sb.st_mode))
+		ret = shift_acl_xattr(fdpath, "system.posix_acl_default", map);
+	if (ret < 0) {
+		e->step = SHIFT_STEP_ACL;
+		errno = -ret;
+		goto out_errno;
+	}
+
+	if (caps_len > 0 && map->restore_caps) {
+		ret = set_vfs_ns_caps(fdpath, &caps, caps_len, map->root_uid);
+		if (ret < 0)
+			e->caps_error = errno;
+	}
+
+	return 0;
+
+out_errno:
+	e->error = errno;
+	return -1;
+}
+
+// Shift the ownership, the ACLs and the file capabilities of a batch of
+// entries of dirfd. Returns the index of the entry that failed or nr.
+size_t shift_entries(int dirfd, const struct shift_map *map, struct shift_entry *entries, size_t nr, const char *names)
+{
+	for (size_t i = 0; i < nr; i++) {
+		if (shift_entry_do(dirfd, names + entries[i].name, map, &entries[i]) < 0)
+			return i;
+	}
+
+	return nr;
+}
+
 #define __STACK_SIZE (8 * 1024 * 1024)
 static pid_t do_clone(int (*fn)(void *), void *arg, int flags)
 {
@@ -401,6 +599,7 @@ static int create_detached_idmapped_mount(const char *path, const char *fstype)
 import "C"
 
 import (
+	"encoding/binary"
 	"fmt"
 	"os"
 	"os/exec"
@@ -429,6 +628,113 @@ func ShiftOwner(basepath string, path string, uid int, gid int) error {
 	return nil
 }
 
+// shiftMap is the C representation of an IdmapSet used by shiftBatch.
+type shiftMap struct {
+	m *C.struct_shift_map
+}
+
+// newShiftMap converts the set for shifting in the given direction ("in" or "out").
+// The file capabilities are rewritten for rootUID if restoreCaps is set.
+func newShiftMap(set *CompiledIdmapSet, how string, restoreCaps bool, rootUID int64) *shiftMap {
+	var uids, gids []C.struct_shift_range
+
+	uidRanges, gidRanges := set.ranges(how)
+	for _, r := range uidRanges {
+		uids = append(uids, C.struct_shift_range{start: C.int64_t(r.start), end: C.int64_t(r.end), target: C.int64_t(r.target)})
+	}
+
+	for _, r := range gidRanges {
+		gids = append(gids, C.struct_shift_range{start: C.int64_t(r.start), end: C.int64_t(r.end), target: C.int64_t(r.target)})
+	}
+
+	// The map is read by C while the walk is running so it has to live in C memory.
+	m := (*C.struct_shift_map)(C.calloc(1, C.size_t(unsafe.Sizeof(C.struct_shift_map{}))))
+	m.uid = (*C.struct_shift_range)(C.calloc(C.size_t(len(uids)+1), C.size_t(unsafe.Sizeof(C.struct_shift_range{}))))
+	m.nr_uid = C.size_t(len(uids))
+	copy(unsafe.Slice(m.uid, len(uids)), uids)
+	m.gid = (*C.struct_shift_range)(C.calloc(C.size_t(len(gids)+1), C.size_t(unsafe.Sizeof(C.struct_shift_range{}))))
+	m.nr_gid = C.size_t(len(gids))
+	copy(unsafe.Slice(m.gid, len(gids)), gids)
+
+	if restoreCaps {
+		m.restore_caps = 1
+		m.root_uid = C.uint32_t(rootUID)
+	}
+
+	return &shiftMap{m: m}
+}
+
+func (m *shiftMap) free() {
+	C.free(unsafe.Pointer(m.m.uid))
+	C.free(unsafe.Pointer(m.m.gid))
+	C.free(unsafe.Pointer(m.m))
+}
+
+// shiftBatchSize is the maximum number of entries shifted with a single cgo call.
+const shiftBatchSize = 512
+
+// shiftBatch holds entries of a single directory that are shifted with a single cgo call.
+type shiftBatch struct {
+	entries []C.struct_shift_entry
+	names   []byte
+}
+
+func (b *shiftBatch) add(name string) {
+	b.entries = append(b.entries, C.struct_shift_entry{name: C.uint32_t(len(b.names))})
+	b.names = append(b.names, name...)
+	b.names = append(b.names, 0)
+}
+
+func (b *shiftBatch) len() int {
+	return len(b.entries)
+}
+
+func (b *shiftBatch) name(i int) string {
+	start := int(b.entries[i].name)
+	end := start
+	for b.names[end] != 0 {
+		end++
+	}
+
+	return string(b.names[start:end])
+}
+
+// apply shifts the entries of the batch relative to dirfd and empties it.
+// path returns the full path of an entry for logging.
+func (b *shiftBatch) apply(dirfd int, m *shiftMap, path func(name string) string) error {
+	defer func() {
+		b.entries = b.entries[:0]
+		b.names = b.names[:0]
+	}()
+
+	if len(b.entries) == 0 {
+		return nil
+	}
+
+	nr := int(C.shift_entries(C.int(dirfd), m.m, &b.entries[0], C.size_t(len(b.entries)), (*C.char)(unsafe.Pointer(&b.names[0]))))
+
+	for i := 0; i < nr; i++ {
+		if b.entries[i].caps_error != 0 {
+			logger.Warnf("Unable to set file capabilities on %q: %v", path(b.name(i)), unix.Errno(b.entries[i].caps_error))
+		}
+	}
+
+	if nr == len(b.entries) {
+		return nil
+	}
+
+	e := b.entries[nr]
+	err := unix.Errno(e.error)
+	switch e.step {
+	case C.SHIFT_STEP_GET_CAPS:
+		return fmt.Errorf("Failed to get capabilities of %q: %w", path(b.name(nr)), err)
+	case C.SHIFT_STEP_ACL:
+		return fmt.Errorf("Failed to change ACLs on %q: %w", path(b.name(nr)), err)
+	default:
+		return fmt.Errorf("Failed to change ownership of %q: %w", path(b.name(nr)), err)
+	}
+}
+
 // GetCaps extracts the list of capabilities effective on the file
 func GetCaps(path string) ([]byte, error) {
 	xattrs, err := shared.GetAllXattr(path)
@@ -462,12 +768,12 @@ func SetCaps(path string, caps []byte, uid int64) error {
 
 // ShiftACL updates uid and gid for file ACLs when entering/exiting a namespace
 func ShiftACL(path string, shiftIDs func(uid int64, gid int64) (int64, int64)) error {
-	err := shiftACLType(path, C.ACL_TYPE_ACCESS, shiftIDs)
+	err := shiftACLType(path, "system.posix_acl_access", shiftIDs)
 	if err != nil {
 		return err
 	}
 
-	err = shiftACLType(path, C.ACL_TYPE_DEFAULT, shiftIDs)
+	err = shiftACLType(path, "system.posix_acl_default", shiftIDs)
 	if err != nil {
 		return err
 	}
@@ -475,76 +781,86 @@ func ShiftACL(path string, shiftIDs func(uid int64, gid int64) (int64, int64)) e
 	return nil
 }
 
-func shiftACLType(path string, aclType int, shiftIDs func(uid int64, gid int64) (int64, int64)) error {
-	// Convert the path to something usable with cgo
-	cpath := C.CString(path)
-	defer C.free(unsafe.Pointer(cpath))
+func shiftACLType(path string, xattrName string, shiftIDs func(uid int64, gid int64) (int64, int64)) error {
+	// Read the raw ACL, most of them fit in the initial buffer.
+	buf := make([]byte, 256)
+	size, err := unix.Getxattr(path, xattrName, buf)
+	if err == unix.ERANGE {
+		size, err = unix.Getxattr(path, xattrName, nil)
+		if err == nil {
+			buf = make([]byte, size)
+			size, err = unix.Getxattr(path, xattrName, buf)
+		}
+	}
 
-	// Read the current ACL set for the requested type
-	acl := C.acl_get_file(cpath, C.uint(aclType))
-	if acl == nil {
+	if err == unix.ENODATA || err == unix.EOPNOTSUPP {
 		return nil
+	} else if err != nil {
+		return fmt.Errorf("Failed to get ACLs of %s: %w", path, err)
 	}
 
-	defer C.acl_free(unsafe.Pointer(acl))
+	buf = buf[:size]
 
-	// Iterate through all ACL entries
-	update := false
-	for entryID := C.ACL_FIRST_ENTRY; ; entryID = C.ACL_NEXT_ENTRY {
-		var ent C.acl_entry_t
-		var tag C.acl_tag_t
-
-		// Get the ACL entry
-		ret := C.acl_get_entry(acl, C.int(entryID), &ent)
-		if ret == 0 {
-			break
-		} else if ret < 0 {
-			return fmt.Errorf("Failed to get the ACL entry for %s", path)
+	update, err := shiftACLXattr(buf, func(tag int, id int64) int64 {
+		if tag == C.ACL_USER {
+			uid, _ := shiftIDs(id, -1)
+			return uid
 		}
 
-		// Get the ACL type
-		ret = C.acl_get_tag_type(ent, &tag)
-		if ret == -1 {
-			return fmt.Errorf("Failed to get the ACL type for %s", path)
-		}
+		_, gid := shiftIDs(-1, id)
+		return gid
+	})
+	if err != nil {
+		return fmt.Errorf("Failed to parse ACLs of %s: %w", path, err)
+	}
 
-		// We only care about user and group ACLs, copy anything else
-		if tag != C.ACL_USER && tag != C.ACL_GROUP {
-			continue
+	// Only update the on-disk ACLs if something changed
+	if update {
+		err = unix.Setxattr(path, xattrName, buf, unix.XATTR_REPLACE)
+		if err != nil {
+			return fmt.Errorf("%s - Failed to change ACLs on %s", err, path)
 		}
+	}
 
-		// Get the value
-		idp := (*C.id_t)(C.acl_get_qualifier(ent))
-		if idp == nil {
-			return fmt.Errorf("Failed to get current ACL value for %s", path)
-		}
+	return nil
+}
 
-		// Shift the value
-		newID := int64(-1)
-		if tag == C.ACL_USER {
-			newID, _ = shiftIDs((int64)(*idp), -1)
-		} else {
-			_, newID = shiftIDs(-1, (int64)(*idp))
-		}
+// shiftACLXattr shifts the ACL_USER and ACL_GROUP entries of a raw POSIX ACL xattr value in place.
+// shiftID returns the new id of an entry, -1 leaves the entry unchanged. It returns whether any
+// entry was changed.
+func shiftACLXattr(buf []byte, shiftID func(tag int, id int64) int64) (bool, error) {
+	headerSize := int(unsafe.Sizeof(C.struct_posix_acl_xattr_header{}))
+	entrySize := int(unsafe.Sizeof(C.struct_posix_acl_xattr_entry{}))
 
-		// Update the new entry with the shifted value
-		ret = C.acl_set_qualifier(ent, unsafe.Pointer(&newID))
-		if ret == -1 {
-			return fmt.Errorf("Failed to set ACL qualifier on %s", path)
-		}
+	if len(buf) < headerSize || (len(buf)-headerSize)%entrySize != 0 {
+		return false, fmt.Errorf("Invalid ACL size")
+	}
 
-		update = true
+	version := binary.LittleEndian.Uint32(buf)
+	if version != C.POSIX_ACL_XATTR_VERSION {
+		return false, fmt.Errorf("Invalid ACL header version %d != %d", version, C.POSIX_ACL_XATTR_VERSION)
 	}
 
-	// Update the on-disk ACLs to match
-	if update {
-		ret, err := C.acl_set_file(cpath, C.uint(aclType), acl)
-		if ret < 0 {
-			return fmt.Errorf("%s - Failed to change ACLs on %s", err, path)
+	update := false
+	for offset := headerSize; offset < len(buf); offset += entrySize {
+		entry := buf[offset : offset+entrySize]
+
+		tag := int(binary.LittleEndian.Uint16(entry))
+		if tag != C.ACL_USER && tag != C.ACL_GROUP {
+			continue
 		}
+
+		id := int64(binary.LittleEndian.Uint32(entry[4:]))
+		newID := shiftID(tag, id)
+		if newID == -1 || newID == id {
+			continue
+		}
+
+		binary.LittleEndian.PutUint32(entry[4:], uint32(newID))
+		update = true
 	}
 
-	return nil
+	return update, nil
 }
 
 // SupportsVFS3Fscaps checks if VFS3Fscaps are supported
@@ -585,77 +901,42 @@ func SupportsVFS3Fscaps(prefix string) bool {
 }
 
 // UnshiftACL performs an UID/GID unshift on the ACL xattr value in accordance with idmap (set) provided
-func UnshiftACL(value string, set *IdmapSet) (string, error) {
+func UnshiftACL(value string, set *CompiledIdmapSet) (string, error) {
 	if set == nil {
 		return "", fmt.Errorf("Invalid IdmapSet supplied")
 	}
 
 	buf := []byte(value)
-	cBuf := C.CBytes(buf)
-	defer C.free(cBuf)
-	var header *C.struct_posix_acl_xattr_header = (*C.struct_posix_acl_xattr_header)(cBuf)
-
-	size := len(buf)
-	if size < int(unsafe.Sizeof(*header)) {
-		return "", fmt.Errorf("Invalid ACL size")
-	}
-
-	if header.a_version != C.native_to_le32(C.POSIX_ACL_XATTR_VERSION) {
-		return "", fmt.Errorf("Invalid ACL header version %d != %d", header.a_version, C.native_to_le32(C.POSIX_ACL_XATTR_VERSION))
-	}
-
-	count := C.posix_acl_xattr_count(C.size_t(size))
-	if count < 0 {
-		return "", fmt.Errorf("Invalid ACL count")
-	}
-
-	if count == 0 {
-		return "", fmt.Errorf("No valid ACLs found")
-	}
-
-	entryPtr := C.posix_entry_start(unsafe.Pointer(header))
-	endEntryPtr := C.posix_entry_end(entryPtr, C.size_t(count))
-	for entryPtr != endEntryPtr {
-		entry := (*C.struct_posix_acl_xattr_entry)(entryPtr)
-		switch C.le16_to_native(entry.e_tag) {
-		case C.ACL_USER:
-			ouid := int64(C.le32_to_native(entry.e_id))
-			uid, _ := set.ShiftFromNs(ouid, -1)
-			if int(uid) != -1 {
-				entry.e_id = C.native_to_le32(C.int(uid))
-				logger.Debugf("Unshifting ACL_USER from uid %d to uid %d", ouid, uid)
+	_, err := shiftACLXattr(buf, func(tag int, id int64) int64 {
+		if tag == C.ACL_USER {
+			uid, _ := set.ShiftFromNs(id, -1)
+			if uid != -1 {
+				logger.Debugf("Unshifting ACL_USER from uid %d to uid %d", id, uid)
 			}
 
-		case C.ACL_GROUP:
-			ogid := int64(C.le32_to_native(entry.e_id))
-			_, gid := set.ShiftFromNs(-1, ogid)
-			if int(gid) != -1 {
-				entry.e_id = C.native_to_le32(C.int(gid))
-				logger.Debugf("Unshifting ACL_GROUP from gid %d to gid %d", ogid, gid)
-			}
+			return uid
+		}
 
-		case C.ACL_USER_OBJ:
-			logger.Debugf("Ignoring ACL type ACL_USER_OBJ")
-		case C.ACL_GROUP_OBJ:
-			logger.Debugf("Ignoring ACL type ACL_GROUP_OBJ")
-		case C.ACL_MASK:
-			logger.Debugf("Ignoring ACL type ACL_MASK")
-		case C.ACL_OTHER:
-			logger.Debugf("Ignoring ACL type ACL_OTHER")
-		default:
-			logger.Debugf("Ignoring unknown ACL type %d", C.le16_to_native(entry.e_tag))
+		_, gid := set.ShiftFromNs(-1, id)
+		if gid != -1 {
+			logger.Debugf("Unshifting ACL_GROUP from gid %d to gid %d", id, gid)
 		}
 
-		entryPtr = C.posix_entry_next(entryPtr)
+		return gid
+	})
+	if err != nil {
+		return "", err
 	}
 
-	buf = C.GoBytes(cBuf, C.int(size))
+	if len(buf) == int(unsafe.Sizeof(C.struct_posix_acl_xattr_header{})) {
+		return "", fmt.Errorf("No valid ACLs found")
+	}
 
 	return string(buf), nil
 }
 
 // UnshiftCaps performs an UID/GID unshift on the security.capability xattr value in accordance with idmap (set) provided
-func UnshiftCaps(value string, set *IdmapSet) (string, error) {
+func UnshiftCaps(value string, set *CompiledIdmapSet) (string, error) {
 	if set == nil {
 		return "", fmt.Errorf("Invalid IdmapSet supplied")
 	}
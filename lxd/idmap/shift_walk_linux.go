@@ -0,0 +1,460 @@
+//go:build linux && cgo
+
+package idmap
+
+import (
+	"fmt"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+)
+
+// shiftDir is a directory queued for shifting.
+//
+// Directories are opened relative to their parent with O_NOFOLLOW, so the walk can't be
+// redirected outside of the tree through symlinks. The parent stays open until all of its
+// queued children have been opened.
+type shiftDir struct {
+	parent *shiftDir
+	name   string
+	path   string
+	fd     int
+
+	// One reference is held while the directory is being processed and one per queued child.
+	refs atomic.Int32
+}
+
+func (d *shiftDir) release() {
+	if d.refs.Add(-1) == 0 {
+		_ = unix.Close(d.fd)
+	}
+}
+
+// shiftQueue is the directory queue of a single worker. The worker takes the most recently
+// queued directory while idle workers steal the oldest ones, which are the largest subtrees.
+type shiftQueue struct {
+	mu   sync.Mutex
+	dirs []*shiftDir
+}
+
+func (q *shiftQueue) push(d *shiftDir) {
+	q.mu.Lock()
+	q.dirs = append(q.dirs, d)
+	q.mu.Unlock()
+}
+
+func (q *shiftQueue) pop() *shiftDir {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+
+	if len(q.dirs) == 0 {
+		return nil
+	}
+
+	d := q.dirs[len(q.dirs)-1]
+	q.dirs[len(q.dirs)-1] = nil
+	q.dirs = q.dirs[:len(q.dirs)-1]
+
+	return d
+}
+
+func (q *shiftQueue) steal() *shiftDir {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+
+	if len(q.dirs) == 0 {
+		return nil
+	}
+
+	d := q.dirs[0]
+	q.dirs[0] = nil
+	q.dirs = q.dirs[1:]
+
+	return d
+}
+
+type shiftInode struct {
+	dev uint64
+	ino uint64
+}
+
+// shiftWalker shifts a tree on all CPUs.
+//
+// Every worker reads its directories with getdents and fstatat and shifts their entries in
+// batches, each batch being handled by a single cgo call which changes the ownership, the
+// POSIX ACLs and the file capabilities relative to the directory file descriptor.
+type shiftWalker struct {
+	set      *CompiledIdmapSet
+	how      string
+	testmode bool
+	root     string
+	skipper  func(dir string, absPath string, fi os.FileInfo) bool
+	m        *shiftMap
+
+	queues []*shiftQueue
+
+	// Directories queued or being processed, the walk is over when it drops to zero.
+	pending atomic.Int64
+
+	// Idle workers wait on cond.
+	mu   sync.Mutex
+	cond *sync.Cond
+	idle atomic.Int32
+
+	errMu  sync.Mutex
+	err    error
+	failed atomic.Bool
+
+	linksMu sync.Mutex
+	links   map[shiftInode]struct{}
+}
+
+// shiftTree shifts the tree rooted at dir, which must not have a trailing slash.
+func (set *CompiledIdmapSet) shiftTree(dir string, testmode bool, how string, skipper func(dir string, absPath string, fi os.FileInfo) bool, restoreCaps bool, rootUID int64) error {
+	w := &shiftWalker{
+		set:      set,
+		how:      how,
+		testmode: testmode,
+		root:     dir,
+		skipper:  skipper,
+		links:    map[shiftInode]struct{}{},
+	}
+
+	w.cond = sync.NewCond(&w.mu)
+
+	if !testmode {
+		w.m = newShiftMap(set, how, restoreCaps, rootUID)
+		defer w.m.free()
+	}
+
+	parentFd, err := unix.Open(filepath.Dir(dir), unix.O_RDONLY|unix.O_DIRECTORY|unix.O_CLOEXEC, 0)
+	if err != nil {
+		return fmt.Errorf("Failed opening %q: %w", filepath.Dir(dir), err)
+	}
+
+	parent := &shiftDir{path: filepath.Dir(dir), fd: parentFd}
+	parent.refs.Store(1)
+	defer parent.release()
+
+	var st unix.Stat_t
+	err = unix.Fstatat(parent.fd, filepath.Base(dir), &st, unix.AT_SYMLINK_NOFOLLOW)
+	if err != nil {
+		return fmt.Errorf("Failed to stat %q: %w", dir, err)
+	}
+
+	if skipper != nil && skipper(dir, dir, &shiftFileInfo{name: filepath.Base(dir), st: st}) {
+		return nil
+	}
+
+	if testmode {
+		w.print(dir, &st)
+	} else {
+		batch := &shiftBatch{}
+		batch.add(filepath.Base(dir))
+		err = batch.apply(parent.fd, w.m, func(string) string { return dir })
+		if err != nil {
+			return err
+		}
+	}
+
+	if st.Mode&unix.S_IFMT != unix.S_IFDIR {
+		return nil
+	}
+
+	workers := runtime.GOMAXPROCS(0)
+	w.queues = make([]*shiftQueue, workers)
+	for i := range w.queues {
+		w.queues[i] = &shiftQueue{}
+	}
+
+	parent.refs.Add(1)
+	w.pending.Store(1)
+	w.queues[0].push(&shiftDir{parent: parent, name: filepath.Base(dir), path: dir, fd: -1})
+
+	wg := sync.WaitGroup{}
+	for i := 0; i < workers; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			w.worker(i)
+		}(i)
+	}
+
+	wg.Wait()
+
+	return w.err
+}
+
+func (w *shiftWalker) fail(err error) {
+	w.errMu.Lock()
+	if w.err == nil {
+		w.err = err
+	}
+
+	w.errMu.Unlock()
+	w.failed.Store(true)
+}
+
+func (w *shiftWalker) print(path string, st *unix.Stat_t) {
+	uids, gids := w.set.ranges(w.how)
+	uid, gid := uids.shift(int64(st.Uid)), gids.shift(int64(st.Gid))
+	fmt.Printf("I would shift %q to %d %d\n", path, uid, gid)
+}
+
+// seen reports whether an inode with multiple links was already shifted through another name.
+func (w *shiftWalker) seen(st *unix.Stat_t) bool {
+	if st.Nlink < 2 || st.Mode&unix.S_IFMT == unix.S_IFDIR {
+		return false
+	}
+
+	key := shiftInode{dev: uint64(st.Dev), ino: uint64(st.Ino)}
+
+	w.linksMu.Lock()
+	defer w.linksMu.Unlock()
+
+	_, ok := w.links[key]
+	if !ok {
+		w.links[key] = struct{}{}
+	}
+
+	return ok
+}
+
+// queue adds a directory to the queue of the given worker.
+func (w *shiftWalker) queue(id int, d *shiftDir) {
+	w.pending.Add(1)
+	w.queues[id].push(d)
+
+	if w.idle.Load() > 0 {
+		w.mu.Lock()
+		w.cond.Broadcast()
+		w.mu.Unlock()
+	}
+}
+
+func (w *shiftWalker) tryNext(id int) *shiftDir {
+	d := w.queues[id].pop()
+	if d != nil {
+		return d
+	}
+
+	for i := 1; i < len(w.queues); i++ {
+		d = w.queues[(id+i)%len(w.queues)].steal()
+		if d != nil {
+			return d
+		}
+	}
+
+	return nil
+}
+
+// next returns the next directory to process, waiting for one if needed, or nil once the walk is over.
+func (w *shiftWalker) next(id int) *shiftDir {
+	d := w.tryNext(id)
+	if d != nil {
+		return d
+	}
+
+	w.mu.Lock()
+	defer w.mu.Unlock()
+
+	// Anything queued after this point either gets found below or wakes us up.
+	w.idle.Add(1)
+	defer w.idle.Add(-1)
+
+	for {
+		d = w.tryNext(id)
+		if d != nil {
+			return d
+		}
+
+		if w.pending.Load() == 0 {
+			return nil
+		}
+
+		w.cond.Wait()
+	}
+}
+
+func (w *shiftWalker) worker(id int) {
+	buf := make([]byte, 32*1024)
+	batch := &shiftBatch{}
+
+	for {
+		d := w.next(id)
+		if d == nil {
+			return
+		}
+
+		w.walkDir(id, d, buf, batch)
+
+		if w.pending.Add(-1) == 0 {
+			w.mu.Lock()
+			w.cond.Broadcast()
+			w.mu.Unlock()
+		}
+	}
+}
+
+// walkDir shifts the entries of a directory and queues its subdirectories.
+func (w *shiftWalker) walkDir(id int, d *shiftDir, buf []byte, batch *shiftBatch) {
+	if w.failed.Load() {
+		// Only release the file descriptors once something went wrong.
+		d.parent.release()
+		return
+	}
+
+	fd, err := unix.Openat(d.parent.fd, d.name, unix.O_RDONLY|unix.O_DIRECTORY|unix.O_NOFOLLOW|unix.O_CLOEXEC, 0)
+	d.parent.release()
+	if err != nil {
+		w.fail(fmt.Errorf("Failed opening %q: %w", d.path, err))
+		return
+	}
+
+	d.fd = fd
+	d.refs.Store(1)
+	defer d.release()
+
+	path := func(name string) string { return d.path + "/" + name }
+	children := []*shiftDir{}
+
+	// Subdirectories are only queued once their own entry has been shifted.
+	flush := func() bool {
+		if !w.testmode {
+			err := batch.apply(d.fd, w.m, path)
+			if err != nil {
+				w.fail(err)
+				return false
+			}
+		}
+
+		for _, child := range children {
+			d.refs.Add(1)
+			w.queue(id, child)
+		}
+
+		children = children[:0]
+
+		return true
+	}
+
+	var names []string
+	for {
+		n, err := unix.ReadDirent(d.fd, buf)
+		if err != nil {
+			w.fail(fmt.Errorf("Failed reading %q: %w", d.path, err))
+			return
+		}
+
+		if n == 0 {
+			break
+		}
+
+		_, _, names = unix.ParseDirent(buf[:n], -1, names[:0])
+		for _, name := range names {
+			var st unix.Stat_t
+
+			err = unix.Fstatat(d.fd, name, &st, unix.AT_SYMLINK_NOFOLLOW)
+			if err != nil {
+				w.fail(fmt.Errorf("Failed to stat %q: %w", path(name), err))
+				return
+			}
+
+			if w.skipper != nil && w.skipper(w.root, path(name), &shiftFileInfo{name: name, st: st}) {
+				continue
+			}
+
+			if w.seen(&st) {
+				continue
+			}
+
+			if w.testmode {
+				w.print(path(name), &st)
+			} else {
+				batch.add(name)
+			}
+
+			if st.Mode&unix.S_IFMT == unix.S_IFDIR {
+				children = append(children, &shiftDir{parent: d, name: name, path: path(name), fd: -1})
+			}
+
+			if batch.len() >= shiftBatchSize && !flush() {
+				return
+			}
+		}
+
+		if w.failed.Load() {
+			return
+		}
+	}
+
+	flush()
+}
+
+// shiftFileInfo is the os.FileInfo passed to the skipper.
+type shiftFileInfo struct {
+	name string
+	st   unix.Stat_t
+}
+
+func (fi *shiftFileInfo) Name() string {
+	return fi.name
+}
+
+func (fi *shiftFileInfo) Size() int64 {
+	return fi.st.Size
+}
+
+func (fi *shiftFileInfo) Mode() os.FileMode {
+	mode := os.FileMode(fi.st.Mode & 0777)
+
+	switch fi.st.Mode & unix.S_IFMT {
+	case unix.S_IFBLK:
+		mode |= os.ModeDevice
+	case unix.S_IFCHR:
+		mode |= os.ModeDevice | os.ModeCharDevice
+	case unix.S_IFDIR:
+		mode |= os.ModeDir
+	case unix.S_IFIFO:
+		mode |= os.ModeNamedPipe
+	case unix.S_IFLNK:
+		mode |= os.ModeSymlink
+	case unix.S_IFSOCK:
+		mode |= os.ModeSocket
+	}
+
+	if fi.st.Mode&unix.S_ISGID != 0 {
+		mode |= os.ModeSetgid
+	}
+
+	if fi.st.Mode&unix.S_ISUID != 0 {
+		mode |= os.ModeSetuid
+	}
+
+	if fi.st.Mode&unix.S_ISVTX != 0 {
+		mode |= os.ModeSticky
+	}
+
+	return mode
+}
+
+func (fi *shiftFileInfo) ModTime() time.Time {
+	return time.Unix(fi.st.Mtim.Unix())
+}
+
+func (fi *shiftFileInfo) IsDir() bool {
+	return fi.st.Mode&unix.S_IFMT == unix.S_IFDIR
+}
+
+// Sys returns a *syscall.Stat_t like the os.FileInfo of os.Lstat, which is what skippers assert.
+// Both types are generated from the kernel's struct stat, so they share the layout.
+func (fi *shiftFileInfo) Sys() any {
+	return (*syscall.Stat_t)(unsafe.Pointer(&fi.st))
+}
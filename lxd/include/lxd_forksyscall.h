@@ -0,0 +1,48 @@
+#ifndef LXD_FORKSYSCALL_H
+#define LXD_FORKSYSCALL_H
+
+#include <linux/types.h>
+
+// Requests understood by "forksyscall helper".
+#define FORKSYSCALL_HELPER_MKNOD	1
+#define FORKSYSCALL_HELPER_SETXATTR	2
+
+// File descriptors of the calling task passed along with each request.
+#define FORKSYSCALL_HELPER_FD_PIDFD	0
+#define FORKSYSCALL_HELPER_FD_NS	1
+#define FORKSYSCALL_HELPER_FD_ROOT	2
+#define FORKSYSCALL_HELPER_FD_CWD	3
+#define FORKSYSCALL_HELPER_NR_FDS	4
+
+#define FORKSYSCALL_HELPER_PATH_MAX	4096
+#define FORKSYSCALL_HELPER_NAME_MAX	256
+#define FORKSYSCALL_HELPER_VALUE_MAX	65536
+
+// Only the used part of value is sent, the helper replies with a __s32 which
+// is 0 on success or the errno forksyscall would have printed.
+struct forksyscall_helper_req {
+	__u32 syscall;
+	__s32 pid;
+
+	// Credentials of the calling task, mapped into the container for setxattr.
+	__u32 uid;
+	__u32 gid;
+	__u32 fsuid;
+	__u32 fsgid;
+
+	// mknod
+	__u32 mode;
+	__u32 __reserved;
+	__u64 dev;
+
+	// setxattr
+	__s32 flags;
+	__s32 whiteout;
+	__u32 size;
+
+	char path[FORKSYSCALL_HELPER_PATH_MAX];
+	char name[FORKSYSCALL_HELPER_NAME_MAX];
+	char value[FORKSYSCALL_HELPER_VALUE_MAX];
+};
+
+#endif /* LXD_FORKSYSCALL_H */
@@ -1688,6 +1688,23 @@ func (d *lxc) deviceDetachNIC(configCopy map[string]string, netIF []deviceConfig
 func (d *lxc) deviceHandleMounts(mounts []deviceConfig.MountEntryItem) error {
 	reverter := revert.New()
 	defer reverter.Fail()
+
+	// Consecutive mounts which can be moved into the container are handled by a single helper.
+	var moves []lxcMoveMount
+	flushMoves := func() error {
+		if len(moves) == 0 {
+			return nil
+		}
+
+		err := d.moveMounts(moves)
+		moves = nil
+		if err != nil {
+			return fmt.Errorf("Failed to add mounts for device inside container: %w", err)
+		}
+
+		return nil
+	}
+
 	for _, mount := range mounts {
 		if mount.DevPath != "" {
 			flags := 0
@@ -1711,12 +1728,27 @@ func (d *lxc) deviceHandleMounts(mounts []deviceConfig.MountEntryItem) error {
 				}
 			}
 
+			if d.state.OS.IdmappedMounts && idmapType == idmap.IdmapStorageIdmapped {
+				moves = append(moves, lxcMoveMount{source: mount.DevPath, target: mount.TargetPath, fstype: mount.FSType, flags: flags, idmapType: idmapType})
+				continue
+			}
+
+			err := flushMoves()
+			if err != nil {
+				return err
+			}
+
 			// Mount it into the container.
-			err := d.insertMount(mount.DevPath, mount.TargetPath, mount.FSType, flags, idmapType)
+			err = d.insertMount(mount.DevPath, mount.TargetPath, mount.FSType, flags, idmapType)
 			if err != nil {
 				return fmt.Errorf("Failed to add mount for device inside container: %s", err)
 			}
 		} else {
+			err := flushMoves()
+			if err != nil {
+				return err
+			}
+
 			relativeTargetPath := strings.TrimPrefix(mount.TargetPath, "/")
 
 			// Connect to files API.
@@ -1750,6 +1782,11 @@ func (d *lxc) deviceHandleMounts(mounts []deviceConfig.MountEntryItem) error {
 		}
 	}
 
+	err := flushMoves()
+	if err != nil {
+		return err
+	}
+
 	reverter.Success()
 
 	return nil
@@ -1798,17 +1835,18 @@ func (d *lxc) DeviceEventHandler(runConf *deviceConfig.RunConfig) error {
 
 	// Generate uevent inside container if requested.
 	if len(runConf.Uevents) > 0 {
-		pidFdNr, pidFd := d.inheritInitPidFd()
-		if pidFdNr >= 0 {
-			defer func() { _ = pidFd.Close() }()
-		}
+		ns := d.initNamespaces()
+		defer ns.release()
+
+		files, pidFdNr, env := ns.inherit(3)
 
+		pid := d.InitPID()
 		for _, eventParts := range runConf.Uevents {
 			ueventArray := make([]string, 6)
 			ueventArray[0] = "forkuevent"
 			ueventArray[1] = "inject"
 			ueventArray[2] = "--"
-			ueventArray[3] = fmt.Sprintf("%d", d.InitPID())
+			ueventArray[3] = fmt.Sprintf("%d", pid)
 			ueventArray[4] = fmt.Sprintf("%d", pidFdNr)
 			length := 0
 			for _, part := range eventParts {
@@ -1817,7 +1855,7 @@ func (d *lxc) DeviceEventHandler(runConf *deviceConfig.RunConfig) error {
 
 			ueventArray[5] = fmt.Sprintf("%d", length)
 			ueventArray = append(ueventArray, eventParts...)
-			_, _, err := shared.RunCommandSplit(context.TODO(), nil, []*os.File{pidFd}, d.state.OS.ExecPath, ueventArray...)
+			_, _, err := shared.RunCommandSplit(context.TODO(), env, files, d.state.OS.ExecPath, ueventArray...)
 			if err != nil {
 				return err
 			}
@@ -2559,7 +2597,7 @@ func (d *lxc) onStart(_ map[string]string) error {
 	}
 
 	// Trigger a rebalance
-	cgroup.TaskSchedulerTrigger("container", d.name, "started")
+	cgroup.TaskSchedulerTrigger("container", d.project.Name, d.name, "started")
 
 	// Record last start state.
 	err = d.recordLastState()
@@ -2943,6 +2981,9 @@ func (d *lxc) onStop(args map[string]string) error {
 		// This is to required so we can actually unmount the container.
 		d.stopForkfile(false)
 
+		// Drop the handles on the namespaces of the container.
+		d.forgetInitNamespaces()
+
 		// Clean up devices.
 		d.cleanupDevices(false, "")
 
@@ -3017,7 +3058,7 @@ func (d *lxc) onStop(args map[string]string) error {
 		}
 
 		// Trigger a rebalance
-		cgroup.TaskSchedulerTrigger("container", d.name, "stopped")
+		cgroup.TaskSchedulerTrigger("container", d.project.Name, d.name, "stopped")
 
 		// Destroy ephemeral containers
 		if d.ephemeral {
@@ -4833,7 +4874,7 @@ func (d *lxc) Update(args db.InstanceArgs, userRequested bool) error {
 
 	if cpuLimitWasChanged {
 		// Trigger a scheduler re-run
-		cgroup.TaskSchedulerTrigger("container", d.name, "changed")
+		cgroup.TaskSchedulerTrigger("container", d.project.Name, d.name, "changed")
 	}
 
 	if userRequested {
@@ -6694,19 +6735,6 @@ func (d *lxc) templateApplyNow(trigger instance.TemplateTrigger) error {
 	return nil
 }
 
-func (d *lxc) inheritInitPidFd() (int, *os.File) {
-	if d.state.OS.PidFds {
-		pidFdFile, err := d.InitPidFd()
-		if err != nil {
-			return -1, nil
-		}
-
-		return 3, pidFdFile
-	}
-
-	return -1, nil
-}
-
 // FileSFTPConn returns a connection to the forkfile handler.
 func (d *lxc) FileSFTPConn() (net.Conn, error) {
 	// Lock to avoid concurrent spawning.
@@ -6828,15 +6856,13 @@ func (d *lxc) FileSFTPConn() (net.Conn, error) {
 		args = append(args, "4")
 		extraFiles = append(extraFiles, rootfsFile)
 
-		// Get the pidfd.
-		pidFdNr, pidFd := d.inheritInitPidFd()
-		if pidFdNr >= 0 {
-			defer func() { _ = pidFd.Close() }()
-			args = append(args, "5")
-			extraFiles = append(extraFiles, pidFd)
-		} else {
-			args = append(args, "-1")
-		}
+		// Get the pidfd and namespaces.
+		ns := d.initNamespaces()
+		defer ns.release()
+
+		nsFiles, pidFdNr, env := ns.inherit(5)
+		args = append(args, fmt.Sprintf("%d", pidFdNr))
+		extraFiles = append(extraFiles, nsFiles...)
 
 		// Finalize the args.
 		args = append(args, fmt.Sprintf("%d", d.InitPID()))
@@ -6845,6 +6871,7 @@ func (d *lxc) FileSFTPConn() (net.Conn, error) {
 		forkfile := exec.Cmd{
 			Path:       d.state.OS.ExecPath,
 			Args:       args,
+			Env:        env,
 			ExtraFiles: extraFiles,
 		}
 
@@ -6931,8 +6958,8 @@ func (d *lxc) FileSFTP() (*sftp.Client, error) {
 		return nil, err
 	}
 
-	// Get a SFTP client.
-	client, err := sftp.NewClientPipe(conn, conn)
+	// Get a SFTP client, pipelining the writes of large files.
+	client, err := sftp.NewClientPipe(conn, conn, sftp.UseConcurrentWrites(true))
 	if err != nil {
 		_ = conn.Close()
 		return nil, err
@@ -7315,6 +7342,32 @@ func (d *lxc) memoryState() api.InstanceStateMemory {
 	return memory
 }
 
+// networkCounters returns the counters of the instance's network interfaces keyed by interface name.
+// When netlink can be used directly only the link counters are retrieved, skipping addresses.
+func (d *lxc) networkCounters(hostInterfaces []net.Interface) map[string]api.InstanceStateNetworkCounters {
+	result := map[string]api.InstanceStateNetworkCounters{}
+
+	pid := d.InitPID()
+	if pid < 1 {
+		return result
+	}
+
+	if d.state.OS.NetnsGetifaddrs {
+		counters, err := netutils.NetnsGetifstats(int32(pid))
+		if err == nil {
+			return counters
+		}
+
+		d.logger.Debug("Failed to retrieve network counters via netlink", logger.Ctx{"pid": pid, "err": err})
+	}
+
+	for name, state := range d.networkState(hostInterfaces) {
+		result[name] = state.Counters
+	}
+
+	return result
+}
+
 func (d *lxc) networkState(hostInterfaces []net.Interface) map[string]api.InstanceStateNetwork {
 	result := map[string]api.InstanceStateNetwork{}
 
@@ -7325,7 +7378,15 @@ func (d *lxc) networkState(hostInterfaces []net.Interface) map[string]api.Instan
 
 	couldUseNetnsGetifaddrs := d.state.OS.NetnsGetifaddrs
 	if couldUseNetnsGetifaddrs {
-		nw, err := netutils.NetnsGetifaddrs(int32(pid), hostInterfaces)
+		var nw map[string]api.InstanceStateNetwork
+		var err error
+
+		if d.state.NetnsIfaddrs != nil {
+			nw, err = d.state.NetnsIfaddrs.Get(int32(pid), hostInterfaces)
+		} else {
+			nw, err = netutils.NetnsGetifaddrs(int32(pid), hostInterfaces)
+		}
+
 		if err != nil {
 			couldUseNetnsGetifaddrs = false
 			d.logger.Warn("Failed to retrieve network information via netlink", logger.Ctx{"pid": pid})
@@ -7335,16 +7396,16 @@ func (d *lxc) networkState(hostInterfaces []net.Interface) map[string]api.Instan
 	}
 
 	if !couldUseNetnsGetifaddrs {
-		pidFdNr, pidFd := d.inheritInitPidFd()
-		if pidFdNr >= 0 {
-			defer func() { _ = pidFd.Close() }()
-		}
+		ns := d.initNamespaces()
+		defer ns.release()
+
+		files, pidFdNr, env := ns.inherit(3)
 
 		// Get the network state from the container
 		out, _, err := shared.RunCommandSplit(
 			context.TODO(),
-			nil,
-			[]*os.File{pidFd},
+			env,
+			files,
 			d.state.OS.ExecPath,
 			"forknet",
 			"info",
@@ -7615,50 +7676,7 @@ func (d *lxc) insertMountLXC(source, target, fstype string, flags int) error {
 }
 
 func (d *lxc) moveMount(source, target, fstype string, flags int, idmapType idmap.IdmapStorageType) error {
-	// Get the init PID
-	pid := d.InitPID()
-	if pid == -1 {
-		// Container isn't running
-		return fmt.Errorf("Can't insert mount into stopped container")
-	}
-
-	switch idmapType {
-	case idmap.IdmapStorageIdmapped:
-	case idmap.IdmapStorageNone:
-	default:
-		return fmt.Errorf("Invalid idmap value specified")
-	}
-
-	pidFdNr, pidFd := seccomp.MakePidFd(pid, d.state)
-	if pidFdNr >= 0 {
-		defer func() { _ = pidFd.Close() }()
-	}
-
-	pidStr := fmt.Sprintf("%d", pid)
-
-	if !strings.HasPrefix(target, "/") {
-		target = "/" + target
-	}
-
-	_, err := shared.RunCommandInheritFds(
-		context.Background(),
-		[]*os.File{pidFd},
-		d.state.OS.ExecPath,
-		"forkmount",
-		"move-mount",
-		"--",
-		pidStr,
-		fmt.Sprintf("%d", pidFdNr),
-		fstype,
-		source,
-		target,
-		string(idmapType),
-		fmt.Sprintf("%d", flags))
-	if err != nil {
-		return err
-	}
-
-	return nil
+	return d.moveMounts([]lxcMoveMount{{source: source, target: target, fstype: fstype, flags: flags, idmapType: idmapType}})
 }
 
 func (d *lxc) insertMount(source, target, fstype string, flags int, idmapType idmap.IdmapStorageType) error {
@@ -7703,14 +7721,15 @@ func (d *lxc) removeMount(mount string) error {
 		}
 	} else {
 		// Remove the mount from the container
-		pidFdNr, pidFd := d.inheritInitPidFd()
-		if pidFdNr >= 0 {
-			defer func() { _ = pidFd.Close() }()
-		}
+		ns := d.initNamespaces()
+		defer ns.release()
+
+		files, pidFdNr, env := ns.inherit(3)
 
-		_, err := shared.RunCommandInheritFds(
+		_, _, err := shared.RunCommandSplit(
 			context.TODO(),
-			[]*os.File{pidFd},
+			env,
+			files,
 			d.state.OS.ExecPath,
 			"forkmount",
 			"lxd-umount",
@@ -8417,19 +8436,19 @@ func (d *lxc) Metrics(hostInterfaces []net.Interface) (*metrics.MetricSet, error
 	}
 
 	// Get network stats
-	networkState := d.networkState(hostInterfaces)
+	networkCounters := d.networkCounters(hostInterfaces)
 
-	for name, state := range networkState {
+	for name, counters := range networkCounters {
 		labels := map[string]string{"device": name}
 
-		out.AddSamples(metrics.NetworkReceiveBytesTotal, metrics.Sample{Value: float64(state.Counters.BytesReceived), Labels: labels})
-		out.AddSamples(metrics.NetworkReceivePacketsTotal, metrics.Sample{Value: float64(state.Counters.PacketsReceived), Labels: labels})
-		out.AddSamples(metrics.NetworkTransmitBytesTotal, metrics.Sample{Value: float64(state.Counters.BytesSent), Labels: labels})
-		out.AddSamples(metrics.NetworkTransmitPacketsTotal, metrics.Sample{Value: float64(state.Counters.PacketsSent), Labels: labels})
-		out.AddSamples(metrics.NetworkReceiveErrsTotal, metrics.Sample{Value: float64(state.Counters.ErrorsReceived), Labels: labels})
-		out.AddSamples(metrics.NetworkTransmitErrsTotal, metrics.Sample{Value: float64(state.Counters.ErrorsSent), Labels: labels})
-		out.AddSamples(metrics.NetworkReceiveDropTotal, metrics.Sample{Value: float64(state.Counters.PacketsDroppedInbound), Labels: labels})
-		out.AddSamples(metrics.NetworkTransmitDropTotal, metrics.Sample{Value: float64(state.Counters.PacketsDroppedOutbound), Labels: labels})
+		out.AddSamples(metrics.NetworkReceiveBytesTotal, metrics.Sample{Value: float64(counters.BytesReceived), Labels: labels})
+		out.AddSamples(metrics.NetworkReceivePacketsTotal, metrics.Sample{Value: float64(counters.PacketsReceived), Labels: labels})
+		out.AddSamples(metrics.NetworkTransmitBytesTotal, metrics.Sample{Value: float64(counters.BytesSent), Labels: labels})
+		out.AddSamples(metrics.NetworkTransmitPacketsTotal, metrics.Sample{Value: float64(counters.PacketsSent), Labels: labels})
+		out.AddSamples(metrics.NetworkReceiveErrsTotal, metrics.Sample{Value: float64(counters.ErrorsReceived), Labels: labels})
+		out.AddSamples(metrics.NetworkTransmitErrsTotal, metrics.Sample{Value: float64(counters.ErrorsSent), Labels: labels})
+		out.AddSamples(metrics.NetworkReceiveDropTotal, metrics.Sample{Value: float64(counters.PacketsDroppedInbound), Labels: labels})
+		out.AddSamples(metrics.NetworkTransmitDropTotal, metrics.Sample{Value: float64(counters.PacketsDroppedOutbound), Labels: labels})
 	}
 
 	// Get number of processes
@@ -0,0 +1,248 @@
+package drivers
+
+import (
+	"context"
+	"fmt"
+	"os"
+	"strings"
+
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/lxd/idmap"
+	"github.com/canonical/lxd/shared"
+	"github.com/canonical/lxd/shared/netutils"
+)
+
+const (
+	// moveMountsMaxFds is the largest number of detached mounts sent to forkmount in one message.
+	// It must match FORKMOUNT_MOVE_MAX_FDS.
+	moveMountsMaxFds = 64
+
+	// moveMountsMaxData is the largest size of the destinations sent to forkmount in one message.
+	// It must match FORKMOUNT_MOVE_MAX_DATA.
+	moveMountsMaxData = 65536
+)
+
+// lxcMoveMount is a mount moved into a running container with the new mount API.
+type lxcMoveMount struct {
+	source    string
+	target    string
+	fstype    string
+	flags     int
+	idmapType idmap.IdmapStorageType
+}
+
+// mountAttributes converts the mount flags into the attributes of a detached mount.
+func mountAttributes(flags int) int {
+	attrs := 0
+
+	for flag, attr := range map[int]int{
+		unix.MS_RDONLY:      unix.MOUNT_ATTR_RDONLY,
+		unix.MS_NOSUID:      unix.MOUNT_ATTR_NOSUID,
+		unix.MS_NODEV:       unix.MOUNT_ATTR_NODEV,
+		unix.MS_NOEXEC:      unix.MOUNT_ATTR_NOEXEC,
+		unix.MS_RELATIME:    unix.MOUNT_ATTR_RELATIME,
+		unix.MS_NOATIME:     unix.MOUNT_ATTR_NOATIME,
+		unix.MS_STRICTATIME: unix.MOUNT_ATTR_STRICTATIME,
+		unix.MS_NODIRATIME:  unix.MOUNT_ATTR_NODIRATIME,
+	} {
+		if flags&flag != 0 {
+			attrs |= attr
+		}
+	}
+
+	return attrs
+}
+
+// detach sets up a detached mount of the source, a new filesystem unless the filesystem type is
+// empty or "none" in which case the source gets cloned. The mount is idmapped to the user
+// namespace if it needs to be.
+func (m *lxcMoveMount) detach(userNsFd int) (int, error) {
+	var mntFd int
+	var err error
+
+	if m.fstype != "" && m.fstype != "none" {
+		fsFd, err := unix.Fsopen(m.fstype, unix.FSOPEN_CLOEXEC)
+		if err != nil {
+			return -1, fmt.Errorf("Failed to open filesystem %q: %w", m.fstype, err)
+		}
+
+		defer func() { _ = unix.Close(fsFd) }()
+
+		err = unix.FsconfigSetString(fsFd, "source", m.source)
+		if err != nil {
+			return -1, fmt.Errorf("Failed to set source %q: %w", m.source, err)
+		}
+
+		err = unix.FsconfigCreate(fsFd)
+		if err != nil {
+			return -1, fmt.Errorf("Failed to create filesystem %q: %w", m.source, err)
+		}
+
+		mntFd, err = unix.Fsmount(fsFd, unix.FSMOUNT_CLOEXEC, mountAttributes(m.flags))
+		if err != nil {
+			return -1, fmt.Errorf("Failed to mount %q: %w", m.source, err)
+		}
+	} else {
+		mntFd, err = unix.OpenTree(unix.AT_FDCWD, m.source, unix.OPEN_TREE_CLOEXEC|unix.OPEN_TREE_CLONE)
+		if err != nil {
+			return -1, fmt.Errorf("Failed to clone %q: %w", m.source, err)
+		}
+	}
+
+	if m.idmapType == idmap.IdmapStorageIdmapped {
+		attr := unix.MountAttr{
+			Attr_set:  unix.MOUNT_ATTR_IDMAP,
+			Userns_fd: uint64(userNsFd),
+		}
+
+		err = unix.MountSetattr(mntFd, "", unix.AT_EMPTY_PATH, &attr)
+		if err != nil {
+			_ = unix.Close(mntFd)
+			return -1, fmt.Errorf("Failed to idmap %q: %w", m.source, err)
+		}
+	}
+
+	return mntFd, nil
+}
+
+// sendDetachedMounts sends the detached mounts and their destinations to forkmount, as few
+// messages as possible.
+func sendDetachedMounts(sock int, mntFds []int, targets []string) error {
+	for len(mntFds) > 0 {
+		data := []byte{}
+
+		n := 0
+		for n < len(mntFds) && n < moveMountsMaxFds && len(data)+len(targets[n])+1 <= moveMountsMaxData {
+			data = append(data, targets[n]...)
+			data = append(data, 0)
+			n++
+		}
+
+		if n == 0 {
+			return fmt.Errorf("Mount target %q is too long", targets[0])
+		}
+
+		err := netutils.AbstractUnixSendFds(sock, mntFds[:n], data)
+		if err != nil {
+			return err
+		}
+
+		mntFds = mntFds[n:]
+		targets = targets[n:]
+	}
+
+	return nil
+}
+
+// moveMounts moves the mounts into the container with a single forkmount helper.
+//
+// The daemon sets the mounts up as detached mounts, all idmapped through the same user namespace
+// file descriptor, and sends them in batches over a socket to the helper which only has to move
+// them at their destinations once it joined the mount namespace of the container.
+func (d *lxc) moveMounts(mounts []lxcMoveMount) error {
+	// Get the init PID
+	pid := d.InitPID()
+	if pid == -1 {
+		// Container isn't running
+		return fmt.Errorf("Can't insert mount into stopped container")
+	}
+
+	ns := d.initNamespaces()
+	defer ns.release()
+
+	userNsFd := -1
+	for _, m := range mounts {
+		switch m.idmapType {
+		case idmap.IdmapStorageIdmapped:
+		case idmap.IdmapStorageNone:
+		default:
+			return fmt.Errorf("Invalid idmap value specified")
+		}
+
+		if m.idmapType == idmap.IdmapStorageIdmapped && userNsFd < 0 {
+			var err error
+
+			userNsFd, err = ns.open(pid, "user")
+			if err != nil {
+				return fmt.Errorf("Failed to open user namespace of container: %w", err)
+			}
+
+			defer func() { _ = unix.Close(userNsFd) }()
+		}
+	}
+
+	// Set up all the mounts before any of them gets moved.
+	mntFds := make([]int, 0, len(mounts))
+	targets := make([]string, 0, len(mounts))
+
+	defer func() {
+		for _, fd := range mntFds {
+			_ = unix.Close(fd)
+		}
+	}()
+
+	for i := range mounts {
+		mntFd, err := mounts[i].detach(userNsFd)
+		if err != nil {
+			return err
+		}
+
+		mntFds = append(mntFds, mntFd)
+
+		target := mounts[i].target
+		if !strings.HasPrefix(target, "/") {
+			target = "/" + target
+		}
+
+		targets = append(targets, target)
+	}
+
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return fmt.Errorf("Failed to create socket pair: %w", err)
+	}
+
+	defer func() { _ = unix.Close(fds[0]) }()
+
+	helper := os.NewFile(uintptr(fds[1]), "forkmount")
+	defer func() { _ = helper.Close() }()
+
+	// The helper gets to the end of the mounts once the socket is shut down.
+	sent := make(chan error, 1)
+	go func() {
+		err := sendDetachedMounts(fds[0], mntFds, targets)
+		_ = unix.Shutdown(fds[0], unix.SHUT_WR)
+		sent <- err
+	}()
+
+	files, pidFdNr, env := ns.inherit(3)
+	sockFdNr := 3 + len(files)
+	files = append(files, helper)
+
+	_, _, err = shared.RunCommandSplit(
+		context.Background(),
+		env,
+		files,
+		d.state.OS.ExecPath,
+		"forkmount",
+		"move-mounts",
+		"--",
+		fmt.Sprintf("%d", pid),
+		fmt.Sprintf("%d", pidFdNr),
+		fmt.Sprintf("%d", sockFdNr))
+
+	// Unblock the sender if the helper went away before receiving everything.
+	_ = unix.Shutdown(fds[0], unix.SHUT_RDWR)
+	sendErr := <-sent
+
+	if err != nil {
+		return err
+	}
+
+	if sendErr != nil {
+		return fmt.Errorf("Failed to send detached mounts: %w", sendErr)
+	}
+
+	return nil
+}
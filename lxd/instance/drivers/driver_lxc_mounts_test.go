@@ -0,0 +1,125 @@
+package drivers
+
+import (
+	"bytes"
+	"fmt"
+	"strings"
+	"testing"
+
+	"golang.org/x/sys/unix"
+)
+
+// recvDetachedMounts receives the messages sent by sendDetachedMounts until the socket is shut
+// down, returning the targets of each message.
+func recvDetachedMounts(t *testing.T, sock int) [][]string {
+	batches := [][]string{}
+	buf := make([]byte, moveMountsMaxData+1)
+	oob := make([]byte, unix.CmsgSpace((moveMountsMaxFds+1)*4))
+
+	for {
+		n, oobn, flags, _, err := unix.Recvmsg(sock, buf, oob, unix.MSG_CMSG_CLOEXEC)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		if n == 0 {
+			return batches
+		}
+
+		if flags&(unix.MSG_TRUNC|unix.MSG_CTRUNC) != 0 {
+			t.Fatalf("Message truncated, flags %#x", flags)
+		}
+
+		msgs, err := unix.ParseSocketControlMessage(oob[:oobn])
+		if err != nil || len(msgs) != 1 {
+			t.Fatalf("Invalid control message: %v", err)
+		}
+
+		fds, err := unix.ParseUnixRights(&msgs[0])
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		for _, fd := range fds {
+			_ = unix.Close(fd)
+		}
+
+		targets := strings.Split(string(bytes.TrimSuffix(buf[:n], []byte{0})), "\x00")
+		if len(targets) != len(fds) {
+			t.Fatalf("Got %d targets for %d mounts", len(targets), len(fds))
+		}
+
+		batches = append(batches, targets)
+	}
+}
+
+func TestSendDetachedMounts(t *testing.T) {
+	tests := []struct {
+		name    string
+		mounts  int
+		target  int
+		batches []int
+	}{
+		{"Single mount", 1, 8, []int{1}},
+		{"Limited by file descriptors", 2*moveMountsMaxFds + 5, 8, []int{moveMountsMaxFds, moveMountsMaxFds, 5}},
+		{"Limited by data", 40, 4095, []int{16, 16, 8}},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			defer func() { _ = unix.Close(fds[0]) }()
+			defer func() { _ = unix.Close(fds[1]) }()
+
+			mntFds := make([]int, tt.mounts)
+			targets := make([]string, tt.mounts)
+			for i := range mntFds {
+				mntFds[i], err = unix.Open("/", unix.O_PATH|unix.O_CLOEXEC, 0)
+				if err != nil {
+					t.Fatal(err)
+				}
+
+				defer func(fd int) { _ = unix.Close(fd) }(mntFds[i])
+
+				prefix := fmt.Sprintf("/%d/", i)
+				targets[i] = prefix + strings.Repeat("a", tt.target-len(prefix))
+			}
+
+			sent := make(chan error, 1)
+			go func() {
+				err := sendDetachedMounts(fds[0], mntFds, targets)
+				_ = unix.Shutdown(fds[0], unix.SHUT_WR)
+				sent <- err
+			}()
+
+			batches := recvDetachedMounts(t, fds[1])
+			err = <-sent
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			received := []string{}
+			for i, batch := range batches {
+				if i >= len(tt.batches) || len(batch) != tt.batches[i] {
+					t.Fatalf("Batch %d has %d mounts, expected batches of %v", i, len(batch), tt.batches)
+				}
+
+				received = append(received, batch...)
+			}
+
+			if len(batches) != len(tt.batches) || strings.Join(received, ",") != strings.Join(targets, ",") {
+				t.Fatalf("Received %d batches, expected %v in order", len(batches), tt.batches)
+			}
+		})
+	}
+
+	// Targets which can't fit in a message are refused.
+	err := sendDetachedMounts(-1, []int{0}, []string{strings.Repeat("a", moveMountsMaxData)})
+	if err == nil {
+		t.Fatal("Expected an error for a too long target")
+	}
+}
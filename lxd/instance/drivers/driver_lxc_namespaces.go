@@ -0,0 +1,152 @@
+package drivers
+
+import (
+	"fmt"
+	"os"
+	"sync"
+
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/lxd/linux"
+)
+
+// lxcNamespaces holds the pidfd of the init process of a running container and the directory of
+// its namespaces. Those are kept across helper invocations, the helpers inherit them rather than
+// getting the pidfd from LXC and looking the namespaces up in /proc every time.
+type lxcNamespaces struct {
+	pid   int
+	pidFd *os.File
+	nsFd  *os.File
+
+	// Number of users of the handle, it gets closed on release once it is no longer cached.
+	refs  int
+	stale bool
+}
+
+var lxcNamespacesMu sync.Mutex
+
+// lxcNamespacesCache holds the namespaces of the running containers, keyed by instance ID.
+var lxcNamespacesCache = map[int]*lxcNamespaces{}
+
+// alive checks that the init process the handle was opened for is still around, which means that
+// its pid and namespaces haven't been reused.
+func (ns *lxcNamespaces) alive() bool {
+	return linux.PidfdSendSignal(int(ns.pidFd.Fd()), 0, 0) == nil
+}
+
+func (ns *lxcNamespaces) close() {
+	_ = ns.pidFd.Close()
+	_ = ns.nsFd.Close()
+}
+
+// release gives up a reference to the handle, it may be nil.
+func (ns *lxcNamespaces) release() {
+	if ns == nil {
+		return
+	}
+
+	lxcNamespacesMu.Lock()
+	defer lxcNamespacesMu.Unlock()
+
+	ns.refs--
+	if ns.refs == 0 && ns.stale {
+		ns.close()
+	}
+}
+
+// forget removes the handle from the cache, closing it once its last user releases it.
+// Must be called with lxcNamespacesMu held.
+func (ns *lxcNamespaces) forget(id int) {
+	if lxcNamespacesCache[id] == ns {
+		delete(lxcNamespacesCache, id)
+	}
+
+	ns.stale = true
+	if ns.refs == 0 {
+		ns.close()
+	}
+}
+
+// inherit returns the files for a helper to inherit starting at fd, the pidfd number to pass it and
+// the environment telling it where the namespaces are. Without a handle, nothing gets inherited
+// and the pidfd number is -1.
+func (ns *lxcNamespaces) inherit(fd int) ([]*os.File, int, []string) {
+	if ns == nil {
+		return nil, -1, nil
+	}
+
+	env := append(os.Environ(), fmt.Sprintf("LXD_NSFD=%d:%d", fd+1, ns.pid))
+
+	return []*os.File{ns.pidFd, ns.nsFd}, fd, env
+}
+
+// open returns a file descriptor for the namespace of the given type of the process, looking it up
+// in /proc when there is no handle.
+func (ns *lxcNamespaces) open(pid int, nsType string) (int, error) {
+	if ns == nil {
+		return unix.Open(fmt.Sprintf("/proc/%d/ns/%s", pid, nsType), unix.O_RDONLY|unix.O_CLOEXEC, 0)
+	}
+
+	return unix.Openat(int(ns.nsFd.Fd()), nsType, unix.O_RDONLY|unix.O_CLOEXEC, 0)
+}
+
+// initNamespaces returns a handle on the namespaces of the container's init process to be released
+// once done with. It returns nil if pidfds aren't supported or the container isn't running.
+func (d *lxc) initNamespaces() *lxcNamespaces {
+	if !d.state.OS.PidFds {
+		return nil
+	}
+
+	lxcNamespacesMu.Lock()
+	defer lxcNamespacesMu.Unlock()
+
+	ns := lxcNamespacesCache[d.id]
+	if ns != nil {
+		if ns.alive() {
+			ns.refs++
+			return ns
+		}
+
+		ns.forget(d.id)
+	}
+
+	pidFd, err := d.InitPidFd()
+	if err != nil {
+		return nil
+	}
+
+	pid := d.InitPID()
+	if pid <= 0 {
+		_ = pidFd.Close()
+		return nil
+	}
+
+	nsFd, err := os.Open(fmt.Sprintf("/proc/%d/ns", pid))
+	if err != nil {
+		_ = pidFd.Close()
+		return nil
+	}
+
+	ns = &lxcNamespaces{pid: pid, pidFd: pidFd, nsFd: nsFd, refs: 1}
+
+	// Make sure the pid wasn't recycled before its namespaces got opened.
+	if !ns.alive() {
+		ns.close()
+		return nil
+	}
+
+	lxcNamespacesCache[d.id] = ns
+
+	return ns
+}
+
+// forgetInitNamespaces drops the cached namespaces of the container, once it stopped.
+func (d *lxc) forgetInitNamespaces() {
+	lxcNamespacesMu.Lock()
+	defer lxcNamespacesMu.Unlock()
+
+	ns := lxcNamespacesCache[d.id]
+	if ns != nil {
+		ns.forget(d.id)
+	}
+}
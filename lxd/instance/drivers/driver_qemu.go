@@ -1726,7 +1726,7 @@ func (d *qemu) start(stateful bool, op *operationlock.InstanceOperation) error {
 	}
 
 	// Trigger a rebalance procedure which will set vCPU affinity (pinning) (explicit or implicit)
-	cgroup.TaskSchedulerTrigger("virtual-machine", d.name, "started")
+	cgroup.TaskSchedulerTrigger("virtual-machine", d.project.Name, d.name, "started")
 
 	// Run monitor hooks from devices.
 	for _, monHook := range monHooks {
@@ -4947,7 +4947,7 @@ func (d *qemu) Stop(stateful bool) error {
 	}
 
 	// Trigger a rebalance
-	cgroup.TaskSchedulerTrigger("virtual-machine", d.name, "stopped")
+	cgroup.TaskSchedulerTrigger("virtual-machine", d.project.Name, d.name, "stopped")
 
 	return nil
 }
@@ -5817,7 +5817,7 @@ func (d *qemu) Update(args db.InstanceArgs, userRequested bool) error {
 
 	if cpuLimitWasChanged {
 		// Trigger a scheduler re-run
-		cgroup.TaskSchedulerTrigger("virtual-machine", d.name, "changed")
+		cgroup.TaskSchedulerTrigger("virtual-machine", d.project.Name, d.name, "changed")
 	}
 
 	if isRunning {
@@ -7573,8 +7573,8 @@ func (d *qemu) FileSFTP() (*sftp.Client, error) {
 		return nil, err
 	}
 
-	// Get a SFTP client.
-	client, err := sftp.NewClientPipe(conn, conn)
+	// Get a SFTP client, pipelining the writes of large files.
+	client, err := sftp.NewClientPipe(conn, conn, sftp.UseConcurrentWrites(true))
 	if err != nil {
 		_ = conn.Close()
 		return nil, err
@@ -475,8 +475,14 @@ func instanceFilePost(s *state.State, inst instance.Instance, path string, r *ht
 			return response.InternalError(err)
 		}
 
-		// Transfer the file into the instance.
-		_, err = io.Copy(file, r.Body)
+		// Transfer the file into the instance, letting the SFTP client pipeline the writes when
+		// the size is known.
+		var body io.Reader = r.Body
+		if r.ContentLength >= 0 {
+			body = io.LimitReader(r.Body, r.ContentLength)
+		}
+
+		_, err = io.Copy(file, body)
 		if err != nil {
 			return response.InternalError(err)
 		}
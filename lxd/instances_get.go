@@ -444,6 +444,24 @@ func doInstancesGet(s *state.State, r *http.Request) (any, error) {
 				}
 			}
 
+			// Retrieve the network state of all the running containers in one go.
+			if recursion >= 2 && s.NetnsIfaddrs != nil {
+				initPIDs := make([]int32, 0, len(instances))
+				for _, dbInst := range instances {
+					inst, found := localInstancesByID[dbInst.ID]
+					if !found || inst.Type() != instancetype.Container {
+						continue
+					}
+
+					pid := inst.InitPID()
+					if pid > 0 {
+						initPIDs = append(initPIDs, int32(pid))
+					}
+				}
+
+				s.NetnsIfaddrs.Prefetch(initPIDs)
+			}
+
 			queue := make(chan db.Instance, threads)
 
 			for i := 0; i < threads; i++ {
@@ -17,7 +17,7 @@ import (
 // InstanceTarWriter provides a TarWriter implementation that handles ID shifting and hardlink tracking.
 type InstanceTarWriter struct {
 	tarWriter *tar.Writer
-	idmapSet  *idmap.IdmapSet
+	idmapSet  *idmap.CompiledIdmapSet
 	linkMap   map[uint64]string
 }
 
@@ -25,7 +25,10 @@ type InstanceTarWriter struct {
 func NewInstanceTarWriter(writer io.Writer, idmapSet *idmap.IdmapSet) *InstanceTarWriter {
 	ctw := new(InstanceTarWriter)
 	ctw.tarWriter = tar.NewWriter(writer)
-	ctw.idmapSet = idmapSet
+	if idmapSet != nil {
+		ctw.idmapSet = idmapSet.Compile()
+	}
+
 	ctw.linkMap = map[uint64]string{}
 	return ctw
 }
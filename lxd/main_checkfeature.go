@@ -15,6 +15,7 @@ package main
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 #include <syscall.h>
 #include <linux/seccomp.h>
@@ -25,6 +26,7 @@ package main
 
 #include "lxd.h"
 #include "compiler.h"
+#include "file_utils.h"
 #include "lxd_seccomp.h"
 #include "memory_utils.h"
 #include "mount_utils.h"
@@ -42,6 +44,7 @@ __ro_after_init bool pidfd_aware = false;
 __ro_after_init bool pidfd_setns_aware = false;
 __ro_after_init bool uevent_aware = false;
 __ro_after_init int seccomp_notify_aware = 0;
+__ro_after_init bool idmapped_mounts_aware = false;
 __ro_after_init char errbuf[4096];
 
 static int netns_set_nsid(int fd)
@@ -262,26 +265,6 @@ cleanup_sigkill:
 	goto cleanup_wait;
 }
 
-static void is_user_notification_continue_aware(void)
-{
-	int ret;
-	pid_t pid;
-
-	pid = fork();
-	if (pid < 0)
-		return;
-
-	if (pid == 0) {
-		__do_user_notification_continue();
-		// Should not be reached.
-		_exit(EXIT_FAILURE);
-	}
-
-	ret = wait_for_pid(pid);
-	if (!ret)
-		seccomp_notify_aware = 2;
-}
-
 __noreturn static void __do_user_notification_addfd(void)
 {
 	__do_close int listener = -EBADF;
@@ -383,37 +366,44 @@ cleanup_sigkill:
 	goto cleanup_wait;
 }
 
-static void is_user_notification_addfd_aware(void)
+// Number of probes which couldn't be run, their results aren't cached.
+static int probes_failed;
+
+// probe_start runs a probe in a child process, its exit status being the result, so that it
+// runs concurrently with the other probes.
+static pid_t probe_start(void (*probe)(void))
 {
-	int ret;
 	pid_t pid;
 
 	pid = fork();
-	if (pid < 0)
-		return;
+	if (pid < 0) {
+		probes_failed++;
+		return -1;
+	}
 
 	if (pid == 0) {
-		__do_user_notification_addfd();
+		probe();
 		// Should not be reached.
 		_exit(EXIT_FAILURE);
 	}
 
-	ret = wait_for_pid(pid);
-	if (!ret)
-		seccomp_notify_aware = 3;
+	return pid;
 }
 
-static void is_seccomp_notify_aware(void)
+// probe_wait returns whether the probe started by probe_start succeeded.
+static bool probe_wait(pid_t pid)
 {
-	__u32 action[] = { SECCOMP_RET_USER_NOTIF };
+	if (pid < 0)
+		return false;
 
-	if (syscall(__NR_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action[0]) == 0) {
-		seccomp_notify_aware = 1;
-		is_user_notification_continue_aware();
-		if (seccomp_notify_aware == 2)
-			is_user_notification_addfd_aware();
-	}
+	return wait_for_pid(pid) == 0;
+}
 
+static bool is_seccomp_notify_aware(void)
+{
+	__u32 action[] = { SECCOMP_RET_USER_NOTIF };
+
+	return syscall(__NR_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action[0]) == 0;
 }
 
 static int is_pidfd_aware(void)
@@ -491,57 +481,23 @@ static void is_close_range_aware(void)
 	close_range_aware = true;
 }
 
-static void is_core_scheduling_aware(void)
+__noreturn static void __do_core_scheduling(void)
 {
+	pid_t pid_self;
+	__u64 core_sched_cookie;
 	int ret;
-	pid_t pid;
 
-	pid = fork();
-	if (pid < 0)
-		return;
-
-	if (pid == 0) {
-		pid_t pid_self;
-		__u64 core_sched_cookie;
-
-		pid_self = getpid();
-
-		ret = core_scheduling_cookie_create_threadgroup(pid_self);
-		if (ret)
-			_exit(EXIT_FAILURE);
-
-		core_sched_cookie = core_scheduling_cookie_get(pid_self);
-		if (!core_scheduling_cookie_valid(core_sched_cookie))
-			_exit(EXIT_FAILURE);
+	pid_self = getpid();
 
-		_exit(EXIT_SUCCESS);
-	}
-
-	ret = wait_for_pid(pid);
+	ret = core_scheduling_cookie_create_threadgroup(pid_self);
 	if (ret)
-		return;
-
-	core_scheduling_aware = true;
-}
-
-void checkfeature(void)
-{
-	__do_close int hostnetns_fd = -EBADF, newnetns_fd = -EBADF, pidfd = -EBADF;
-
-	is_netnsid_aware(&hostnetns_fd, &newnetns_fd);
-	pidfd = is_pidfd_aware();
-	is_uevent_aware();
-	is_seccomp_notify_aware();
-	is_tiocgptpeer_aware();
-	is_close_range_aware();
-	is_core_scheduling_aware();
-
-	if (pidfd >= 0)
-		pidfd_setns_aware = !setns(pidfd, CLONE_NEWNET);
+		_exit(EXIT_FAILURE);
 
-	if (setns(hostnetns_fd, CLONE_NEWNET) < 0)
-		(void)sprintf(errbuf, "%s", "Failed to attach to host network namespace");
+	core_sched_cookie = core_scheduling_cookie_get(pid_self);
+	if (!core_scheduling_cookie_valid(core_sched_cookie))
+		_exit(EXIT_FAILURE);
 
+	_exit(EXIT_SUCCESS);
 }
 
 static bool is_empty_string(char *s)
@@ -575,6 +531,177 @@ static bool kernel_supports_idmapped_mounts(void)
 
 	return false;
 }
+
+// Version of the kernel features cache, to be bumped whenever a probe is added or changes.
+#define CHECKFEATURE_CACHE_VERSION 2
+
+// checkfeature_cache_key builds the key the results are cached under, the probes being only
+// run again after a reboot or a kernel change. Core scheduling isn't cached as it depends on SMT,
+// which can be toggled at runtime.
+static int checkfeature_cache_key(char *key, size_t size)
+{
+	__do_close int fd = -EBADF;
+	char boot_id[64] = {};
+	struct utsname uts;
+	ssize_t len;
+	int ret;
+
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	len = read_nointr(fd, boot_id, sizeof(boot_id) - 1);
+	if (len <= 0)
+		return -EINVAL;
+
+	if (boot_id[len - 1] == '\n')
+		boot_id[len - 1] = '\0';
+
+	ret = uname(&uts);
+	if (ret < 0)
+		return -errno;
+
+	ret = snprintf(key, size, "%d\n%s\n%s %s %s\n", CHECKFEATURE_CACHE_VERSION, boot_id, uts.release, uts.version, uts.machine);
+	if (ret < 0 || (size_t)ret >= size)
+		return -E2BIG;
+
+	return ret;
+}
+
+static int checkfeature_cache_path(char *path, size_t size)
+{
+	const char *lxd_dir;
+	int ret;
+
+	lxd_dir = getenv("LXD_DIR");
+	if (lxd_dir && *lxd_dir)
+		ret = snprintf(path, size, "%s/cache/kernel-features", lxd_dir);
+	else
+		ret = snprintf(path, size, "%s", "/var/cache/lxd/kernel-features");
+	if (ret < 0 || (size_t)ret >= size)
+		return -E2BIG;
+
+	return 0;
+}
+
+// checkfeature_cache_load sets the results from the cache, if they were cached under the key.
+static bool checkfeature_cache_load(const char *path, const char *key, size_t key_len)
+{
+	__do_close int fd = -EBADF;
+	char buf[4096] = {};
+	int values[8];
+	ssize_t len;
+	int ret;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return false;
+
+	len = read_nointr(fd, buf, sizeof(buf) - 1);
+	if (len < 0 || (size_t)len <= key_len || memcmp(buf, key, key_len) != 0)
+		return false;
+
+	ret = sscanf(buf + key_len, "%d %d %d %d %d %d %d %d",
+		     &values[0], &values[1], &values[2], &values[3], &values[4],
+		     &values[5], &values[6], &values[7]);
+	if (ret != (int)ARRAY_SIZE(values))
+		return false;
+
+	close_range_aware	= values[0];
+	tiocgptpeer_aware	= values[1];
+	netnsid_aware		= values[2];
+	pidfd_aware		= values[3];
+	pidfd_setns_aware	= values[4];
+	uevent_aware		= values[5];
+	seccomp_notify_aware	= values[6];
+	idmapped_mounts_aware	= values[7];
+
+	return true;
+}
+
+// checkfeature_cache_store caches the results under the key, failures are ignored as this only
+// means probing again on the next start.
+static void checkfeature_cache_store(const char *path, const char *key)
+{
+	__do_close int fd = -EBADF;
+	char tmp_path[PATH_MAX];
+	char buf[4096];
+	int len, ret;
+
+	len = snprintf(buf, sizeof(buf), "%s%d %d %d %d %d %d %d %d\n", key,
+		       close_range_aware, tiocgptpeer_aware, netnsid_aware,
+		       pidfd_aware, pidfd_setns_aware, uevent_aware,
+		       seccomp_notify_aware, idmapped_mounts_aware);
+	if (len < 0 || (size_t)len >= sizeof(buf))
+		return;
+
+	ret = snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid());
+	if (ret < 0 || (size_t)ret >= sizeof(tmp_path))
+		return;
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		return;
+
+	if (write_nointr(fd, buf, len) != len || rename(tmp_path, path) < 0)
+		(void)unlink(tmp_path);
+}
+
+void checkfeature(void)
+{
+	__do_close int hostnetns_fd = -EBADF, newnetns_fd = -EBADF, pidfd = -EBADF;
+	pid_t core_scheduling_pid, notify_continue_pid = -1, notify_addfd_pid = -1;
+	char key[512], path[PATH_MAX];
+	int key_len;
+	bool cache;
+
+	// Start the probes which run in child processes first, they get
+	// reaped once the probes run in this process are done. Core
+	// scheduling is probed even with cached results, see
+	// checkfeature_cache_key().
+	core_scheduling_pid = probe_start(__do_core_scheduling);
+
+	key_len = checkfeature_cache_key(key, sizeof(key));
+	cache = key_len > 0 && !checkfeature_cache_path(path, sizeof(path));
+	if (cache && checkfeature_cache_load(path, key, key_len)) {
+		core_scheduling_aware = probe_wait(core_scheduling_pid);
+		return;
+	}
+
+	if (is_seccomp_notify_aware()) {
+		seccomp_notify_aware = 1;
+		notify_continue_pid = probe_start(__do_user_notification_continue);
+		notify_addfd_pid = probe_start(__do_user_notification_addfd);
+	}
+
+	is_netnsid_aware(&hostnetns_fd, &newnetns_fd);
+	pidfd = is_pidfd_aware();
+	is_uevent_aware();
+	is_tiocgptpeer_aware();
+	is_close_range_aware();
+	idmapped_mounts_aware = kernel_supports_idmapped_mounts();
+
+	if (pidfd >= 0)
+		pidfd_setns_aware = !setns(pidfd, CLONE_NEWNET);
+
+	if (setns(hostnetns_fd, CLONE_NEWNET) < 0)
+		(void)sprintf(errbuf, "%s", "Failed to attach to host network namespace");
+
+	core_scheduling_aware = probe_wait(core_scheduling_pid);
+
+	// Adding file descriptors relies on continuing syscalls.
+	if (probe_wait(notify_continue_pid)) {
+		seccomp_notify_aware = 2;
+		if (probe_wait(notify_addfd_pid))
+			seccomp_notify_aware = 3;
+	} else if (notify_addfd_pid > 0) {
+		(void)wait_for_pid(notify_addfd_pid);
+	}
+
+	// The results of an incomplete run would stick until the next reboot.
+	if (cache && !probes_failed && errbuf[0] == '\0')
+		checkfeature_cache_store(path, key);
+}
 */
 import "C"
 
@@ -616,7 +743,7 @@ func canUsePidFds() bool {
 // mounts. This check does not give any indication whether the relevant
 // filesystem used for a container does have this support.
 func kernelSupportsIdmappedMounts() bool {
-	return bool(C.kernel_supports_idmapped_mounts())
+	return bool(C.idmapped_mounts_aware)
 }
 
 func canUseNativeTerminals() bool {
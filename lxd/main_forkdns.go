@@ -2,11 +2,9 @@
 package main
 
 import (
-	"bufio"
 	"errors"
 	"fmt"
 	"net"
-	"os"
 	"path/filepath"
 	"strings"
 	"sync"
@@ -26,16 +24,17 @@ type cmdForkDNS struct {
 }
 
 type dnsHandler struct {
-	domain    string
-	leaseFile string
+	domain string
+	leases *dnsLeases
+	cache  *dnsCache
 }
 
 var dnsServersFileLock sync.Mutex
 var dnsServersList []string
 
 // serversFileMonitor performs an initial load of the server list and then waits for the file to be
-// modified before triggering a reload.
-func serversFileMonitor(watcher *inotify.Watcher, watcherPath string, networkName string) {
+// modified before triggering a reload. It also tells the lease index when the lease file changed.
+func serversFileMonitor(watcher *inotify.Watcher, watcherPath string, networkName string, leases *dnsLeases) {
 	err := loadServersList(networkName)
 	if err != nil {
 		logger.Errorf("Server list load error: %v", err)
@@ -44,6 +43,11 @@ func serversFileMonitor(watcher *inotify.Watcher, watcherPath string, networkNam
 	for {
 		select {
 		case ev := <-watcher.Event:
+			if ev.Name == leases.path {
+				leases.invalidate()
+				continue
+			}
+
 			// Ignore files events that dont concern the servers list file.
 			if ev.Name != filepath.Join(watcherPath, network.ForkdnsServersListFile) {
 				continue
@@ -158,26 +162,11 @@ func (h *dnsHandler) handlePTR(r *dns.Msg) (dns.Msg, error) {
 
 	// If we get here, then the recursion desired flag was set, meaning we cannot answer the
 	// query locally and need to relay it to the other forkdns instances.
-
-	// Get current list of servers safely.
-	dnsServersFileLock.Lock()
-	servers := dnsServersList
-	dnsServersFileLock.Unlock()
-
-	// Query all the servers.
-	for _, server := range servers {
-		req := dns.Msg{}
-		req.Question = r.Question
-		// Tell the remote node we only want to query their local data (to stop loops).
-		req.RecursionDesired = false
-		req.Id = r.Id
-
-		resp, err := dns.Exchange(&req, fmt.Sprintf("%s:1053", server))
-		if err != nil || len(resp.Answer) == 0 {
-			// Error or empty response, try the next one
-			continue
-		}
-
+	resp, ok := h.relay(r, func(resp *dns.Msg) bool {
+		// Error or empty response, try the next one
+		return len(resp.Answer) > 0
+	})
+	if ok {
 		return *resp, nil
 	}
 
@@ -186,6 +175,35 @@ func (h *dnsHandler) handlePTR(r *dns.Msg) (dns.Msg, error) {
 	return msg, nil
 }
 
+// relay relays the question to the other forkdns instances, returning the first response accepted
+// by the caller. Responses are cached, see dnsCache.
+func (h *dnsHandler) relay(r *dns.Msg, accept func(resp *dns.Msg) bool) (*dns.Msg, bool) {
+	return h.cache.relay(r, func() (*dns.Msg, bool) {
+		// Get current list of servers safely.
+		dnsServersFileLock.Lock()
+		servers := dnsServersList
+		dnsServersFileLock.Unlock()
+
+		// Query all the servers.
+		for _, server := range servers {
+			req := dns.Msg{}
+			req.Question = r.Question
+			// Tell the remote node we only want to query their local data (to stop loops).
+			req.RecursionDesired = false
+			req.Id = r.Id
+
+			resp, err := dns.Exchange(&req, fmt.Sprintf("%s:1053", server))
+			if err != nil || !accept(resp) {
+				continue
+			}
+
+			return resp, true
+		}
+
+		return nil, false
+	})
+}
+
 // getLeaseHostByReverseIPName finds the hostname used in the DHCP lease by supplying a reverse
 // DNS hostname of the device's IP.
 func (h *dnsHandler) getLeaseHostByReverseIPName(reverseName string) (string, error) {
@@ -194,30 +212,7 @@ func (h *dnsHandler) getLeaseHostByReverseIPName(reverseName string) (string, er
 		return "", errors.New("Failed to convert reverse name to IP")
 	}
 
-	file, err := os.Open(h.leaseFile)
-	if err != nil {
-		return "", err
-	}
-
-	defer func() { _ = file.Close() }()
-
-	scanner := bufio.NewScanner(file)
-	for scanner.Scan() {
-		fields := strings.Fields(scanner.Text())
-		if len(fields) >= 5 {
-			address := fields[2]
-			if address == ip {
-				return fields[3], nil
-			}
-		}
-	}
-
-	err = scanner.Err()
-	if err != nil {
-		return "", err
-	}
-
-	return "", nil
+	return h.leases.lookup(ip, true)
 }
 
 // handleA answers requests for A DNS records.
@@ -261,26 +256,11 @@ func (h *dnsHandler) handleA(r *dns.Msg) (dns.Msg, error) {
 
 	// If we get here, then the recursion desired flag was set, meaning we cannot answer the
 	// query locally and need to relay it to the other forkdns instances.
-
-	// Get current list of servers safely.
-	dnsServersFileLock.Lock()
-	servers := dnsServersList
-	dnsServersFileLock.Unlock()
-
-	// Query all the servers.
-	for _, server := range servers {
-		req := dns.Msg{}
-		req.Question = r.Question
-		// Tell the remote node we only want to query their local data (to stop loops).
-		req.RecursionDesired = false
-		req.Id = r.Id
-
-		resp, err := dns.Exchange(&req, fmt.Sprintf("%s:1053", server))
-		if err != nil || resp.Rcode != dns.RcodeSuccess {
-			// Error sending request or error response, try next server.
-			continue
-		}
-
+	resp, ok := h.relay(r, func(resp *dns.Msg) bool {
+		// Error sending request or error response, try next server.
+		return resp.Rcode == dns.RcodeSuccess
+	})
+	if ok {
 		return *resp, nil
 	}
 
@@ -293,30 +273,7 @@ func (h *dnsHandler) handleA(r *dns.Msg) (dns.Msg, error) {
 func (h *dnsHandler) getLeaseHostByDNSName(dnsName string) (string, error) {
 	host := strings.TrimSuffix(dnsName, fmt.Sprintf(".%s.", h.domain))
 
-	file, err := os.Open(h.leaseFile)
-	if err != nil {
-		return "", err
-	}
-
-	defer func() { _ = file.Close() }()
-
-	scanner := bufio.NewScanner(file)
-	for scanner.Scan() {
-		fields := strings.Fields(scanner.Text())
-		if len(fields) >= 5 {
-			hostname := fields[3]
-			if hostname == host {
-				return fields[2], nil
-			}
-		}
-	}
-
-	err = scanner.Err()
-	if err != nil {
-		return "", err
-	}
-
-	return "", nil
+	return h.leases.lookup(host, false)
 }
 
 func (c *cmdForkDNS) Command() *cobra.Command {
@@ -374,8 +331,17 @@ func (c *cmdForkDNS) Run(cmd *cobra.Command, args []string) error {
 		return fmt.Errorf("Unable to setup inotify watch on %s: %w", path, err)
 	}
 
+	// Watch the lease file being rewritten by dnsmasq to keep the lease index up to date.
+	leases := newDNSLeases(shared.VarPath("networks", networkName, "dnsmasq.leases"))
+	err = watcher.AddWatch(filepath.Dir(leases.path), inotify.InCreate|inotify.InModify|inotify.InMovedTo|inotify.InDelete)
+	if err != nil {
+		logger.Warn("Unable to setup inotify watch on lease file, reading it on every query", logger.Ctx{"path": leases.path, "err": err})
+	} else {
+		leases.watched.Store(true)
+	}
+
 	// Run the server list monitor concurrently waiting for file changes.
-	go serversFileMonitor(watcher, path, networkName)
+	go serversFileMonitor(watcher, path, networkName, leases)
 
 	logger.Info("Started")
 
@@ -385,8 +351,9 @@ func (c *cmdForkDNS) Run(cmd *cobra.Command, args []string) error {
 	}
 
 	srv.Handler = &dnsHandler{
-		domain:    args[1],
-		leaseFile: shared.VarPath("networks", networkName, "dnsmasq.leases"),
+		domain: args[1],
+		leases: leases,
+		cache:  newDNSCache(),
 	}
 
 	err = srv.ListenAndServe()
@@ -0,0 +1,247 @@
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"os"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/miekg/dns"
+	"golang.org/x/sync/singleflight"
+)
+
+// dnsCacheSize is the largest number of relayed responses kept in the cache.
+const dnsCacheSize = 4096
+
+// dnsCacheZeroTTL is how long responses with a zero TTL are cached. The other forkdns instances
+// answer from their leases with a zero TTL, they are still cached for a little while to absorb
+// bursts of identical queries without serving leases much older than the peer's.
+var dnsCacheZeroTTL = time.Second
+
+// dnsLeases indexes the dnsmasq leases of the network by hostname and by address.
+//
+// The index is rebuilt from the lease file on the first lookup after the inotify watcher reported
+// a change to it, dnsmasq rewriting the whole file on every lease change. Without a watch on the
+// file, it gets read on every lookup.
+type dnsLeases struct {
+	path string
+
+	// Whether the lease file may have changed since it was last read.
+	stale   atomic.Bool
+	watched atomic.Bool
+
+	mu        sync.RWMutex
+	hosts     map[string]string
+	addresses map[string]string
+}
+
+func newDNSLeases(path string) *dnsLeases {
+	l := &dnsLeases{path: path}
+	l.stale.Store(true)
+
+	return l
+}
+
+// invalidate marks the lease file as changed.
+func (l *dnsLeases) invalidate() {
+	l.stale.Store(true)
+}
+
+// refresh reads the lease file if it changed. Must be called with the lock held.
+func (l *dnsLeases) refresh() error {
+	if l.watched.Load() && !l.stale.Swap(false) {
+		return nil
+	}
+
+	hosts, addresses, err := readLeases(l.path)
+	if err != nil {
+		l.stale.Store(true)
+		return err
+	}
+
+	l.hosts = hosts
+	l.addresses = addresses
+
+	return nil
+}
+
+// lookup returns the value of the key in the index selected by byAddress.
+func (l *dnsLeases) lookup(key string, byAddress bool) (string, error) {
+	if !l.watched.Load() || l.stale.Load() {
+		l.mu.Lock()
+		err := l.refresh()
+		l.mu.Unlock()
+		if err != nil {
+			return "", err
+		}
+	}
+
+	l.mu.RLock()
+	defer l.mu.RUnlock()
+
+	if byAddress {
+		return l.addresses[key], nil
+	}
+
+	return l.hosts[key], nil
+}
+
+// readLeases reads the dnsmasq lease file, keeping the first lease of each hostname and address.
+func readLeases(path string) (map[string]string, map[string]string, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	defer func() { _ = file.Close() }()
+
+	hosts := map[string]string{}
+	addresses := map[string]string{}
+
+	scanner := bufio.NewScanner(file)
+	for scanner.Scan() {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) < 5 {
+			continue
+		}
+
+		address, hostname := fields[2], fields[3]
+
+		_, ok := hosts[hostname]
+		if !ok {
+			hosts[hostname] = address
+		}
+
+		_, ok = addresses[address]
+		if !ok {
+			addresses[address] = hostname
+		}
+	}
+
+	err = scanner.Err()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	return hosts, addresses, nil
+}
+
+type dnsCacheKey struct {
+	name   string
+	qtype  uint16
+	qclass uint16
+}
+
+type dnsCacheEntry struct {
+	msg    *dns.Msg
+	expiry time.Time
+}
+
+// dnsCache caches the responses relayed from the other forkdns instances for as long as the TTL of
+// their answers allows (dnsCacheZeroTTL for a zero TTL), and coalesces identical queries relayed at
+// the same time.
+type dnsCache struct {
+	mu      sync.Mutex
+	entries map[dnsCacheKey]dnsCacheEntry
+
+	relays singleflight.Group
+}
+
+func newDNSCache() *dnsCache {
+	return &dnsCache{entries: map[dnsCacheKey]dnsCacheEntry{}}
+}
+
+func dnsCacheKeyOf(q dns.Question) dnsCacheKey {
+	return dnsCacheKey{name: strings.ToLower(q.Name), qtype: q.Qtype, qclass: q.Qclass}
+}
+
+// get returns a copy of the cached response to the question, if still valid.
+func (c *dnsCache) get(q dns.Question) *dns.Msg {
+	key := dnsCacheKeyOf(q)
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	entry, ok := c.entries[key]
+	if !ok {
+		return nil
+	}
+
+	if !time.Now().Before(entry.expiry) {
+		delete(c.entries, key)
+		return nil
+	}
+
+	return entry.msg.Copy()
+}
+
+// add caches the response to the question for the lowest TTL of its answers, or dnsCacheZeroTTL if
+// that's zero. Responses without answers don't get cached.
+func (c *dnsCache) add(q dns.Question, msg *dns.Msg) {
+	if len(msg.Answer) == 0 {
+		return
+	}
+
+	ttl := msg.Answer[0].Header().Ttl
+	for _, rr := range msg.Answer[1:] {
+		ttl = min(ttl, rr.Header().Ttl)
+	}
+
+	lifetime := time.Duration(ttl) * time.Second
+	if ttl == 0 {
+		lifetime = dnsCacheZeroTTL
+	}
+
+	now := time.Now()
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if len(c.entries) >= dnsCacheSize {
+		for key, entry := range c.entries {
+			if !now.Before(entry.expiry) {
+				delete(c.entries, key)
+			}
+		}
+
+		if len(c.entries) >= dnsCacheSize {
+			return
+		}
+	}
+
+	c.entries[dnsCacheKeyOf(q)] = dnsCacheEntry{msg: msg.Copy(), expiry: now.Add(lifetime)}
+}
+
+// relay returns the response to the question, from the cache or by calling query. Concurrent
+// relays of the same question share a single query. The response gets the ID of the request.
+func (c *dnsCache) relay(r *dns.Msg, query func() (*dns.Msg, bool)) (*dns.Msg, bool) {
+	q := r.Question[0]
+
+	msg := c.get(q)
+	if msg == nil {
+		key := dnsCacheKeyOf(q)
+
+		v, _, _ := c.relays.Do(fmt.Sprintf("%s/%d/%d", key.name, key.qtype, key.qclass), func() (any, error) {
+			msg, ok := query()
+			if !ok {
+				return nil, nil
+			}
+
+			c.add(q, msg)
+			return msg, nil
+		})
+
+		if v == nil {
+			return nil, false
+		}
+
+		msg = v.(*dns.Msg).Copy()
+	}
+
+	msg.Id = r.Id
+
+	return msg, true
+}
@@ -0,0 +1,143 @@
+package main
+
+import (
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/stretchr/testify/require"
+)
+
+func TestDNSLeases(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "dnsmasq.leases")
+	err := os.WriteFile(path, []byte("1700000000 00:16:3e:00:00:01 10.0.0.2 c1 *\n1700000000 00:16:3e:00:00:02 10.0.0.3 c2 *\n1700000000 00:16:3e:00:00:03 10.0.0.4 c1 *\n"), 0600)
+	require.NoError(t, err)
+
+	leases := newDNSLeases(path)
+	leases.watched.Store(true)
+
+	// The first lease of a hostname wins.
+	ip, err := leases.lookup("c1", false)
+	require.NoError(t, err)
+	require.Equal(t, "10.0.0.2", ip)
+
+	host, err := leases.lookup("10.0.0.3", true)
+	require.NoError(t, err)
+	require.Equal(t, "c2", host)
+
+	// Changes are only picked up once the file is reported as modified.
+	err = os.WriteFile(path, []byte("1700000000 00:16:3e:00:00:04 10.0.0.5 c3 *\n"), 0600)
+	require.NoError(t, err)
+
+	ip, err = leases.lookup("c3", false)
+	require.NoError(t, err)
+	require.Equal(t, "", ip)
+
+	leases.invalidate()
+	ip, err = leases.lookup("c3", false)
+	require.NoError(t, err)
+	require.Equal(t, "10.0.0.5", ip)
+
+	ip, err = leases.lookup("c1", false)
+	require.NoError(t, err)
+	require.Equal(t, "", ip)
+}
+
+func TestDNSCache(t *testing.T) {
+	cache := newDNSCache()
+
+	request := func(id uint16) *dns.Msg {
+		r := &dns.Msg{}
+		r.SetQuestion("C1.lxd.", dns.TypeA)
+		r.Id = id
+		return r
+	}
+
+	answer := func(ttl uint32) *dns.Msg {
+		msg := &dns.Msg{}
+		msg.Answer = append(msg.Answer, &dns.A{Hdr: dns.RR_Header{Name: "c1.lxd.", Rrtype: dns.TypeA, Class: dns.ClassINET, Ttl: ttl}})
+		return msg
+	}
+
+	queries := 0
+
+	// Responses are cached, whatever the case of the question.
+	cache.relay(request(2), func() (*dns.Msg, bool) { queries++; return answer(60), true })
+	msg, ok := cache.relay(request(3), func() (*dns.Msg, bool) { queries++; return nil, false })
+	require.True(t, ok)
+	require.Equal(t, uint16(3), msg.Id)
+	require.Equal(t, 1, queries)
+
+	// Failed relays aren't cached.
+	other := &dns.Msg{}
+	other.SetQuestion("c2.lxd.", dns.TypeA)
+	_, ok = cache.relay(other, func() (*dns.Msg, bool) { queries++; return nil, false })
+	require.False(t, ok)
+	require.Equal(t, 2, queries)
+}
+
+func TestDNSCachePeerAnswers(t *testing.T) {
+	zeroTTL := dnsCacheZeroTTL
+	dnsCacheZeroTTL = 100 * time.Millisecond
+	defer func() { dnsCacheZeroTTL = zeroTTL }()
+
+	path := filepath.Join(t.TempDir(), "dnsmasq.leases")
+	err := os.WriteFile(path, []byte("1700000000 00:16:3e:00:00:01 10.0.0.2 c1 *\n"), 0600)
+	require.NoError(t, err)
+
+	// The peer answering the relayed questions from its leases.
+	peer := &dnsHandler{domain: "lxd", leases: newDNSLeases(path), cache: newDNSCache()}
+
+	tests := []struct {
+		name   string
+		qtype  uint16
+		qname  string
+		lookup func(h *dnsHandler, r *dns.Msg) (dns.Msg, error)
+	}{
+		{name: "A", qtype: dns.TypeA, qname: "c1.lxd.", lookup: (*dnsHandler).handleA},
+		{name: "PTR", qtype: dns.TypePTR, qname: "2.0.0.10.in-addr.arpa.", lookup: (*dnsHandler).handlePTR},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			cache := newDNSCache()
+			queries := 0
+
+			query := func() (*dns.Msg, bool) {
+				queries++
+
+				req := &dns.Msg{}
+				req.SetQuestion(tt.qname, tt.qtype)
+				req.RecursionDesired = false
+
+				resp, err := tt.lookup(peer, req)
+				require.NoError(t, err)
+				require.NotEmpty(t, resp.Answer)
+				require.Equal(t, uint32(0), resp.Answer[0].Header().Ttl)
+
+				return &resp, true
+			}
+
+			r := &dns.Msg{}
+			r.SetQuestion(tt.qname, tt.qtype)
+
+			// The zero TTL answers of the peer are cached for a little while.
+			for i := 0; i < 2; i++ {
+				msg, ok := cache.relay(r, query)
+				require.True(t, ok)
+				require.Equal(t, r.Id, msg.Id)
+				require.Equal(t, uint32(0), msg.Answer[0].Header().Ttl)
+			}
+
+			require.Equal(t, 1, queries)
+
+			time.Sleep(2 * dnsCacheZeroTTL)
+
+			_, ok := cache.relay(r, query)
+			require.True(t, ok)
+			require.Equal(t, 2, queries)
+		})
+	}
+}
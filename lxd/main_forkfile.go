@@ -149,6 +149,9 @@ func (c *cmdForkfile) Run(cmd *cobra.Command, args []string) error {
 		return err
 	}
 
+	// Sessions which modified the filesystem share the syncs.
+	syncer := newFSSyncer(rootfsFD)
+
 	// Automatically shutdown after inactivity.
 	go func() {
 		for {
@@ -229,15 +232,18 @@ func (c *cmdForkfile) Run(cmd *cobra.Command, args []string) error {
 			mu.Unlock()
 
 			// Spawn the server.
-			server, err := sftp.NewServer(conn)
+			tracker := newSFTPWriteTracker(conn)
+			server, err := sftp.NewServer(tracker)
 			if err != nil {
 				return
 			}
 
 			_ = server.Serve()
 
-			// Sync the filesystem.
-			_ = unix.Syncfs(int(rootfsFD))
+			// Sync the filesystem if the session may have modified it.
+			if tracker.dirty {
+				syncer.sync()
+			}
 		}(conn)
 	}
 }
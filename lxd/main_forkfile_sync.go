@@ -0,0 +1,173 @@
+package main
+
+import (
+	"encoding/binary"
+	"io"
+	"sync"
+
+	"golang.org/x/sys/unix"
+)
+
+// SFTP request types which may modify the filesystem, extended requests included (posix-rename,
+// hardlink and fsync).
+var sftpModifyingPackets = map[byte]bool{
+	6:   true, // SSH_FXP_WRITE
+	9:   true, // SSH_FXP_SETSTAT
+	10:  true, // SSH_FXP_FSETSTAT
+	13:  true, // SSH_FXP_REMOVE
+	14:  true, // SSH_FXP_MKDIR
+	15:  true, // SSH_FXP_RMDIR
+	18:  true, // SSH_FXP_RENAME
+	20:  true, // SSH_FXP_SYMLINK
+	200: true, // SSH_FXP_EXTENDED
+}
+
+const (
+	// sftpPacketOpen is SSH_FXP_OPEN, which only modifies the filesystem depending on its flags.
+	sftpPacketOpen = 3
+
+	// sftpOpenModifyingFlags are SSH_FXF_WRITE, SSH_FXF_APPEND, SSH_FXF_CREAT and SSH_FXF_TRUNC.
+	sftpOpenModifyingFlags = 0x02 | 0x04 | 0x08 | 0x10
+
+	// sftpOpenMaxPath is the longest path of an open request which gets looked at, the session
+	// is considered as modifying the filesystem beyond that.
+	sftpOpenMaxPath = 4096
+)
+
+// sftpWriteTracker looks at the SFTP requests read from a connection to tell whether the session
+// may have modified the filesystem. It only keeps the start of each request, up to the flags of the
+// open requests, and skips over the rest of it.
+type sftpWriteTracker struct {
+	io.ReadWriteCloser
+
+	// Whether a request which may modify the filesystem was seen.
+	dirty bool
+
+	// Start of the current request and the size it's collected up to.
+	buf  []byte
+	want int
+
+	// Number of bytes of the current request left to skip.
+	skip int
+}
+
+func newSFTPWriteTracker(conn io.ReadWriteCloser) *sftpWriteTracker {
+	return &sftpWriteTracker{ReadWriteCloser: conn, want: 5}
+}
+
+// Read reads from the connection, looking at the requests.
+func (t *sftpWriteTracker) Read(p []byte) (int, error) {
+	n, err := t.ReadWriteCloser.Read(p)
+	t.feed(p[:n])
+
+	return n, err
+}
+
+func (t *sftpWriteTracker) feed(b []byte) {
+	for len(b) > 0 && !t.dirty {
+		if t.skip > 0 {
+			n := min(t.skip, len(b))
+			t.skip -= n
+			b = b[n:]
+			continue
+		}
+
+		n := min(t.want-len(t.buf), len(b))
+		t.buf = append(t.buf, b[:n]...)
+		b = b[n:]
+
+		if len(t.buf) < t.want {
+			return
+		}
+
+		t.dirty = t.next()
+	}
+}
+
+// next handles the collected start of a request, it returns true if the request may modify the
+// filesystem or can't be understood.
+func (t *sftpWriteTracker) next() bool {
+	// The size of a request doesn't include its length field.
+	size := int(binary.BigEndian.Uint32(t.buf)) + 4
+	if size < 5 {
+		return true
+	}
+
+	if sftpModifyingPackets[t.buf[4]] {
+		return true
+	}
+
+	if t.buf[4] == sftpPacketOpen && t.want < 13 {
+		// Collect the request ID and the length of the path.
+		t.want = 13
+		return t.want > size
+	}
+
+	if t.buf[4] == sftpPacketOpen && t.want == 13 {
+		// Collect the path and the flags.
+		pathLen := int(binary.BigEndian.Uint32(t.buf[9:]))
+		if pathLen > sftpOpenMaxPath {
+			return true
+		}
+
+		t.want = 13 + pathLen + 4
+		return t.want > size
+	}
+
+	if t.buf[4] == sftpPacketOpen && binary.BigEndian.Uint32(t.buf[t.want-4:])&sftpOpenModifyingFlags != 0 {
+		return true
+	}
+
+	// Skip the rest of the request.
+	t.skip = size - len(t.buf)
+	t.buf = t.buf[:0]
+	t.want = 5
+
+	return false
+}
+
+// fsSyncer coalesces the syncfs calls of concurrent sessions. A caller waits for a sync which
+// started after it asked for one, so that its own changes are covered, but shares it with the
+// other callers waiting at the same time.
+type fsSyncer struct {
+	fd int
+
+	mu        sync.Mutex
+	cond      *sync.Cond
+	running   bool
+	started   uint64
+	completed uint64
+}
+
+func newFSSyncer(fd int) *fsSyncer {
+	s := &fsSyncer{fd: fd}
+	s.cond = sync.NewCond(&s.mu)
+
+	return s
+}
+
+// sync syncs the filesystem.
+func (s *fsSyncer) sync() {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	target := s.started + 1
+	for s.completed < target {
+		if s.running {
+			s.cond.Wait()
+			continue
+		}
+
+		s.running = true
+		s.started++
+		generation := s.started
+		s.mu.Unlock()
+
+		_ = unix.Syncfs(s.fd)
+
+		s.mu.Lock()
+		s.running = false
+		s.completed = generation
+		s.cond.Broadcast()
+	}
+}
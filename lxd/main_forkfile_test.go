@@ -0,0 +1,53 @@
+package main
+
+import (
+	"encoding/binary"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+)
+
+// sftpTestPacket builds an SFTP request of the given type with a request ID and the given fields.
+func sftpTestPacket(packetType byte, fields ...any) []byte {
+	body := []byte{packetType, 0, 0, 0, 1}
+	for _, field := range fields {
+		switch v := field.(type) {
+		case string:
+			body = binary.BigEndian.AppendUint32(body, uint32(len(v)))
+			body = append(body, v...)
+		case uint32:
+			body = binary.BigEndian.AppendUint32(body, v)
+		}
+	}
+
+	return append(binary.BigEndian.AppendUint32(nil, uint32(len(body))), body...)
+}
+
+func TestSFTPWriteTracker(t *testing.T) {
+	readOnly := append(sftpTestPacket(7, "/etc/hostname"), sftpTestPacket(3, "/etc/hostname", uint32(0x01), uint32(0))...)
+	readOnly = append(readOnly, sftpTestPacket(5, "handle", uint32(0), uint32(0), uint32(32768))...)
+
+	tests := []struct {
+		name  string
+		data  []byte
+		dirty bool
+	}{
+		{"Read only", readOnly, false},
+		{"Open for writing", append(readOnly, sftpTestPacket(3, "/etc/hostname", uint32(0x1a), uint32(0))...), true},
+		{"Write", append(readOnly, sftpTestPacket(6, "handle", uint32(0), uint32(0), "data")...), true},
+		{"Mkdir", sftpTestPacket(14, "/root/dir", uint32(0)), true},
+		{"Truncated length", []byte{0, 0, 0, 0, 7}, true},
+	}
+
+	for _, test := range tests {
+		// Feed the data at once and a byte at a time.
+		for _, chunk := range []int{len(test.data), 1} {
+			tracker := newSFTPWriteTracker(nil)
+			for i := 0; i < len(test.data); i += chunk {
+				tracker.feed(test.data[i:min(i+chunk, len(test.data))])
+			}
+
+			require.Equal(t, test.dirty, tracker.dirty, test.name)
+		}
+	}
+}
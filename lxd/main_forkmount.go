@@ -16,6 +16,7 @@ package main
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -241,80 +242,6 @@ static void do_lxd_forkmount(int pidfd, int ns_fd)
 	_exit(0);
 }
 
-static int lxc_safe_uint(const char *numstr, unsigned int *converted)
-{
-	char *err = NULL;
-	unsigned long int uli;
-
-	while (isspace(*numstr))
-		numstr++;
-
-	if (*numstr == '-')
-		return -EINVAL;
-
-	errno = 0;
-	uli = strtoul(numstr, &err, 0);
-	if (errno == ERANGE && uli == ULONG_MAX)
-		return -ERANGE;
-
-	if (err == numstr || *err != '\0')
-		return -EINVAL;
-
-	if (uli > UINT_MAX)
-		return -ERANGE;
-
-	*converted = (unsigned int)uli;
-	return 0;
-}
-
-static int mnt_attributes_new(unsigned int old_flags, unsigned int *new_flags)
-{
-	unsigned int flags = 0;
-
-	if (old_flags & MS_RDONLY) {
-		flags |= MOUNT_ATTR_RDONLY;
-		old_flags &= ~MS_RDONLY;
-	}
-
-	if (old_flags & MS_NOSUID) {
-		flags |= MOUNT_ATTR_NOSUID;
-		old_flags &= ~MS_NOSUID;
-	}
-
-	if (old_flags & MS_NODEV) {
-		flags |= MOUNT_ATTR_NODEV;
-		old_flags &= ~MS_NODEV;
-	}
-
-	if (old_flags & MS_NOEXEC) {
-		flags |= MOUNT_ATTR_NOEXEC;
-		old_flags &= ~MS_NOEXEC;
-	}
-
-	if (old_flags & MS_RELATIME) {
-		flags |= MOUNT_ATTR_RELATIME;
-		old_flags &= ~MS_RELATIME;
-	}
-
-	if (old_flags & MS_NOATIME) {
-		flags |= MOUNT_ATTR_NOATIME;
-		old_flags &= ~MS_NOATIME;
-	}
-
-	if (old_flags & MS_STRICTATIME) {
-		flags |= MOUNT_ATTR_STRICTATIME;
-		old_flags &= ~MS_STRICTATIME;
-	}
-
-	if (old_flags & MS_NODIRATIME) {
-		flags |= MOUNT_ATTR_NODIRATIME;
-		old_flags &= ~MS_NODIRATIME;
-	}
-
-	*new_flags |= flags;
-	return old_flags;
-}
-
 static int make_final_open(struct stat *st_src, const char *dest)
 {
 	int ret;
@@ -366,77 +293,104 @@ static int make_dest_open(int fd_src, const char *dest)
 	return make_final_open(&st_src, dest);
 }
 
-static void do_move_forkmount(int pidfd, int ns_fd)
-{
-	__do_close int fs_fd = -EBADF, mnt_fd = -EBADF, fd_userns = -EBADF,
-		       dest_fd = -EBADF;
-	int ret;
-	char *fstype, *src, *dest, *idmapType, *flags;
-	unsigned int old_mntflags = 0, new_mntflags = 0;
-
-	fstype = advance_arg(true);
-	src = advance_arg(true);
-	dest = advance_arg(true);
-	idmapType = advance_arg(true);
-	flags = advance_arg(true);
-
-	ret = lxc_safe_uint(flags, &old_mntflags);
-	if (ret < 0)
-		die("parse mount flags");
+// Limits of a single move-mounts message, they must match the ones of the daemon.
+#define FORKMOUNT_MOVE_MAX_FDS 64
+#define FORKMOUNT_MOVE_MAX_DATA 65536
 
-	mnt_attributes_new(old_mntflags, &new_mntflags);
-
-	if (strcmp(fstype, "") && strcmp(fstype, "none")) {
-		fs_fd = lxd_fsopen(fstype, FSOPEN_CLOEXEC);
-		if (fs_fd < 0)
-			die("fsopen: %s", fstype);
+// forkmount_move_recv receives a batch of detached mounts along with the NUL-terminated
+// destinations they must be moved to. It returns the number of mounts, 0 once the daemon
+// closed its side of the socket, or -1 on error.
+static int forkmount_move_recv(int sock, int *fds, char **dests, char *buf)
+{
+	char cmsgbuf[CMSG_SPACE(FORKMOUNT_MOVE_MAX_FDS * sizeof(int))] = {};
+	struct iovec iov = {
+		.iov_base	= buf,
+		.iov_len	= FORKMOUNT_MOVE_MAX_DATA,
+	};
+	struct msghdr msg = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= cmsgbuf,
+		.msg_controllen	= sizeof(cmsgbuf),
+	};
+	struct cmsghdr *cmsg;
+	int nr_fds = 0, nr_dests = 0;
+	ssize_t ret;
 
-		ret = lxd_fsconfig(fs_fd, FSCONFIG_SET_STRING, "source", src, 0);
-		if (ret < 0)
-			die("fsconfig: source");
+	do {
+		ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0)
+		return ret;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		nr_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+	if (nr_fds > 0)
+		memcpy(fds, CMSG_DATA(cmsg), nr_fds * sizeof(int));
+
+	// Each destination is NUL-terminated, there must be one per mount.
+	for (ssize_t off = 0; off < ret && nr_dests < FORKMOUNT_MOVE_MAX_FDS; nr_dests++) {
+		char *end = memchr(buf + off, '\0', ret - off);
+		if (!end)
+			break;
+
+		dests[nr_dests] = buf + off;
+		off = end - buf + 1;
+	}
 
-		ret = lxd_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0);
-		if (ret < 0)
-			die("fsconfig: create");
+	if (nr_fds == 0 || nr_dests != nr_fds || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		for (int i = 0; i < nr_fds; i++)
+			close(fds[i]);
 
-		mnt_fd = lxd_fsmount(fs_fd, FSMOUNT_CLOEXEC, new_mntflags);
-		if (mnt_fd < 0)
-			die("fsmount");
-	} else {
-		mnt_fd = lxd_open_tree(-EBADF, src, OPEN_TREE_CLOEXEC | OPEN_TREE_CLONE);
-		if (mnt_fd < 0)
-			die("open_tree");
+		errno = EBADMSG;
+		return -1;
 	}
 
-	fd_userns = preserve_ns(-ESRCH, ns_fd, "user");
-	if (fd_userns < 0)
-		die("preserve userns");
+	return nr_fds;
+}
 
-	if (strcmp(idmapType, "idmapped") == 0) {
-		struct lxc_mount_attr attr = {
-			.attr_set	= MOUNT_ATTR_IDMAP,
-			.userns_fd	= fd_userns,
+// do_move_forkmounts moves all the detached mounts the daemon sends over the socket into the
+// container, so that a single helper handles any number of mounts.
+static void do_move_forkmounts(int pidfd, int ns_fd, int sock)
+{
+	__do_free char *buf = NULL;
+	int fds[FORKMOUNT_MOVE_MAX_FDS];
+	char *dests[FORKMOUNT_MOVE_MAX_FDS];
+	int nr_fds;
 
-		};
-
-		ret = lxd_mount_setattr(mnt_fd, "", AT_EMPTY_PATH, &attr, sizeof(attr));
-		if (ret)
-			die("idmap mount");
-	}
+	buf = malloc(FORKMOUNT_MOVE_MAX_DATA);
+	if (!buf)
+		die("Failed to allocate receive buffer");
 
 	attach_userns_fd(ns_fd);
 
 	if (!change_namespaces(pidfd, ns_fd, CLONE_NEWNS))
 		die("Failed setns to container mount namespace");
 
-	dest_fd = make_dest_open(mnt_fd, dest);
-	if (dest_fd < 0)
-		die("Failed to create destination mount point");
+	for (;;) {
+		nr_fds = forkmount_move_recv(sock, fds, dests, buf);
+		if (nr_fds < 0)
+			die("Failed to receive detached mounts");
 
-	ret = lxd_move_mount(mnt_fd, "", dest_fd, "",
-			     MOVE_MOUNT_F_EMPTY_PATH | MOVE_MOUNT_T_EMPTY_PATH);
-	if (ret)
-		die("Failed to move detached mount to target from %d to %s", mnt_fd, dest);
+		if (nr_fds == 0)
+			break;
+
+		for (int i = 0; i < nr_fds; i++) {
+			__do_close int mnt_fd = fds[i], dest_fd = -EBADF;
+			int ret;
+
+			dest_fd = make_dest_open(mnt_fd, dests[i]);
+			if (dest_fd < 0)
+				die("Failed to create destination mount point %s", dests[i]);
+
+			ret = lxd_move_mount(mnt_fd, "", dest_fd, "",
+					     MOVE_MOUNT_F_EMPTY_PATH | MOVE_MOUNT_T_EMPTY_PATH);
+			if (ret)
+				die("Failed to move detached mount to target from %d to %s", mnt_fd, dests[i]);
+		}
+	}
 
 	_exit(EXIT_SUCCESS);
 }
@@ -589,7 +543,9 @@ void forkmount(void)
 		do_lxd_forkmount(pidfd, ns_fd);
 	} else if (strcmp(command, "lxc-mount") == 0) {
 		do_lxc_forkmount();
-	} else if (strcmp(command, "move-mount") == 0) {
+	} else if (strcmp(command, "move-mounts") == 0) {
+		int sock;
+
 		// Get the pid
 		cur = advance_arg(false);
 		if (cur == NULL || (strcmp(cur, "--help") == 0 || strcmp(cur, "--version") == 0 || strcmp(cur, "-h") == 0))
@@ -604,7 +560,11 @@ void forkmount(void)
 		if (ns_fd < 0)
 			_exit(EXIT_FAILURE);
 
-		do_move_forkmount(pidfd, ns_fd);
+		sock = atoi(advance_arg(true));
+		if (sock < 0)
+			_exit(EXIT_FAILURE);
+
+		do_move_forkmounts(pidfd, ns_fd, sock);
 	} else if (strcmp(command, "lxd-umount") == 0) {
 		// Get the pid
 		cur = advance_arg(false);
@@ -689,3 +649,30 @@ func (c *cmdForkmount) Command() *cobra.Command {
 func (c *cmdForkmount) Run(cmd *cobra.Command, args []string) error {
 	return fmt.Errorf("This command should have been intercepted in cgo")
 }
+
+// forkmountMoveMaxFds is the largest number of detached mounts in a single move-mounts message.
+const forkmountMoveMaxFds = C.FORKMOUNT_MOVE_MAX_FDS
+
+// forkmountMoveRecv receives a batch of detached mounts and their destinations like the
+// move-mounts helper does.
+func forkmountMoveRecv(sock int) ([]int, []string, error) {
+	buf := C.malloc(C.FORKMOUNT_MOVE_MAX_DATA)
+	defer C.free(buf)
+
+	var fds [C.FORKMOUNT_MOVE_MAX_FDS]C.int
+	var dests [C.FORKMOUNT_MOVE_MAX_FDS]*C.char
+
+	n, err := C.forkmount_move_recv(C.int(sock), &fds[0], &dests[0], (*C.char)(buf))
+	if n < 0 {
+		return nil, nil, err
+	}
+
+	mntFds := make([]int, 0, n)
+	targets := make([]string, 0, n)
+	for i := 0; i < int(n); i++ {
+		mntFds = append(mntFds, int(fds[i]))
+		targets = append(targets, C.GoString(dests[i]))
+	}
+
+	return mntFds, targets, nil
+}
@@ -0,0 +1,100 @@
+package main
+
+import (
+	"os"
+	"testing"
+
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/shared/netutils"
+)
+
+// openFds returns the number of open file descriptors of the process.
+func openFds(t *testing.T) int {
+	entries, err := os.ReadDir("/proc/self/fd")
+	require.NoError(t, err)
+
+	return len(entries)
+}
+
+// testMountFds returns file descriptors standing in for detached mounts.
+func testMountFds(t *testing.T, n int) []int {
+	fds := make([]int, n)
+	for i := range fds {
+		fd, err := unix.Open("/", unix.O_PATH|unix.O_CLOEXEC, 0)
+		require.NoError(t, err)
+
+		fds[i] = fd
+		t.Cleanup(func() { _ = unix.Close(fd) })
+	}
+
+	return fds
+}
+
+func TestForkmountMoveRecv(t *testing.T) {
+	sockets, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	require.NoError(t, err)
+
+	defer func() { _ = unix.Close(sockets[0]) }()
+	defer func() { _ = unix.Close(sockets[1]) }()
+
+	// A batch of mounts with one destination each.
+	err = netutils.AbstractUnixSendFds(sockets[0], testMountFds(t, 3), []byte("/a\x00/b/c\x00/d\x00"))
+	require.NoError(t, err)
+
+	fds, targets, err := forkmountMoveRecv(sockets[1])
+	require.NoError(t, err)
+	require.Len(t, fds, 3)
+	require.Equal(t, []string{"/a", "/b/c", "/d"}, targets)
+
+	for _, fd := range fds {
+		require.NoError(t, unix.Close(fd))
+	}
+
+	// Invalid messages are refused without leaking the mounts they carry.
+	invalid := []struct {
+		name string
+		fds  int
+		data string
+	}{
+		{"Fewer destinations than mounts", 2, "/a\x00"},
+		{"More destinations than mounts", 1, "/a\x00/b\x00"},
+		{"Unterminated destination", 1, "/a"},
+		{"Too many mounts", forkmountMoveMaxFds + 1, ""},
+	}
+
+	for _, tt := range invalid {
+		data := []byte(tt.data)
+		if tt.fds > forkmountMoveMaxFds {
+			for i := 0; i < tt.fds; i++ {
+				data = append(data, "/a\x00"...)
+			}
+		}
+
+		mntFds := testMountFds(t, tt.fds)
+		before := openFds(t)
+
+		err = netutils.AbstractUnixSendFds(sockets[0], mntFds, data)
+		require.NoError(t, err, tt.name)
+
+		_, _, err = forkmountMoveRecv(sockets[1])
+		require.ErrorIs(t, err, unix.EBADMSG, tt.name)
+		require.Equal(t, before, openFds(t), tt.name)
+	}
+
+	// Messages without mounts are refused too.
+	_, err = unix.Write(sockets[0], []byte("/a\x00"))
+	require.NoError(t, err)
+
+	_, _, err = forkmountMoveRecv(sockets[1])
+	require.ErrorIs(t, err, unix.EBADMSG)
+
+	// The end of the mounts is signaled by shutting down the socket.
+	require.NoError(t, unix.Shutdown(sockets[0], unix.SHUT_WR))
+
+	fds, targets, err = forkmountMoveRecv(sockets[1])
+	require.NoError(t, err)
+	require.Empty(t, fds)
+	require.Empty(t, targets)
+}
@@ -241,14 +241,16 @@ void forkproxy(void)
 import "C"
 
 import (
+	"context"
 	"fmt"
 	"io"
 	"net"
 	"os"
 	"os/signal"
+	"runtime"
 	"strconv"
 	"strings"
-	"sync"
+	"syscall"
 	"time"
 	"unsafe"
 
@@ -269,22 +271,11 @@ type cmdForkproxy struct {
 	global *cmdGlobal
 }
 
-// UDP session tracking (map "client tuple" to udp session)
-var udpSessions = map[string]*udpSession{}
-var udpSessionsLock sync.Mutex
-
-type udpSession struct {
-	client    net.Addr
-	target    net.Conn
-	timer     *time.Timer
-	timerLock sync.Mutex
-}
-
 // Command setup network connection proxying.
 func (c *cmdForkproxy) Command() *cobra.Command {
 	// Main subcommand
 	cmd := &cobra.Command{}
-	cmd.Use = "forkproxy <listen PID> <listen PidFd> <listen address> <connect PID> <connect PidFd> <connect address> <log path> <pid path> <listen gid> <listen uid> <listen mode> <security gid> <security uid>"
+	cmd.Use = "forkproxy <listen PID> <listen PidFd> <listen address> <connect PID> <connect PidFd> <connect address> <log path> <pid path> <listen gid> <listen uid> <listen mode> <security gid> <security uid> <proxy protocol> <listeners> <cpu steering>"
 	cmd.Short = "Setup network connection proxying"
 	cmd.Long = `Description:
   Setup network connection proxying
@@ -293,7 +284,7 @@ func (c *cmdForkproxy) Command() *cobra.Command {
   container, connecting one side to the host and the other to the
   container.
 `
-	cmd.Args = cobra.ExactArgs(12)
+	cmd.Args = cobra.ExactArgs(14)
 	cmd.RunE = c.Run
 	cmd.Hidden = true
 
@@ -333,14 +324,27 @@ func listenerInstance(epFd C.int, lAddr *deviceConfig.ProxyAddress, cAddr *devic
 				return
 			}
 
-			dstConn, err := net.Dial(cAddr.ConnType, connectAddr)
+			defer func() { _ = srcConn.Close() }()
+
+			listener, ok := srcConn.(*net.UDPConn)
+			if !ok {
+				fmt.Println("Warning: UDP listener isn't a UDP socket")
+				rearmUDPFd(epFd, connFd)
+				return
+			}
+
+			target, err := net.ResolveUDPAddr(cAddr.ConnType, connectAddr)
 			if err != nil {
-				fmt.Printf("Warning: Failed to connect to target: %v\n", err)
+				fmt.Printf("Warning: Failed to resolve target: %v\n", err)
 				rearmUDPFd(epFd, connFd)
 				return
 			}
 
-			genericRelay(srcConn, dstConn)
+			err = relayUDP(listener, target)
+			if daemon.Debug && err != nil {
+				fmt.Printf("Warning: Error while relaying UDP: %v\n", err)
+			}
+
 			rearmUDPFd(epFd, connFd)
 		}()
 
@@ -412,7 +416,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 	}
 
 	// Quick checks.
-	if len(args) != 12 {
+	if len(args) != 14 {
 		_ = cmd.Help()
 
 		if len(args) == 0 {
@@ -450,6 +454,16 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 		}
 	}
 
+	listeners := 1
+	if lAddr.ConnType != "unix" && args[12] != "" {
+		listeners, err = strconv.Atoi(args[12])
+		if err != nil || listeners < 1 {
+			return fmt.Errorf("Invalid number of listeners %q", args[12])
+		}
+	}
+
+	cpuSteering := listeners > 1 && shared.IsTrue(args[13])
+
 	if C.whoami == C.FORKPROXY_CHILD {
 		defer func() { _ = unix.Close(forkproxyUDSSockFDNum) }()
 
@@ -472,24 +486,35 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 			}
 		}
 
+	send:
 		for _, listenAddress := range listenAddresses {
-			file, err := getListenerFile(lAddr.ConnType, listenAddress)
-			if err != nil {
-				return err
-			}
+			for i := 0; i < listeners; i++ {
+				file, err := getListenerFile(lAddr.ConnType, listenAddress, listeners > 1)
+				if err != nil {
+					return err
+				}
 
-		sAgain:
-			err = netutils.AbstractUnixSendFd(forkproxyUDSSockFDNum, int(file.Fd()))
-			if err != nil {
-				errno, ok := shared.GetErrno(err)
-				if ok && (errno == unix.EAGAIN) {
-					goto sAgain
+				// Attaching the program to one socket applies it to the whole reuseport group.
+				if i == 0 && cpuSteering {
+					err = attachReuseportCPUSteering(file, listeners)
+					if err != nil {
+						return err
+					}
 				}
 
-				break
-			}
+			sAgain:
+				err = netutils.AbstractUnixSendFd(forkproxyUDSSockFDNum, int(file.Fd()))
+				if err != nil {
+					errno, ok := shared.GetErrno(err)
+					if ok && (errno == unix.EAGAIN) {
+						goto sAgain
+					}
 
-			_ = file.Close()
+					break send
+				}
+
+				_ = file.Close()
+			}
 		}
 
 		if lAddr.ConnType == "unix" && !lAddr.Abstract {
@@ -538,7 +563,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 
 	addrRecvCount := 1
 	if lAddr.ConnType != "unix" {
-		addrRecvCount = len(lAddr.Ports)
+		addrRecvCount = len(lAddr.Ports) * listeners
 	}
 
 	files := []*os.File{}
@@ -575,7 +600,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 		for i, f := range files {
 			listenerMap[int(f.Fd())] = &lStruct{
 				f:          f,
-				lAddrIndex: i,
+				lAddrIndex: i / listeners,
 			}
 		}
 	} else {
@@ -588,7 +613,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 
 			listenerMap[int(f.Fd())] = &lStruct{
 				lConn:      &listener,
-				lAddrIndex: i,
+				lAddrIndex: i / listeners,
 			}
 		}
 	}
@@ -625,21 +650,27 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 		defer func() { _ = os.Remove(lAddr.Address) }()
 	}
 
-	epFd := C.epoll_create1(C.EPOLL_CLOEXEC)
-	if epFd < 0 {
-		return fmt.Errorf("Failed to create new epoll instance")
+	// Each listener of an address gets its own epoll loop so they can be served in parallel.
+	epFds := make([]C.int, listeners)
+	for i := range epFds {
+		epFds[i] = C.epoll_create1(C.EPOLL_CLOEXEC)
+		if epFds[i] < 0 {
+			return fmt.Errorf("Failed to create new epoll instance")
+		}
 	}
 
 	// Wait for SIGTERM and close the listener in order to exit the loop below
 	self := unix.Getpid()
 	go func() {
 		<-sigs
-		for _, f := range files {
-			C.epoll_ctl(epFd, C.EPOLL_CTL_DEL, C.int(f.Fd()), nil)
+		for i, f := range files {
+			C.epoll_ctl(epFds[i%listeners], C.EPOLL_CTL_DEL, C.int(f.Fd()), nil)
 			_ = f.Close()
 		}
 
-		_ = unix.Close(int(epFd))
+		for _, epFd := range epFds {
+			_ = unix.Close(int(epFd))
+		}
 
 		if !isUDPListener {
 			for _, l := range listenerMap {
@@ -652,7 +683,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 	}()
 	defer func() { _ = unix.Kill(self, unix.SIGTERM) }()
 
-	for _, f := range files {
+	for i, f := range files {
 		var ev C.struct_epoll_event
 		ev.events = C.EPOLLIN
 		if isUDPListener {
@@ -660,7 +691,7 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 		}
 
 		*(*C.int)(unsafe.Pointer(&ev.data)) = C.int(f.Fd())
-		ret := C.epoll_ctl(epFd, C.EPOLL_CTL_ADD, C.int(f.Fd()), &ev)
+		ret := C.epoll_ctl(epFds[i%listeners], C.EPOLL_CTL_ADD, C.int(f.Fd()), &ev)
 		if ret < 0 {
 			return fmt.Errorf("Error: Failed to add listener fd to epoll instance")
 		}
@@ -669,13 +700,44 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 	// This line is used by LXD to check forkproxy has started OK.
 	fmt.Println("Status: Started")
 
+	var cpus []int
+	if listeners > 1 {
+		cpus = allowedCPUs()
+	}
+
+	done := make(chan struct{}, listeners)
+	for i, epFd := range epFds {
+		go func(i int, epFd C.int) {
+			defer func() { done <- struct{}{} }()
+
+			if len(cpus) > 0 {
+				runtime.LockOSThread()
+
+				var set unix.CPUSet
+				set.Set(listenerCPU(cpus, i, listeners, cpuSteering))
+				_ = unix.SchedSetaffinity(0, &set)
+			}
+
+			proxyEpollLoop(epFd, listenerMap, lAddr, cAddr, args[11] == "true")
+		}(i, epFd)
+	}
+
+	// Stop once any of the loops failed.
+	<-done
+
+	fmt.Println("Status: Stopping proxy")
+	return nil
+}
+
+// proxyEpollLoop accepts new connections and datagrams on the listeners added to the epoll instance.
+func proxyEpollLoop(epFd C.int, listenerMap map[int]*lStruct, lAddr *deviceConfig.ProxyAddress, cAddr *deviceConfig.ProxyAddress, proxy bool) {
 	for {
 		var events [10]C.struct_epoll_event
 
 		nfds := C.lxc_epoll_wait_nointr(epFd, &events[0], 10, -1)
 		if nfds < 0 {
 			fmt.Println("Error: Failed to wait on epoll instance")
-			break
+			return
 		}
 
 		for i := C.int(0); i < nfds; i++ {
@@ -685,74 +747,92 @@ func (c *cmdForkproxy) Run(cmd *cobra.Command, args []string) error {
 				continue
 			}
 
-			err := listenerInstance(epFd, lAddr, cAddr, curFd, srcConn, args[11] == "true")
+			err := listenerInstance(epFd, lAddr, cAddr, curFd, srcConn, proxy)
 			if err != nil {
 				fmt.Printf("Warning: Failed to prepare new listener instance: %v\n", err)
 			}
 		}
 	}
+}
 
-	fmt.Println("Status: Stopping proxy")
-	return nil
+// allowedCPUs returns the CPUs the process is allowed to run on.
+func allowedCPUs() []int {
+	var set unix.CPUSet
+
+	err := unix.SchedGetaffinity(0, &set)
+	if err != nil {
+		return nil
+	}
+
+	cpus := []int{}
+	for cpu := 0; cpu < len(set)*64; cpu++ {
+		if set.IsSet(cpu) {
+			cpus = append(cpus, cpu)
+		}
+	}
+
+	return cpus
 }
 
-func proxyCopy(dst net.Conn, src net.Conn) error {
-	var err error
+// listenerCPU returns the CPU to pin the loop of the given listener to. With CPU steering the
+// listener gets what's received on the CPUs matching its index, so one of those is preferred.
+func listenerCPU(cpus []int, index int, listeners int, cpuSteering bool) int {
+	if cpuSteering {
+		for _, cpu := range cpus {
+			if cpu%listeners == index {
+				return cpu
+			}
+		}
+	}
 
-	// Attempt casting to UDP connections
-	srcUDP, srcIsUDP := src.(*net.UDPConn)
-	dstUDP, dstIsUDP := dst.(*net.UDPConn)
+	return cpus[index%len(cpus)]
+}
 
-	buf := make([]byte, 32*1024)
-	for {
-	rAgain:
-		var nr int
-		var er error
-
-		if srcIsUDP && srcUDP.RemoteAddr() == nil {
-			var addr net.Addr
-			nr, addr, er = srcUDP.ReadFrom(buf)
-			if er == nil {
-				// Look for existing UDP session
-				udpSessionsLock.Lock()
-				us, ok := udpSessions[addr.String()]
-				udpSessionsLock.Unlock()
-
-				if !ok {
-					dc, err := net.Dial(dst.RemoteAddr().Network(), dst.RemoteAddr().String())
-					if err != nil {
-						return err
-					}
+// attachReuseportCPUSteering attaches a classic BPF program to the reuseport group of the socket which
+// picks the socket of the group by the CPU that received the packet.
+func attachReuseportCPUSteering(file *os.File, listeners int) error {
+	cpuOffset := unix.SKF_AD_OFF + unix.SKF_AD_CPU
+
+	prog := []unix.SockFilter{
+		// A = current CPU
+		{Code: unix.BPF_LD | unix.BPF_W | unix.BPF_ABS, K: uint32(cpuOffset)},
+		// A = A % listeners
+		{Code: unix.BPF_ALU | unix.BPF_MOD | unix.BPF_K, K: uint32(listeners)},
+		// Return A as the index of the socket.
+		{Code: unix.BPF_RET | unix.BPF_A},
+	}
 
-					us = &udpSession{
-						client: addr,
-						target: dc,
-					}
+	fprog := unix.SockFprog{
+		Len:    uint16(len(prog)),
+		Filter: &prog[0],
+	}
 
-					udpSessionsLock.Lock()
-					udpSessions[addr.String()] = us
-					udpSessionsLock.Unlock()
+	err := unix.SetsockoptSockFprog(int(file.Fd()), unix.SOL_SOCKET, unix.SO_ATTACH_REUSEPORT_CBPF, &fprog)
+	if err != nil {
+		return fmt.Errorf("Failed to attach CPU steering program: %w", err)
+	}
 
-					go func() { _ = proxyCopy(src, dc) }()
-					us.timer = time.AfterFunc(30*time.Minute, func() {
-						_ = us.target.Close()
+	return nil
+}
 
-						udpSessionsLock.Lock()
-						delete(udpSessions, addr.String())
-						udpSessionsLock.Unlock()
-					})
-				}
+func proxyCopy(dst net.Conn, src net.Conn) error {
+	var err error
 
-				us.timerLock.Lock()
-				us.timer.Reset(30 * time.Minute)
-				us.timerLock.Unlock()
+	_, srcIsUDP := src.(*net.UDPConn)
+	_, dstIsUDP := dst.(*net.UDPConn)
 
-				dst = us.target
-				dstUDP, dstIsUDP = dst.(*net.UDPConn)
-			}
-		} else {
-			nr, er = src.Read(buf)
-		}
+	// Let the runtime relay stream connections, it uses splice(2) between TCP and unix stream
+	// sockets so the data doesn't get copied through userspace.
+	if !srcIsUDP && !dstIsUDP {
+		_, err = io.Copy(dst, src)
+		return err
+	}
+
+	// Connected UDP sockets, datagrams from unconnected listeners are handled by relayUDP.
+	buf := make([]byte, 32*1024)
+	for {
+	rAgain:
+		nr, er := src.Read(buf)
 
 		// keep retrying on EAGAIN
 		errno, ok := shared.GetErrno(er)
@@ -762,33 +842,7 @@ func proxyCopy(dst net.Conn, src net.Conn) error {
 
 		if nr > 0 {
 		wAgain:
-			var nw int
-			var ew error
-
-			if dstIsUDP && dstUDP.RemoteAddr() == nil {
-				var us *udpSession
-
-				udpSessionsLock.Lock()
-				for _, v := range udpSessions {
-					if v.target.LocalAddr() == src.LocalAddr() {
-						us = v
-						break
-					}
-				}
-				udpSessionsLock.Unlock()
-
-				if us == nil {
-					return fmt.Errorf("Connection expired")
-				}
-
-				us.timerLock.Lock()
-				us.timer.Reset(30 * time.Minute)
-				us.timerLock.Unlock()
-
-				nw, ew = dstUDP.WriteTo(buf[0:nr], us.client)
-			} else {
-				nw, ew = dst.Write(buf[0:nr])
-			}
+			nw, ew := dst.Write(buf[0:nr])
 
 			// keep retrying on EAGAIN
 			errno, ok := shared.GetErrno(ew)
@@ -806,6 +860,7 @@ func proxyCopy(dst net.Conn, src net.Conn) error {
 				break
 			}
 		}
+
 		if er != nil {
 			if er != io.EOF {
 				err = er
@@ -828,11 +883,7 @@ func genericRelay(dst net.Conn, src net.Conn) {
 	chRecv := make(chan error)
 
 	go relayer(src, dst, chRecv)
-
-	_, isUDP := dst.(*net.UDPConn)
-	if !isUDP {
-		go relayer(dst, src, chSend)
-	}
+	go relayer(dst, src, chSend)
 
 	select {
 	case errSnd := <-chSend:
@@ -850,9 +901,7 @@ func genericRelay(dst net.Conn, src net.Conn) {
 	_ = dst.Close()
 
 	// Empty the channels
-	if !isUDP {
-		<-chSend
-	}
+	<-chSend
 	<-chRecv
 }
 
@@ -947,12 +996,36 @@ func unixRelay(dst io.ReadWriteCloser, src io.ReadWriteCloser) {
 	<-chRecv
 }
 
-func tryListen(protocol string, addr string) (net.Listener, error) {
+// listenConfig returns the configuration for opening listeners, setting SO_REUSEPORT if requested.
+func listenConfig(reusePort bool) *net.ListenConfig {
+	lc := &net.ListenConfig{}
+	if !reusePort {
+		return lc
+	}
+
+	lc.Control = func(network string, address string, c syscall.RawConn) error {
+		var err error
+
+		cErr := c.Control(func(fd uintptr) {
+			err = unix.SetsockoptInt(int(fd), unix.SOL_SOCKET, unix.SO_REUSEPORT, 1)
+		})
+		if cErr != nil {
+			return cErr
+		}
+
+		return err
+	}
+
+	return lc
+}
+
+func tryListen(protocol string, addr string, reusePort bool) (net.Listener, error) {
 	var listener net.Listener
 	var err error
 
+	lc := listenConfig(reusePort)
 	for i := 0; i < 10; i++ {
-		listener, err = net.Listen(protocol, addr)
+		listener, err = lc.Listen(context.Background(), protocol, addr)
 		if err == nil {
 			break
 		}
@@ -967,7 +1040,7 @@ func tryListen(protocol string, addr string) (net.Listener, error) {
 	return listener, nil
 }
 
-func tryListenUDP(protocol string, addr string) (*os.File, error) {
+func tryListenUDP(protocol string, addr string, reusePort bool) (*os.File, error) {
 	var UDPConn *net.UDPConn
 	var err error
 
@@ -976,9 +1049,13 @@ func tryListenUDP(protocol string, addr string) (*os.File, error) {
 		return nil, err
 	}
 
+	lc := listenConfig(reusePort)
 	for i := 0; i < 10; i++ {
-		UDPConn, err = net.ListenUDP(protocol, udpAddr)
+		var conn net.PacketConn
+
+		conn, err = lc.ListenPacket(context.Background(), protocol, udpAddr.String())
 		if err == nil {
+			UDPConn = conn.(*net.UDPConn)
 			file, err := UDPConn.File()
 			_ = UDPConn.Close()
 			return file, err
@@ -1000,12 +1077,12 @@ func tryListenUDP(protocol string, addr string) (*os.File, error) {
 	return file, err
 }
 
-func getListenerFile(protocol string, addr string) (*os.File, error) {
+func getListenerFile(protocol string, addr string, reusePort bool) (*os.File, error) {
 	if protocol == "udp" {
-		return tryListenUDP("udp", addr)
+		return tryListenUDP("udp", addr, reusePort)
 	}
 
-	listener, err := tryListen(protocol, addr)
+	listener, err := tryListen(protocol, addr, reusePort)
 	if err != nil {
 		return nil, fmt.Errorf("Failed to listen on %s: %w", addr, err)
 	}
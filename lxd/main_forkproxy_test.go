@@ -1,10 +1,19 @@
 package main
 
 import (
+	"bytes"
+	"fmt"
+	"io"
 	"log"
+	"net"
+	"os"
+	"path/filepath"
+	"runtime"
 	"testing"
+	"time"
 
 	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
 
 	deviceConfig "github.com/canonical/lxd/lxd/device/config"
 	"github.com/canonical/lxd/lxd/network"
@@ -190,3 +199,281 @@ func TestParseAddr(t *testing.T) {
 		require.Equal(t, tt.expected, addr)
 	}
 }
+
+func TestGenericRelayStream(t *testing.T) {
+	dir := t.TempDir()
+	data := bytes.Repeat([]byte("0123456789abcdef"), 256*1024)
+
+	tests := []struct {
+		name    string
+		network string
+		address string
+	}{
+		{"TCP to TCP", "tcp", "127.0.0.1:0"},
+		{"TCP to unix", "unix", filepath.Join(dir, "target.sock")},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			target, err := net.Listen(tt.network, tt.address)
+			require.NoError(t, err)
+			defer func() { _ = target.Close() }()
+
+			received := make(chan []byte, 1)
+			go func() {
+				conn, err := target.Accept()
+				if err != nil {
+					received <- nil
+					return
+				}
+
+				defer func() { _ = conn.Close() }()
+
+				buf, _ := io.ReadAll(conn)
+				received <- buf
+			}()
+
+			listener, err := net.Listen("tcp", "127.0.0.1:0")
+			require.NoError(t, err)
+			defer func() { _ = listener.Close() }()
+
+			client, err := net.Dial("tcp", listener.Addr().String())
+			require.NoError(t, err)
+
+			srcConn, err := listener.Accept()
+			require.NoError(t, err)
+
+			dstConn, err := net.Dial(tt.network, target.Addr().String())
+			require.NoError(t, err)
+
+			relayed := make(chan struct{})
+			go func() {
+				genericRelay(srcConn, dstConn)
+				close(relayed)
+			}()
+
+			_, err = client.Write(data)
+			require.NoError(t, err)
+			require.NoError(t, client.Close())
+
+			require.Equal(t, data, <-received)
+			<-relayed
+		})
+	}
+}
+
+func TestRelayUDP(t *testing.T) {
+	// Echo server standing in for the target.
+	target, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	require.NoError(t, err)
+	defer func() { _ = target.Close() }()
+
+	go func() {
+		buf := make([]byte, 1500)
+		for {
+			n, addr, err := target.ReadFrom(buf)
+			if err != nil {
+				return
+			}
+
+			_, _ = target.WriteTo(buf[:n], addr)
+		}
+	}()
+
+	listener, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	require.NoError(t, err)
+
+	relayed := make(chan error, 1)
+	go func() {
+		relayed <- relayUDP(listener, target.LocalAddr().(*net.UDPAddr))
+	}()
+
+	clients := make([]*net.UDPConn, 4)
+	for i := range clients {
+		clients[i], err = net.DialUDP("udp", nil, listener.LocalAddr().(*net.UDPAddr))
+		require.NoError(t, err)
+		defer func(c *net.UDPConn) { _ = c.Close() }(clients[i])
+	}
+
+	buf := make([]byte, 1500)
+	for round := 0; round < 16; round++ {
+		for i, client := range clients {
+			msg := []byte(fmt.Sprintf("client %d round %d", i, round))
+			_, err = client.Write(msg)
+			require.NoError(t, err)
+
+			require.NoError(t, client.SetReadDeadline(time.Now().Add(5*time.Second)))
+			n, err := client.Read(buf)
+			require.NoError(t, err)
+			require.Equal(t, msg, buf[:n])
+		}
+	}
+
+	require.NoError(t, listener.Close())
+	require.Error(t, <-relayed)
+}
+
+func TestRelayUDPReplies(t *testing.T) {
+	// Target answering each datagram with more replies than fit in a batch, the first one empty.
+	replies := 3*udpBatchSize + 1
+
+	target, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	require.NoError(t, err)
+	defer func() { _ = target.Close() }()
+
+	require.NoError(t, target.SetReadBuffer(4*1024*1024))
+
+	go func() {
+		buf := make([]byte, 1500)
+		for {
+			_, addr, err := target.ReadFrom(buf)
+			if err != nil {
+				return
+			}
+
+			for i := 0; i < replies; i++ {
+				msg := []byte(fmt.Sprintf("reply %d", i))
+				if i == 0 {
+					msg = nil
+				}
+
+				_, _ = target.WriteTo(msg, addr)
+			}
+		}
+	}()
+
+	listener, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	require.NoError(t, err)
+
+	relayed := make(chan error, 1)
+	go func() {
+		relayed <- relayUDP(listener, target.LocalAddr().(*net.UDPAddr))
+	}()
+
+	client, err := net.DialUDP("udp", nil, listener.LocalAddr().(*net.UDPAddr))
+	require.NoError(t, err)
+	defer func() { _ = client.Close() }()
+
+	require.NoError(t, client.SetReadBuffer(4*1024*1024))
+
+	buf := make([]byte, 1500)
+	for round := 0; round < 2; round++ {
+		_, err = client.Write([]byte("request"))
+		require.NoError(t, err)
+
+		for i := 0; i < replies; i++ {
+			require.NoError(t, client.SetReadDeadline(time.Now().Add(5*time.Second)))
+			n, err := client.Read(buf)
+			require.NoError(t, err)
+
+			if i == 0 {
+				require.Equal(t, 0, n)
+				continue
+			}
+
+			require.Equal(t, fmt.Sprintf("reply %d", i), string(buf[:n]))
+		}
+	}
+
+	require.NoError(t, listener.Close())
+	require.Error(t, <-relayed)
+}
+
+func TestListenerCPU(t *testing.T) {
+	tests := []struct {
+		name        string
+		cpus        []int
+		listeners   int
+		cpuSteering bool
+		expected    []int
+	}{
+		{"Spread", []int{4, 5, 6}, 5, false, []int{4, 5, 6, 4, 5}},
+		{"Steering on all CPUs", []int{0, 1, 2, 3}, 4, true, []int{0, 1, 2, 3}},
+		{"Steering on a subset of the CPUs", []int{2, 3, 4, 5}, 2, true, []int{2, 3}},
+		{"Steering on more CPUs than listeners", []int{0, 1, 2, 3, 4, 5}, 3, true, []int{0, 1, 2}},
+		{"Steering without a matching CPU", []int{1, 3}, 2, true, []int{1, 1}},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			for i, expected := range tt.expected {
+				require.Equal(t, expected, listenerCPU(tt.cpus, i, tt.listeners, tt.cpuSteering), "listener %d", i)
+			}
+		})
+	}
+}
+
+func TestAttachReuseportCPUSteering(t *testing.T) {
+	listeners := 2
+
+	files := make([]*os.File, listeners)
+	conns := make([]net.PacketConn, listeners)
+	addr := "127.0.0.1:0"
+	for i := range files {
+		var err error
+		files[i], err = getListenerFile("udp", addr, true)
+		require.NoError(t, err)
+		defer func(f *os.File) { _ = f.Close() }(files[i])
+
+		conns[i], err = net.FilePacketConn(files[i])
+		require.NoError(t, err)
+		defer func(c net.PacketConn) { _ = c.Close() }(conns[i])
+
+		addr = conns[i].LocalAddr().String()
+	}
+
+	err := attachReuseportCPUSteering(files[0], listeners)
+	require.NoError(t, err)
+
+	// Fd made the file description shared with the connection blocking, which defeats deadlines.
+	require.NoError(t, unix.SetNonblock(int(files[0].Fd()), true))
+
+	t.Run("Steering", func(t *testing.T) {
+		// Datagrams received on a CPU go to the listener of the CPU modulo the number of listeners.
+		cpus := allowedCPUs()
+		for i := range conns {
+			cpu := listenerCPU(cpus, i, listeners, true)
+			if cpu%listeners != i {
+				t.Skipf("No CPU to steer to listener %d", i)
+			}
+
+			// Loopback datagrams are received on the CPU which sent them. The thread is thrown
+			// away with the goroutine, so its affinity doesn't leak.
+			sent := make(chan error, 1)
+			go func() {
+				runtime.LockOSThread()
+
+				var set unix.CPUSet
+				set.Set(cpu)
+				err := unix.SchedSetaffinity(0, &set)
+				if err != nil {
+					sent <- err
+					return
+				}
+
+				client, err := net.Dial("udp", addr)
+				if err != nil {
+					sent <- err
+					return
+				}
+
+				defer func() { _ = client.Close() }()
+
+				_, err = client.Write([]byte(fmt.Sprintf("cpu %d", cpu)))
+				sent <- err
+			}()
+
+			require.NoError(t, <-sent)
+
+			buf := make([]byte, 64)
+			require.NoError(t, conns[i].SetReadDeadline(time.Now().Add(5*time.Second)))
+			n, _, err := conns[i].ReadFrom(buf)
+			require.NoError(t, err)
+			require.Equal(t, fmt.Sprintf("cpu %d", cpu), string(buf[:n]))
+		}
+	})
+
+	// The program is attached to the group, so detaching it works from any of its sockets.
+	err = unix.SetsockoptInt(int(files[1].Fd()), unix.SOL_SOCKET, unix.SO_DETACH_REUSEPORT_BPF, 0)
+	require.NoError(t, err)
+}
@@ -0,0 +1,351 @@
+package main
+
+import (
+	"errors"
+	"fmt"
+	"net"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+
+	"golang.org/x/sys/unix"
+)
+
+const (
+	// udpBatchSize is the largest number of datagrams moved by a single recvmmsg or sendmmsg call.
+	udpBatchSize = 64
+
+	// udpBufferSize is the size of the buffer of each datagram, longer ones get truncated.
+	udpBufferSize = 32 * 1024
+
+	// udpSessionShards is the number of independently locked parts of the session table.
+	udpSessionShards = 64
+
+	// udpSessionTimeout is how long a session is kept after its last datagram.
+	udpSessionTimeout = 30 * time.Minute
+
+	// udpSessionTick is the resolution of the session expiry.
+	udpSessionTick = time.Minute
+)
+
+type udpSession struct {
+	relay  *udpRelay
+	client mmsgAddr
+	target *net.UDPConn
+	raw    syscall.RawConn
+
+	// Tick of the last datagram in either direction.
+	lastSeen atomic.Int64
+	closed   atomic.Bool
+}
+
+// touch marks the session as used, only writing to it once per tick.
+func (s *udpSession) touch() {
+	now := s.relay.now.Load()
+	if s.lastSeen.Load() != now {
+		s.lastSeen.Store(now)
+	}
+}
+
+// udpReplyBatch holds the buffers for relaying a batch of replies to a client.
+type udpReplyBatch struct {
+	in  *mmsgBatch
+	out *mmsgBatch
+}
+
+// udpReplyBatches is shared by all sessions, a session only takes a batch once its target replied
+// and gives it back once the replies were sent, so idle sessions don't hold any buffers.
+var udpReplyBatches = sync.Pool{
+	New: func() any {
+		return &udpReplyBatch{
+			in:  newMmsgBatch(udpBatchSize, udpBufferSize),
+			out: newMmsgBatch(udpBatchSize, 0),
+		}
+	},
+}
+
+// recvReplies waits for replies from the target and reads them into a batch from the pool.
+func (s *udpSession) recvReplies() (*udpReplyBatch, int, error) {
+	var b *udpReplyBatch
+	var n int
+	var errno syscall.Errno
+
+	err := s.raw.Read(func(fd uintptr) bool {
+		b = udpReplyBatches.Get().(*udpReplyBatch)
+		n, errno = b.in.recvFd(fd)
+		if errno == unix.EAGAIN {
+			udpReplyBatches.Put(b)
+			b = nil
+			return false
+		}
+
+		return true
+	})
+	if err != nil {
+		return nil, 0, err
+	}
+
+	if errno != 0 {
+		udpReplyBatches.Put(b)
+		return nil, 0, errno
+	}
+
+	return b, n, nil
+}
+
+// replies sends back to the client what the target replies.
+func (s *udpSession) replies() {
+	for {
+		b, n, err := s.recvReplies()
+		if errors.Is(err, unix.ECONNREFUSED) {
+			continue
+		}
+
+		if err != nil {
+			s.relay.expire(s)
+			return
+		}
+
+		s.touch()
+
+		for i := 0; i < n; i++ {
+			b.out.set(i, b.in.bufs[i][:b.in.msgs[i].len], &s.client)
+		}
+
+		err = b.out.send(s.relay.raw, n)
+		udpReplyBatches.Put(b)
+		if err != nil {
+			s.relay.expire(s)
+			return
+		}
+	}
+}
+
+type udpShard struct {
+	mu       sync.Mutex
+	sessions map[mmsgAddr]*udpSession
+}
+
+// udpRelay forwards datagrams between the clients of an unconnected UDP listener and a target.
+//
+// Each client gets a session with its own socket connected to the target, the replies received on
+// it are sent back to the client from the listener. Idle sessions are expired by a timer wheel
+// which only looks at a session once per timeout, using sessions only updates their last tick.
+type udpRelay struct {
+	listener *net.UDPConn
+	raw      syscall.RawConn
+	target   *net.UDPAddr
+
+	shards [udpSessionShards]udpShard
+
+	// Coarse clock, in ticks since the relay started.
+	now atomic.Int64
+
+	wheelMu sync.Mutex
+	wheel   [][]*udpSession
+}
+
+// relayUDP relays datagrams from the listener to the target until reading from the listener fails.
+func relayUDP(listener *net.UDPConn, target *net.UDPAddr) error {
+	raw, err := listener.SyscallConn()
+	if err != nil {
+		return err
+	}
+
+	r := &udpRelay{
+		listener: listener,
+		raw:      raw,
+		target:   target,
+		wheel:    make([][]*udpSession, int(udpSessionTimeout/udpSessionTick)+1),
+	}
+
+	for i := range r.shards {
+		r.shards[i].sessions = map[mmsgAddr]*udpSession{}
+	}
+
+	done := make(chan struct{})
+	defer close(done)
+	defer r.closeAll()
+
+	go func() {
+		ticker := time.NewTicker(udpSessionTick)
+		defer ticker.Stop()
+
+		for {
+			select {
+			case <-ticker.C:
+				r.tick()
+			case <-done:
+				return
+			}
+		}
+	}()
+
+	b := newMmsgBatch(udpBatchSize, udpBufferSize)
+	out := newMmsgBatch(udpBatchSize, 0)
+	sessions := make([]*udpSession, udpBatchSize)
+
+	for {
+		n, err := b.recv(r.raw)
+		if err != nil {
+			return err
+		}
+
+		for i := 0; i < n; i++ {
+			sessions[i] = r.session(&b.names[i])
+		}
+
+		// Send the datagrams of each session with a single call.
+		for i := 0; i < n; i++ {
+			s := sessions[i]
+			if s == nil {
+				continue
+			}
+
+			count := 0
+			for j := i; j < n; j++ {
+				if sessions[j] != s {
+					continue
+				}
+
+				out.set(count, b.bufs[j][:b.msgs[j].len], nil)
+				sessions[j] = nil
+				count++
+			}
+
+			err = out.send(s.raw, count)
+			if err != nil {
+				// The datagrams are lost, the next ones get a new session.
+				r.expire(s)
+			}
+		}
+	}
+}
+
+func (addr *mmsgAddr) shard() int {
+	// FNV-1a
+	h := uint32(2166136261)
+	for _, c := range addr.data[:addr.len] {
+		h ^= uint32(c)
+		h *= 16777619
+	}
+
+	return int(h % udpSessionShards)
+}
+
+// session returns the session of the client, creating it if needed, or nil if that failed.
+func (r *udpRelay) session(client *mmsgAddr) *udpSession {
+	shard := &r.shards[client.shard()]
+
+	shard.mu.Lock()
+	s := shard.sessions[*client]
+	shard.mu.Unlock()
+
+	if s != nil {
+		s.touch()
+		return s
+	}
+
+	target, err := net.DialUDP(r.target.Network(), nil, r.target)
+	if err != nil {
+		fmt.Printf("Warning: Failed to connect to target: %v\n", err)
+		return nil
+	}
+
+	raw, err := target.SyscallConn()
+	if err != nil {
+		_ = target.Close()
+		return nil
+	}
+
+	s = &udpSession{
+		relay:  r,
+		client: *client,
+		target: target,
+		raw:    raw,
+	}
+
+	s.lastSeen.Store(r.now.Load())
+
+	shard.mu.Lock()
+	shard.sessions[*client] = s
+	shard.mu.Unlock()
+
+	r.schedule(s, s.lastSeen.Load()+int64(len(r.wheel)-1))
+
+	go s.replies()
+
+	return s
+}
+
+func (r *udpRelay) schedule(s *udpSession, tick int64) {
+	slot := int(tick % int64(len(r.wheel)))
+
+	r.wheelMu.Lock()
+	r.wheel[slot] = append(r.wheel[slot], s)
+	r.wheelMu.Unlock()
+}
+
+// tick advances the clock and expires the sessions of the current slot which weren't used since
+// they got scheduled, the other ones get scheduled again for their actual expiry.
+func (r *udpRelay) tick() {
+	now := r.now.Add(1)
+	timeout := int64(len(r.wheel) - 1)
+	slot := int(now % int64(len(r.wheel)))
+
+	r.wheelMu.Lock()
+	sessions := r.wheel[slot]
+	r.wheel[slot] = nil
+	r.wheelMu.Unlock()
+
+	for _, s := range sessions {
+		if s.closed.Load() {
+			continue
+		}
+
+		expiry := s.lastSeen.Load() + timeout
+		if expiry <= now {
+			r.expire(s)
+			continue
+		}
+
+		r.schedule(s, expiry)
+	}
+}
+
+// expire removes the session and closes its socket.
+func (r *udpRelay) expire(s *udpSession) {
+	if s.closed.Swap(true) {
+		return
+	}
+
+	shard := &r.shards[s.client.shard()]
+
+	shard.mu.Lock()
+	if shard.sessions[s.client] == s {
+		delete(shard.sessions, s.client)
+	}
+
+	shard.mu.Unlock()
+
+	_ = s.target.Close()
+}
+
+func (r *udpRelay) closeAll() {
+	for i := range r.shards {
+		shard := &r.shards[i]
+
+		shard.mu.Lock()
+		sessions := make([]*udpSession, 0, len(shard.sessions))
+		for _, s := range shard.sessions {
+			sessions = append(sessions, s)
+		}
+
+		shard.mu.Unlock()
+
+		for _, s := range sessions {
+			r.expire(s)
+		}
+	}
+}
@@ -6,14 +6,17 @@ package main
 #endif
 #include <fcntl.h>
 #include <libgen.h>
+#include <poll.h>
 #include <sched.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/capability.h>
 #include <sys/fsuid.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/vfs.h>
@@ -21,9 +24,11 @@ package main
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include "include/lxd_forksyscall.h"
 #include "include/macro.h"
 #include "include/memory_utils.h"
 #include "include/mount_utils.h"
+#include "include/process_utils.h"
 #include "include/syscall_numbers.h"
 #include "include/syscall_wrappers.h"
 
@@ -146,20 +151,70 @@ static bool acquire_final_creds(pid_t pid, uid_t uid, gid_t gid, uid_t fsuid, gi
 	return true;
 }
 
+// Attaches to the root and working directory of pid. If root_fd and cwd_fd are
+// valid the caller is expected to already be in the mount namespace of pid.
+static bool attach_basic_creds(pid_t pid, int pidfd, int ns_fd, int root_fd, int cwd_fd)
+{
+	if (root_fd >= 0 && cwd_fd >= 0)
+		return chdirchroot_in_mntns(cwd_fd, root_fd);
+
+	return acquire_basic_creds(pid, pidfd, ns_fd, NULL, NULL);
+}
+
+static int mknod_do(pid_t pid, int pidfd, int ns_fd, int root_fd, int cwd_fd,
+		    const char *target, mode_t mode, dev_t dev,
+		    uid_t uid, gid_t gid, uid_t fsuid, gid_t fsgid)
+{
+	__do_close int target_dir_fd = -EBADF;
+	char *target_dir = NULL;
+	int ret;
+	char path[PATH_MAX];
+	struct statfs sfs;
+
+	if (!attach_basic_creds(pid, pidfd, ns_fd, root_fd, cwd_fd))
+		return ENOANO;
+
+	snprintf(path, sizeof(path), "%s", target);
+	target_dir = dirname(path);
+	target_dir_fd = open(target_dir, O_PATH | O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+	if (target_dir_fd < 0)
+		return ENOANO;
+
+	if (!acquire_final_creds(pid, uid, gid, fsuid, fsgid))
+		return ENOANO;
+
+	ret = fstatfs(target_dir_fd, &sfs);
+	if (ret)
+		return ENOANO;
+
+	if (sfs.f_flags & MS_NODEV)
+		return EPERM;
+
+	// basename() can modify its argument so accessing target_host is
+	// invalid from now on.
+	ret = mknodat(target_dir_fd, target, mode, dev);
+	if (ret) {
+		if (errno == EPERM)
+			return ENOMEDIUM;
+
+		return errno;
+	}
+
+	return 0;
+}
+
 // Expects command line to be in the form:
 // <PID> <root-uid> <root-gid> <path> <mode> <dev>
 static void mknod_emulate(void)
 {
-	__do_close int target_dir_fd = -EBADF, pidfd = -EBADF, ns_fd = -EBADF;
-	char *target = NULL, *target_dir = NULL;
+	__do_close int pidfd = -EBADF, ns_fd = -EBADF;
+	char *target = NULL;
 	int ret;
-	char path[PATH_MAX];
 	mode_t mode;
 	dev_t dev;
 	pid_t pid;
 	uid_t fsuid, uid;
 	gid_t fsgid, gid;
-	struct statfs sfs;
 
 	pid = atoi(advance_arg(true));
 	pidfd = atoi(advance_arg(true));
@@ -174,44 +229,9 @@ static void mknod_emulate(void)
 	fsuid = atoi(advance_arg(true));
 	fsgid = atoi(advance_arg(true));
 
-	if (!acquire_basic_creds(pid, pidfd, ns_fd, NULL, NULL)) {
-		fprintf(stderr, "%d", ENOANO);
-		_exit(EXIT_FAILURE);
-	}
-
-	snprintf(path, sizeof(path), "%s", target);
-	target_dir = dirname(path);
-	target_dir_fd = open(target_dir, O_PATH | O_RDONLY | O_CLOEXEC | O_DIRECTORY);
-	if (target_dir_fd < 0) {
-		fprintf(stderr, "%d", ENOANO);
-		_exit(EXIT_FAILURE);
-	}
-
-	if (!acquire_final_creds(pid, uid, gid, fsuid, fsgid)) {
-		fprintf(stderr, "%d", ENOANO);
-		_exit(EXIT_FAILURE);
-	}
-
-	ret = fstatfs(target_dir_fd, &sfs);
+	ret = mknod_do(pid, pidfd, ns_fd, -EBADF, -EBADF, target, mode, dev, uid, gid, fsuid, fsgid);
 	if (ret) {
-		fprintf(stderr, "%d", ENOANO);
-		_exit(EXIT_FAILURE);
-	}
-
-	if (sfs.f_flags & MS_NODEV) {
-		fprintf(stderr, "%d", EPERM);
-		_exit(EXIT_FAILURE);
-	}
-
-	// basename() can modify its argument so accessing target_host is
-	// invalid from now on.
-	ret = mknodat(target_dir_fd, target, mode, dev);
-	if (ret) {
-		if (errno == EPERM)
-			fprintf(stderr, "%d", ENOMEDIUM);
-		else
-			fprintf(stderr, "%d", errno);
-
+		fprintf(stderr, "%d", ret);
 		_exit(EXIT_FAILURE);
 	}
 }
@@ -244,19 +264,60 @@ static bool change_creds(int pidfd, int ns_fd, cap_t caps, uid_t nsuid, gid_t ns
 	return true;
 }
 
+static int setxattr_do(pid_t pid, int pidfd, int ns_fd, int root_fd, int cwd_fd,
+		       uid_t nsuid, gid_t nsgid, uid_t nsfsuid, gid_t nsfsgid,
+		       const char *name, const char *target, int flags,
+		       int whiteout, const void *data, size_t size)
+{
+	__do_close int target_fd = -EBADF;
+	cap_t caps;
+	cap_flag_value_t flag;
+
+	if (!attach_basic_creds(pid, pidfd, ns_fd, root_fd, cwd_fd))
+		return ENOANO;
+
+	target_fd = open(target, O_RDONLY | O_CLOEXEC);
+	if (target_fd < 0)
+		return errno;
+
+	caps = cap_get_pid(pid);
+	if (!caps)
+		return ENOANO;
+
+	if (whiteout == 1) {
+		if (cap_get_flag(caps,  CAP_SYS_ADMIN, CAP_EFFECTIVE, &flag) != 0)
+			return EPERM;
+
+		if (flag == CAP_CLEAR)
+			return EPERM;
+	}
+
+	if (whiteout == 1) {
+		if (fsetxattr(target_fd, "trusted.overlay.opaque", "y", 1, flags))
+			return errno;
+	} else {
+		if (!change_creds(pidfd, ns_fd, caps, nsuid, nsgid, nsfsuid, nsfsgid))
+			return EFAULT;
+
+		if (fsetxattr(target_fd, name, data, size, flags))
+			return errno;
+	}
+
+	return 0;
+}
+
 static void setxattr_emulate(void)
 {
-	__do_close int ns_fd = -EBADF, pidfd = -EBADF, target_fd = -EBADF;
+	__do_close int ns_fd = -EBADF, pidfd = -EBADF;
 	int flags = 0;
 	char *name, *target;
 	uid_t nsfsuid, nsuid;
 	gid_t nsfsgid, nsgid;
 	pid_t pid = 0;
-	cap_t caps;
-	cap_flag_value_t flag;
 	int whiteout;
 	void *data;
 	size_t size;
+	int ret;
 
 	pid = atoi(advance_arg(true));
 	pidfd = atoi(advance_arg(true));
@@ -274,51 +335,12 @@ static void setxattr_emulate(void)
 	size = atoi(advance_arg(true));
 	data = advance_arg(true);
 
-	if (!acquire_basic_creds(pid, pidfd, ns_fd, NULL, NULL)) {
-		fprintf(stderr, "%d", ENOANO);
-		_exit(EXIT_FAILURE);
-	}
-
-	target_fd = open(target, O_RDONLY | O_CLOEXEC);
-	if (target_fd < 0) {
-		fprintf(stderr, "%d", errno);
-		_exit(EXIT_FAILURE);
-	}
-
-	caps = cap_get_pid(pid);
-	if (!caps) {
-		fprintf(stderr, "%d", ENOANO);
+	ret = setxattr_do(pid, pidfd, ns_fd, -EBADF, -EBADF, nsuid, nsgid, nsfsuid, nsfsgid,
+			  name, target, flags, whiteout, data, size);
+	if (ret) {
+		fprintf(stderr, "%d", ret);
 		_exit(EXIT_FAILURE);
 	}
-
-	if (whiteout == 1) {
-		if (cap_get_flag(caps,  CAP_SYS_ADMIN, CAP_EFFECTIVE, &flag) != 0) {
-			fprintf(stderr, "%d", EPERM);
-			_exit(EXIT_FAILURE);
-		}
-
-		if (flag == CAP_CLEAR) {
-			fprintf(stderr, "%d", EPERM);
-			_exit(EXIT_FAILURE);
-		}
-	}
-
-	if (whiteout == 1) {
-		if (fsetxattr(target_fd, "trusted.overlay.opaque", "y", 1, flags)) {
-			fprintf(stderr, "%d", errno);
-			_exit(EXIT_FAILURE);
-		}
-	} else {
-		if (!change_creds(pidfd, ns_fd, caps, nsuid, nsgid, nsfsuid, nsfsgid)) {
-			fprintf(stderr, "%d", EFAULT);
-			_exit(EXIT_FAILURE);
-		}
-
-		if (fsetxattr(target_fd, name, data, size, flags)) {
-			fprintf(stderr, "%d", errno);
-			_exit(EXIT_FAILURE);
-		}
-	}
 }
 
 static void mount_emulate(void)
@@ -519,6 +541,166 @@ static void sched_setscheduler_emulate(void)
 		_exit(EXIT_FAILURE);
 }
 
+static ssize_t forksyscall_helper_recv(int sock, struct forksyscall_helper_req *req, int *fds)
+{
+	char cmsgbuf[CMSG_SPACE(FORKSYSCALL_HELPER_NR_FDS * sizeof(int))] = {};
+	struct iovec iov = {
+		.iov_base	= req,
+		.iov_len	= sizeof(*req),
+	};
+	struct msghdr msg = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= cmsgbuf,
+		.msg_controllen	= sizeof(cmsgbuf),
+	};
+	struct cmsghdr *cmsg;
+	size_t nr_fds = 0;
+	ssize_t ret;
+
+	do {
+		ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+	if (ret <= 0)
+		return ret;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		nr_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+	if (nr_fds != FORKSYSCALL_HELPER_NR_FDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		for (size_t i = 0; i < nr_fds; i++)
+			close(((int *)CMSG_DATA(cmsg))[i]);
+
+		errno = EBADMSG;
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), FORKSYSCALL_HELPER_NR_FDS * sizeof(int));
+
+	if ((size_t)ret < offsetof(struct forksyscall_helper_req, value) ||
+	    req->size > FORKSYSCALL_HELPER_VALUE_MAX ||
+	    (size_t)ret < offsetof(struct forksyscall_helper_req, value) + req->size) {
+		for (size_t i = 0; i < nr_fds; i++)
+			close(fds[i]);
+
+		errno = EBADMSG;
+		return -1;
+	}
+
+	req->path[FORKSYSCALL_HELPER_PATH_MAX - 1] = '\0';
+	req->name[FORKSYSCALL_HELPER_NAME_MAX - 1] = '\0';
+
+	return ret;
+}
+
+static int forksyscall_helper_handle(struct forksyscall_helper_req *req, int *fds)
+{
+	int pidfd = fds[FORKSYSCALL_HELPER_FD_PIDFD];
+	int ns_fd = fds[FORKSYSCALL_HELPER_FD_NS];
+	int root_fd = fds[FORKSYSCALL_HELPER_FD_ROOT];
+	int cwd_fd = fds[FORKSYSCALL_HELPER_FD_CWD];
+
+	// Verify that the pid has not been recycled since the handles were opened.
+	if (lxd_pidfd_send_signal(pidfd, 0, NULL, 0) && errno != EPERM)
+		return ENOANO;
+
+	switch (req->syscall) {
+	case FORKSYSCALL_HELPER_MKNOD:
+		return mknod_do(req->pid, pidfd, ns_fd, root_fd, cwd_fd, req->path,
+				req->mode, req->dev, req->uid, req->gid,
+				req->fsuid, req->fsgid);
+	case FORKSYSCALL_HELPER_SETXATTR:
+		return setxattr_do(req->pid, pidfd, ns_fd, root_fd, cwd_fd,
+				   req->uid, req->gid, req->fsuid, req->fsgid,
+				   req->name, req->path, req->flags,
+				   req->whiteout, req->value, req->size);
+	}
+
+	return ENOANO;
+}
+
+// Expects command line to be in the form:
+// <PID> <PidFd> <socket fd>
+//
+// Stays attached to the mount namespace of PID and handles requests received
+// on the socket until it is closed or PID exits. Each request is handled by a
+// forked child which only needs to switch to the root, working directory and
+// credentials of the calling task rather than re-executing LXD.
+static void forksyscall_helper(void)
+{
+	__do_close int pidfd = -EBADF, ns_fd = -EBADF, sock = -EBADF;
+	__do_free struct forksyscall_helper_req *req = NULL;
+	pid_t pid;
+
+	pid = atoi(advance_arg(true));
+	pidfd = atoi(advance_arg(true));
+	sock = atoi(advance_arg(true));
+
+	ns_fd = pidfd_nsfd(pidfd, pid);
+	if (ns_fd < 0)
+		_exit(EXIT_FAILURE);
+
+	if (!change_namespaces(pidfd, ns_fd, CLONE_NEWNS))
+		_exit(EXIT_FAILURE);
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		_exit(EXIT_FAILURE);
+
+	for (;;) {
+		struct pollfd pfds[] = {
+			{ .fd = sock,	.events = POLLIN },
+			{ .fd = pidfd,	.events = POLLIN },
+		};
+		int fds[FORKSYSCALL_HELPER_NR_FDS];
+		__s32 err = ENOANO;
+		ssize_t len;
+		pid_t child;
+		int status;
+
+		if (poll(pfds, ARRAY_SIZE(pfds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			_exit(EXIT_FAILURE);
+		}
+
+		// The instance is gone, don't keep its mount namespace around.
+		if (pfds[1].revents)
+			_exit(EXIT_SUCCESS);
+
+		len = forksyscall_helper_recv(sock, req, fds);
+		if (len == 0)
+			_exit(EXIT_SUCCESS);
+
+		if (len < 0 && errno != EBADMSG)
+			_exit(EXIT_FAILURE);
+
+		if (len > 0) {
+			child = fork();
+			if (child == 0)
+				_exit(forksyscall_helper_handle(req, fds));
+
+			for (int i = 0; i < FORKSYSCALL_HELPER_NR_FDS; i++)
+				close(fds[i]);
+
+			while (child > 0 && waitpid(child, &status, 0) < 0) {
+				if (errno != EINTR) {
+					child = -1;
+					break;
+				}
+			}
+
+			if (child > 0 && WIFEXITED(status))
+				err = WEXITSTATUS(status);
+		}
+
+		if (send(sock, &err, sizeof(err), MSG_NOSIGNAL) != sizeof(err))
+			_exit(EXIT_FAILURE);
+	}
+}
+
 void forksyscall(void)
 {
 	char *syscall = NULL;
@@ -542,6 +724,8 @@ void forksyscall(void)
 		setxattr_emulate();
 	else if (strcmp(syscall, "mount") == 0)
 		mount_emulate();
+	else if (strcmp(syscall, "helper") == 0)
+		forksyscall_helper();
 	else
 		_exit(EXIT_FAILURE);
 
@@ -185,19 +185,41 @@ void attach_userns_fd(int ns_fd)
 	}
 }
 
+// inherited_nsfd returns the /proc/<pid>/ns directory inherited from LXD, which passes it as
+// LXD_NSFD=<fd>:<pid>, or -EBADF if it wasn't passed for @pid. The fd can only be taken once.
+static int inherited_nsfd(pid_t pid)
+{
+	char *env;
+	int fd, env_pid;
+
+	env = getenv("LXD_NSFD");
+	if (!env || sscanf(env, "%d:%d", &fd, &env_pid) != 2 || fd < 0 || env_pid != pid)
+		return -EBADF;
+
+	unsetenv("LXD_NSFD");
+
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+		return -EBADF;
+
+	return fd;
+}
+
 int pidfd_nsfd(int pidfd, pid_t pid)
 {
 	__do_close int ns_fd = -EBADF;
 	int ret;
 	char path[100];
 
-	ret = snprintf(path, sizeof(path), "/proc/%d/ns", pid);
-	if (ret < 0 || (size_t)ret >= sizeof(path))
-		return -E2BIG;
+	ns_fd = inherited_nsfd(pid);
+	if (ns_fd < 0) {
+		ret = snprintf(path, sizeof(path), "/proc/%d/ns", pid);
+		if (ret < 0 || (size_t)ret >= sizeof(path))
+			return -E2BIG;
 
-	ns_fd = open(path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
-	if (ns_fd < 0)
-		return -errno;
+		ns_fd = open(path, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+		if (ns_fd < 0)
+			return -errno;
+	}
 
 	if (pidfd >= 0) {
 		// Verify that the pid has not been recycled and our /proc/<pid> handle
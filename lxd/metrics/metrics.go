@@ -89,12 +89,17 @@ func (m *MetricSet) String() string {
 		return int(metricTypes[i]) < int(metricTypes[j])
 	})
 
+	histogramMetrics := []MetricType{
+		SeccompNotificationDurationSeconds,
+	}
+
 	gaugeMetrics := []MetricType{
 		ProcsTotal,
 		CPUs,
 		GoGoroutines,
 		GoHeapObjects,
 		Instances,
+		SeccompQueueDepth,
 	}
 
 	for _, metricType := range metricTypes {
@@ -107,7 +112,9 @@ func (m *MetricSet) String() string {
 		metricTypeName := ""
 
 		// ProcsTotal is a gauge according to the OpenMetrics spec as its value can decrease.
-		if shared.ValueInSlice(metricType, gaugeMetrics) {
+		if shared.ValueInSlice(metricType, histogramMetrics) {
+			metricTypeName = "histogram"
+		} else if shared.ValueInSlice(metricType, gaugeMetrics) {
 			metricTypeName = "gauge"
 		} else if strings.HasSuffix(MetricNames[metricType], "_total") || strings.HasSuffix(MetricNames[metricType], "_seconds") {
 			metricTypeName = "counter"
@@ -144,10 +151,12 @@ func (m *MetricSet) String() string {
 
 			valueStr := strconv.FormatFloat(sample.Value, 'g', -1, 64)
 
+			metricName := MetricNames[metricType] + sample.suffix
+
 			if labels != "" {
-				_, err = out.WriteString(fmt.Sprintf("%s{%s} %s\n", MetricNames[metricType], labels, valueStr))
+				_, err = out.WriteString(fmt.Sprintf("%s{%s} %s\n", metricName, labels, valueStr))
 			} else {
-				_, err = out.WriteString(fmt.Sprintf("%s %s\n", MetricNames[metricType], valueStr))
+				_, err = out.WriteString(fmt.Sprintf("%s %s\n", metricName, valueStr))
 			}
 
 			if err != nil {
@@ -164,6 +173,70 @@ func (m *MetricSet) String() string {
 	return out.String()
 }
 
+// Histogram counts observations into buckets with the given upper bounds.
+type Histogram struct {
+	bounds []float64
+	counts []uint64
+	count  uint64
+	sum    float64
+}
+
+// NewHistogram returns a new Histogram with the given sorted bucket upper bounds.
+// Observations above the last bound are only counted in the implicit +Inf bucket.
+func NewHistogram(bounds []float64) *Histogram {
+	return &Histogram{
+		bounds: bounds,
+		counts: make([]uint64, len(bounds)),
+	}
+}
+
+// Observe adds a value to the histogram.
+func (h *Histogram) Observe(value float64) {
+	i := sort.SearchFloat64s(h.bounds, value)
+	if i < len(h.counts) {
+		h.counts[i]++
+	}
+
+	h.count++
+	h.sum += value
+}
+
+// Samples returns the bucket, sum and count series of the histogram with the given labels.
+func (h *Histogram) Samples(labels map[string]string) []Sample {
+	withLabels := func(extra map[string]string) map[string]string {
+		out := make(map[string]string, len(labels)+len(extra))
+		for k, v := range labels {
+			out[k] = v
+		}
+
+		for k, v := range extra {
+			out[k] = v
+		}
+
+		return out
+	}
+
+	samples := make([]Sample, 0, len(h.bounds)+3)
+
+	var cumulative uint64
+	for i, bound := range h.bounds {
+		cumulative += h.counts[i]
+		samples = append(samples, Sample{
+			Labels: withLabels(map[string]string{"le": strconv.FormatFloat(bound, 'g', -1, 64)}),
+			Value:  float64(cumulative),
+			suffix: "_bucket",
+		})
+	}
+
+	samples = append(samples,
+		Sample{Labels: withLabels(map[string]string{"le": "+Inf"}), Value: float64(h.count), suffix: "_bucket"},
+		Sample{Labels: withLabels(nil), Value: h.sum, suffix: "_sum"},
+		Sample{Labels: withLabels(nil), Value: float64(h.count), suffix: "_count"},
+	)
+
+	return samples
+}
+
 // MetricSetFromAPI converts api.Metrics to a MetricSet, and returns it.
 func MetricSetFromAPI(metrics *Metrics, labels map[string]string) (*MetricSet, error) {
 	set := NewMetricSet(labels)
@@ -56,3 +56,23 @@ func TestMetricSet_FilterSamples(t *testing.T) {
 		require.Contains(t, hasKeys, "project")
 	}
 }
+
+func TestHistogram(t *testing.T) {
+	h := NewHistogram([]float64{0.1, 1})
+	h.Observe(0.25)
+	h.Observe(0.5)
+	h.Observe(4)
+
+	m := NewMetricSet(nil)
+	m.AddSamples(SeccompNotificationDurationSeconds, h.Samples(map[string]string{"syscall": "mount"})...)
+
+	require.Equal(t, MetricHeaders[SeccompNotificationDurationSeconds]+`
+# TYPE lxd_seccomp_notification_duration_seconds histogram
+lxd_seccomp_notification_duration_seconds_bucket{le="0.1",syscall="mount"} 0
+lxd_seccomp_notification_duration_seconds_bucket{le="1",syscall="mount"} 2
+lxd_seccomp_notification_duration_seconds_bucket{le="+Inf",syscall="mount"} 3
+lxd_seccomp_notification_duration_seconds_sum{syscall="mount"} 4.75
+lxd_seccomp_notification_duration_seconds_count{syscall="mount"} 3
+# EOF
+`, m.String())
+}
@@ -0,0 +1,154 @@
+package main
+
+import (
+	"syscall"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+)
+
+// mmsghdr is struct mmsghdr as used by recvmmsg and sendmmsg.
+type mmsghdr struct {
+	hdr unix.Msghdr
+	len uint32
+}
+
+// mmsgAddr is a socket address as returned by the kernel. It's comparable and so usable as a map
+// key, avoiding the allocation of a net.Addr and of its string form for each datagram.
+type mmsgAddr struct {
+	len  uint32
+	data [unix.SizeofSockaddrInet6]byte
+}
+
+// mmsgBatch holds the buffers and headers for moving datagrams with recvmmsg and sendmmsg.
+type mmsgBatch struct {
+	msgs  []mmsghdr
+	iovs  []unix.Iovec
+	bufs  [][]byte
+	names []mmsgAddr
+}
+
+// newMmsgBatch returns a batch of the given size, with buffers of bufSize bytes to receive into
+// unless bufSize is 0.
+func newMmsgBatch(size int, bufSize int) *mmsgBatch {
+	b := &mmsgBatch{
+		msgs:  make([]mmsghdr, size),
+		iovs:  make([]unix.Iovec, size),
+		names: make([]mmsgAddr, size),
+	}
+
+	if bufSize > 0 {
+		b.bufs = make([][]byte, size)
+		for i := range b.bufs {
+			b.bufs[i] = make([]byte, bufSize)
+		}
+	}
+
+	for i := range b.msgs {
+		b.msgs[i].hdr.Iov = &b.iovs[i]
+		b.msgs[i].hdr.SetIovlen(1)
+	}
+
+	return b
+}
+
+func mmsgSyscall(trap uintptr, fd uintptr, msgs []mmsghdr) (int, syscall.Errno) {
+	for {
+		n, _, errno := unix.Syscall6(trap, fd, uintptr(unsafe.Pointer(&msgs[0])), uintptr(len(msgs)), 0, 0, 0)
+		if errno != unix.EINTR {
+			return int(n), errno
+		}
+	}
+}
+
+// recv reads up to a full batch of datagrams along with their source addresses.
+func (b *mmsgBatch) recv(rc syscall.RawConn) (int, error) {
+	var n int
+	var errno syscall.Errno
+
+	err := rc.Read(func(fd uintptr) bool {
+		n, errno = b.recvFd(fd)
+		return errno != unix.EAGAIN
+	})
+	if err != nil {
+		return 0, err
+	}
+
+	if errno != 0 {
+		return 0, errno
+	}
+
+	return n, nil
+}
+
+// recvFd does a single recvmmsg call on a non-blocking socket.
+func (b *mmsgBatch) recvFd(fd uintptr) (int, syscall.Errno) {
+	for i := range b.msgs {
+		b.iovs[i].Base = &b.bufs[i][0]
+		b.iovs[i].SetLen(len(b.bufs[i]))
+		b.msgs[i].hdr.Name = &b.names[i].data[0]
+		b.msgs[i].hdr.Namelen = uint32(len(b.names[i].data))
+	}
+
+	n, errno := mmsgSyscall(unix.SYS_RECVMMSG, fd, b.msgs)
+	if errno != 0 {
+		return 0, errno
+	}
+
+	for i := 0; i < n; i++ {
+		name := &b.names[i]
+		name.len = b.msgs[i].hdr.Namelen
+
+		// Clear what's left of a longer address so it compares equal as a map key.
+		clear(name.data[name.len:])
+	}
+
+	return n, 0
+}
+
+// set queues a datagram for sending, to the given address unless it's nil.
+func (b *mmsgBatch) set(i int, buf []byte, addr *mmsgAddr) {
+	// Empty datagrams have no first byte to point to.
+	b.iovs[i].Base = unsafe.SliceData(buf)
+	b.iovs[i].SetLen(len(buf))
+
+	if addr == nil {
+		b.msgs[i].hdr.Name = nil
+		b.msgs[i].hdr.Namelen = 0
+		return
+	}
+
+	b.names[i] = *addr
+	b.msgs[i].hdr.Name = &b.names[i].data[0]
+	b.msgs[i].hdr.Namelen = addr.len
+}
+
+// send writes the first n queued datagrams.
+func (b *mmsgBatch) send(rc syscall.RawConn, n int) error {
+	msgs := b.msgs[:n]
+	for len(msgs) > 0 {
+		var sent int
+		var errno syscall.Errno
+
+		err := rc.Write(func(fd uintptr) bool {
+			sent, errno = mmsgSyscall(unix.SYS_SENDMMSG, fd, msgs)
+			return errno != unix.EAGAIN
+		})
+		if err != nil {
+			return err
+		}
+
+		if errno == unix.ECONNREFUSED {
+			// Reported for an earlier datagram which the peer didn't accept, move on.
+			continue
+		}
+
+		if errno != 0 {
+			return errno
+		}
+
+		msgs = msgs[sent:]
+	}
+
+	return nil
+}
@@ -0,0 +1,364 @@
+//go:build linux && cgo
+
+package seccomp
+
+import (
+	"os"
+	"runtime"
+	"strconv"
+	"sync"
+	"time"
+
+	"github.com/canonical/lxd/lxd/metrics"
+	"github.com/canonical/lxd/shared/logger"
+)
+
+// defaultDispatchQueueLimit is the default number of notifications of a single instance that
+// can be queued or handled at the same time before its connection stops being read.
+const defaultDispatchQueueLimit = 64
+
+// dispatchWorkers returns the number of notification handlers run concurrently.
+// It can be overridden through LXD_SECCOMP_WORKERS.
+func dispatchWorkers() int {
+	workers, err := strconv.Atoi(os.Getenv("LXD_SECCOMP_WORKERS"))
+	if err == nil && workers > 0 {
+		return workers
+	}
+
+	// Most handlers spend their time waiting on a forked helper rather than on the CPU.
+	return max(4, 2*runtime.NumCPU())
+}
+
+// dispatchQueueWorkers returns the number of notifications of a single instance handled at the same
+// time. It can be overridden through LXD_SECCOMP_QUEUE_WORKERS.
+func dispatchQueueWorkers(workers int) int {
+	queueWorkers, err := strconv.Atoi(os.Getenv("LXD_SECCOMP_QUEUE_WORKERS"))
+	if err == nil && queueWorkers > 0 {
+		return min(queueWorkers, workers)
+	}
+
+	// Leave most of the workers to the other instances.
+	return max(1, workers/4)
+}
+
+// dispatchQueueLimit returns the per instance backpressure limit.
+// It can be overridden through LXD_SECCOMP_QUEUE_LIMIT.
+func dispatchQueueLimit() int {
+	limit, err := strconv.Atoi(os.Getenv("LXD_SECCOMP_QUEUE_LIMIT"))
+	if err == nil && limit > 0 {
+		return limit
+	}
+
+	return defaultDispatchQueueLimit
+}
+
+// dispatchQueue holds the pending notifications of a single seccomp client connection.
+type dispatchQueue struct {
+	tasks []dispatchTask
+	ready bool
+
+	// Number of notifications of the queue being handled.
+	running int
+
+	// Called once the queue was released and its last notification handled.
+	onIdle func()
+
+	// Slots are taken when a notification is queued and released once it has been handled.
+	slots chan struct{}
+}
+
+type dispatchTask struct {
+	run    func()
+	queued time.Time
+}
+
+// dispatcher runs seccomp notification handlers on a bounded set of workers.
+//
+// Every client connection, and so every instance, gets its own queue and the workers take one
+// notification from each queue with pending work in turn. As only a few notifications of a queue
+// are handled at the same time, an instance issuing a burst of expensive syscalls can't occupy
+// all the workers and only delays its own notifications. Once an instance has reached
+// its queue limit, queueing blocks until one of its notifications has been handled, which in turn
+// stops the connection from being read and pushes back on the instance.
+type dispatcher struct {
+	mu      sync.Mutex
+	cond    *sync.Cond
+	ready   []*dispatchQueue
+	queued  int
+	stopped bool
+	limit   int
+
+	// Largest number of notifications of a queue handled at the same time.
+	perQueue int
+
+	waitSeconds    float64
+	throttledTotal uint64
+}
+
+// newDispatcher starts a dispatcher with the given number of workers, perQueue of which can handle
+// the notifications of a single queue.
+func newDispatcher(workers int, limit int, perQueue int) *dispatcher {
+	d := &dispatcher{limit: limit, perQueue: perQueue}
+	d.cond = sync.NewCond(&d.mu)
+
+	for i := 0; i < workers; i++ {
+		go d.worker()
+	}
+
+	return d
+}
+
+// newQueue returns a new queue for a client connection.
+func (d *dispatcher) newQueue() *dispatchQueue {
+	return &dispatchQueue{slots: make(chan struct{}, d.limit)}
+}
+
+// submit queues a task, blocking while the queue is at its limit.
+func (d *dispatcher) submit(q *dispatchQueue, run func()) {
+	select {
+	case q.slots <- struct{}{}:
+	default:
+		d.mu.Lock()
+		d.throttledTotal++
+		d.mu.Unlock()
+
+		logger.Debug("Seccomp notification queue full, waiting for pending notifications", logger.Ctx{"limit": d.limit})
+		q.slots <- struct{}{}
+	}
+
+	d.mu.Lock()
+	if d.stopped {
+		d.mu.Unlock()
+		run()
+		<-q.slots
+		return
+	}
+
+	q.tasks = append(q.tasks, dispatchTask{run: run, queued: time.Now()})
+	d.queued++
+
+	if !q.ready && q.running < d.perQueue {
+		q.ready = true
+		d.ready = append(d.ready, q)
+	}
+
+	d.mu.Unlock()
+	d.cond.Signal()
+}
+
+// next returns the next task to run and the queue it belongs to, or nil once stopped and all the
+// queued tasks have been taken.
+func (d *dispatcher) next() (*dispatchQueue, *dispatchTask) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+
+	for len(d.ready) == 0 {
+		// Saturated queues still have tasks, they get ready again as their tasks complete.
+		if d.stopped && d.queued == 0 {
+			return nil, nil
+		}
+
+		d.cond.Wait()
+	}
+
+	q := d.ready[0]
+	d.ready[0] = nil
+	d.ready = d.ready[1:]
+
+	task := q.tasks[0]
+	q.tasks[0] = dispatchTask{}
+	q.tasks = q.tasks[1:]
+	q.running++
+	d.queued--
+
+	// Go to the back of the line so that other queues get their turn first.
+	if len(q.tasks) > 0 && q.running < d.perQueue {
+		d.ready = append(d.ready, q)
+	} else {
+		q.ready = false
+		if len(q.tasks) == 0 {
+			q.tasks = nil
+		}
+	}
+
+	if d.stopped && d.queued == 0 {
+		d.cond.Broadcast()
+	}
+
+	d.waitSeconds += time.Since(task.queued).Seconds()
+
+	return q, &task
+}
+
+func (d *dispatcher) worker() {
+	for {
+		q, task := d.next()
+		if task == nil {
+			return
+		}
+
+		task.run()
+		d.done(q)
+		<-q.slots
+	}
+}
+
+// done records the completion of a task of the queue, making it ready again if it was saturated.
+func (d *dispatcher) done(q *dispatchQueue) {
+	d.mu.Lock()
+	q.running--
+
+	ready := !q.ready && len(q.tasks) > 0
+	if ready {
+		q.ready = true
+		d.ready = append(d.ready, q)
+	}
+
+	onIdle := q.takeOnIdle()
+	d.mu.Unlock()
+
+	if ready {
+		d.cond.Signal()
+	}
+
+	if onIdle != nil {
+		onIdle()
+	}
+}
+
+// release is called once no more tasks get submitted to the queue. onIdle is called as soon as
+// all of its tasks have been handled, which may be right away.
+func (d *dispatcher) release(q *dispatchQueue, onIdle func()) {
+	d.mu.Lock()
+	q.onIdle = onIdle
+	onIdle = q.takeOnIdle()
+	d.mu.Unlock()
+
+	if onIdle != nil {
+		onIdle()
+	}
+}
+
+// takeOnIdle returns the idle callback of a released queue without pending or running tasks and
+// clears it. Must be called with the dispatcher lock held.
+func (q *dispatchQueue) takeOnIdle() func() {
+	if q.onIdle == nil || len(q.tasks) > 0 || q.running > 0 {
+		return nil
+	}
+
+	onIdle := q.onIdle
+	q.onIdle = nil
+
+	return onIdle
+}
+
+// stop makes the workers exit once the pending tasks have been handled.
+// Tasks submitted afterwards are run by the caller.
+func (d *dispatcher) stop() {
+	d.mu.Lock()
+	d.stopped = true
+	d.mu.Unlock()
+	d.cond.Broadcast()
+}
+
+// metrics adds the queue state to the metric set.
+func (d *dispatcher) metrics(out *metrics.MetricSet) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+
+	out.AddSamples(metrics.SeccompQueueDepth, metrics.Sample{Value: float64(d.queued)})
+	out.AddSamples(metrics.SeccompQueueWaitSecondsTotal, metrics.Sample{Value: d.waitSeconds})
+	out.AddSamples(metrics.SeccompThrottledTotal, metrics.Sample{Value: float64(d.throttledTotal)})
+}
+
+// syscallLatencyBuckets are the upper bounds in seconds of the notification latency histograms.
+var syscallLatencyBuckets = []float64{0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}
+
+// syscallStatsInstance identifies the instance of a notification latency histogram.
+type syscallStatsInstance struct {
+	project string
+	name    string
+}
+
+// syscallStatsKey identifies a notification latency histogram.
+type syscallStatsKey struct {
+	syscall  string
+	instance syscallStatsInstance
+	outcome  string
+}
+
+// syscallStats tracks the receive to respond latency of notifications per syscall, instance and outcome.
+//
+// The histograms of an instance are kept while a connection which handled its notifications is
+// around, they are dropped along with the last of them so stopped, deleted or renamed instances
+// stop being reported.
+type syscallStats struct {
+	mu         sync.Mutex
+	histograms map[syscallStatsKey]*metrics.Histogram
+
+	// Number of connections holding a reference on the histograms of each instance.
+	instances map[syscallStatsInstance]int
+}
+
+func newSyscallStats() *syscallStats {
+	return &syscallStats{
+		histograms: map[syscallStatsKey]*metrics.Histogram{},
+		instances:  map[syscallStatsInstance]int{},
+	}
+}
+
+// acquire takes a reference on the histograms of the instance.
+func (s *syscallStats) acquire(inst syscallStatsInstance) {
+	s.mu.Lock()
+	s.instances[inst]++
+	s.mu.Unlock()
+}
+
+// release drops a reference on the histograms of the instance, removing them with the last one.
+func (s *syscallStats) release(inst syscallStatsInstance) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	s.instances[inst]--
+	if s.instances[inst] > 0 {
+		return
+	}
+
+	delete(s.instances, inst)
+	for key := range s.histograms {
+		if key.instance == inst {
+			delete(s.histograms, key)
+		}
+	}
+}
+
+// observe records a handled notification.
+func (s *syscallStats) observe(key syscallStatsKey, duration time.Duration) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	histogram := s.histograms[key]
+	if histogram == nil {
+		histogram = metrics.NewHistogram(syscallLatencyBuckets)
+		s.histograms[key] = histogram
+	}
+
+	histogram.Observe(duration.Seconds())
+}
+
+// metrics adds the latency histograms to the metric set.
+func (s *syscallStats) metrics(out *metrics.MetricSet) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	for key, histogram := range s.histograms {
+		labels := map[string]string{
+			"syscall": key.syscall,
+			"name":    key.instance.name,
+			"project": key.instance.project,
+			"outcome": key.outcome,
+		}
+
+		out.AddSamples(metrics.SeccompNotificationDurationSeconds, histogram.Samples(labels)...)
+	}
+}
@@ -0,0 +1,401 @@
+//go:build linux && cgo
+
+package seccomp
+
+// #include <errno.h>
+// #include "../include/lxd_forksyscall.h"
+import "C"
+
+import (
+	"fmt"
+	"os"
+	"os/exec"
+	"sync"
+	"sync/atomic"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/lxd/linux"
+	"github.com/canonical/lxd/lxd/state"
+	"github.com/canonical/lxd/shared"
+	"github.com/canonical/lxd/shared/logger"
+)
+
+// syscallHelper is a persistent "forksyscall helper" process attached to the mount namespace of an
+// instance. It handles emulated syscalls by forking rather than re-executing LXD for each of them.
+type syscallHelper struct {
+	mu    sync.Mutex
+	fd    int
+	mntns uint64
+	dead  atomic.Bool
+
+	// Closed once the helper has been started or failed to, err and process are then set.
+	started chan struct{}
+	err     error
+	process *os.Process
+
+	// Closed once the helper process has been reaped.
+	exited chan struct{}
+}
+
+// syscallHelpers keeps the running helpers keyed by the PID of the instance's init process.
+type syscallHelpers struct {
+	s       *state.State
+	mu      sync.Mutex
+	helpers map[int32]*syscallHelper
+	stopped bool
+
+	// spawn starts the helper process of an instance, setting the socket of the helper.
+	spawn func(h *syscallHelper, initPID int32) (*exec.Cmd, error)
+}
+
+// syscallHelperReqPool avoids allocating a request buffer for each emulated syscall.
+var syscallHelperReqPool = sync.Pool{
+	New: func() any { return new(C.struct_forksyscall_helper_req) },
+}
+
+// newSyscallHelpers returns the helper registry or nil if helpers are disabled.
+// Helpers are opt-in through LXD_SECCOMP_HELPER and need pidfd support to track the instance.
+func newSyscallHelpers(s *state.State) *syscallHelpers {
+	if !s.OS.PidFds || !shared.IsTrue(os.Getenv("LXD_SECCOMP_HELPER")) {
+		return nil
+	}
+
+	hs := &syscallHelpers{
+		s:       s,
+		helpers: map[int32]*syscallHelper{},
+	}
+
+	hs.spawn = hs.spawnHelper
+
+	return hs
+}
+
+func mntnsInode(pid int) (uint64, error) {
+	var st unix.Stat_t
+
+	err := unix.Stat(fmt.Sprintf("/proc/%d/ns/mnt", pid), &st)
+	if err != nil {
+		return 0, err
+	}
+
+	return st.Ino, nil
+}
+
+// get returns the helper of the instance if the calling task shares its mount namespace,
+// starting it if needed. Callers in other mount namespaces have to use forksyscall.
+// The helper is started without holding the lock so other instances don't wait for it, concurrent
+// callers for the same instance wait for the first one to start it.
+func (hs *syscallHelpers) get(initPID int32, callerPID int) *syscallHelper {
+	callerMntns, err := mntnsInode(callerPID)
+	if err != nil {
+		return nil
+	}
+
+	hs.mu.Lock()
+	h := hs.helpers[initPID]
+	hs.mu.Unlock()
+
+	if h == nil || h.dead.Load() {
+		initMntns, err := mntnsInode(int(initPID))
+		if err != nil || initMntns != callerMntns {
+			return nil
+		}
+
+		spawn := false
+
+		hs.mu.Lock()
+		if hs.stopped {
+			hs.mu.Unlock()
+			return nil
+		}
+
+		h = hs.helpers[initPID]
+		if h == nil || h.dead.Load() {
+			h = &syscallHelper{
+				fd:      -1,
+				mntns:   initMntns,
+				started: make(chan struct{}),
+				exited:  make(chan struct{}),
+			}
+
+			hs.helpers[initPID] = h
+			spawn = true
+		}
+
+		hs.mu.Unlock()
+
+		if spawn {
+			hs.start(h, initPID)
+		}
+	}
+
+	<-h.started
+
+	if h.err != nil || h.mntns != callerMntns {
+		return nil
+	}
+
+	return h
+}
+
+// start spawns the helper process and watches it, dropping the helper once it goes away.
+func (hs *syscallHelpers) start(h *syscallHelper, initPID int32) {
+	cmd, err := hs.spawn(h, initPID)
+	if err != nil {
+		logger.Debug("Failed starting syscall helper", logger.Ctx{"pid": initPID, "err": err})
+
+		h.err = err
+		h.dead.Store(true)
+		close(h.exited)
+		close(h.started)
+
+		hs.drop(initPID, h)
+		return
+	}
+
+	h.process = cmd.Process
+	close(h.started)
+
+	go func() {
+		_ = cmd.Wait()
+
+		h.mu.Lock()
+		h.dead.Store(true)
+		_ = unix.Close(h.fd)
+		h.mu.Unlock()
+
+		hs.drop(initPID, h)
+		close(h.exited)
+	}()
+}
+
+// drop removes the helper from the registry if it's still the one of the instance.
+func (hs *syscallHelpers) drop(initPID int32, h *syscallHelper) {
+	hs.mu.Lock()
+	if hs.helpers[initPID] == h {
+		delete(hs.helpers, initPID)
+	}
+
+	hs.mu.Unlock()
+}
+
+// spawnHelper spawns the "forksyscall helper" process of the instance.
+func (hs *syscallHelpers) spawnHelper(h *syscallHelper, initPID int32) (*exec.Cmd, error) {
+	pidFd, err := linux.PidFdOpen(int(initPID), 0)
+	if err != nil {
+		return nil, err
+	}
+
+	defer func() { _ = pidFd.Close() }()
+
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		return nil, err
+	}
+
+	remote := os.NewFile(uintptr(fds[1]), "forksyscall helper")
+	defer func() { _ = remote.Close() }()
+
+	cmd := &exec.Cmd{
+		Path:       hs.s.OS.ExecPath,
+		Args:       []string{hs.s.OS.ExecPath, "forksyscall", "helper", fmt.Sprintf("%d", initPID), "3", "4"},
+		ExtraFiles: []*os.File{pidFd, remote},
+	}
+
+	err = cmd.Start()
+	if err != nil {
+		_ = unix.Close(fds[0])
+		return nil, err
+	}
+
+	h.fd = fds[0]
+
+	return cmd, nil
+}
+
+// forget stops the helper of the instance, once the seccomp connection of the instance is gone.
+func (hs *syscallHelpers) forget(initPID int32) {
+	hs.mu.Lock()
+	h := hs.helpers[initPID]
+	delete(hs.helpers, initPID)
+	hs.mu.Unlock()
+
+	if h != nil {
+		h.stop()
+	}
+}
+
+// stop stops all the helpers, none are started afterwards.
+func (hs *syscallHelpers) stop() {
+	hs.mu.Lock()
+	hs.stopped = true
+	helpers := make([]*syscallHelper, 0, len(hs.helpers))
+	for _, h := range hs.helpers {
+		helpers = append(helpers, h)
+	}
+
+	clear(hs.helpers)
+	hs.mu.Unlock()
+
+	for _, h := range helpers {
+		h.stop()
+	}
+}
+
+// stop kills the helper process and waits for it to be reaped.
+func (h *syscallHelper) stop() {
+	<-h.started
+
+	if h.process != nil {
+		_ = h.process.Kill()
+	}
+
+	<-h.exited
+}
+
+// call sends a request on behalf of pid and returns the errno reported by the helper.
+// If ok is false the request wasn't delivered and the syscall should be emulated through forksyscall.
+func (h *syscallHelper) call(req *C.struct_forksyscall_helper_req, pid int) (errno int, ok bool) {
+	pidFd, err := linux.PidFdOpen(pid, 0)
+	if err != nil {
+		return 0, false
+	}
+
+	defer func() { _ = pidFd.Close() }()
+
+	fds := []int{int(pidFd.Fd())}
+	defer func() {
+		for _, fd := range fds[1:] {
+			_ = unix.Close(fd)
+		}
+	}()
+
+	for _, path := range []struct {
+		name  string
+		flags int
+	}{
+		{"ns", unix.O_DIRECTORY | unix.O_RDONLY},
+		{"root", unix.O_PATH | unix.O_RDONLY | unix.O_NOFOLLOW},
+		{"cwd", unix.O_PATH | unix.O_RDONLY},
+	} {
+		fd, err := unix.Open(fmt.Sprintf("/proc/%d/%s", pid, path.name), path.flags|unix.O_CLOEXEC, 0)
+		if err != nil {
+			return 0, false
+		}
+
+		fds = append(fds, fd)
+	}
+
+	size := int(unsafe.Offsetof(req.value)) + int(req.size)
+	buf := unsafe.Slice((*byte)(unsafe.Pointer(req)), size)
+
+	h.mu.Lock()
+	defer h.mu.Unlock()
+
+	if h.dead.Load() {
+		return 0, false
+	}
+
+	err = unix.Sendmsg(h.fd, buf, unix.UnixRights(fds...), nil, 0)
+	if err != nil {
+		return 0, false
+	}
+
+	var resp C.__s32
+	for {
+		var n int
+
+		n, err = unix.Read(h.fd, unsafe.Slice((*byte)(unsafe.Pointer(&resp)), unsafe.Sizeof(resp)))
+		if err == unix.EINTR {
+			continue
+		}
+
+		if err != nil || n != int(unsafe.Sizeof(resp)) {
+			// The helper went away while handling the request, it's unknown whether
+			// the syscall was performed.
+			return int(C.ENOANO), true
+		}
+
+		break
+	}
+
+	return int(resp), true
+}
+
+// helperSyscall emulates a syscall through the persistent helper of the instance.
+// It returns the negative errno to report and false if the helper can't be used.
+func (s *Server) helperSyscall(siov *Iovec, pid int, fill func(req *C.struct_forksyscall_helper_req) bool) (int, bool) {
+	if s.helpers == nil {
+		return 0, false
+	}
+
+	h := s.helpers.get(int32(siov.msg.init_pid), pid)
+	if h == nil {
+		return 0, false
+	}
+
+	req := getHelperReq(pid)
+	defer putHelperReq(req)
+	if !fill(req) {
+		return 0, false
+	}
+
+	errno, ok := h.call(req, pid)
+	if !ok {
+		return 0, false
+	}
+
+	if errno == int(C.ENOANO) {
+		return int(-C.EPERM), true
+	}
+
+	return -errno, true
+}
+
+// getHelperReq returns a cleared request for pid from the pool.
+func getHelperReq(pid int) *C.struct_forksyscall_helper_req {
+	req := syscallHelperReqPool.Get().(*C.struct_forksyscall_helper_req)
+	resetHelperReq(req, pid)
+
+	return req
+}
+
+// putHelperReq returns a request to the pool.
+func putHelperReq(req *C.struct_forksyscall_helper_req) {
+	syscallHelperReqPool.Put(req)
+}
+
+// resetHelperReq clears a pooled request for pid. The value, which makes up most of the request,
+// isn't cleared as only the part filled in by the request is sent.
+func resetHelperReq(req *C.struct_forksyscall_helper_req, pid int) {
+	req.syscall = 0
+	req.pid = C.__s32(pid)
+	req.uid, req.gid = 0, 0
+	req.fsuid, req.fsgid = 0, 0
+	req.mode = 0
+	req.__reserved = 0
+	req.dev = 0
+	req.flags = 0
+	req.whiteout = 0
+	req.size = 0
+
+	clear(req.path[:])
+	clear(req.name[:])
+}
+
+// setHelperString copies a NUL terminated string into a request field, failing if it doesn't fit.
+func setHelperString(dst []C.char, value string) bool {
+	if len(value) >= len(dst) {
+		return false
+	}
+
+	for i := 0; i < len(value); i++ {
+		dst[i] = C.char(value[i])
+	}
+
+	dst[len(value)] = 0
+
+	return true
+}
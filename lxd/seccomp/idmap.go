@@ -0,0 +1,63 @@
+//go:build linux && cgo
+
+package seccomp
+
+import (
+	"sync"
+
+	"github.com/canonical/lxd/lxd/idmap"
+)
+
+// idmapCacheEntry is the compiled current idmap of an instance.
+type idmapCacheEntry struct {
+	project  string
+	name     string
+	compiled *idmap.CompiledIdmapSet
+}
+
+// idmapCache keeps the compiled current idmap of the instances notifying through a seccomp
+// connection, keyed by the PID of their init process. The current idmap of an instance doesn't
+// change while it's running. Every connection has its own cache which goes away along with the
+// connection and its pending notifications, so a reused PID can't hit the entry of the instance it
+// used to belong to. Hits are also checked against the instance the notification resolved to.
+type idmapCache struct {
+	mu      sync.Mutex
+	entries map[int32]idmapCacheEntry
+}
+
+func newIdmapCache() *idmapCache {
+	return &idmapCache{
+		entries: map[int32]idmapCacheEntry{},
+	}
+}
+
+// get returns the compiled current idmap of the instance. A nil cache compiles it on every call.
+func (c *idmapCache) get(initPID int32, inst Instance) (*idmap.CompiledIdmapSet, error) {
+	projectName := inst.Project().Name
+	name := inst.Name()
+
+	if c != nil {
+		c.mu.Lock()
+		entry, ok := c.entries[initPID]
+		c.mu.Unlock()
+
+		if ok && entry.project == projectName && entry.name == name {
+			return entry.compiled, nil
+		}
+	}
+
+	idmapset, err := inst.CurrentIdmap()
+	if err != nil {
+		return nil, err
+	}
+
+	compiled := idmapset.Compile()
+
+	if c != nil {
+		c.mu.Lock()
+		c.entries[initPID] = idmapCacheEntry{project: projectName, name: name, compiled: compiled}
+		c.mu.Unlock()
+	}
+
+	return compiled, nil
+}
@@ -12,6 +12,7 @@ package seccomp
 #include <linux/seccomp.h>
 #include <linux/types.h>
 #include <linux/kdev_t.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -24,9 +25,11 @@ package seccomp
 #include <sys/syscall.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "../include/lxd_bpf.h"
+#include "../include/lxd_forksyscall.h"
 #include "../include/lxd_seccomp.h"
 #include "../include/memory_utils.h"
 #include "../include/process_utils.h"
@@ -246,6 +249,114 @@ static void prepare_seccomp_iovec(struct iovec *iov,
 	iov[3].iov_len = SECCOMP_COOKIE_SIZE;
 }
 
+#define SECCOMP_MEM_REGIONS_MAX 8
+
+// A part of the memory of the task which made the syscall, ret is the number of bytes read or -errno.
+struct seccomp_mem_region {
+	__u64 addr;
+	void *buf;
+	__u64 len;
+	__s64 ret;
+};
+
+// All buffers backing a single Iovec in one allocation. The scratch buffer holding the syscall
+// arguments read from the task's memory is kept when the buffer gets reused.
+struct seccomp_iovec_buf {
+	struct iovec iov[4];
+	struct seccomp_notify_proxy_msg msg;
+	struct seccomp_notif notif;
+	struct seccomp_notif_resp resp;
+	char cookie[SECCOMP_COOKIE_SIZE];
+	struct seccomp_mem_region regions[SECCOMP_MEM_REGIONS_MAX];
+	char *scratch;
+	size_t scratch_size;
+};
+
+static void init_seccomp_iovec_buf(struct seccomp_iovec_buf *buf)
+{
+	memset(buf, 0, sizeof(struct seccomp_iovec_buf));
+	prepare_seccomp_iovec(buf->iov, &buf->msg, &buf->notif, &buf->resp,
+			      buf->cookie);
+}
+
+static void free_seccomp_iovec_buf(struct seccomp_iovec_buf *buf)
+{
+	free(buf->scratch);
+	free(buf);
+}
+
+// seccomp_iovec_buf_scratch returns a zeroed scratch buffer of at least size bytes.
+static char *seccomp_iovec_buf_scratch(struct seccomp_iovec_buf *buf, size_t size)
+{
+	if (size > buf->scratch_size) {
+		char *scratch;
+
+		scratch = realloc(buf->scratch, size);
+		if (!scratch)
+			return NULL;
+
+		buf->scratch = scratch;
+		buf->scratch_size = size;
+	}
+
+	if (buf->scratch)
+		memset(buf->scratch, 0, size);
+
+	return buf->scratch;
+}
+
+// seccomp_read_mem reads the regions of the memory of the task which made the syscall with a
+// single process_vm_readv(). Regions it couldn't fully read, such as strings close to the end of
+// a mapping, are read through the memory file which handles partial reads, as is everything if
+// process_vm_readv() isn't usable. Regions with a NULL address are skipped.
+static int seccomp_read_mem(pid_t pid, int mem_fd, int notify_fd, __u64 id,
+			    struct seccomp_mem_region *regions, int n)
+{
+	struct iovec local[SECCOMP_MEM_REGIONS_MAX], remote[SECCOMP_MEM_REGIONS_MAX];
+	int idx[SECCOMP_MEM_REGIONS_MAX];
+	int count = 0, done = 0;
+	ssize_t bytes;
+
+	if (n > SECCOMP_MEM_REGIONS_MAX)
+		return -E2BIG;
+
+	for (int i = 0; i < n; i++) {
+		regions[i].ret = 0;
+		if (!regions[i].addr || !regions[i].len)
+			continue;
+
+		local[count].iov_base	= regions[i].buf;
+		local[count].iov_len	= regions[i].len;
+		remote[count].iov_base	= (void *)(uintptr_t)regions[i].addr;
+		remote[count].iov_len	= regions[i].len;
+		idx[count++]		= i;
+	}
+
+	if (count == 0)
+		return 0;
+
+	bytes = process_vm_readv(pid, local, count, remote, count, 0);
+	if (bytes > 0) {
+		// Unlike the memory file, the pid could have been reused if the task went away.
+		if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &id))
+			return -errno;
+
+		for (; done < count && (size_t)bytes >= local[done].iov_len; done++) {
+			regions[idx[done]].ret = local[done].iov_len;
+			bytes -= local[done].iov_len;
+		}
+	}
+
+	for (; done < count; done++) {
+		ssize_t ret;
+
+		ret = pread(mem_fd, local[done].iov_base, local[done].iov_len, regions[idx[done]].addr);
+		regions[idx[done]].ret = ret < 0 ? -errno : ret;
+	}
+
+	return 0;
+}
+
 // We use the BPF_DEVCG_DEV_CHAR macro as a cheap way to detect whether the kernel has
 // the correct headers available to be compiled for bpf support. Since cgo doesn't have
 // a good way of letting us probe for structs or enums the alternative would be to vendor
@@ -264,13 +375,338 @@ static inline int bpf(int cmd, union bpf_attr *attr, size_t size)
 	return syscall(__NR_bpf, cmd, attr, size);
 }
 
+// Device cgroup programs loaded on behalf of containers are cached by content. Each systemd unit
+// start loads a nearly always identical program, those loads then get a new file descriptor for
+// the already verified program rather than going through the verifier again. The kernel refuses
+// to attach one program twice to the same cgroup though, which systemd does when it attaches the
+// unchanged policy of a restarted unit before detaching the old one. Such attaches get a newly
+// loaded copy of the program instead.
+#define BPF_PROG_CACHE_SIZE 64
+#define BPF_PROG_CACHE_MAX_INSNS 4096
+
+struct bpf_prog_cache_entry {
+	uint64_t hash;
+	union bpf_attr attr;
+	char license[128];
+	struct bpf_insn *insn;
+	int fd;
+	__u32 id;
+	uint64_t last_used;
+};
+
+static struct bpf_prog_cache_entry bpf_prog_cache[BPF_PROG_CACHE_SIZE];
+static uint64_t bpf_prog_cache_clock;
+static pthread_mutex_t bpf_prog_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// bpf_prog_cacheable returns whether the program only depends on the attributes, the instructions
+// and the license, so not on objects referenced through the file descriptors of the container,
+// and whether the caller doesn't want the verifier log.
+static bool bpf_prog_cacheable(const union bpf_attr *attr)
+{
+	return attr->insn_cnt <= BPF_PROG_CACHE_MAX_INSNS && attr->log_level == 0 &&
+	       attr->prog_ifindex == 0 && attr->prog_btf_fd == 0 &&
+	       attr->func_info_cnt == 0 && attr->line_info_cnt == 0 &&
+	       attr->attach_prog_fd == 0;
+}
+
+// bpf_prog_cache_key clears the parts of the attributes which don't affect the loaded program.
+static void bpf_prog_cache_key(union bpf_attr *key, const union bpf_attr *attr)
+{
+	memcpy(key, attr, sizeof(*key));
+	key->insns	= 0;
+	key->license	= 0;
+	key->log_size	= 0;
+	key->log_buf	= 0;
+}
+
+static uint64_t bpf_prog_cache_hash(const union bpf_attr *key, const char *license,
+				    const struct bpf_insn *insn)
+{
+	const unsigned char *parts[] = { (const unsigned char *)key, (const unsigned char *)license,
+					 (const unsigned char *)insn };
+	size_t sizes[] = { sizeof(*key), strlen(license), sizeof(*insn) * key->insn_cnt };
+	uint64_t hash = 14695981039346656037ULL;
+
+	// FNV-1a
+	for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+		for (size_t j = 0; j < sizes[i]; j++) {
+			hash ^= parts[i][j];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+// bpf_prog_cache_get returns a new file descriptor for the cached program or -1 if not cached.
+static int bpf_prog_cache_get(uint64_t hash, const union bpf_attr *key, const char *license,
+			      const struct bpf_insn *insn)
+{
+	int fd = -1;
+
+	pthread_mutex_lock(&bpf_prog_cache_lock);
+	for (size_t i = 0; i < BPF_PROG_CACHE_SIZE; i++) {
+		struct bpf_prog_cache_entry *entry = &bpf_prog_cache[i];
+
+		if (!entry->insn || entry->hash != hash)
+			continue;
+
+		if (memcmp(&entry->attr, key, sizeof(*key)) ||
+		    strcmp(entry->license, license) ||
+		    memcmp(entry->insn, insn, sizeof(*insn) * key->insn_cnt))
+			continue;
+
+		fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+		if (fd >= 0)
+			entry->last_used = ++bpf_prog_cache_clock;
+
+		break;
+	}
+	pthread_mutex_unlock(&bpf_prog_cache_lock);
+
+	return fd;
+}
+
+// bpf_prog_id returns the ID of the loaded program or 0 if it can't be retrieved.
+static __u32 bpf_prog_id(int prog_fd)
+{
+	struct bpf_prog_info info = {};
+	union bpf_attr attr = {};
+
+	attr.info.bpf_fd	= prog_fd;
+	attr.info.info_len	= sizeof(info);
+	attr.info.info		= ptr_to_u64(&info);
+	if (bpf(BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof(attr)) < 0)
+		return 0;
+
+	return info.id;
+}
+
+// bpf_prog_cache_add caches the program, taking ownership of insn on success.
+static bool bpf_prog_cache_add(uint64_t hash, const union bpf_attr *key, const char *license,
+			       struct bpf_insn *insn, int prog_fd)
+{
+	struct bpf_prog_cache_entry *entry = &bpf_prog_cache[0];
+	size_t license_len;
+	__u32 id;
+	int fd;
+
+	license_len = strlen(license);
+	if (license_len >= sizeof(entry->license))
+		return false;
+
+	id = bpf_prog_id(prog_fd);
+	if (!id)
+		return false;
+
+	fd = fcntl(prog_fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+
+	pthread_mutex_lock(&bpf_prog_cache_lock);
+
+	// Take a free slot or the least recently used one.
+	for (size_t i = 0; i < BPF_PROG_CACHE_SIZE; i++) {
+		if (!bpf_prog_cache[i].insn) {
+			entry = &bpf_prog_cache[i];
+			break;
+		}
+
+		if (bpf_prog_cache[i].last_used < entry->last_used)
+			entry = &bpf_prog_cache[i];
+	}
+
+	// Programs evicted from the cache stay loaded for as long as containers use them.
+	if (entry->insn) {
+		close(entry->fd);
+		free(entry->insn);
+	}
+
+	entry->hash		= hash;
+	entry->insn		= insn;
+	entry->fd		= fd;
+	entry->id		= id;
+	entry->last_used	= ++bpf_prog_cache_clock;
+	memcpy(&entry->attr, key, sizeof(*key));
+	memset(entry->license, 0, sizeof(entry->license));
+	memcpy(entry->license, license, license_len);
+
+	pthread_mutex_unlock(&bpf_prog_cache_lock);
+
+	return true;
+}
+
+// bpf_prog_cache_reload loads a new copy of the cached program prog_fd refers to. It returns -1
+// with errno set to ENOENT if the program isn't one of the cached ones.
+static int bpf_prog_cache_reload(int prog_fd)
+{
+	__do_free struct bpf_insn *insn = NULL;
+	char license[128];
+	union bpf_attr attr = {};
+	int error = ENOENT;
+	__u32 id;
+
+	id = bpf_prog_id(prog_fd);
+	if (!id) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&bpf_prog_cache_lock);
+	for (size_t i = 0; i < BPF_PROG_CACHE_SIZE; i++) {
+		struct bpf_prog_cache_entry *entry = &bpf_prog_cache[i];
+		size_t insn_size;
+
+		if (!entry->insn || entry->id != id)
+			continue;
+
+		insn_size = sizeof(*insn) * entry->attr.insn_cnt;
+		insn = malloc(insn_size);
+		if (insn) {
+			memcpy(insn, entry->insn, insn_size);
+			memcpy(&attr, &entry->attr, sizeof(attr));
+			memcpy(license, entry->license, sizeof(license));
+		} else {
+			error = ENOMEM;
+		}
+
+		break;
+	}
+	pthread_mutex_unlock(&bpf_prog_cache_lock);
+
+	if (!insn) {
+		errno = error;
+		return -1;
+	}
+
+	attr.insns	= ptr_to_u64(insn);
+	attr.license	= ptr_to_u64(license);
+
+	return bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
+}
+
+// bpf_prog_load_cached loads the program of attr through the cache. new_attr holds what's passed
+// to the kernel on a miss, with the log buffer already set up. The cache takes ownership of *insn
+// when adding the program, setting it to NULL.
+static int bpf_prog_load_cached(const union bpf_attr *attr, union bpf_attr *new_attr,
+				const char *license, struct bpf_insn **insn, bool *cached)
+{
+	union bpf_attr key = {};
+	uint64_t hash = 0;
+	bool cacheable;
+	int fd;
+
+	*cached = false;
+
+	cacheable = bpf_prog_cacheable(attr);
+	if (cacheable) {
+		bpf_prog_cache_key(&key, attr);
+		hash = bpf_prog_cache_hash(&key, license, *insn);
+		fd = bpf_prog_cache_get(hash, &key, license, *insn);
+		if (fd >= 0) {
+			*cached = true;
+			return fd;
+		}
+	}
+
+	new_attr->insns		= ptr_to_u64(*insn);
+	new_attr->license	= ptr_to_u64(license);
+	fd = bpf(BPF_PROG_LOAD, new_attr, sizeof(*new_attr));
+	if (fd < 0)
+		return -1;
+
+	if (cacheable && bpf_prog_cache_add(hash, &key, license, *insn, fd))
+		*insn = NULL;
+
+	return fd;
+}
+
+// bpf_prog_attach_cached attaches a program, attaching a new copy of it instead if it's a cached
+// program already attached to the cgroup. The copy is returned in *copy_fd, -1 otherwise, so the
+// caller can swap it into the container in place of the cached one.
+static int bpf_prog_attach_cached(union bpf_attr *attr, unsigned int attr_len, int *copy_fd)
+{
+	int fd;
+
+	*copy_fd = -1;
+
+	if (bpf(BPF_PROG_ATTACH, attr, attr_len) == 0)
+		return 0;
+
+	if (errno != EINVAL || !(attr->attach_flags & BPF_F_ALLOW_MULTI))
+		return -1;
+
+	fd = bpf_prog_cache_reload(attr->attach_bpf_fd);
+	if (fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	attr->attach_bpf_fd = fd;
+	if (bpf(BPF_PROG_ATTACH, attr, attr_len) < 0) {
+		int saved_errno = errno;
+
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	*copy_fd = fd;
+	return 0;
+}
+
+// bpf_device_prog_load loads a device cgroup program like an intercepted load, taking ownership
+// of insn. Only used by the tests of the program cache.
+static int bpf_device_prog_load(struct bpf_insn *insn, __u32 insn_cnt, const char *license,
+				bool *cached)
+{
+	union bpf_attr attr = {}, new_attr;
+	char license_buf[128] = {};
+	size_t license_len;
+	int fd;
+
+	// Same zero padded license buffer as intercepted loads.
+	license_len = strlen(license);
+	if (license_len >= sizeof(license_buf)) {
+		free(insn);
+		errno = EINVAL;
+		return -1;
+	}
+
+	memcpy(license_buf, license, license_len);
+
+	attr.prog_type	= BPF_PROG_TYPE_CGROUP_DEVICE;
+	attr.insn_cnt	= insn_cnt;
+	memcpy(&new_attr, &attr, sizeof(attr));
+
+	fd = bpf_prog_load_cached(&attr, &new_attr, license_buf, &insn, cached);
+	free(insn);
+
+	return fd;
+}
+
+// bpf_device_prog_attach attaches a device cgroup program like an intercepted attach. Only used by
+// the tests of the program cache.
+static int bpf_device_prog_attach(int target_fd, int prog_fd, __u32 flags, int *copy_fd)
+{
+	union bpf_attr attr = {};
+
+	attr.target_fd		= target_fd;
+	attr.attach_bpf_fd	= prog_fd;
+	attr.attach_type	= BPF_CGROUP_DEVICE;
+	attr.attach_flags	= flags;
+
+	return bpf_prog_attach_cached(&attr, sizeof(attr), copy_fd);
+}
+
 static int handle_bpf_syscall(pid_t pid_target, int notify_fd, int mem_fd,
 			      int tgid, struct seccomp_notify_proxy_msg *msg,
 			      struct seccomp_notif *req, struct seccomp_notif_resp *resp,
-			      int *bpf_cmd, int *bpf_prog_type, int *bpf_attach_type)
+			      int *bpf_cmd, int *bpf_prog_type, int *bpf_attach_type,
+			      bool *bpf_prog_cached)
 {
 	__do_close int pidfd = -EBADF, bpf_target_fd = -EBADF, bpf_attach_fd = -EBADF,
-		       bpf_prog_fd = -EBADF;
+		       bpf_prog_fd = -EBADF, bpf_copy_fd = -EBADF;
 	__do_free struct bpf_insn *insn = NULL;
 	char log_buf[4096] = {};
 	char license[128] = {};
@@ -278,12 +714,14 @@ static int handle_bpf_syscall(pid_t pid_target, int notify_fd, int mem_fd,
 	union bpf_attr attr = {}, new_attr = {};
 	unsigned int attr_len = sizeof(attr);
 	struct seccomp_notif_addfd addfd = {};
+	struct seccomp_mem_region regions[2] = {};
 	int ret;
 	int cmd;
 
 	*bpf_cmd		= -EINVAL;
 	*bpf_prog_type		= -EINVAL;
 	*bpf_attach_type	= -EINVAL;
+	*bpf_prog_cached	= false;
 
 	if (attr_len < req->data.args[2])
 		return -EFBIG;
@@ -333,11 +771,21 @@ static int handle_bpf_syscall(pid_t pid_target, int notify_fd, int mem_fd,
 		if (!insn)
 			return -ENOMEM;
 
-		ret = pread(mem_fd, insn, insn_size, attr.insns);
+		regions[0].addr	= attr.insns;
+		regions[0].buf	= insn;
+		regions[0].len	= insn_size;
+		regions[1].addr	= attr.license;
+		regions[1].buf	= license;
+		regions[1].len	= sizeof(license);
+		ret = seccomp_read_mem(pid_target, mem_fd, notify_fd, req->id, regions, 2);
 		if (ret < 0)
-			return -errno;
-		if (ret != insn_size)
+			return ret;
+		if (regions[0].ret < 0)
+			return regions[0].ret;
+		if (regions[0].ret != insn_size)
 			return -EIO;
+		if (regions[1].ret < 0)
+			return regions[1].ret;
 
 		memcpy(&new_attr, &attr, sizeof(attr));
 
@@ -347,12 +795,11 @@ static int handle_bpf_syscall(pid_t pid_target, int notify_fd, int mem_fd,
 		if (new_attr.log_size > 0)
 			new_attr.log_buf = ptr_to_u64(log_buf);
 
-		if (attr.license && pread(mem_fd, license, sizeof(license), attr.license) < 0)
-			return -errno;
+		// Only keep the string, whatever followed it was read as well.
+		license[sizeof(license) - 1] = '\0';
+		memset(license + strlen(license), 0, sizeof(license) - strlen(license));
 
-		new_attr.insns		= ptr_to_u64(insn);
-		new_attr.license	= ptr_to_u64(license);
-		bpf_prog_fd = bpf(cmd, &new_attr, sizeof(new_attr));
+		bpf_prog_fd = bpf_prog_load_cached(&attr, &new_attr, license, &insn, bpf_prog_cached);
 		if (bpf_prog_fd < 0) {
 			int saved_errno = errno;
 
@@ -401,9 +848,25 @@ static int handle_bpf_syscall(pid_t pid_target, int notify_fd, int mem_fd,
 				return -EINVAL;
 		}
 
+		addfd.newfd		= attr.attach_bpf_fd;
 		attr.target_fd		= bpf_target_fd;
 		attr.attach_bpf_fd	= bpf_attach_fd;
-		ret = bpf(cmd, &attr, attr_len);
+		ret = bpf_prog_attach_cached(&attr, attr_len, &bpf_copy_fd);
+		if (ret < 0 || bpf_copy_fd < 0)
+			break;
+
+		// Make the container's descriptor refer to the attached copy, so detaching it works.
+		addfd.srcfd		= bpf_copy_fd;
+		addfd.id		= req->id;
+		addfd.flags		= SECCOMP_ADDFD_FLAG_SETFD;
+		addfd.newfd_flags	= O_CLOEXEC;
+		if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd) < 0) {
+			int saved_errno = errno;
+
+			bpf(BPF_PROG_DETACH, &attr, attr_len);
+			return -saved_errno;
+		}
+
 		break;
 	case BPF_PROG_DETACH:
 		if (attr.attach_type != BPF_CGROUP_DEVICE)
@@ -479,6 +942,7 @@ import (
 	"runtime"
 	"strconv"
 	"strings"
+	"sync"
 	"time"
 	"unsafe"
 
@@ -490,6 +954,7 @@ import (
 	"github.com/canonical/lxd/lxd/idmap"
 	_ "github.com/canonical/lxd/lxd/include" // Used by cgo
 	"github.com/canonical/lxd/lxd/linux"
+	"github.com/canonical/lxd/lxd/metrics"
 	"github.com/canonical/lxd/lxd/project"
 	"github.com/canonical/lxd/lxd/state"
 	"github.com/canonical/lxd/lxd/subprocess"
@@ -902,6 +1367,11 @@ type Server struct {
 	s    *state.State
 	path string
 	l    net.Listener
+
+	dispatcher *dispatcher
+	stats      *syscallStats
+	sysinfo    *sysinfoCache
+	helpers    *syscallHelpers
 }
 
 // Iovec defines an iovec to move data between kernel and userspace.
@@ -910,46 +1380,137 @@ type Iovec struct {
 	memFd    int
 	procFd   int
 	notifyFd int
+	buf      *C.struct_seccomp_iovec_buf
 	msg      *C.struct_seccomp_notify_proxy_msg
 	req      *C.struct_seccomp_notif
 	resp     *C.struct_seccomp_notif_resp
 	cookie   *C.char
 	iov      *C.struct_iovec
+	received time.Time
+
+	// Connection the notification was received on.
+	client *seccompClient
 }
 
-// NewSeccompIovec creates a new seccomp iovec.
-func NewSeccompIovec(ucred *unix.Ucred) *Iovec {
-	msgPtr := C.malloc(C.sizeof_struct_seccomp_notify_proxy_msg)
-	msg := (*C.struct_seccomp_notify_proxy_msg)(msgPtr)
-	C.memset(msgPtr, 0, C.sizeof_struct_seccomp_notify_proxy_msg)
+// seccompClient is the state of a seccomp client connection shared by its notification handlers.
+type seccompClient struct {
+	queue  *dispatchQueue
+	idmaps *idmapCache
+
+	mu sync.Mutex
+
+	// Instances whose notifications were handled, holding a reference on their statistics.
+	instances map[syscallStatsInstance]struct{}
+
+	// Init PIDs of the notifications, their syscall helpers are stopped along with the connection.
+	initPIDs map[int32]struct{}
+}
+
+func newSeccompClient(queue *dispatchQueue) *seccompClient {
+	return &seccompClient{
+		queue:     queue,
+		idmaps:    newIdmapCache(),
+		instances: map[syscallStatsInstance]struct{}{},
+		initPIDs:  map[int32]struct{}{},
+	}
+}
 
-	regPtr := C.malloc(C.sizeof_struct_seccomp_notif)
-	req := (*C.struct_seccomp_notif)(regPtr)
-	C.memset(regPtr, 0, C.sizeof_struct_seccomp_notif)
+// received records the init PID of a notification received on the connection.
+func (c *seccompClient) received(initPID int32) {
+	c.mu.Lock()
+	c.initPIDs[initPID] = struct{}{}
+	c.mu.Unlock()
+}
 
-	respPtr := C.malloc(C.sizeof_struct_seccomp_notif_resp)
-	resp := (*C.struct_seccomp_notif_resp)(respPtr)
-	C.memset(respPtr, 0, C.sizeof_struct_seccomp_notif_resp)
+// handled records that a notification of the instance was handled through the connection.
+func (c *seccompClient) handled(stats *syscallStats, inst syscallStatsInstance) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
 
-	cookiePtr := C.malloc(64 * C.sizeof_char)
-	cookie := (*C.char)(cookiePtr)
-	C.memset(cookiePtr, 0, 64*C.sizeof_char)
+	_, ok := c.instances[inst]
+	if !ok {
+		c.instances[inst] = struct{}{}
+		stats.acquire(inst)
+	}
+}
 
-	iovUnsafePtr := C.malloc(4 * C.sizeof_struct_iovec)
-	iov := (*C.struct_iovec)(iovUnsafePtr)
-	C.memset(iovUnsafePtr, 0, 4*C.sizeof_struct_iovec)
+// close drops the references of the connection and stops its syscall helpers once its last
+// notification has been handled.
+func (c *seccompClient) close(stats *syscallStats, helpers *syscallHelpers) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
 
-	C.prepare_seccomp_iovec(iov, msg, req, resp, cookie)
+	for inst := range c.instances {
+		stats.release(inst)
+	}
+
+	if helpers != nil {
+		for initPID := range c.initPIDs {
+			helpers.forget(initPID)
+		}
+	}
+
+	clear(c.instances)
+	clear(c.initPIDs)
+}
+
+// idmaps returns the compiled idmap cache of the connection, nil if not received on one.
+func (siov *Iovec) idmaps() *idmapCache {
+	if siov.client == nil {
+		return nil
+	}
+
+	return siov.client.idmaps
+}
+
+// iovecBufPoolSize is the maximum number of idle Iovec buffers kept around for reuse.
+const iovecBufPoolSize = 64
+
+// iovecBufPool holds idle Iovec buffers so that receiving a notification doesn't need to allocate.
+var iovecBufPool = make(chan *C.struct_seccomp_iovec_buf, iovecBufPoolSize)
+
+// getIovecBuf returns a zeroed Iovec buffer, reusing an idle one if possible.
+func getIovecBuf() *C.struct_seccomp_iovec_buf {
+	select {
+	case buf := <-iovecBufPool:
+		// The iovec array keeps pointing at the other members so only clear the data.
+		buf.msg = C.struct_seccomp_notify_proxy_msg{}
+		buf.notif = C.struct_seccomp_notif{}
+		buf.resp = C.struct_seccomp_notif_resp{}
+		buf.cookie = [len(buf.cookie)]C.char{}
+		return buf
+	default:
+	}
+
+	buf := (*C.struct_seccomp_iovec_buf)(C.malloc(C.sizeof_struct_seccomp_iovec_buf))
+	C.init_seccomp_iovec_buf(buf)
+
+	return buf
+}
+
+// putIovecBuf returns an Iovec buffer to the pool or frees it if the pool is full.
+func putIovecBuf(buf *C.struct_seccomp_iovec_buf) {
+	select {
+	case iovecBufPool <- buf:
+	default:
+		C.free_seccomp_iovec_buf(buf)
+	}
+}
+
+// NewSeccompIovec creates a new seccomp iovec.
+func NewSeccompIovec(ucred *unix.Ucred) *Iovec {
+	buf := getIovecBuf()
 
 	return &Iovec{
 		memFd:    -1,
 		procFd:   -1,
 		notifyFd: -1,
-		msg:      msg,
-		req:      req,
-		resp:     resp,
-		cookie:   cookie,
-		iov:      iov,
+		buf:      buf,
+		msg:      &buf.msg,
+		req:      &buf.notif,
+		resp:     &buf.resp,
+		cookie:   &buf.cookie[0],
+		iov:      &buf.iov[0],
 		ucred:    ucred,
 	}
 }
@@ -968,11 +1529,78 @@ func (siov *Iovec) PutSeccompIovec() {
 		_ = unix.Close(siov.notifyFd)
 	}
 
-	C.free(unsafe.Pointer(siov.msg))
-	C.free(unsafe.Pointer(siov.req))
-	C.free(unsafe.Pointer(siov.resp))
-	C.free(unsafe.Pointer(siov.cookie))
-	C.free(unsafe.Pointer(siov.iov))
+	if siov.buf != nil {
+		putIovecBuf(siov.buf)
+		siov.buf = nil
+	}
+}
+
+// xattrSizeMax is the largest extended attribute value the kernel accepts.
+const xattrSizeMax = 64 * 1024
+
+// memRegion is a part of the memory of the task which made the syscall.
+type memRegion struct {
+	addr uint64
+	size int
+}
+
+// readMemory reads the regions of the memory of the task which made the syscall, all of them with a
+// single syscall when possible. Regions at a NULL address are returned empty, the others may be
+// shorter than requested if they run past the end of a mapping. The returned slices point into
+// the scratch buffer of the Iovec and are only valid until the next call.
+func (siov *Iovec) readMemory(regions ...memRegion) ([][]byte, error) {
+	if len(regions) > C.SECCOMP_MEM_REGIONS_MAX {
+		return nil, fmt.Errorf("Too many memory regions: %d", len(regions))
+	}
+
+	total := 0
+	for _, r := range regions {
+		total += r.size
+	}
+
+	scratch := unsafe.Pointer(C.seccomp_iovec_buf_scratch(siov.buf, C.size_t(total)))
+	if scratch == nil && total > 0 {
+		return nil, fmt.Errorf("Failed to allocate memory")
+	}
+
+	offset := 0
+	for i, r := range regions {
+		region := &siov.buf.regions[i]
+		region.addr = C.__u64(r.addr)
+		region.buf = unsafe.Add(scratch, offset)
+		region.len = C.__u64(r.size)
+		offset += r.size
+	}
+
+	ret := C.seccomp_read_mem(C.pid_t(siov.req.pid), C.int(siov.memFd), C.int(siov.notifyFd), siov.req.id, &siov.buf.regions[0], C.int(len(regions)))
+	if ret < 0 {
+		return nil, unix.Errno(-ret)
+	}
+
+	data := unsafe.Slice((*byte)(scratch), total)
+	out := make([][]byte, len(regions))
+	offset = 0
+	for i, r := range regions {
+		n := int64(siov.buf.regions[i].ret)
+		if n < 0 {
+			return nil, unix.Errno(-n)
+		}
+
+		out[i] = data[offset : offset+int(n)]
+		offset += r.size
+	}
+
+	return out, nil
+}
+
+// cString returns the NUL terminated string at the start of b.
+func cString(b []byte) string {
+	n := bytes.IndexByte(b, 0)
+	if n < 0 {
+		return string(b)
+	}
+
+	return string(b[:n])
 }
 
 // ReceiveSeccompIovec receives a seccomp iovec.
@@ -985,11 +1613,94 @@ func (siov *Iovec) ReceiveSeccompIovec(fd int) (uint64, error) {
 	siov.procFd = int(fds[0])
 	siov.memFd = int(fds[1])
 	siov.notifyFd = int(fds[2])
+	siov.received = time.Now()
 	logger.Debugf("Syscall handler received fds %d(/proc/<pid>), %d(/proc/<pid>/mem), and %d([seccomp notify])", siov.procFd, siov.memFd, siov.notifyFd)
 
 	return bytes, nil
 }
 
+// iovecReceiver receives the notifications of a connection in batches, starting with a single one
+// and growing the batch under load.
+type iovecReceiver struct {
+	fd    int
+	ucred *unix.Ucred
+	batch *netutils.AbstractUnixFdsBatch
+
+	// Iovecs waiting for a notification and their iovec arrays.
+	siovs []*Iovec
+	iovs  []unsafe.Pointer
+
+	// Iovecs which received a notification and their sizes.
+	received []*Iovec
+	sizes    []uint64
+}
+
+func newIovecReceiver(fd int, ucred *unix.Ucred) (*iovecReceiver, error) {
+	batch, err := netutils.NewAbstractUnixFdsBatch(3, netutils.UnixFdsAcceptLess)
+	if err != nil {
+		return nil, err
+	}
+
+	r := &iovecReceiver{fd: fd, ucred: ucred, batch: batch}
+	r.grow(1)
+
+	return r, nil
+}
+
+func (r *iovecReceiver) grow(size int) {
+	for len(r.siovs) < size {
+		siov := NewSeccompIovec(r.ucred)
+		r.siovs = append(r.siovs, siov)
+		r.iovs = append(r.iovs, unsafe.Pointer(siov.iov))
+	}
+}
+
+// receive waits for notifications and returns those queued on the socket along with their size.
+// The returned slices are only valid until the next call.
+func (r *iovecReceiver) receive() ([]*Iovec, []uint64, error) {
+	n, err := r.batch.Receive(r.fd, r.iovs, 4)
+	if err != nil {
+		return nil, nil, err
+	}
+
+	r.received = r.received[:0]
+	r.sizes = r.sizes[:0]
+	now := time.Now()
+
+	for i := 0; i < n; i++ {
+		siov := r.siovs[i]
+		siov.procFd = r.batch.Fd(i, 0)
+		siov.memFd = r.batch.Fd(i, 1)
+		siov.notifyFd = r.batch.Fd(i, 2)
+		siov.received = now
+		logger.Debugf("Syscall handler received fds %d(/proc/<pid>), %d(/proc/<pid>/mem), and %d([seccomp notify])", siov.procFd, siov.memFd, siov.notifyFd)
+
+		r.received = append(r.received, siov)
+		r.sizes = append(r.sizes, r.batch.Size(i))
+
+		// The Iovec now belongs to its handler.
+		r.siovs[i] = NewSeccompIovec(r.ucred)
+		r.iovs[i] = unsafe.Pointer(r.siovs[i].iov)
+	}
+
+	if n == len(r.siovs) && n < netutils.AbstractUnixFdsBatchMax {
+		r.grow(min(2*n, netutils.AbstractUnixFdsBatchMax))
+	}
+
+	return r.received, r.sizes, nil
+}
+
+// free releases the Iovecs waiting for a notification and the batch.
+func (r *iovecReceiver) free() {
+	for _, siov := range r.siovs {
+		siov.PutSeccompIovec()
+	}
+
+	r.siovs = nil
+	r.iovs = nil
+	r.batch.Free()
+}
+
 // IsValidSeccompIovec checks whether a seccomp iovec is valid.
 func (siov *Iovec) IsValidSeccompIovec(size uint64) bool {
 	if size < uint64(C.SECCOMP_MSG_SIZE_MIN) {
@@ -1080,10 +1791,15 @@ func NewSeccompServer(s *state.State, path string, findPID func(pid int32, state
 	}
 
 	// Start the server
+	workers := dispatchWorkers()
 	server := Server{
-		s:    s,
-		path: path,
-		l:    l,
+		s:          s,
+		path:       path,
+		l:          l,
+		dispatcher: newDispatcher(workers, dispatchQueueLimit(), dispatchQueueWorkers(workers)),
+		stats:      newSyscallStats(),
+		sysinfo:    newSysinfoCache(sysinfoCacheTTL),
+		helpers:    newSyscallHelpers(s),
 	}
 
 	go func() {
@@ -1108,19 +1824,37 @@ func NewSeccompServer(s *state.State, path string, findPID func(pid int32, state
 					return
 				}
 
+				client := newSeccompClient(server.dispatcher.newQueue())
+
+				receiver, err := newIovecReceiver(int(unixFile.Fd()), ucred)
+				if err != nil {
+					logger.Errorf("Unable to setup seccomp socket receiver: %v", err)
+					_ = c.Close()
+					return
+				}
+
+				defer receiver.free()
+
 				for {
-					siov := NewSeccompIovec(ucred)
-					bytes, err := siov.ReceiveSeccompIovec(int(unixFile.Fd()))
+					siovs, sizes, err := receiver.receive()
 					if err != nil {
 						logger.Debugf("Disconnected from seccomp socket after failed receive: pid=%v, err=%s", ucred.Pid, err)
 						_ = c.Close()
+
+						// Handlers still queued can use the connection state.
+						server.dispatcher.release(client.queue, func() { client.close(server.stats, server.helpers) })
+
 						return
 					}
 
-					if siov.IsValidSeccompIovec(bytes) {
-						go func() { _ = server.HandleValid(int(unixFile.Fd()), siov, findPID) }()
-					} else {
-						go server.HandleInvalid(int(unixFile.Fd()), siov)
+					for i, siov := range siovs {
+						if siov.IsValidSeccompIovec(sizes[i]) {
+							siov.client = client
+							client.received(int32(siov.msg.init_pid))
+							server.dispatcher.submit(client.queue, func() { _ = server.HandleValid(int(unixFile.Fd()), siov, findPID) })
+						} else {
+							go server.HandleInvalid(int(unixFile.Fd()), siov)
+						}
 					}
 				}
 			}()
@@ -1357,7 +2091,24 @@ func (s *Server) doDeviceSyscall(c Instance, args *MknodArgs, siov *Iovec) int {
 		return int(-C.EPERM)
 	}
 
-	errno := CallForkmknod(c, dev, int(args.cPid), s.s)
+	errno, ok := s.helperSyscall(siov, int(args.cPid), func(req *C.struct_forksyscall_helper_req) bool {
+		uid, gid, fsuid, fsgid, err := TaskIDs(int(args.cPid))
+		if err != nil {
+			return false
+		}
+
+		req.syscall = C.FORKSYSCALL_HELPER_MKNOD
+		req.uid, req.gid = C.__u32(uid), C.__u32(gid)
+		req.fsuid, req.fsgid = C.__u32(fsuid), C.__u32(fsgid)
+		req.mode = C.__u32(args.cMode)
+		req.dev = C.__u64(args.cDev)
+
+		return setHelperString(req.path[:], args.path)
+	})
+	if !ok {
+		errno = CallForkmknod(c, dev, int(args.cPid), s.s)
+	}
+
 	if errno != int(-C.ENOMEDIUM) {
 		return errno
 	}
@@ -1537,7 +2288,7 @@ func (s *Server) HandleSetxattrSyscall(c Instance, siov *Iovec) int {
 		return int(-C.EPERM)
 	}
 
-	idmapset, err := c.CurrentIdmap()
+	idmapset, err := siov.idmaps().get(int32(siov.msg.init_pid), c)
 	if err != nil {
 		if s.s.OS.SeccompListenerContinue {
 			ctx["syscall_continue"] = "true"
@@ -1551,45 +2302,21 @@ func (s *Server) HandleSetxattrSyscall(c Instance, siov *Iovec) int {
 	args.nsuid, args.nsgid = idmapset.ShiftFromNs(uid, gid)
 	args.nsfsuid, args.nsfsgid = idmapset.ShiftFromNs(fsuid, fsgid)
 
-	// const char *path
-	cBuf := [unix.PathMax]C.char{}
-	_, err = C.pread(C.int(siov.memFd), unsafe.Pointer(&cBuf[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[0]))
-	if err != nil {
-		ctx["err"] = fmt.Sprintf("Failed to read memory for setxattr syscall: %s", err)
-		if s.s.OS.SeccompListenerContinue {
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
-
-		return int(-C.EPERM)
-	}
-
-	args.path = C.GoString(&cBuf[0])
-
-	// const char *name
-	_, err = C.pread(C.int(siov.memFd), unsafe.Pointer(&cBuf[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[1]))
-	if err != nil {
-		ctx["err"] = fmt.Sprintf("Failed to read memory for setxattr syscall: %s", err)
-		if s.s.OS.SeccompListenerContinue {
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
-
-		return int(-C.EPERM)
-	}
-
-	args.name = C.GoString(&cBuf[0])
-
 	// size_t size
 	args.size = int(siov.req.data.args[3])
+	if args.size > xattrSizeMax {
+		return int(-C.E2BIG)
+	}
 
 	// int flags
 	args.flags = C.int(siov.req.data.args[4])
 
-	buf := make([]byte, args.size)
-	_, err = C.pread(C.int(siov.memFd), unsafe.Pointer(&buf[0]), C.size_t(args.size), C.off_t(siov.req.data.args[2]))
+	// const char *path, const char *name, const void *value
+	mem, err := siov.readMemory(
+		memRegion{addr: uint64(siov.req.data.args[0]), size: unix.PathMax},
+		memRegion{addr: uint64(siov.req.data.args[1]), size: unix.PathMax},
+		memRegion{addr: uint64(siov.req.data.args[2]), size: args.size},
+	)
 	if err != nil {
 		ctx["err"] = fmt.Sprintf("Failed to read memory for setxattr syscall: %s", err)
 		if s.s.OS.SeccompListenerContinue {
@@ -1601,7 +2328,10 @@ func (s *Server) HandleSetxattrSyscall(c Instance, siov *Iovec) int {
 		return int(-C.EPERM)
 	}
 
-	args.value = buf
+	args.path = cString(mem[0])
+	args.name = cString(mem[1])
+	args.value = make([]byte, args.size)
+	copy(args.value, mem[2])
 
 	whiteout := 0
 	if string(args.name) == "trusted.overlay.opaque" && string(args.value) == "y" {
@@ -1612,6 +2342,25 @@ func (s *Server) HandleSetxattrSyscall(c Instance, siov *Iovec) int {
 		return 0
 	}
 
+	errno, ok := s.helperSyscall(siov, args.pid, func(req *C.struct_forksyscall_helper_req) bool {
+		if args.size > len(req.value) {
+			return false
+		}
+
+		req.syscall = C.FORKSYSCALL_HELPER_SETXATTR
+		req.uid, req.gid = C.__u32(args.nsuid), C.__u32(args.nsgid)
+		req.fsuid, req.fsgid = C.__u32(args.nsfsuid), C.__u32(args.nsfsgid)
+		req.flags = C.__s32(args.flags)
+		req.whiteout = C.__s32(whiteout)
+		req.size = C.__u32(args.size)
+		copy(unsafe.Slice((*byte)(unsafe.Pointer(&req.value[0])), len(req.value)), args.value)
+
+		return setHelperString(req.path[:], args.path) && setHelperString(req.name[:], args.name)
+	})
+	if ok {
+		return errno
+	}
+
 	_, stderr, err := shared.RunCommandSplit(
 		context.TODO(),
 		nil,
@@ -1688,7 +2437,7 @@ func (s *Server) HandleSchedSetschedulerSyscall(c Instance, siov *Iovec) int {
 		return int(-C.EPERM)
 	}
 
-	idmapset, err := c.CurrentIdmap()
+	idmapset, err := siov.idmaps().get(int32(siov.msg.init_pid), c)
 	if err != nil {
 		if s.s.OS.SeccompListenerContinue {
 			ctx["syscall_continue"] = "true"
@@ -1816,32 +2565,53 @@ func (s *Server) HandleSysinfoSyscall(c Instance, siov *Iovec) int {
 		return 0
 	}
 
-	instMetrics := Sysinfo{} // Architecture independent place to hold instance metrics.
-
-	cg, err := cgroup.NewFileReadWriter(int(siov.msg.init_pid), liblxc.HasAPIExtension("cgroup2"))
+	// Architecture independent instance metrics, served from memory on repeated calls.
+	instMetrics, err := s.sysinfo.get(int32(siov.msg.init_pid), s.instanceSysinfo)
 	if err != nil {
-		l.Warn("Failed loading cgroup", logger.Ctx{"err": err, "pid": siov.msg.init_pid})
+		l.Warn("Failed getting instance sysinfo", logger.Ctx{"err": err, "pid": siov.msg.init_pid})
 		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
 
 		return 0
 	}
 
-	// Get instance uptime.
-	pidStat, err := os.ReadFile(fmt.Sprintf("/proc/%d/stat", siov.msg.init_pid))
+	// Get writable pointer to buffer of sysinfo syscall result.
+	const sz = int(unsafe.Sizeof(info))
+	var b []byte = (*(*[sz]byte)(unsafe.Pointer(&info)))[:]
+
+	// Write instance metrics to native sysinfo struct.
+	instMetrics.ToNative(&info)
+
+	// Write sysinfo response into buffer.
+	_, err = unix.Pwrite(siov.memFd, b, int64(siov.req.data.args[0]))
 	if err != nil {
-		l.Warn("Failed getting init process info", logger.Ctx{"err": err, "pid": siov.msg.init_pid})
+		l.Warn("Failed writing sysinfo", logger.Ctx{"err": err})
 		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
 
 		return 0
 	}
 
+	return 0
+}
+
+// instanceSysinfo collects the cgroup and uptime based sysinfo values of an instance.
+func (s *Server) instanceSysinfo(initPID int32) (*Sysinfo, error) {
+	instMetrics := Sysinfo{} // Architecture independent place to hold instance metrics.
+
+	cg, err := cgroup.NewFileReadWriter(int(initPID), liblxc.HasAPIExtension("cgroup2"))
+	if err != nil {
+		return nil, fmt.Errorf("Failed loading cgroup: %w", err)
+	}
+
+	// Get instance uptime.
+	pidStat, err := os.ReadFile(fmt.Sprintf("/proc/%d/stat", initPID))
+	if err != nil {
+		return nil, fmt.Errorf("Failed getting init process info: %w", err)
+	}
+
 	fields := strings.Fields(string(pidStat))
 	tickValue, err := strconv.ParseInt(fields[21], 10, 64)
 	if err != nil {
-		l.Warn("Failed parsing init process info", logger.Ctx{"err": err, "pid": siov.msg.init_pid})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
+		return nil, fmt.Errorf("Failed parsing init process info: %w", err)
 	}
 
 	age := float64(tickValue / 100)
@@ -1852,10 +2622,7 @@ func (s *Server) HandleSysinfoSyscall(c Instance, siov *Iovec) int {
 	// Get instance process count.
 	pids, err := cg.GetProcessesUsage()
 	if err != nil {
-		l.Warn("Failed getting process count", logger.Ctx{"err": err})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
+		return nil, fmt.Errorf("Failed getting process count: %w", err)
 	}
 
 	instMetrics.Procs = uint16(pids)
@@ -1863,10 +2630,7 @@ func (s *Server) HandleSysinfoSyscall(c Instance, siov *Iovec) int {
 	// Get instance memory stats.
 	memStats, err := cg.GetMemoryStats()
 	if err != nil {
-		l.Warn("Failed getting memory stats", logger.Ctx{"err": err})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
+		return nil, fmt.Errorf("Failed getting memory stats: %w", err)
 	}
 
 	for k, v := range memStats {
@@ -1881,19 +2645,13 @@ func (s *Server) HandleSysinfoSyscall(c Instance, siov *Iovec) int {
 	// Get instance memory limit.
 	memoryLimit, err := cg.GetEffectiveMemoryLimit()
 	if err != nil {
-		l.Warn("Failed getting effective memory limit", logger.Ctx{"err": err})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
+		return nil, fmt.Errorf("Failed getting effective memory limit: %w", err)
 	}
 
 	// Get instance memory usage.
 	memoryUsage, err := cg.GetMemoryUsage()
 	if err != nil {
-		l.Warn("Failed to get memory usage", logger.Ctx{"err": err})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
+		return nil, fmt.Errorf("Failed getting memory usage: %w", err)
 	}
 
 	instMetrics.Totalram = uint64(memoryLimit)
@@ -1903,41 +2661,19 @@ func (s *Server) HandleSysinfoSyscall(c Instance, siov *Iovec) int {
 	if s.s.OS.CGInfo.Supports(cgroup.MemorySwapUsage, cg) {
 		swapLimit, err := cg.GetMemorySwapLimit()
 		if err != nil {
-			l.Warn("Failed getting swap limit", logger.Ctx{"err": err})
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-			return 0
+			return nil, fmt.Errorf("Failed getting swap limit: %w", err)
 		}
 
 		swapUsage, err := cg.GetMemorySwapUsage()
 		if err != nil {
-			l.Warn("Failed getting swap usage", logger.Ctx{"err": err})
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-			return 0
+			return nil, fmt.Errorf("Failed getting swap usage: %w", err)
 		}
 
 		instMetrics.Totalswap = uint64(swapLimit)
 		instMetrics.Freeswap = instMetrics.Totalswap - uint64(swapUsage)
 	}
 
-	// Get writable pointer to buffer of sysinfo syscall result.
-	const sz = int(unsafe.Sizeof(info))
-	var b []byte = (*(*[sz]byte)(unsafe.Pointer(&info)))[:]
-
-	// Write instance metrics to native sysinfo struct.
-	instMetrics.ToNative(&info)
-
-	// Write sysinfo response into buffer.
-	_, err = unix.Pwrite(siov.memFd, b, int64(siov.req.data.args[0]))
-	if err != nil {
-		l.Warn("Failed writing sysinfo", logger.Ctx{"err": err})
-		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-
-		return 0
-	}
-
-	return 0
+	return &instMetrics, nil
 }
 
 type nullWriteCloser struct {
@@ -2290,48 +3026,27 @@ func (s *Server) HandleMountSyscall(c Instance, siov *Iovec) int {
 		defer func() { _ = pidFd.Close() }()
 	}
 
-	mntSource := [unix.PathMax]C.char{}
-	mntTarget := [unix.PathMax]C.char{}
-	mntFs := [unix.PathMax]C.char{}
-	mntData := [unix.PathMax]C.char{}
-
-	// const char *source
-	if siov.req.data.args[0] != 0 {
-		_, err := C.pread(C.int(siov.memFd), unsafe.Pointer(&mntSource[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[0]))
-		if err != nil {
-			ctx["err"] = fmt.Sprintf("Failed to read source path for of mount syscall: %s", err)
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
+	// const char *source, const char *target, const char *filesystemtype, const void *data
+	mem, err := siov.readMemory(
+		memRegion{addr: uint64(siov.req.data.args[0]), size: unix.PathMax},
+		memRegion{addr: uint64(siov.req.data.args[1]), size: unix.PathMax},
+		memRegion{addr: uint64(siov.req.data.args[2]), size: unix.PathMax},
+		memRegion{addr: uint64(siov.req.data.args[4]), size: unix.PathMax},
+	)
+	if err != nil {
+		ctx["err"] = fmt.Sprintf("Failed to read arguments of mount syscall: %s", err)
+		ctx["syscall_continue"] = "true"
+		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
+		return 0
 	}
-	args.source = C.GoString(&mntSource[0])
+
+	args.source = cString(mem[0])
 	ctx["source"] = args.source
 
-	// const char *target
-	if siov.req.data.args[1] != 0 {
-		_, err := C.pread(C.int(siov.memFd), unsafe.Pointer(&mntTarget[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[1]))
-		if err != nil {
-			ctx["err"] = fmt.Sprintf("Failed to read target path for of mount syscall: %s", err)
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
-	}
-	args.target = C.GoString(&mntTarget[0])
+	args.target = cString(mem[1])
 	ctx["target"] = args.target
 
-	// const char *filesystemtype
-	if siov.req.data.args[1] != 0 {
-		_, err := C.pread(C.int(siov.memFd), unsafe.Pointer(&mntFs[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[2]))
-		if err != nil {
-			ctx["err"] = fmt.Sprintf("Failed to read fstype for of mount syscall: %s", err)
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
-	}
-	args.fstype = C.GoString(&mntFs[0])
+	args.fstype = cString(mem[2])
 	ctx["fstype"] = args.fstype
 
 	// idmap shift
@@ -2346,19 +3061,10 @@ func (s *Server) HandleMountSyscall(c Instance, siov *Iovec) int {
 	args.flags = int(siov.req.data.args[3])
 
 	// const void *data
-	if siov.req.data.args[4] != 0 {
-		_, err := C.pread(C.int(siov.memFd), unsafe.Pointer(&mntData[0]), C.size_t(unix.PathMax), C.off_t(siov.req.data.args[4]))
-		if err != nil {
-			ctx["err"] = fmt.Sprintf("Failed to read mount data for of mount syscall: %s", err)
-			ctx["syscall_continue"] = "true"
-			C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
-			return 0
-		}
-	}
-	args.data = C.GoString(&mntData[0])
+	args.data = cString(mem[3])
 	ctx["data"] = args.data
 
-	err := linux.PidfdSendSignal(int(pidFd.Fd()), 0, 0)
+	err = linux.PidfdSendSignal(int(pidFd.Fd()), 0, 0)
 	if err != nil {
 		ctx["err"] = fmt.Sprintf("Failed to send signal to target process for of mount syscall: %s", err)
 		ctx["syscall_continue"] = "true"
@@ -2373,7 +3079,7 @@ func (s *Server) HandleMountSyscall(c Instance, siov *Iovec) int {
 		return 0
 	}
 
-	idmapset, err := c.CurrentIdmap()
+	idmapset, err := siov.idmaps().get(int32(siov.msg.init_pid), c)
 	if err != nil {
 		ctx["syscall_continue"] = "true"
 		C.seccomp_notify_update_response(siov.resp, 0, C.uint32_t(seccompUserNotifFlagContinue))
@@ -2494,6 +3200,7 @@ func (s *Server) HandleBpfSyscall(c Instance, siov *Iovec) int {
 
 	defer logger.Debug("Handling bpf syscall", ctx)
 	var bpfCmd, bpfProgType, bpfAttachType C.int
+	var bpfProgCached C.bool
 
 	if shared.IsFalseOrEmpty(c.ExpandedConfig()["security.syscalls.intercept.bpf.devices"]) {
 		ctx["syscall_continue"] = "true"
@@ -2523,11 +3230,13 @@ func (s *Server) HandleBpfSyscall(c Instance, siov *Iovec) int {
 		siov.resp,
 		&bpfCmd,
 		&bpfProgType,
-		&bpfAttachType)
+		&bpfAttachType,
+		&bpfProgCached)
 	runtime.UnlockOSThread()
 	ctx["bpf_cmd"] = fmt.Sprintf("%d", bpfCmd)
 	ctx["bpf_prog_type"] = fmt.Sprintf("%d", bpfProgType)
 	ctx["bpf_attach_type"] = fmt.Sprintf("%d", bpfAttachType)
+	ctx["bpf_prog_cached"] = fmt.Sprintf("%t", bool(bpfProgCached))
 	if ret < 0 {
 		ctx["syscall_continue"] = "true"
 		ctx["syscall_handler_error"] = fmt.Sprintf("%s - Failed to handle bpf syscall", unix.Errno(-ret))
@@ -2538,8 +3247,53 @@ func (s *Server) HandleBpfSyscall(c Instance, siov *Iovec) int {
 	return 0
 }
 
-func (s *Server) handleSyscall(c Instance, siov *Iovec) int {
-	switch int(C.seccomp_notify_get_syscall(siov.req, siov.resp)) {
+// bpfDeviceProgLoad loads a device cgroup program through the cache of intercepted loads,
+// returning its file descriptor and whether it came from the cache. It only exists for the tests,
+// which can't call into C directly.
+func bpfDeviceProgLoad(insns []byte, license string) (int, bool, error) {
+	cLicense := C.CString(license)
+	defer C.free(unsafe.Pointer(cLicense))
+
+	// The cache takes ownership of the instructions.
+	cInsns := C.CBytes(insns)
+
+	var cached C.bool
+	fd, err := C.bpf_device_prog_load((*C.struct_bpf_insn)(cInsns), C.__u32(len(insns)/C.sizeof_struct_bpf_insn), cLicense, &cached)
+	if fd < 0 {
+		return -1, false, err
+	}
+
+	return int(fd), bool(cached), nil
+}
+
+// bpfDeviceProgAttach attaches a device cgroup program to a cgroup like an intercepted attach.
+// It returns the file descriptor of the copy attached instead of a cached program or -1. It only
+// exists for the tests, which can't call into C directly.
+func bpfDeviceProgAttach(cgroupFd int, progFd int, flags uint32) (int, error) {
+	var copyFd C.int
+
+	ret, err := C.bpf_device_prog_attach(C.int(cgroupFd), C.int(progFd), C.__u32(flags), &copyFd)
+	if ret < 0 {
+		return -1, err
+	}
+
+	return int(copyFd), nil
+}
+
+// seccompNotifyNames maps the intercepted syscalls to the names used in metrics.
+var seccompNotifyNames = map[int]string{
+	lxdSeccompNotifyMknod:             "mknod",
+	lxdSeccompNotifyMknodat:           "mknodat",
+	lxdSeccompNotifySetxattr:          "setxattr",
+	lxdSeccompNotifyMount:             "mount",
+	lxdSeccompNotifyBpf:               "bpf",
+	lxdSeccompNotifySchedSetscheduler: "sched_setscheduler",
+	lxdSeccompNotifySysinfo:           "sysinfo",
+	lxdSeccompNotifyFinitModule:       "finit_module",
+}
+
+func (s *Server) handleSyscall(c Instance, siov *Iovec, syscall int) int {
+	switch syscall {
 	case lxdSeccompNotifyMknod:
 		return s.HandleMknodSyscall(c, siov)
 	case lxdSeccompNotifyMknodat:
@@ -2579,20 +3333,60 @@ func (s *Server) HandleValid(fd int, siov *Iovec, findPID func(pid int32, state
 		return err
 	}
 
-	errno := s.handleSyscall(c, siov)
+	syscall := int(C.seccomp_notify_get_syscall(siov.req, siov.resp))
+	errno := s.handleSyscall(c, siov, syscall)
 
 	err = siov.SendSeccompIovec(fd, errno, 0)
 	if err != nil {
 		return err
 	}
 
+	key := syscallStatsKey{
+		syscall:  seccompNotifyNames[syscall],
+		instance: syscallStatsInstance{project: c.Project().Name, name: c.Name()},
+	}
+
+	if siov.client != nil {
+		siov.client.handled(s.stats, key.instance)
+	}
+
+	if key.syscall == "" {
+		key.syscall = "unknown"
+	}
+
+	if uint32(siov.resp.flags)&seccompUserNotifFlagContinue != 0 {
+		key.outcome = "continue"
+	} else if siov.resp.error != 0 {
+		key.outcome = "denied"
+	} else {
+		key.outcome = "emulated"
+	}
+
+	s.stats.observe(key, time.Since(siov.received))
+
 	return nil
 }
 
+// Metrics returns the notification queue and handling metrics of the seccomp server.
+func (s *Server) Metrics() *metrics.MetricSet {
+	out := metrics.NewMetricSet(nil)
+	s.dispatcher.metrics(out)
+	s.stats.metrics(out)
+
+	return out
+}
+
 // Stop stops a seccomp server.
 func (s *Server) Stop() error {
 	_ = os.Remove(s.path)
-	return s.l.Close()
+	err := s.l.Close()
+	s.dispatcher.stop()
+
+	if s.helpers != nil {
+		s.helpers.stop()
+	}
+
+	return err
 }
 
 func lxcSupportSeccompNotifyContinue(state *state.State) error {
@@ -3,8 +3,24 @@
 package seccomp
 
 import (
+	"encoding/binary"
+	"errors"
 	"fmt"
+	"os"
+	"os/exec"
+	"strings"
+	"sync"
+	"sync/atomic"
 	"testing"
+	"time"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/lxd/idmap"
+	"github.com/canonical/lxd/shared/api"
+	"github.com/canonical/lxd/shared/benchutil"
+	"github.com/canonical/lxd/shared/netutils"
 )
 
 func TestMountFlagsToOpts(t *testing.T) {
@@ -18,3 +34,679 @@ func TestMountFlagsToOpts(t *testing.T) {
 		t.Fatal(fmt.Errorf("Mount options parsing failed with invalid option string: %s", opts))
 	}
 }
+
+func TestDispatcherFairQueueing(t *testing.T) {
+	d := newDispatcher(1, 16, 1)
+	defer d.stop()
+
+	noisy := d.newQueue()
+	quiet := d.newQueue()
+
+	// Keep the only worker busy while the queues fill up.
+	started := make(chan struct{})
+	block := make(chan struct{})
+	d.submit(noisy, func() {
+		close(started)
+		<-block
+	})
+
+	<-started
+
+	var mu sync.Mutex
+	var order []string
+	record := func(name string) func() {
+		return func() {
+			mu.Lock()
+			order = append(order, name)
+			mu.Unlock()
+		}
+	}
+
+	for i := 0; i < 3; i++ {
+		d.submit(noisy, record("noisy"))
+	}
+
+	d.submit(quiet, record("quiet"))
+
+	done := make(chan struct{})
+	d.submit(noisy, func() { close(done) })
+
+	close(block)
+	<-done
+
+	mu.Lock()
+	defer mu.Unlock()
+
+	// The noisy queue is saturated while its first notification is handled, it then goes to
+	// the back of the line.
+	if len(order) != 4 || order[0] != "quiet" {
+		t.Fatalf("Unexpected handling order: %v", order)
+	}
+}
+
+func TestDispatcherQueueWorkers(t *testing.T) {
+	d := newDispatcher(2, 16, 1)
+	defer d.stop()
+
+	busy := d.newQueue()
+	other := d.newQueue()
+
+	// The busy queue has more blocked notifications than there are workers.
+	var mu sync.Mutex
+	running := 0
+	maxRunning := 0
+	block := make(chan struct{})
+	for i := 0; i < 4; i++ {
+		d.submit(busy, func() {
+			mu.Lock()
+			running++
+			maxRunning = max(maxRunning, running)
+			mu.Unlock()
+
+			<-block
+
+			mu.Lock()
+			running--
+			mu.Unlock()
+		})
+	}
+
+	done := make(chan struct{})
+	d.submit(other, func() { close(done) })
+
+	select {
+	case <-done:
+	case <-time.After(5 * time.Second):
+		t.Fatal("The busy queue starved the other one")
+	}
+
+	close(block)
+
+	drained := make(chan struct{})
+	d.submit(busy, func() { close(drained) })
+	<-drained
+
+	mu.Lock()
+	defer mu.Unlock()
+
+	if maxRunning != 1 {
+		t.Fatalf("Expected one notification of the busy queue handled at a time, got %d", maxRunning)
+	}
+}
+
+func TestDispatcherBackpressure(t *testing.T) {
+	d := newDispatcher(1, 2, 1)
+	defer d.stop()
+
+	q := d.newQueue()
+
+	started := make(chan struct{})
+	block := make(chan struct{})
+	d.submit(q, func() {
+		close(started)
+		<-block
+	})
+
+	<-started
+	d.submit(q, func() {})
+
+	submitted := make(chan struct{})
+	go func() {
+		d.submit(q, func() {})
+		close(submitted)
+	}()
+
+	select {
+	case <-submitted:
+		t.Fatal("Submit didn't block on a full queue")
+	case <-time.After(100 * time.Millisecond):
+	}
+
+	close(block)
+
+	select {
+	case <-submitted:
+	case <-time.After(5 * time.Second):
+		t.Fatal("Submit didn't resume after the queue drained")
+	}
+
+	d.mu.Lock()
+	throttled := d.throttledTotal
+	d.mu.Unlock()
+
+	if throttled != 1 {
+		t.Fatalf("Expected one throttled submit, got %d", throttled)
+	}
+}
+
+func TestDispatcherRelease(t *testing.T) {
+	d := newDispatcher(1, 16, 1)
+	defer d.stop()
+
+	q := d.newQueue()
+
+	started := make(chan struct{})
+	block := make(chan struct{})
+	d.submit(q, func() {
+		close(started)
+		<-block
+	})
+
+	d.submit(q, func() {})
+	<-started
+
+	// The callback waits for the pending notifications.
+	idle := make(chan struct{})
+	d.release(q, func() { close(idle) })
+
+	select {
+	case <-idle:
+		t.Fatal("Released queue reported idle with pending notifications")
+	case <-time.After(100 * time.Millisecond):
+	}
+
+	close(block)
+
+	select {
+	case <-idle:
+	case <-time.After(5 * time.Second):
+		t.Fatal("Released queue wasn't reported idle")
+	}
+
+	// Idle queues are reported right away.
+	called := false
+	d.release(d.newQueue(), func() { called = true })
+	if !called {
+		t.Fatal("Idle queue wasn't reported idle")
+	}
+}
+
+func TestSyscallStatsRelease(t *testing.T) {
+	stats := newSyscallStats()
+	c1 := syscallStatsInstance{project: "default", name: "c1"}
+	c2 := syscallStatsInstance{project: "default", name: "c2"}
+
+	// Two connections of c1, one of c2.
+	stats.acquire(c1)
+	stats.acquire(c1)
+	stats.acquire(c2)
+
+	for _, inst := range []syscallStatsInstance{c1, c2} {
+		stats.observe(syscallStatsKey{syscall: "mknod", instance: inst, outcome: "emulated"}, time.Millisecond)
+		stats.observe(syscallStatsKey{syscall: "setxattr", instance: inst, outcome: "denied"}, time.Millisecond)
+	}
+
+	stats.release(c1)
+	if len(stats.histograms) != 4 {
+		t.Fatalf("Expected the histograms to be kept while referenced, got %d", len(stats.histograms))
+	}
+
+	stats.release(c1)
+	if len(stats.histograms) != 2 || len(stats.instances) != 1 {
+		t.Fatalf("Expected the histograms of c1 to be dropped, got %d", len(stats.histograms))
+	}
+
+	for key := range stats.histograms {
+		if key.instance != c2 {
+			t.Fatalf("Unexpected histogram left: %v", key)
+		}
+	}
+}
+
+// idmapInstance is an instance with a fixed current idmap.
+type idmapInstance struct {
+	Instance
+
+	name    string
+	idmaps  int
+	idmapTo int64
+}
+
+func (i *idmapInstance) Name() string { return i.name }
+
+func (i *idmapInstance) Project() api.Project { return api.Project{Name: "default"} }
+
+func (i *idmapInstance) CurrentIdmap() (*idmap.IdmapSet, error) {
+	i.idmaps++
+
+	return &idmap.IdmapSet{Idmap: []idmap.IdmapEntry{{Isuid: true, Isgid: true, Hostid: i.idmapTo, Nsid: 0, Maprange: 65536}}}, nil
+}
+
+func TestIdmapCache(t *testing.T) {
+	c1 := &idmapInstance{name: "c1", idmapTo: 100000}
+	c2 := &idmapInstance{name: "c2", idmapTo: 200000}
+
+	conn := newIdmapCache()
+
+	// Hits don't ask the instance again.
+	for i := 0; i < 2; i++ {
+		compiled, err := conn.get(1234, c1)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		uid, _ := compiled.ShiftFromNs(100000, 100000)
+		if uid != 0 {
+			t.Fatalf("Unexpected uid %d", uid)
+		}
+	}
+
+	if c1.idmaps != 1 {
+		t.Fatalf("Expected the idmap to be retrieved once, got %d", c1.idmaps)
+	}
+
+	// An entry of a reused PID isn't returned for another instance.
+	compiled, err := conn.get(1234, c2)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	uid, _ := compiled.ShiftFromNs(200000, 200000)
+	if uid != 0 || c2.idmaps != 1 {
+		t.Fatalf("Unexpected uid %d after %d retrievals", uid, c2.idmaps)
+	}
+
+	// Connections don't share their entries.
+	_, err = newIdmapCache().get(1234, c2)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if c2.idmaps != 2 {
+		t.Fatalf("Expected the idmap to be retrieved again, got %d", c2.idmaps)
+	}
+}
+
+// testSyscallHelpers returns a helper registry spawning sleeping processes. Spawns for the PIDs in
+// block wait for it to be closed.
+func testSyscallHelpers(t *testing.T, block map[int32]chan struct{}) (*syscallHelpers, *atomic.Int32) {
+	spawned := &atomic.Int32{}
+
+	hs := &syscallHelpers{helpers: map[int32]*syscallHelper{}}
+	hs.spawn = func(h *syscallHelper, initPID int32) (*exec.Cmd, error) {
+		spawned.Add(1)
+
+		ch := block[initPID]
+		if ch != nil {
+			<-ch
+		}
+
+		fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+		if err != nil {
+			return nil, err
+		}
+
+		defer func() { _ = unix.Close(fds[1]) }()
+
+		cmd := exec.Command("sleep", "infinity")
+		err = cmd.Start()
+		if err != nil {
+			_ = unix.Close(fds[0])
+			return nil, err
+		}
+
+		h.fd = fds[0]
+
+		return cmd, nil
+	}
+
+	t.Cleanup(hs.stop)
+
+	return hs, spawned
+}
+
+// testProcess starts a process sharing our mount namespace and returns its PID.
+func testProcess(t *testing.T) int32 {
+	cmd := exec.Command("sleep", "infinity")
+	err := cmd.Start()
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	t.Cleanup(func() {
+		_ = cmd.Process.Kill()
+		_ = cmd.Wait()
+	})
+
+	return int32(cmd.Process.Pid)
+}
+
+func TestSyscallHelpersStart(t *testing.T) {
+	slow := testProcess(t)
+	fast := testProcess(t)
+
+	block := map[int32]chan struct{}{slow: make(chan struct{})}
+	hs, spawned := testSyscallHelpers(t, block)
+
+	// Concurrent callers of an instance wait for a single spawn.
+	helpers := make(chan *syscallHelper, 3)
+	for i := 0; i < 3; i++ {
+		go func() { helpers <- hs.get(slow, os.Getpid()) }()
+	}
+
+	// Other instances don't wait behind it.
+	if hs.get(fast, os.Getpid()) == nil {
+		t.Fatal("Failed to start the helper of another instance")
+	}
+
+	select {
+	case <-helpers:
+		t.Fatal("Helper returned before being started")
+	default:
+	}
+
+	close(block[slow])
+
+	first := <-helpers
+	if first == nil || <-helpers != first || <-helpers != first {
+		t.Fatal("Callers didn't get the same helper")
+	}
+
+	if spawned.Load() != 2 {
+		t.Fatalf("Expected two spawns, got %d", spawned.Load())
+	}
+
+	// Running helpers are reused.
+	if hs.get(slow, os.Getpid()) != first || spawned.Load() != 2 {
+		t.Fatal("Running helper wasn't reused")
+	}
+}
+
+func TestSyscallHelpersStop(t *testing.T) {
+	pid1 := testProcess(t)
+	pid2 := testProcess(t)
+
+	hs, _ := testSyscallHelpers(t, nil)
+
+	h1 := hs.get(pid1, os.Getpid())
+	h2 := hs.get(pid2, os.Getpid())
+	if h1 == nil || h2 == nil {
+		t.Fatal("Failed to start the helpers")
+	}
+
+	// Forgetting an instance reaps its helper only.
+	hs.forget(pid1)
+	if !h1.dead.Load() || h2.dead.Load() {
+		t.Fatal("Forget didn't reap the helper of the instance only")
+	}
+
+	hs.stop()
+	if !h2.dead.Load() {
+		t.Fatal("Stop didn't reap the helpers")
+	}
+
+	if hs.get(pid2, os.Getpid()) != nil {
+		t.Fatal("Helper started after stop")
+	}
+}
+
+func TestHelperReqReuse(t *testing.T) {
+	req := getHelperReq(1)
+	req.syscall = 2
+	req.uid, req.flags, req.size = 1000, 1, 4
+	if !setHelperString(req.path[:], "/foo") || !setHelperString(req.name[:], "user.foo") {
+		t.Fatal("Failed to fill the request")
+	}
+
+	putHelperReq(req)
+
+	// Pooled requests come back cleared, whichever one is returned.
+	req = getHelperReq(42)
+	defer putHelperReq(req)
+
+	if req.syscall != 0 || req.pid != 42 || req.uid != 0 || req.flags != 0 || req.size != 0 || req.path[1] != 0 || req.name[1] != 0 {
+		t.Fatal("Request wasn't reset")
+	}
+}
+
+func TestSysinfoCache(t *testing.T) {
+	c := newSysinfoCache(time.Hour)
+
+	collected := 0
+	collect := func(initPID int32) (*Sysinfo, error) {
+		collected++
+		return &Sysinfo{Procs: uint16(initPID)}, nil
+	}
+
+	for i := 0; i < 3; i++ {
+		info, err := c.get(1, collect)
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		if info.Procs != 1 {
+			t.Fatalf("Unexpected sysinfo: %+v", info)
+		}
+	}
+
+	if collected != 1 {
+		t.Fatalf("Expected a single collection, got %d", collected)
+	}
+
+	_, err := c.get(2, collect)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if collected != 2 {
+		t.Fatalf("Expected a collection for a new instance, got %d", collected)
+	}
+}
+
+func BenchmarkSeccompIovec(b *testing.B) {
+	benchutil.Run(b, func() {
+		siov := NewSeccompIovec(nil)
+		siov.PutSeccompIovec()
+	})
+}
+
+// BenchmarkIovecReceiver receives a storm of notifications, sent the way liblxc forwards them to
+// the seccomp server: a message carrying the proc, mem and notify file descriptors of the task.
+func BenchmarkIovecReceiver(b *testing.B) {
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	defer func() { _ = unix.Close(fds[0]) }()
+
+	devNull, err := os.Open("/dev/null")
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	defer func() { _ = devNull.Close() }()
+
+	receiver, err := newIovecReceiver(fds[0], nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	defer receiver.free()
+
+	sent := make(chan error, 1)
+	go func() {
+		defer func() { _ = unix.Close(fds[1]) }()
+
+		fd := int(devNull.Fd())
+		msg := make([]byte, 64)
+		for i := 0; i < b.N; i++ {
+			err := netutils.AbstractUnixSendFds(fds[1], []int{fd, fd, fd}, msg)
+			if err != nil {
+				sent <- err
+				return
+			}
+		}
+
+		sent <- nil
+	}()
+
+	pending := 0
+	receives := 0
+
+	benchutil.Run(b, func() {
+		if pending == 0 {
+			siovs, _, err := receiver.receive()
+			if err != nil {
+				b.Fatal(err)
+			}
+
+			for _, siov := range siovs {
+				siov.PutSeccompIovec()
+			}
+
+			pending = len(siovs)
+			receives++
+		}
+
+		pending--
+	})
+
+	err = <-sent
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportMetric(float64(b.N)/float64(receives), "notifications/receive")
+}
+
+// testCgroup2 creates a cgroup in the cgroup2 hierarchy and returns a file descriptor for it.
+func testCgroup2(t *testing.T) int {
+	if os.Geteuid() != 0 {
+		t.Skip("Creating cgroups requires root")
+	}
+
+	mountinfo, err := os.ReadFile("/proc/self/mountinfo")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	mountpoint := ""
+	for _, line := range strings.Split(string(mountinfo), "\n") {
+		fields := strings.Fields(line)
+		if len(fields) > 8 && fields[len(fields)-3] == "cgroup2" {
+			mountpoint = fields[4]
+			break
+		}
+	}
+
+	if mountpoint == "" {
+		t.Skip("No cgroup2 hierarchy mounted")
+	}
+
+	path, err := os.MkdirTemp(mountpoint, "lxd-test-")
+	if err != nil {
+		t.Skipf("Failed to create cgroup: %v", err)
+	}
+
+	t.Cleanup(func() { _ = os.Remove(path) })
+
+	fd, err := unix.Open(path, unix.O_RDONLY|unix.O_DIRECTORY|unix.O_CLOEXEC, 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	t.Cleanup(func() { _ = unix.Close(fd) })
+
+	return fd
+}
+
+// testBpfDeviceProgDetach detaches a device cgroup program.
+func testBpfDeviceProgDetach(cgroupFd int, progFd int) error {
+	attr := struct {
+		targetFd    uint32
+		attachBpfFd uint32
+		attachType  uint32
+		attachFlags uint32
+	}{
+		targetFd:    uint32(cgroupFd),
+		attachBpfFd: uint32(progFd),
+		attachType:  6, // BPF_CGROUP_DEVICE
+	}
+
+	// 9 == BPF_PROG_DETACH
+	_, _, errno := unix.Syscall(unix.SYS_BPF, 9, uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+	if errno != 0 {
+		return errno
+	}
+
+	return nil
+}
+
+func TestBpfDeviceProgReattach(t *testing.T) {
+	cgroupFd := testCgroup2(t)
+
+	// r1 = <unique>, r0 = 1, exit. The unused immediate keeps other runs from sharing the program.
+	insns := make([]byte, 3*8)
+	insns[0] = 0xb7
+	insns[1] = 1
+	binary.NativeEndian.PutUint32(insns[4:], uint32(time.Now().UnixNano()))
+	insns[8] = 0xb7
+	binary.NativeEndian.PutUint32(insns[12:], 1)
+	insns[16] = 0x95
+
+	prog, cached, err := bpfDeviceProgLoad(insns, "GPL")
+	if errors.Is(err, unix.EPERM) {
+		t.Skip("Loading BPF programs isn't permitted")
+	}
+
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	defer func() { _ = unix.Close(prog) }()
+
+	if cached {
+		t.Fatal("First load was served from the cache")
+	}
+
+	// Restarting a systemd unit with an unchanged device policy loads the same program again and
+	// attaches it next to the old one before detaching that.
+	reload, cached, err := bpfDeviceProgLoad(insns, "GPL")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	defer func() { _ = unix.Close(reload) }()
+
+	if !cached {
+		t.Fatal("Second load wasn't served from the cache")
+	}
+
+	// 2 == BPF_F_ALLOW_MULTI
+	copyFd, err := bpfDeviceProgAttach(cgroupFd, prog, 2)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	if copyFd != -1 {
+		t.Fatal("First attach used a copy of the program")
+	}
+
+	copyFd, err = bpfDeviceProgAttach(cgroupFd, reload, 2)
+	if err != nil {
+		t.Fatalf("Failed to attach the program again: %v", err)
+	}
+
+	if copyFd < 0 {
+		t.Fatal("Second attach didn't use a copy of the program")
+	}
+
+	defer func() { _ = unix.Close(copyFd) }()
+
+	// Both programs are attached, the cached one only once.
+	err = testBpfDeviceProgDetach(cgroupFd, prog)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	err = testBpfDeviceProgDetach(cgroupFd, copyFd)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	err = testBpfDeviceProgDetach(cgroupFd, reload)
+	if !errors.Is(err, unix.ENOENT) {
+		t.Fatalf("Expected the cached program to be detached already, got %v", err)
+	}
+}
@@ -1,5 +1,10 @@
 package seccomp
 
+import (
+	"sync"
+	"time"
+)
+
 // Sysinfo architecture independent sysinfo struct.
 type Sysinfo struct {
 	Uptime    int64
@@ -11,3 +16,75 @@ type Sysinfo struct {
 	Freeswap  uint64
 	Procs     uint16
 }
+
+// sysinfoCacheTTL is how long the collected values of an instance are reused for.
+const sysinfoCacheTTL = time.Second
+
+// sysinfoCache keeps the most recently collected Sysinfo of each instance, keyed by the PID of
+// its init process, so that bursts of sysinfo calls don't each hit cgroupfs and procfs.
+type sysinfoCache struct {
+	mu      sync.Mutex
+	entries map[int32]*sysinfoCacheEntry
+	ttl     time.Duration
+}
+
+type sysinfoCacheEntry struct {
+	mu        sync.Mutex
+	info      Sysinfo
+	collected time.Time
+}
+
+func newSysinfoCache(ttl time.Duration) *sysinfoCache {
+	return &sysinfoCache{
+		entries: map[int32]*sysinfoCacheEntry{},
+		ttl:     ttl,
+	}
+}
+
+// get returns the Sysinfo of the given init PID, calling collect if the cached copy has expired.
+// Concurrent callers for the same PID wait for a single collection.
+func (c *sysinfoCache) get(initPID int32, collect func(initPID int32) (*Sysinfo, error)) (Sysinfo, error) {
+	now := time.Now()
+
+	c.mu.Lock()
+	entry := c.entries[initPID]
+	if entry == nil {
+		// Drop the entries of instances which stopped calling sysinfo.
+		for pid, other := range c.entries {
+			if other.mu.TryLock() {
+				if now.Sub(other.collected) > c.ttl {
+					delete(c.entries, pid)
+				}
+
+				other.mu.Unlock()
+			}
+		}
+
+		entry = &sysinfoCacheEntry{}
+		c.entries[initPID] = entry
+	}
+
+	c.mu.Unlock()
+
+	entry.mu.Lock()
+	defer entry.mu.Unlock()
+
+	if entry.collected.IsZero() || time.Since(entry.collected) > c.ttl {
+		info, err := collect(initPID)
+		if err != nil {
+			return Sysinfo{}, err
+		}
+
+		entry.info = *info
+		entry.collected = time.Now()
+	}
+
+	info := entry.info
+
+	// Keep the uptime ticking between collections.
+	if info.Uptime > 0 {
+		info.Uptime += int64(time.Since(entry.collected).Seconds())
+	}
+
+	return info, nil
+}
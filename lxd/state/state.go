@@ -22,6 +22,7 @@ import (
 	"github.com/canonical/lxd/lxd/node"
 	"github.com/canonical/lxd/lxd/sys"
 	"github.com/canonical/lxd/shared"
+	"github.com/canonical/lxd/shared/netutils"
 )
 
 // State is a gateway to the two main stateful components of LXD, the database
@@ -47,6 +48,9 @@ type State struct {
 	OS    *sys.OS
 	Proxy func(req *http.Request) (*url.URL, error)
 
+	// Cache of the network state of the instances' network namespaces, nil if unavailable.
+	NetnsIfaddrs *netutils.NetnsIfaddrsCache
+
 	// LXD server
 	Endpoints *endpoints.Endpoints
 
@@ -3,6 +3,7 @@ package drivers
 import (
 	"fmt"
 
+	"github.com/canonical/lxd/lxd/operations"
 	"github.com/canonical/lxd/lxd/storage/quota"
 	"github.com/canonical/lxd/shared/logger"
 	"github.com/canonical/lxd/shared/revert"
@@ -47,7 +48,7 @@ func (d *dir) setupInitialQuota(vol Volume) (revert.Hook, error) {
 		return nil, err
 	}
 
-	err = d.setQuota(volPath, volID, sizeBytes)
+	err = d.setQuota(volPath, volID, sizeBytes, nil)
 	if err != nil {
 		return nil, err
 	}
@@ -92,7 +93,8 @@ func (d *dir) quotaProjectID(volID int64) uint32 {
 }
 
 // setQuota sets the project quota on the path. The volID generates a quota project ID.
-func (d *dir) setQuota(path string, volID int64, sizeBytes int64) error {
+// If op is not nil, the progress of setting the project ID on the existing files is reported through it.
+func (d *dir) setQuota(path string, volID int64, sizeBytes int64, op *operations.Operation) error {
 	if volID == volIDQuotaSkip {
 		// Disabled on purpose, just ignore.
 		return nil
@@ -126,8 +128,21 @@ func (d *dir) setQuota(path string, volID int64, sizeBytes int64) error {
 		}
 	}
 
+	var progress func(entries int64)
+	if op != nil {
+		progress = func(entries int64) {
+			meta := op.Metadata()
+			if meta == nil {
+				meta = make(map[string]any)
+			}
+
+			meta["quota_progress"] = fmt.Sprintf("Setting project quota: %d files", entries)
+			_ = op.UpdateMetadata(meta)
+		}
+	}
+
 	// Initialise the project.
-	err = quota.SetProject(path, projectID)
+	err = quota.SetProject(path, projectID, progress)
 	if err != nil {
 		return err
 	}
@@ -357,7 +357,7 @@ func (d *dir) SetVolumeQuota(vol Volume, size string, allowUnsafeResize bool, op
 			d.logger.Debug("Accounting for VM image file size", logger.Ctx{"sizeBytes": sizeBytes})
 		}
 
-		return d.setQuota(vol.MountPath(), volID, sizeBytes)
+		return d.setQuota(vol.MountPath(), volID, sizeBytes, op)
 	}
 
 	return nil
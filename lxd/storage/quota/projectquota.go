@@ -6,11 +6,17 @@ package quota
 #include <linux/quota.h>
 #include <sys/ioctl.h>
 #include <sys/quota.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifndef FS_XFLAG_PROJINHERIT
@@ -99,34 +105,447 @@ int quota_set(char *dev_path, uint32_t id, uint64_t hard_bytes) {
 	return 0;
 }
 
-int quota_set_path(char *path, uint32_t id, bool inherit) {
+static int quota_set_fd(int fd, uint32_t id, bool inherit) {
 	struct fsxattr attr;
+
+	if (ioctl(fd, FS_IOC_FSGETXATTR, &attr) < 0)
+		return -1;
+
+	// Skip the write if nothing changes, e.g. when a volume gets resized.
+	if (attr.fsx_projid == id && (!inherit || (attr.fsx_xflags & FS_XFLAG_PROJINHERIT)))
+		return 0;
+
+	if (inherit)
+		attr.fsx_xflags |= FS_XFLAG_PROJINHERIT;
+
+	attr.fsx_projid = id;
+
+	return ioctl(fd, FS_IOC_FSSETXATTR, &attr);
+}
+
+// Number of entries handled by a thread before they get added to the shared counter.
+#define QUOTA_WALK_PROGRESS_STEP 256
+
+// quota_walk sets a project ID on a tree using multiple threads.
+//
+// Directories are opened relative to their parent with O_NOFOLLOW and queued as file descriptors
+// for the threads to pick up. The queue is bounded, directories found while it's full are closed
+// and queued by path instead, to be opened again one component at a time relative to the root.
+// This keeps the number of open file descriptors down to the queue plus one per thread.
+struct quota_walk_item {
 	int fd;
-	int ret;
+	char *path;
+};
 
-	fd = open(path, O_RDONLY | O_CLOEXEC);
+struct quota_walk {
+	uint32_t id;
+	int threads;
+	int root;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct quota_walk_item *queue;
+	size_t queued;
+	size_t queue_size;
+	struct quota_walk_item *overflow;
+	size_t overflowed;
+	size_t overflow_size;
+	size_t busy;
+
+	uint64_t entries;
+	bool failed;
+	int error;
+	char error_name[NAME_MAX + 1];
+};
+
+struct quota_walk *quota_walk_new(uint32_t id, int threads) {
+	struct quota_walk *w;
+
+	if (threads < 1)
+		threads = 1;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->queue_size = (size_t)threads * 4;
+	w->queue = calloc(w->queue_size, sizeof(*w->queue));
+	if (!w->queue) {
+		free(w);
+		return NULL;
+	}
+
+	w->id = id;
+	w->threads = threads;
+	w->root = -1;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	return w;
+}
+
+void quota_walk_free(struct quota_walk *w) {
+	size_t i;
+
+	for (i = 0; i < w->queued; i++) {
+		close(w->queue[i].fd);
+		free(w->queue[i].path);
+	}
+
+	for (i = 0; i < w->overflowed; i++)
+		free(w->overflow[i].path);
+
+	if (w->root >= 0)
+		close(w->root);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w->overflow);
+	free(w->queue);
+	free(w);
+}
+
+uint64_t quota_walk_entries(struct quota_walk *w) {
+	return __atomic_load_n(&w->entries, __ATOMIC_RELAXED);
+}
+
+static void quota_walk_fail(struct quota_walk *w, int error, const char *name) {
+	pthread_mutex_lock(&w->lock);
+	if (!w->failed) {
+		w->error = error;
+		strncpy(w->error_name, name, sizeof(w->error_name) - 1);
+		__atomic_store_n(&w->failed, true, __ATOMIC_RELAXED);
+	}
+
+	// Wake up the idle threads so they can stop.
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+// quota_walk_push queues a directory, taking ownership of its file descriptor and path. It returns
+// -1 if the directory couldn't be queued.
+static int quota_walk_push(struct quota_walk *w, int fd, char *path) {
+	int ret = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->queued < w->queue_size) {
+		w->queue[w->queued].fd = fd;
+		w->queue[w->queued].path = path;
+		w->queued++;
+		fd = -1;
+	} else {
+		if (w->overflowed == w->overflow_size) {
+			struct quota_walk_item *overflow;
+			size_t size = w->overflow_size ? w->overflow_size * 2 : w->queue_size;
+
+			overflow = realloc(w->overflow, size * sizeof(*overflow));
+			if (!overflow) {
+				free(path);
+				ret = -1;
+				goto out;
+			}
+
+			w->overflow = overflow;
+			w->overflow_size = size;
+		}
+
+		w->overflow[w->overflowed].fd = -1;
+		w->overflow[w->overflowed].path = path;
+		w->overflowed++;
+	}
+
+	pthread_cond_signal(&w->cond);
+
+out:
+	pthread_mutex_unlock(&w->lock);
+
+	if (fd >= 0)
+		close(fd);
+
+	return ret;
+}
+
+// quota_walk_pop returns the next queued directory, waiting while other threads may still queue
+// some, or false once the walk is over. Open directories are taken first.
+static bool quota_walk_pop(struct quota_walk *w, struct quota_walk_item *item) {
+	bool popped = false;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->queued == 0 && w->overflowed == 0 && w->busy > 0 && !w->failed)
+		pthread_cond_wait(&w->cond, &w->lock);
+
+	if (!w->failed) {
+		if (w->queued > 0) {
+			*item = w->queue[--w->queued];
+			popped = true;
+		} else if (w->overflowed > 0) {
+			*item = w->overflow[--w->overflowed];
+			popped = true;
+		}
+	}
+
+	if (popped)
+		w->busy++;
+
+	pthread_mutex_unlock(&w->lock);
+
+	return popped;
+}
+
+static void quota_walk_done(struct quota_walk *w) {
+	pthread_mutex_lock(&w->lock);
+	w->busy--;
+	if (w->busy == 0 && w->queued == 0 && w->overflowed == 0)
+		pthread_cond_broadcast(&w->cond);
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void quota_walk_count(struct quota_walk *w, uint64_t *count) {
+	(*count)++;
+	if (*count >= QUOTA_WALK_PROGRESS_STEP) {
+		__atomic_fetch_add(&w->entries, *count, __ATOMIC_RELAXED);
+		*count = 0;
+	}
+}
+
+// quota_walk_reopen opens a directory closed for the overflow again, one path component at a time
+// with O_NOFOLLOW so it can't get redirected outside of the tree.
+static int quota_walk_reopen(struct quota_walk *w, const char *path) {
+	char component[NAME_MAX + 1];
+	const char *next;
+	int fd;
+
+	fd = dup(w->root);
 	if (fd < 0)
 		return -1;
 
-	ret = ioctl(fd, FS_IOC_FSGETXATTR, &attr);
-	if (ret < 0) {
+	while (*path) {
+		size_t len;
+		int child;
+
+		next = strchr(path, '/');
+		len = next ? (size_t)(next - path) : strlen(path);
+		if (len > NAME_MAX) {
+			close(fd);
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+
+		memcpy(component, path, len);
+		component[len] = '\0';
+
+		child = openat(fd, component, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK | O_DIRECTORY);
 		close(fd);
-		return -1;
+		if (child < 0)
+			return -1;
+
+		fd = child;
+		path += len;
+		if (*path == '/')
+			path++;
 	}
 
-	if (inherit) {
-		attr.fsx_xflags |= FS_XFLAG_PROJINHERIT;
+	return fd;
+}
+
+// quota_walk_path returns the path of an entry of a directory relative to the root.
+static char *quota_walk_path(const char *dir, const char *name) {
+	size_t dir_len = strlen(dir);
+	size_t name_len = strlen(name);
+	char *path;
+
+	path = malloc(dir_len + name_len + 2);
+	if (!path)
+		return NULL;
+
+	if (dir_len > 0) {
+		memcpy(path, dir, dir_len);
+		path[dir_len++] = '/';
 	}
 
-	attr.fsx_projid = id;
+	memcpy(path + dir_len, name, name_len + 1);
 
-	ret = ioctl(fd, FS_IOC_FSSETXATTR, &attr);
-	if (ret < 0) {
+	return path;
+}
+
+// quota_walk_dir sets the project ID on the entries of the directory, taking ownership of dfd.
+static void quota_walk_dir(struct quota_walk *w, int dfd, const char *path, uint64_t *count) {
+	DIR *dir;
+	struct dirent *ent;
+
+	dir = fdopendir(dfd);
+	if (!dir) {
+		quota_walk_fail(w, errno, ".");
+		close(dfd);
+		return;
+	}
+
+	while (!__atomic_load_n(&w->failed, __ATOMIC_RELAXED)) {
+		unsigned char type;
+		char *child;
+		int fd;
+
+		errno = 0;
+		ent = readdir(dir);
+		if (!ent) {
+			if (errno)
+				quota_walk_fail(w, errno, ".");
+
+			break;
+		}
+
+		if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		type = ent->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+				quota_walk_fail(w, errno, ent->d_name);
+				break;
+			}
+
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
+		}
+
+		// Cannot set project ID on non-regular files after file creation. Infact trying to set
+		// project ID on some file types just blocks forever (such as pipe files).
+		// So skip them as they don't take up disk space anyway.
+		if (type != DT_DIR && type != DT_REG)
+			continue;
+
+		fd = openat(dirfd(dir), ent->d_name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK | (type == DT_DIR ? O_DIRECTORY : 0));
+		if (fd < 0) {
+			quota_walk_fail(w, errno, ent->d_name);
+			break;
+		}
+
+		// Only can set FS_XFLAG_PROJINHERIT on directories.
+		if (quota_set_fd(fd, w->id, type == DT_DIR) < 0) {
+			quota_walk_fail(w, errno, ent->d_name);
+			close(fd);
+			break;
+		}
+
+		quota_walk_count(w, count);
+
+		if (type != DT_DIR) {
+			close(fd);
+			continue;
+		}
+
+		child = quota_walk_path(path, ent->d_name);
+		if (!child || quota_walk_push(w, fd, child) < 0) {
+			if (!child)
+				close(fd);
+
+			quota_walk_fail(w, ENOMEM, ent->d_name);
+			break;
+		}
+	}
+
+	closedir(dir);
+}
+
+static void *quota_walk_worker(void *data) {
+	struct quota_walk *w = data;
+	struct quota_walk_item item;
+	uint64_t count = 0;
+
+	while (quota_walk_pop(w, &item)) {
+		if (item.fd < 0) {
+			item.fd = quota_walk_reopen(w, item.path);
+			if (item.fd < 0)
+				quota_walk_fail(w, errno, item.path);
+		}
+
+		if (item.fd >= 0)
+			quota_walk_dir(w, item.fd, item.path, &count);
+
+		free(item.path);
+		quota_walk_done(w);
+	}
+
+	__atomic_fetch_add(&w->entries, count, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+// quota_walk_run sets the project ID on path and everything below it, returning 0 or -errno.
+int quota_walk_run(struct quota_walk *w, char *path) {
+	pthread_t *threads;
+	struct stat st;
+	char *root;
+	int started = 0;
+	int fd;
+	int i;
+
+	if (lstat(path, &st) < 0) {
+		w->error = errno;
+		return -w->error;
+	}
+
+	if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+		return 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+	if (fd < 0) {
+		w->error = errno;
+		return -w->error;
+	}
+
+	if (quota_set_fd(fd, w->id, S_ISDIR(st.st_mode)) < 0) {
+		w->error = errno;
 		close(fd);
-		return -1;
+		return -w->error;
 	}
 
-	close(fd);
+	w->entries = 1;
+
+	if (!S_ISDIR(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	w->root = dup(fd);
+	root = strdup("");
+	if (w->root < 0 || !root) {
+		w->error = w->root < 0 ? errno : ENOMEM;
+		free(root);
+		close(fd);
+		return -w->error;
+	}
+
+	w->queue[0].fd = fd;
+	w->queue[0].path = root;
+	w->queued = 1;
+
+	// The calling thread is one of the workers, failing to start the others only slows things down.
+	threads = calloc(w->threads, sizeof(*threads));
+	if (threads) {
+		for (i = 1; i < w->threads; i++) {
+			if (pthread_create(&threads[started], NULL, quota_walk_worker, w) != 0)
+				break;
+
+			started++;
+		}
+	}
+
+	quota_walk_worker(w);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+
+	if (w->failed)
+		return -w->error;
+
 	return 0;
 }
 
@@ -156,8 +575,9 @@ import (
 	"bufio"
 	"fmt"
 	"os"
-	"path/filepath"
+	"runtime"
 	"strings"
+	"time"
 	"unsafe"
 
 	"golang.org/x/sys/unix"
@@ -167,6 +587,12 @@ import (
 
 var errNoDevice = fmt.Errorf("Couldn't find backing device for mountpoint")
 
+// setProjectMaxThreads is the largest number of threads used to set a project ID on a tree.
+const setProjectMaxThreads = 16
+
+// setProjectProgressInterval is how often SetProject reports its progress.
+var setProjectProgressInterval = time.Second
+
 func devForPath(path string) (string, error) {
 	// Get major/minor
 	var stat unix.Stat_t
@@ -235,40 +661,56 @@ func GetProject(path string) (uint32, error) {
 }
 
 // SetProject recursively sets the project quota ID (and project inherit flag on directories) for the given path.
-func SetProject(path string, id uint32) error {
-	err := filepath.Walk(path, func(filePath string, info os.FileInfo, err error) error {
-		if err != nil {
-			return err
-		}
+// The tree is walked by multiple threads in a single call to C, progress, if not nil, gets called about
+// once every second with the number of files and directories done so far, and with the total once done.
+func SetProject(path string, id uint32, progress func(entries int64)) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
 
-		inherit := false
-		if info.IsDir() {
-			inherit = true // Only can set FS_XFLAG_PROJINHERIT on directories.
-		} else if !info.Mode().IsRegular() {
-			// Cannot set project ID on non-regular files after file creation. Infact trying to set
-			// project ID on some file types just blocks forever (such as pipe files).
-			// So skip them as they don't take up disk space anyway.
-			return nil
-		}
+	w := C.quota_walk_new(C.uint32_t(id), C.int(min(runtime.NumCPU(), setProjectMaxThreads)))
+	if w == nil {
+		return fmt.Errorf(`Failed to set project ID "%d" on %q: Out of memory`, id, path)
+	}
 
-		// Call ioctl through CGo.
-		cPath := C.CString(filePath)
-		defer C.free(unsafe.Pointer(cPath))
+	defer C.quota_walk_free(w)
 
-		if C.quota_set_path(cPath, C.uint32_t(id), C.bool(inherit)) != 0 {
-			return fmt.Errorf(`Failed to set project ID "%d" on %q (inherit %t)`, id, filePath, inherit)
-		}
+	done := make(chan C.int, 1)
+	go func() {
+		done <- C.quota_walk_run(w, cPath)
+	}()
+
+	ticker := time.NewTicker(setProjectProgressInterval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case ret := <-done:
+			if ret == 0 {
+				if progress != nil {
+					progress(int64(C.quota_walk_entries(w)))
+				}
+
+				return nil
+			}
 
-		return nil
-	})
+			name := C.GoString(&w.error_name[0])
+			if name == "" {
+				return fmt.Errorf(`Failed to set project ID "%d" on %q: %w`, id, path, unix.Errno(-ret))
+			}
 
-	return err
+			return fmt.Errorf(`Failed to set project ID "%d" on %q in %q: %w`, id, name, path, unix.Errno(-ret))
+		case <-ticker.C:
+			if progress != nil {
+				progress(int64(C.quota_walk_entries(w)))
+			}
+		}
+	}
 }
 
 // DeleteProject unsets the project id from the path and clears the quota for the project ID.
 func DeleteProject(path string, id uint32) error {
 	// Unset the project from the path.
-	err := SetProject(path, 0)
+	err := SetProject(path, 0, nil)
 	if err != nil {
 		return err
 	}
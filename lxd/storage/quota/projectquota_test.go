@@ -0,0 +1,85 @@
+//go:build linux && cgo
+
+package quota
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+func TestSetProject(t *testing.T) {
+	interval := setProjectProgressInterval
+	setProjectProgressInterval = time.Millisecond
+	t.Cleanup(func() { setProjectProgressInterval = interval })
+
+	// Wide enough to overflow the queue of open directories.
+	root := filepath.Join(t.TempDir(), "root")
+	entries := 1
+	paths := []string{root}
+	for i := 0; i < 64; i++ {
+		for j := 0; j < 8; j++ {
+			dir := filepath.Join(root, fmt.Sprintf("%d", i), fmt.Sprintf("%d", j))
+			require.NoError(t, os.MkdirAll(dir, 0755))
+			paths = append(paths, dir)
+
+			for k := 0; k < 4; k++ {
+				file := filepath.Join(dir, fmt.Sprintf("file%d", k))
+				require.NoError(t, os.WriteFile(file, nil, 0644))
+				paths = append(paths, file)
+			}
+
+			entries += 5
+		}
+
+		entries++
+	}
+
+	// Symlinks and special files are skipped.
+	outside := t.TempDir()
+	require.NoError(t, os.Symlink(outside, filepath.Join(root, "0", "link")))
+	require.NoError(t, unix.Mkfifo(filepath.Join(root, "0", "fifo"), 0644))
+
+	outsideID, err := GetProject(outside)
+	require.NoError(t, err)
+
+	var reported []int64
+	progress := func(entries int64) {
+		reported = append(reported, entries)
+	}
+
+	id := uint32(4242)
+	err = SetProject(root, id, progress)
+	if errors.Is(err, unix.EOPNOTSUPP) || errors.Is(err, unix.ENOTTY) {
+		// Without project quotas only the default ID can be set, which still walks the tree.
+		id = 0
+		reported = nil
+		err = SetProject(root, id, progress)
+	}
+
+	require.NoError(t, err)
+
+	for _, path := range paths {
+		pathID, err := GetProject(path)
+		require.NoError(t, err)
+		require.Equal(t, id, pathID, path)
+	}
+
+	pathID, err := GetProject(outside)
+	require.NoError(t, err)
+	require.Equal(t, outsideID, pathID)
+
+	// Progress only goes up and ends with the total.
+	require.NotEmpty(t, reported)
+	for i := 1; i < len(reported); i++ {
+		require.LessOrEqual(t, reported[i-1], reported[i])
+	}
+
+	require.Equal(t, int64(entries), reported[len(reported)-1])
+}
@@ -0,0 +1,134 @@
+// Package benchutil provides helpers for the benchmarks of low level primitives.
+package benchutil
+
+import (
+	"encoding/binary"
+	"fmt"
+	"os"
+	"strconv"
+	"strings"
+	"testing"
+	"unsafe"
+
+	"golang.org/x/sys/unix"
+)
+
+// SyscallCounter counts the syscalls entered by the threads of the process, through a counting
+// perf event on the raw_syscalls:sys_enter tracepoint of each of them. Threads started after the
+// counter was created aren't counted.
+type SyscallCounter struct {
+	fds []int
+}
+
+// syscallTracepointID returns the ID of the raw_syscalls:sys_enter tracepoint.
+func syscallTracepointID() (uint64, error) {
+	for _, dir := range []string{"/sys/kernel/tracing", "/sys/kernel/debug/tracing"} {
+		content, err := os.ReadFile(dir + "/events/raw_syscalls/sys_enter/id")
+		if err != nil {
+			continue
+		}
+
+		return strconv.ParseUint(strings.TrimSpace(string(content)), 10, 64)
+	}
+
+	return 0, fmt.Errorf("The raw_syscalls:sys_enter tracepoint isn't available")
+}
+
+// NewSyscallCounter starts counting the syscalls of the threads of the process.
+func NewSyscallCounter() (*SyscallCounter, error) {
+	id, err := syscallTracepointID()
+	if err != nil {
+		return nil, err
+	}
+
+	tasks, err := os.ReadDir("/proc/self/task")
+	if err != nil {
+		return nil, err
+	}
+
+	attr := unix.PerfEventAttr{
+		Type:   unix.PERF_TYPE_TRACEPOINT,
+		Config: id,
+	}
+
+	attr.Size = uint32(unsafe.Sizeof(attr))
+
+	c := &SyscallCounter{}
+	for _, task := range tasks {
+		tid, err := strconv.Atoi(task.Name())
+		if err != nil {
+			continue
+		}
+
+		fd, err := unix.PerfEventOpen(&attr, tid, -1, -1, unix.PERF_FLAG_FD_CLOEXEC)
+		if err == unix.ESRCH {
+			// The thread exited in the meantime.
+			continue
+		}
+
+		if err != nil {
+			c.Close()
+			return nil, fmt.Errorf("Failed to open the syscall counter of thread %d: %w", tid, err)
+		}
+
+		c.fds = append(c.fds, fd)
+	}
+
+	return c, nil
+}
+
+// Count returns the number of syscalls counted so far.
+func (c *SyscallCounter) Count() uint64 {
+	var total uint64
+
+	buf := make([]byte, 8)
+	for _, fd := range c.fds {
+		n, err := unix.Read(fd, buf)
+		if err != nil || n != len(buf) {
+			continue
+		}
+
+		total += binary.NativeEndian.Uint64(buf)
+	}
+
+	return total
+}
+
+// Close stops counting.
+func (c *SyscallCounter) Close() {
+	for _, fd := range c.fds {
+		_ = unix.Close(fd)
+	}
+
+	c.fds = nil
+}
+
+// Run runs op b.N times, reporting its allocations and, if the kernel lets the process count them,
+// the syscalls made per operation.
+func Run(b *testing.B, op func()) {
+	b.Helper()
+	b.ReportAllocs()
+
+	counter, err := NewSyscallCounter()
+	if err != nil {
+		b.Logf("Not counting syscalls: %v", err)
+	} else {
+		defer counter.Close()
+	}
+
+	var start uint64
+	if counter != nil {
+		start = counter.Count()
+	}
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		op()
+	}
+
+	b.StopTimer()
+
+	if counter != nil {
+		b.ReportMetric(float64(counter.Count()-start)/float64(b.N), "syscalls/op")
+	}
+}
@@ -0,0 +1,389 @@
+//go:build linux && cgo
+
+package netutils
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"maps"
+	"net"
+	"os"
+	"slices"
+	"sync"
+	"time"
+
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/shared/api"
+)
+
+// NetnsIfaddrsCache keeps the interface and address state of network namespaces in memory.
+//
+// An entry is filled with a full netlink dump the first time a namespace is looked up and is
+// dropped as soon as a link or address notification is received for that namespace. Unchanged
+// namespaces are therefore served without talking to the kernel. Notifications of other
+// namespaces are received through NETLINK_LISTEN_ALL_NSID which only covers namespaces that
+// have an nsid assigned in the caller's namespace, lookups of any other namespace bypass the
+// cache. The host side names are resolved on every lookup, so changes of the host interfaces
+// only drop the entry of the caller's namespace. If the kernel reports that notifications were
+// dropped, the whole cache is flushed.
+//
+// Notifications aren't sent for traffic so the interface counters are as old as the entry.
+// Use maxAge to bound how stale they can get.
+type NetnsIfaddrsCache struct {
+	mu sync.Mutex
+
+	// Cached state keyed by network namespace inode.
+	entries map[uint64]*netnsIfaddrsCacheEntry
+
+	// Invalidation counters per nsid (-1 being the caller's namespace) and for the whole
+	// cache. They detect notifications received while an entry was being filled.
+	nsidGen  map[int32]uint64
+	flushGen uint64
+
+	maxAge  time.Duration
+	sock    *os.File
+	allNSID bool
+}
+
+type netnsIfaddrsCacheEntry struct {
+	nsid     int32
+	networks map[string]api.InstanceStateNetwork
+	peers    map[string]int
+	created  time.Time
+}
+
+// NewNetnsIfaddrsCache returns a new NetnsIfaddrsCache subscribed to rtnetlink notifications.
+// Entries older than maxAge are refreshed on lookup, a zero maxAge keeps entries until they are
+// invalidated by a notification.
+func NewNetnsIfaddrsCache(maxAge time.Duration) (*NetnsIfaddrsCache, error) {
+	fd, err := unix.Socket(unix.AF_NETLINK, unix.SOCK_RAW|unix.SOCK_CLOEXEC|unix.SOCK_NONBLOCK, unix.NETLINK_ROUTE)
+	if err != nil {
+		return nil, fmt.Errorf("Failed to open netlink socket: %w", err)
+	}
+
+	err = unix.Bind(fd, &unix.SockaddrNetlink{Family: unix.AF_NETLINK})
+	if err != nil {
+		_ = unix.Close(fd)
+		return nil, fmt.Errorf("Failed to bind netlink socket: %w", err)
+	}
+
+	for _, group := range []int{unix.RTNLGRP_LINK, unix.RTNLGRP_IPV4_IFADDR, unix.RTNLGRP_IPV6_IFADDR, unix.RTNLGRP_NSID} {
+		err = unix.SetsockoptInt(fd, unix.SOL_NETLINK, unix.NETLINK_ADD_MEMBERSHIP, group)
+		if err != nil {
+			_ = unix.Close(fd)
+			return nil, fmt.Errorf("Failed to subscribe to rtnetlink group %d: %w", group, err)
+		}
+	}
+
+	// Best effort, a larger buffer makes it less likely that a burst of notifications
+	// forces a full flush.
+	rcvbuf := int(netlinkRcvBuf.Load())
+	if rcvbuf > 0 {
+		_ = unix.SetsockoptInt(fd, unix.SOL_SOCKET, unix.SO_RCVBUFFORCE, rcvbuf)
+	}
+
+	c := &NetnsIfaddrsCache{
+		entries: map[uint64]*netnsIfaddrsCacheEntry{},
+		nsidGen: map[int32]uint64{},
+		maxAge:  maxAge,
+	}
+
+	err = unix.SetsockoptInt(fd, unix.SOL_NETLINK, unix.NETLINK_LISTEN_ALL_NSID, 1)
+	if err == nil {
+		c.allNSID = true
+	}
+
+	// The socket is non-blocking so the runtime poller is used and Close interrupts reads.
+	c.sock = os.NewFile(uintptr(fd), "rtnetlink")
+
+	go c.listen()
+
+	return c, nil
+}
+
+// Close stops listening for notifications and flushes the cache.
+func (c *NetnsIfaddrsCache) Close() error {
+	err := c.sock.Close()
+
+	c.mu.Lock()
+	c.flush()
+	c.mu.Unlock()
+
+	return err
+}
+
+// Get returns the InstanceStateNetwork map of a process' network namespace.
+// An initPID of 0 or less refers to the caller's network namespace.
+func (c *NetnsIfaddrsCache) Get(initPID int32, hostInterfaces []net.Interface) (map[string]api.InstanceStateNetwork, error) {
+	nsPath := "/proc/self/ns/net"
+	if initPID > 0 {
+		nsPath = fmt.Sprintf("/proc/%d/ns/net", initPID)
+	}
+
+	var st unix.Stat_t
+	err := unix.Stat(nsPath, &st)
+	if err != nil {
+		return nil, err
+	}
+
+	c.mu.Lock()
+	entry := c.entries[st.Ino]
+	if entry != nil && (c.maxAge == 0 || time.Since(entry.created) < c.maxAge) {
+		networks := entry.copyNetworks(initPID, hostInterfaces)
+		c.mu.Unlock()
+		return networks, nil
+	}
+
+	c.mu.Unlock()
+
+	var flushGen, nsidGen uint64
+
+	entry = &netnsIfaddrsCacheEntry{
+		peers: map[string]int{},
+	}
+
+	entry.networks, err = netnsGetifaddrs(initPID, nil, entry.peers, func(nsid int32) {
+		c.mu.Lock()
+		entry.nsid = nsid
+		flushGen = c.flushGen
+		nsidGen = c.nsidGen[nsid]
+		c.mu.Unlock()
+	})
+	if err != nil {
+		return nil, err
+	}
+
+	entry.created = time.Now()
+
+	// Without NETLINK_LISTEN_ALL_NSID we only see notifications of our own namespace.
+	// Only keep the entry if nothing changed while the dump was running.
+	c.mu.Lock()
+	if (initPID <= 0 || c.allNSID) && c.flushGen == flushGen && c.nsidGen[entry.nsid] == nsidGen {
+		c.entries[st.Ino] = entry
+	}
+
+	c.mu.Unlock()
+
+	return entry.copyNetworks(initPID, hostInterfaces), nil
+}
+
+// Prefetch fills the entries of the given processes' network namespaces that aren't cached with a
+// single batched dump, so that a following Get of each of them is served from the cache. Failures
+// are ignored, the processes are then looked up again by Get.
+func (c *NetnsIfaddrsCache) Prefetch(initPIDs []int32) {
+	// Other namespaces aren't cached without NETLINK_LISTEN_ALL_NSID.
+	if !c.allNSID {
+		return
+	}
+
+	c.mu.Lock()
+	flushGen := c.flushGen
+	nsidGen := maps.Clone(c.nsidGen)
+	c.mu.Unlock()
+
+	misses := make([]int32, 0, len(initPIDs))
+	inodes := make([]uint64, 0, len(initPIDs))
+	for _, initPID := range initPIDs {
+		if initPID <= 0 {
+			continue
+		}
+
+		var st unix.Stat_t
+		err := unix.Stat(fmt.Sprintf("/proc/%d/ns/net", initPID), &st)
+		if err != nil {
+			continue
+		}
+
+		c.mu.Lock()
+		entry := c.entries[st.Ino]
+		c.mu.Unlock()
+
+		if entry != nil && (c.maxAge == 0 || time.Since(entry.created) < c.maxAge) {
+			continue
+		}
+
+		misses = append(misses, initPID)
+		inodes = append(inodes, st.Ino)
+	}
+
+	if len(misses) == 0 {
+		return
+	}
+
+	results, err := netnsGetifaddrsBatch(misses, nil, true)
+	if err != nil {
+		return
+	}
+
+	created := time.Now()
+
+	// Only keep the entries of namespaces for which nothing changed since the dump started.
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	if c.flushGen != flushGen {
+		return
+	}
+
+	for i, res := range results {
+		if res.Err != nil || c.nsidGen[res.nsid] != nsidGen[res.nsid] {
+			continue
+		}
+
+		c.entries[inodes[i]] = &netnsIfaddrsCacheEntry{
+			nsid:     res.nsid,
+			networks: res.Networks,
+			peers:    res.peers,
+			created:  created,
+		}
+	}
+}
+
+// copyNetworks returns a deep copy of the cached state with the host side interface names
+// resolved against hostInterfaces.
+func (e *netnsIfaddrsCacheEntry) copyNetworks(initPID int32, hostInterfaces []net.Interface) map[string]api.InstanceStateNetwork {
+	networks := make(map[string]api.InstanceStateNetwork, len(e.networks))
+	for name, network := range e.networks {
+		network.Addresses = slices.Clone(network.Addresses)
+
+		peer := e.peers[name]
+		if initPID != 0 && peer > 0 {
+			for _, hostInterface := range hostInterfaces {
+				if hostInterface.Index == peer {
+					network.HostName = hostInterface.Name
+					break
+				}
+			}
+		}
+
+		networks[name] = network
+	}
+
+	return networks
+}
+
+// invalidate drops the entries of the given nsid. Must be called with the lock held.
+func (c *NetnsIfaddrsCache) invalidate(nsid int32) {
+	c.nsidGen[nsid]++
+	for ino, entry := range c.entries {
+		if entry.nsid == nsid {
+			delete(c.entries, ino)
+		}
+	}
+}
+
+// flush drops all entries. Must be called with the lock held.
+func (c *NetnsIfaddrsCache) flush() {
+	c.flushGen++
+	clear(c.nsidGen)
+	clear(c.entries)
+}
+
+// listen processes rtnetlink notifications until the socket is closed.
+func (c *NetnsIfaddrsCache) listen() {
+	rawConn, err := c.sock.SyscallConn()
+	if err != nil {
+		return
+	}
+
+	buf := make([]byte, 65536)
+	oob := make([]byte, unix.CmsgSpace(4))
+
+	for {
+		var n, oobn int
+		var recvErr error
+
+		err := rawConn.Read(func(fd uintptr) bool {
+			n, oobn, _, _, recvErr = unix.Recvmsg(int(fd), buf, oob, unix.MSG_DONTWAIT)
+			return recvErr != unix.EAGAIN
+		})
+		if err != nil {
+			// The socket was closed.
+			return
+		}
+
+		if recvErr != nil {
+			if errors.Is(recvErr, unix.ENOBUFS) {
+				// Notifications were lost, we can't tell what changed.
+				c.mu.Lock()
+				c.flush()
+				c.mu.Unlock()
+			}
+
+			continue
+		}
+
+		nsid := int32(-1)
+		cmsgs, err := unix.ParseSocketControlMessage(oob[:oobn])
+		if err == nil {
+			for _, cmsg := range cmsgs {
+				if cmsg.Header.Level == unix.SOL_NETLINK && cmsg.Header.Type == unix.NETLINK_LISTEN_ALL_NSID && len(cmsg.Data) >= 4 {
+					nsid = int32(binary.NativeEndian.Uint32(cmsg.Data))
+				}
+			}
+		}
+
+		msgs, err := unix.ParseNetlinkMessage(buf[:n])
+		if err != nil {
+			c.mu.Lock()
+			c.flush()
+			c.mu.Unlock()
+			continue
+		}
+
+		c.mu.Lock()
+		for _, msg := range msgs {
+			switch msg.Header.Type {
+			case unix.RTM_NEWLINK, unix.RTM_DELLINK, unix.RTM_NEWADDR, unix.RTM_DELADDR:
+				c.invalidate(nsid)
+			case unix.RTM_NEWNSID, unix.RTM_DELNSID:
+				// The nsid to namespace mapping changed.
+				changed, ok := netnsIDFromMessage(msg.Data)
+				if !ok {
+					c.flush()
+					continue
+				}
+
+				c.invalidate(changed)
+			}
+		}
+
+		c.mu.Unlock()
+	}
+}
+
+// netnsIDFromMessage returns the nsid carried by the payload of an RTM_NEWNSID or RTM_DELNSID
+// notification.
+func netnsIDFromMessage(data []byte) (int32, bool) {
+	// The attributes follow a struct rtgenmsg.
+	const rtgenmsgLen = 4
+
+	if len(data) < rtgenmsgLen {
+		return -1, false
+	}
+
+	attrs := data[rtgenmsgLen:]
+	for len(attrs) >= unix.SizeofRtAttr {
+		attrLen := int(binary.NativeEndian.Uint16(attrs[0:2]))
+		attrType := binary.NativeEndian.Uint16(attrs[2:4])
+		if attrLen < unix.SizeofRtAttr || attrLen > len(attrs) {
+			return -1, false
+		}
+
+		if attrType == unix.NETNSA_NSID && attrLen >= unix.SizeofRtAttr+4 {
+			return int32(binary.NativeEndian.Uint32(attrs[unix.SizeofRtAttr:])), true
+		}
+
+		// Attributes are aligned to 4 bytes.
+		attrLen = (attrLen + 3) &^ 3
+		if attrLen > len(attrs) {
+			break
+		}
+
+		attrs = attrs[attrLen:]
+	}
+
+	return -1, false
+}
@@ -0,0 +1,196 @@
+//go:build linux && cgo
+
+package netutils
+
+import (
+	"encoding/binary"
+	"fmt"
+	"net"
+	"testing"
+	"time"
+
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+)
+
+// netnsCacheSettle is how long the tests wait for the notifications of the namespace setup to be
+// processed, so they don't invalidate the entries the tests fill.
+const netnsCacheSettle = 200 * time.Millisecond
+
+// cachedEntry returns the cache entry of a process' network namespace, nil if there isn't any.
+func cachedEntry(t *testing.T, c *NetnsIfaddrsCache, pid int32) *netnsIfaddrsCacheEntry {
+	var st unix.Stat_t
+	err := unix.Stat(fmt.Sprintf("/proc/%d/ns/net", pid), &st)
+	require.NoError(t, err)
+
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	return c.entries[st.Ino]
+}
+
+// waitEvicted waits for the cache entry of a process' network namespace to be dropped.
+func waitEvicted(t *testing.T, c *NetnsIfaddrsCache, pid int32) {
+	for deadline := time.Now().Add(5 * time.Second); cachedEntry(t, c, pid) != nil; {
+		if time.Now().After(deadline) {
+			t.Fatalf("Cache entry of %d wasn't invalidated", pid)
+		}
+
+		time.Sleep(10 * time.Millisecond)
+	}
+}
+
+func TestNetnsIfaddrsCacheInvalidation(t *testing.T) {
+	pidA, hostA, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	pidB, _, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	c, err := NewNetnsIfaddrsCache(0)
+	require.NoError(t, err)
+
+	defer func() { _ = c.Close() }()
+
+	if !c.allNSID {
+		t.Skip("NETLINK_LISTEN_ALL_NSID isn't supported")
+	}
+
+	time.Sleep(netnsCacheSettle)
+
+	hostInterfaces, err := net.Interfaces()
+	require.NoError(t, err)
+
+	networks, err := c.Get(pidA, hostInterfaces)
+	require.NoError(t, err)
+	require.Equal(t, hostA, networks["eth0"].HostName)
+
+	_, err = c.Get(pidB, hostInterfaces)
+	require.NoError(t, err)
+
+	entryA := cachedEntry(t, c, pidA)
+	require.NotNil(t, entryA)
+	require.NotNil(t, cachedEntry(t, c, pidB))
+
+	// Unchanged namespaces are served from the cache.
+	_, err = c.Get(pidA, hostInterfaces)
+	require.NoError(t, err)
+	require.Same(t, entryA, cachedEntry(t, c, pidA))
+
+	// Adding a host interface and changing another namespace leaves the entry alone. As the
+	// notifications are received in order, the host ones were processed once B got evicted.
+	_, _, err = testNetns(t, 0)
+	require.NoError(t, err)
+
+	testNetnsRun(t, pidB, "addr", "add", "192.0.2.1/24", "dev", "eth0")
+	waitEvicted(t, c, pidB)
+	require.Same(t, entryA, cachedEntry(t, c, pidA))
+
+	networks, err = c.Get(pidB, hostInterfaces)
+	require.NoError(t, err)
+
+	found := false
+	for _, addr := range networks["eth0"].Addresses {
+		if addr.Address == "192.0.2.1" {
+			found = true
+		}
+	}
+
+	require.True(t, found)
+
+	// Changes of a namespace drop its entry.
+	testNetnsRun(t, pidA, "link", "set", "eth0", "mtu", "1400")
+	waitEvicted(t, c, pidA)
+
+	networks, err = c.Get(pidA, hostInterfaces)
+	require.NoError(t, err)
+	require.Equal(t, 1400, networks["eth0"].Mtu)
+}
+
+func TestNetnsIfaddrsCacheMaxAge(t *testing.T) {
+	pid, _, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	c, err := NewNetnsIfaddrsCache(100 * time.Millisecond)
+	require.NoError(t, err)
+
+	defer func() { _ = c.Close() }()
+
+	time.Sleep(netnsCacheSettle)
+
+	_, err = c.Get(pid, nil)
+	require.NoError(t, err)
+
+	entry := cachedEntry(t, c, pid)
+	require.NotNil(t, entry)
+
+	_, err = c.Get(pid, nil)
+	require.NoError(t, err)
+	require.Same(t, entry, cachedEntry(t, c, pid))
+
+	// Expired entries are refreshed on lookup.
+	time.Sleep(150 * time.Millisecond)
+
+	_, err = c.Get(pid, nil)
+	require.NoError(t, err)
+
+	refreshed := cachedEntry(t, c, pid)
+	require.NotNil(t, refreshed)
+	require.NotSame(t, entry, refreshed)
+}
+
+func TestNetnsIfaddrsCachePrefetch(t *testing.T) {
+	pidA, hostA, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	pidB, _, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	c, err := NewNetnsIfaddrsCache(0)
+	require.NoError(t, err)
+
+	defer func() { _ = c.Close() }()
+
+	if !c.allNSID {
+		t.Skip("NETLINK_LISTEN_ALL_NSID isn't supported")
+	}
+
+	time.Sleep(netnsCacheSettle)
+
+	c.Prefetch([]int32{pidA, pidB})
+
+	entryA := cachedEntry(t, c, pidA)
+	require.NotNil(t, entryA)
+	require.NotNil(t, cachedEntry(t, c, pidB))
+
+	// The prefetched entries are used by Get.
+	hostInterfaces, err := net.Interfaces()
+	require.NoError(t, err)
+
+	networks, err := c.Get(pidA, hostInterfaces)
+	require.NoError(t, err)
+	require.Equal(t, hostA, networks["eth0"].HostName)
+	require.Same(t, entryA, cachedEntry(t, c, pidA))
+
+	// Cached entries aren't dumped again.
+	c.Prefetch([]int32{pidA})
+	require.Same(t, entryA, cachedEntry(t, c, pidA))
+}
+
+func TestNetnsIDFromMessage(t *testing.T) {
+	msg := make([]byte, 4+unix.SizeofRtAttr+4)
+	binary.NativeEndian.PutUint16(msg[4:], unix.SizeofRtAttr+4)
+	binary.NativeEndian.PutUint16(msg[6:], unix.NETNSA_NSID)
+	binary.NativeEndian.PutUint32(msg[8:], 7)
+
+	nsid, ok := netnsIDFromMessage(msg)
+	require.True(t, ok)
+	require.Equal(t, int32(7), nsid)
+
+	_, ok = netnsIDFromMessage(msg[:4])
+	require.False(t, ok)
+
+	// Truncated attribute.
+	_, ok = netnsIDFromMessage(msg[:10])
+	require.False(t, ok)
+}
@@ -339,25 +339,19 @@ static int nl_msg_to_ifaddr(void *pctx, bool *netnsid_aware, struct nlmsghdr *h)
 	((struct rtattr *)(((void *)(nmsg)) + \
 			   __NETLINK_ALIGN((nmsg)->nlmsg_len)))
 
-static int __netlink_recv(int fd, unsigned int seq, int type, int af,
-			  __s32 netns_id, bool *netnsid_aware,
+static int __netlink_recv(int fd, struct netlink_recv_buf *rb,
+			  unsigned int seq, int type, int af, __s32 netns_id,
+			  bool *netnsid_aware,
 			  int (*cb)(void *ctx, bool *netnsid_aware,
 				    struct nlmsghdr *h),
 			  void *ctx)
 {
 	int r, property, ret;
+	bool sized = false;
 	char *buf;
 	struct nlmsghdr *hdr;
 	struct ifinfomsg *ifi_msg;
 	struct ifaddrmsg *ifa_msg;
-	union {
-		uint8_t buf[8192];
-		struct {
-			struct nlmsghdr nlh;
-			struct rtgenmsg g;
-		} req;
-		struct nlmsghdr reply;
-	} u;
 	char getlink_buf[__NETLINK_ALIGN(sizeof(struct nlmsghdr)) +
 			 __NETLINK_ALIGN(sizeof(struct ifinfomsg)) +
 			 __NETLINK_ALIGN(1024)] = {0};
@@ -401,17 +395,80 @@ static int __netlink_recv(int fd, unsigned int seq, int type, int af,
 		return -1;
 
 	for (;;) {
-		r = recv(fd, u.buf, sizeof(u.buf), MSG_DONTWAIT);
-		if (r <= 0)
+		struct iovec iov;
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		ssize_t len;
+		char *end;
+
+		// Peek at the size of the first part of the dump and make
+		// sure the buffer can hold it. Every part is allocated at
+		// least as large as the biggest message of the dump.
+		if (!sized) {
+			len = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+
+				return -1;
+			}
+
+			if (netlink_recv_buf_reserve(rb, len) < 0)
+				return -1;
+
+			sized = true;
+		}
+
+		iov.iov_base = rb->buf;
+		iov.iov_len = rb->len;
+
+		// Wait for the dump to make progress rather than failing
+		// whenever the next part hasn't been queued yet.
+		len = recvmsg(fd, &msg, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (len == 0) {
+			errno = ECONNRESET;
 			return -1;
+		}
 
-		for (hdr = &u.reply; __NLMSG_OK(hdr, (void *)&u.buf[r]);
+		if (msg.msg_flags & MSG_TRUNC) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		end = rb->buf + len;
+		for (hdr = (struct nlmsghdr *)rb->buf; __NLMSG_OK(hdr, end);
 		     hdr = __NLMSG_NEXT(hdr)) {
+			if (hdr->nlmsg_len < sizeof(struct nlmsghdr) ||
+			    hdr->nlmsg_len > (size_t)(end - (char *)hdr)) {
+				errno = EBADMSG;
+				return -1;
+			}
+
+			// Ignore leftovers from earlier requests when the
+			// socket is reused.
+			if (hdr->nlmsg_seq != seq)
+				continue;
+
 			if (hdr->nlmsg_type == NLMSG_DONE)
 				return 0;
 
 			if (hdr->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = __NLMSG_DATA(hdr);
+
 				errno = EINVAL;
+				if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(*err)) &&
+				    err->error < 0)
+					errno = -err->error;
+
 				return -1;
 			}
 
@@ -422,13 +479,37 @@ static int __netlink_recv(int fd, unsigned int seq, int type, int af,
 	}
 }
 
+static int __rtnl_enumerate_fd(int fd, struct netlink_recv_buf *rb,
+			       unsigned int link_seq, unsigned int addr_seq,
+			       int link_af, int addr_af, __s32 netns_id,
+			       bool *netnsid_aware,
+			       int (*cb)(void *ctx, bool *netnsid_aware, struct nlmsghdr *h),
+			       void *ctx)
+{
+	int r;
+	bool getaddr_netnsid_aware = false, getlink_netnsid_aware = false;
+
+	r = __netlink_recv(fd, rb, link_seq, RTM_GETLINK, link_af, netns_id,
+			   &getlink_netnsid_aware, cb, ctx);
+	if (!r)
+		r = __netlink_recv(fd, rb, addr_seq, RTM_GETADDR, addr_af,
+				   netns_id, &getaddr_netnsid_aware, cb, ctx);
+
+	if (getaddr_netnsid_aware && getlink_netnsid_aware)
+		*netnsid_aware = true;
+	else
+		*netnsid_aware = false;
+
+	return r;
+}
+
 static int __rtnl_enumerate(int link_af, int addr_af, __s32 netns_id,
 			    bool *netnsid_aware,
 			    int (*cb)(void *ctx, bool *netnsid_aware, struct nlmsghdr *h),
 			    void *ctx)
 {
 	int fd, r, saved_errno;
-	bool getaddr_netnsid_aware = false, getlink_netnsid_aware = false;
+	struct netlink_recv_buf rb = {};
 
 	fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
 	if (fd < 0)
@@ -442,26 +523,41 @@ static int __rtnl_enumerate(int link_af, int addr_af, __s32 netns_id,
 		return -1;
 	}
 
-	r = __netlink_recv(fd, 1, RTM_GETLINK, link_af, netns_id,
-			   &getlink_netnsid_aware, cb, ctx);
-	if (!r)
-		r = __netlink_recv(fd, 2, RTM_GETADDR, addr_af, netns_id,
-				   &getaddr_netnsid_aware, cb, ctx);
+	r = __rtnl_enumerate_fd(fd, &rb, 1, 2, link_af, addr_af, netns_id,
+				netnsid_aware, cb, ctx);
 
 	saved_errno = errno;
 	close(fd);
+	netlink_recv_buf_free(&rb);
 	errno = saved_errno;
 
-	if (getaddr_netnsid_aware && getlink_netnsid_aware)
-		*netnsid_aware = true;
-	else
+	return r;
+}
+
+static int __rtnl_enumerate_handle(struct netlink_handle *handle,
+				   __s32 netns_id, bool *netnsid_aware,
+				   int (*cb)(void *ctx, bool *netnsid_aware, struct nlmsghdr *h),
+				   void *ctx)
+{
+	unsigned int link_seq, addr_seq;
+
+	if (!handle->strict_chk && netns_id >= 0) {
 		*netnsid_aware = false;
+		errno = EOPNOTSUPP;
+		return -1;
+	}
 
-	return r;
+	link_seq = netlink_handle_next_seq(handle);
+	addr_seq = netlink_handle_next_seq(handle);
+
+	return __rtnl_enumerate_fd(handle->fd, &handle->rb, link_seq, addr_seq,
+				   AF_UNSPEC, AF_UNSPEC, netns_id, netnsid_aware,
+				   cb, ctx);
 }
 
-__unused static int netns_getifaddrs(struct netns_ifaddrs **ifap,
-				     __s32 netns_id, bool *netnsid_aware)
+static int __netns_getifaddrs(struct netns_ifaddrs **ifap,
+			      struct netlink_handle *handle, __s32 netns_id,
+			      bool *netnsid_aware)
 {
 	int r, saved_errno;
 	struct ifaddrs_ctx _ctx;
@@ -469,8 +565,13 @@ __unused static int netns_getifaddrs(struct netns_ifaddrs **ifap,
 
 	memset(ctx, 0, sizeof *ctx);
 
-	r = __rtnl_enumerate(AF_UNSPEC, AF_UNSPEC, netns_id, netnsid_aware,
-			     nl_msg_to_ifaddr, ctx);
+	if (handle) {
+		r = __rtnl_enumerate_handle(handle, netns_id, netnsid_aware,
+					    nl_msg_to_ifaddr, ctx);
+	} else {
+		r = __rtnl_enumerate(AF_UNSPEC, AF_UNSPEC, netns_id,
+				     netnsid_aware, nl_msg_to_ifaddr, ctx);
+	}
 	saved_errno = errno;
 	if (r < 0)
 		netns_freeifaddrs(&ctx->first->ifa);
@@ -481,6 +582,489 @@ __unused static int netns_getifaddrs(struct netns_ifaddrs **ifap,
 	return r;
 }
 
+__unused static int netns_getifaddrs(struct netns_ifaddrs **ifap,
+				     __s32 netns_id, bool *netnsid_aware)
+{
+	return __netns_getifaddrs(ifap, NULL, netns_id, netnsid_aware);
+}
+
+// Same as netns_getifaddrs() but runs both dumps on the socket of an open
+// netlink handle instead of creating a new socket for each call.
+__unused static int netns_getifaddrs_handle(struct netlink_handle *handle,
+					    struct netns_ifaddrs **ifap,
+					    __s32 netns_id, bool *netnsid_aware)
+{
+	return __netns_getifaddrs(ifap, handle, netns_id, netnsid_aware);
+}
+
+#define NETNS_IFADDRS_ADDR_MAX 24
+
+// A flat representation of a single entry of a netns_getifaddrs() listing.
+// Link records carry the hardware address (family AF_PACKET) and the link
+// statistics, address records carry the raw IPv4 or IPv6 address. Names live
+// in the string table of the arena the record belongs to.
+struct netns_ifaddrs_record {
+	__u32 name_off;
+	__s32 ifindex;
+	__s32 ifindex_peer;
+	__u32 flags;
+	__s32 mtu;
+
+	__u16 family;
+	__u8 prefixlen;
+	__u8 addr_len;
+	__u8 addr[NETNS_IFADDRS_ADDR_MAX];
+
+	// Set to IFLA_STATS64 if stats64 is valid.
+	__s32 stats_type;
+	struct rtnl_link_stats64 stats64;
+
+	// Index of the next link record in the same hash bucket.
+	__s32 hash_next;
+};
+
+// Alternative result layout of netns_getifaddrs(). Instead of one
+// allocation per entry all records are stored in a single array with a
+// separate string table for the interface names. Free with
+// netns_ifaddrs_arena_free().
+struct netns_ifaddrs_arena {
+	struct netns_ifaddrs_record *records;
+	__u32 nr_records;
+	__u32 cap_records;
+
+	char *strtab;
+	__u32 strtab_len;
+	__u32 strtab_cap;
+
+	// Heads of the per bucket chains of link records.
+	__s32 hash[IFADDRS_HASH_SIZE];
+};
+
+__unused static void netns_ifaddrs_arena_free(struct netns_ifaddrs_arena *arena)
+{
+	free(arena->records);
+	arena->records = NULL;
+	arena->nr_records = 0;
+	arena->cap_records = 0;
+
+	free(arena->strtab);
+	arena->strtab = NULL;
+	arena->strtab_len = 0;
+	arena->strtab_cap = 0;
+}
+
+static void netns_ifaddrs_arena_init(struct netns_ifaddrs_arena *arena)
+{
+	memset(arena, 0, sizeof(*arena));
+	for (size_t i = 0; i < IFADDRS_HASH_SIZE; i++)
+		arena->hash[i] = -1;
+}
+
+// Returns a zeroed record at the end of the arena. The record is only
+// committed once nr_records is incremented.
+static struct netns_ifaddrs_record *arena_next_record(struct netns_ifaddrs_arena *arena)
+{
+	struct netns_ifaddrs_record *rec;
+
+	if (arena->nr_records == arena->cap_records) {
+		__u32 cap = arena->cap_records ? arena->cap_records * 2 : 64;
+		struct netns_ifaddrs_record *records;
+
+		records = realloc(arena->records, cap * sizeof(*records));
+		if (!records) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		arena->records = records;
+		arena->cap_records = cap;
+	}
+
+	rec = &arena->records[arena->nr_records];
+	memset(rec, 0, sizeof(*rec));
+	rec->hash_next = -1;
+
+	return rec;
+}
+
+// Appends a NUL-terminated copy of the name to the string table and
+// returns its offset.
+static int arena_add_name(struct netns_ifaddrs_arena *arena, const char *name,
+			  size_t len, __u32 *off)
+{
+	// Netlink includes the terminating NUL in the attribute length.
+	len = strnlen(name, len);
+
+	if (arena->strtab_len + len + 1 > arena->strtab_cap) {
+		__u32 cap = arena->strtab_cap ? arena->strtab_cap : 1024;
+		char *strtab;
+
+		while (arena->strtab_len + len + 1 > cap)
+			cap *= 2;
+
+		strtab = realloc(arena->strtab, cap);
+		if (!strtab) {
+			errno = ENOMEM;
+			return -1;
+		}
+
+		arena->strtab = strtab;
+		arena->strtab_cap = cap;
+	}
+
+	*off = arena->strtab_len;
+	memcpy(arena->strtab + arena->strtab_len, name, len);
+	arena->strtab[arena->strtab_len + len] = '\0';
+	arena->strtab_len += len + 1;
+
+	return 0;
+}
+
+static void arena_copy_addr(struct netns_ifaddrs_record *rec, int af,
+			    const void *addr, size_t addrlen)
+{
+	size_t len;
+
+	switch (af) {
+	case AF_INET:
+		len = 4;
+		break;
+	case AF_INET6:
+		len = 16;
+		break;
+	default:
+		return;
+	}
+
+	if (addrlen < len)
+		return;
+
+	rec->family = af;
+	rec->addr_len = len;
+	memcpy(rec->addr, addr, len);
+}
+
+static int nl_msg_to_arena(void *pctx, bool *netnsid_aware, struct nlmsghdr *h)
+{
+	struct netns_ifaddrs_arena *arena = pctx;
+	struct netns_ifaddrs_record *rec, *link = NULL;
+	struct ifinfomsg *ifi = __NLMSG_DATA(h);
+	struct ifaddrmsg *ifa = __NLMSG_DATA(h);
+	struct rtattr *rta;
+	bool has_name = false, has_local = false;
+	__s32 link_idx = -1;
+
+	if (h->nlmsg_type != RTM_NEWLINK) {
+		for (__s32 i = arena->hash[ifa->ifa_index % IFADDRS_HASH_SIZE];
+		     i >= 0; i = arena->records[i].hash_next) {
+			if (arena->records[i].ifindex == (__s32)ifa->ifa_index) {
+				link_idx = i;
+				break;
+			}
+		}
+
+		if (link_idx < 0)
+			return 0;
+	}
+
+	rec = arena_next_record(arena);
+	if (!rec)
+		return -1;
+
+	// Only take a pointer once the array can't be moved anymore.
+	if (link_idx >= 0)
+		link = &arena->records[link_idx];
+
+	if (h->nlmsg_type == RTM_NEWLINK) {
+		rec->ifindex = ifi->ifi_index;
+		rec->flags = ifi->ifi_flags;
+
+		for (rta = __NLMSG_RTA(h, sizeof(*ifi)); __NLMSG_RTAOK(rta, h);
+		     rta = __RTA_NEXT(rta)) {
+			size_t len = __RTA_DATALEN(rta);
+
+			switch (rta->rta_type) {
+			case IFLA_IFNAME:
+				if (len <= IFNAMSIZ) {
+					if (arena_add_name(arena, __RTA_DATA(rta), len, &rec->name_off))
+						return -1;
+
+					has_name = true;
+				}
+				break;
+			case IFLA_ADDRESS:
+				if (len <= sizeof(rec->addr)) {
+					rec->family = AF_PACKET;
+					rec->addr_len = len;
+					memcpy(rec->addr, __RTA_DATA(rta), len);
+				}
+				break;
+			case IFLA_STATS64:
+				rec->stats_type = IFLA_STATS64;
+				if (len > sizeof(rec->stats64))
+					len = sizeof(rec->stats64);
+				memcpy(&rec->stats64, __RTA_DATA(rta), len);
+				break;
+			case IFLA_MTU:
+				memcpy(&rec->mtu, __RTA_DATA(rta), sizeof(int));
+				break;
+			case IFLA_TARGET_NETNSID:
+				*netnsid_aware = true;
+				break;
+			case IFLA_LINK:
+				if (len >= sizeof(rec->ifindex_peer))
+					memcpy(&rec->ifindex_peer, __RTA_DATA(rta),
+					       sizeof(rec->ifindex_peer));
+				break;
+			}
+		}
+
+		if (has_name) {
+			unsigned int bucket = rec->ifindex % IFADDRS_HASH_SIZE;
+			rec->hash_next = arena->hash[bucket];
+			arena->hash[bucket] = arena->nr_records;
+		}
+	} else {
+		rec->name_off = link->name_off;
+		rec->mtu = link->mtu;
+		rec->ifindex = link->ifindex;
+		rec->flags = link->flags;
+		has_name = true;
+
+		for (rta = __NLMSG_RTA(h, sizeof(*ifa)); __NLMSG_RTAOK(rta, h);
+		     rta = __RTA_NEXT(rta)) {
+			size_t len = __RTA_DATALEN(rta);
+
+			switch (rta->rta_type) {
+			case IFA_ADDRESS:
+				// On point-to-point links IFA_ADDRESS is the
+				// peer and IFA_LOCAL the local address.
+				if (!has_local)
+					arena_copy_addr(rec, ifa->ifa_family,
+							__RTA_DATA(rta), len);
+				break;
+			case IFA_LOCAL:
+				arena_copy_addr(rec, ifa->ifa_family,
+						__RTA_DATA(rta), len);
+				has_local = true;
+				break;
+			case IFA_LABEL:
+				if (len <= IFNAMSIZ &&
+				    strncmp(__RTA_DATA(rta), arena->strtab + link->name_off, len)) {
+					if (arena_add_name(arena, __RTA_DATA(rta), len, &rec->name_off))
+						return -1;
+				}
+				break;
+			case IFA_TARGET_NETNSID:
+				*netnsid_aware = true;
+				break;
+			}
+		}
+
+		if (rec->addr_len)
+			rec->prefixlen = ifa->ifa_prefixlen;
+	}
+
+	if (has_name)
+		arena->nr_records++;
+
+	return 0;
+}
+
+// Same as netns_getifaddrs_handle() but stores the result in an arena.
+__unused static int netns_getifaddrs_arena_handle(struct netlink_handle *handle,
+						  struct netns_ifaddrs_arena *arena,
+						  __s32 netns_id,
+						  bool *netnsid_aware)
+{
+	int r, saved_errno;
+
+	netns_ifaddrs_arena_init(arena);
+
+	r = __rtnl_enumerate_handle(handle, netns_id, netnsid_aware,
+				    nl_msg_to_arena, arena);
+	saved_errno = errno;
+	if (r < 0)
+		netns_ifaddrs_arena_free(arena);
+	errno = saved_errno;
+
+	return r;
+}
+
+// Counters of a single interface as returned by netns_getifstats_handle().
+struct netns_ifstats {
+	__s32 ifindex;
+	char name[IFNAMSIZ + 1];
+
+	// Set to IFLA_STATS64 if stats64 is valid.
+	__s32 stats_type;
+	struct rtnl_link_stats64 stats64;
+};
+
+struct netns_ifstats_list {
+	struct netns_ifstats *stats;
+	__u32 nr_stats;
+	__u32 cap_stats;
+};
+
+__unused static void netns_ifstats_list_free(struct netns_ifstats_list *list)
+{
+	free(list->stats);
+	list->stats = NULL;
+	list->nr_stats = 0;
+	list->cap_stats = 0;
+}
+
+static int nl_msg_to_ifstats(void *pctx, bool *netnsid_aware, struct nlmsghdr *h)
+{
+	struct netns_ifstats_list *list = pctx;
+	struct ifinfomsg *ifi = __NLMSG_DATA(h);
+	struct netns_ifstats *st;
+	struct rtattr *rta;
+	bool has_name = false;
+
+	if (h->nlmsg_type != RTM_NEWLINK)
+		return 0;
+
+	if (list->nr_stats == list->cap_stats) {
+		__u32 cap = list->cap_stats ? list->cap_stats * 2 : 64;
+		struct netns_ifstats *stats;
+
+		stats = realloc(list->stats, cap * sizeof(*stats));
+		if (!stats) {
+			errno = ENOMEM;
+			return -1;
+		}
+
+		list->stats = stats;
+		list->cap_stats = cap;
+	}
+
+	st = &list->stats[list->nr_stats];
+	memset(st, 0, sizeof(*st));
+	st->ifindex = ifi->ifi_index;
+
+	for (rta = __NLMSG_RTA(h, sizeof(*ifi)); __NLMSG_RTAOK(rta, h);
+	     rta = __RTA_NEXT(rta)) {
+		size_t len = __RTA_DATALEN(rta);
+
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			if (len < sizeof(st->name)) {
+				memcpy(st->name, __RTA_DATA(rta), len);
+				has_name = true;
+			}
+			break;
+		case IFLA_STATS64:
+			if (len > sizeof(st->stats64))
+				len = sizeof(st->stats64);
+			st->stats_type = IFLA_STATS64;
+			memcpy(&st->stats64, __RTA_DATA(rta), len);
+			break;
+		case IFLA_TARGET_NETNSID:
+			*netnsid_aware = true;
+			break;
+		}
+	}
+
+	if (has_name)
+		list->nr_stats++;
+
+	return 0;
+}
+
+// Retrieve the counters of all interfaces of a network namespace. Unlike
+// netns_getifaddrs_handle() this only runs the RTM_GETLINK dump and skips
+// addresses entirely. RTM_GETSTATS would return more compact messages but
+// it doesn't support IFLA_TARGET_NETNSID and doesn't report names.
+__unused static int netns_getifstats_handle(struct netlink_handle *handle,
+					    struct netns_ifstats_list *list,
+					    __s32 netns_id, bool *netnsid_aware)
+{
+	int r, saved_errno;
+
+	memset(list, 0, sizeof(*list));
+	*netnsid_aware = false;
+
+	if (!handle->strict_chk && netns_id >= 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	r = __netlink_recv(handle->fd, &handle->rb,
+			   netlink_handle_next_seq(handle), RTM_GETLINK,
+			   AF_UNSPEC, netns_id, netnsid_aware,
+			   nl_msg_to_ifstats, list);
+	saved_errno = errno;
+	if (r < 0)
+		netns_ifstats_list_free(list);
+	errno = saved_errno;
+
+	return r;
+}
+
+struct netns_ifaddrs_result {
+	// Network namespace to query, a negative value means the caller's.
+	__s32 netns_fd;
+
+	// Network namespace id the namespace was queried with, -1 for the caller's.
+	__s32 netns_id;
+
+	struct netns_ifaddrs_arena arena;
+	bool netnsid_aware;
+
+	// Zero on success, an errno value otherwise.
+	int error;
+};
+
+// Enumerate the interfaces and addresses of several network namespaces in
+// one go. All requests are sent through the same handle. As the kernel
+// only allows one dump at a time per socket the namespaces are processed
+// one after the other. When a request fails the handle is reopened so the
+// remaining namespaces aren't affected by a half-finished dump. On return
+// handle->fd is negative if the handle couldn't be reopened.
+__unused static void netns_getifaddrs_batch(struct netlink_handle *handle,
+					    struct netns_ifaddrs_result *results,
+					    size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		struct netns_ifaddrs_result *res = &results[i];
+		__s32 netns_id = -1;
+		int ret;
+
+		netns_ifaddrs_arena_init(&res->arena);
+		res->netns_id = -1;
+		res->netnsid_aware = false;
+		res->error = 0;
+
+		if (handle->fd < 0) {
+			res->error = EBADF;
+			continue;
+		}
+
+		if (res->netns_fd >= 0) {
+			errno = 0;
+			netns_id = netns_get_nsid_handle(handle, res->netns_fd);
+			if (netns_id < 0) {
+				res->error = errno ?: ENOENT;
+				continue;
+			}
+
+			res->netns_id = netns_id;
+		}
+
+		errno = 0;
+		ret = netns_getifaddrs_arena_handle(handle, &res->arena, netns_id,
+						    &res->netnsid_aware);
+		if (ret < 0) {
+			res->error = errno ?: EINVAL;
+
+			netlink_handle_close(handle);
+			(void)netlink_handle_open(handle, handle->rcvbuf);
+		}
+	}
+}
+
 // Get a pointer to the address structure from a sockaddr.
 __unused static void *get_addr_ptr(struct sockaddr *sockaddr_ptr)
 {
@@ -118,6 +118,121 @@ out:
 	return err;
 }
 
+// The kernel caps the size of a single part of a dump to 32KiB unless a
+// single message is larger than that, so this is enough to receive a full
+// part in one go in almost all cases.
+#define NETLINK_DUMP_BUF_SIZE 32768
+
+// A receive buffer for netlink dumps that grows as needed and can be reused
+// across dumps.
+struct netlink_recv_buf {
+	char *buf;
+	size_t len;
+};
+
+__unused static void netlink_recv_buf_free(struct netlink_recv_buf *rb)
+{
+	free(rb->buf);
+	rb->buf = NULL;
+	rb->len = 0;
+}
+
+// Make sure the receive buffer can hold at least len bytes. The buffer is
+// always a multiple of the page size.
+__unused static int netlink_recv_buf_reserve(struct netlink_recv_buf *rb, size_t len)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	char *buf;
+
+	if (len < NETLINK_DUMP_BUF_SIZE)
+		len = NETLINK_DUMP_BUF_SIZE;
+
+	len = (len + page_size - 1) & ~(page_size - 1);
+	if (len <= rb->len)
+		return 0;
+
+	buf = realloc(rb->buf, len);
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	rb->buf = buf;
+	rb->len = len;
+	return 0;
+}
+
+// A persistent NETLINK_ROUTE socket that can be reused across requests.
+// Every request sent through the handle gets a fresh sequence number so
+// replies to earlier (possibly aborted) requests can be told apart and
+// discarded.
+struct netlink_handle {
+	int fd;
+	__u32 seq;
+	bool strict_chk;
+	int rcvbuf;
+	struct netlink_recv_buf rb;
+};
+
+__unused static void netlink_handle_close(struct netlink_handle *handle)
+{
+	if (handle->fd >= 0) {
+		close(handle->fd);
+		handle->fd = -EBADF;
+	}
+
+	netlink_recv_buf_free(&handle->rb);
+}
+
+// Open a netlink handle. If rcvbuf is positive it is used as the size of the
+// socket receive buffer, raising the rmem_max limit if permitted.
+__unused static int netlink_handle_open(struct netlink_handle *handle,
+					int rcvbuf)
+{
+	int fd, ret;
+
+	handle->fd = -EBADF;
+	handle->seq = 0;
+	handle->strict_chk = false;
+	handle->rcvbuf = rcvbuf;
+	handle->rb.buf = NULL;
+	handle->rb.len = 0;
+
+	fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	ret = setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &(int){1},
+			 sizeof(int));
+	if (ret == 0)
+		handle->strict_chk = true;
+
+	// Let the kernel report the failing attribute on errors. This is purely
+	// informational so don't fail if it's unsupported.
+	(void)setsockopt(fd, SOL_NETLINK, NETLINK_EXT_ACK, &(int){1},
+			 sizeof(int));
+
+	if (rcvbuf > 0) {
+		ret = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+				 sizeof(rcvbuf));
+		if (ret < 0)
+			(void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+					 sizeof(rcvbuf));
+	}
+
+	handle->fd = fd;
+	return 0;
+}
+
+static __u32 netlink_handle_next_seq(struct netlink_handle *handle)
+{
+	// Sequence number 0 is used by the kernel for notifications.
+	if (++handle->seq == 0)
+		handle->seq = 1;
+
+	return handle->seq;
+}
+
 static int netlink_recv(int fd, struct nlmsghdr *nlmsghdr)
 {
 	int ret;
@@ -186,8 +301,8 @@ static int __netlink_send(int fd, struct nlmsghdr *nlmsghdr)
 	return ret;
 }
 
-static int netlink_transaction(int fd, struct nlmsghdr *request,
-			       struct nlmsghdr *answer)
+__unused static int netlink_transaction(int fd, struct nlmsghdr *request,
+					struct nlmsghdr *answer)
 {
 	int ret;
 
@@ -250,20 +365,15 @@ static int addattr(struct nlmsghdr *n, size_t maxlen, int type,
 	return 0;
 }
 
-__unused static __s32 netns_get_nsid(__s32 netns_fd)
+static __s32 __netns_get_nsid(int fd, __u32 seq, __s32 netns_fd)
 {
-	int fd, ret;
+	int ret;
 	ssize_t len;
 	char buf[NLMSG_ALIGN(sizeof(struct nlmsghdr)) +
 		 NLMSG_ALIGN(sizeof(struct rtgenmsg)) + NLMSG_ALIGN(1024)];
 	struct rtattr *tb[__LXC_NETNSA_MAX + 1];
 	struct nlmsghdr *hdr;
 	struct rtgenmsg *msg;
-	int saved_errno;
-
-	fd = netlink_open(NETLINK_ROUTE);
-	if (fd < 0)
-		return -1;
 
 	memset(buf, 0, sizeof(buf));
 	hdr = (struct nlmsghdr *)buf;
@@ -271,20 +381,43 @@ __unused static __s32 netns_get_nsid(__s32 netns_fd)
 
 	hdr->nlmsg_len = NLMSG_LENGTH(sizeof(*msg));
 	hdr->nlmsg_type = RTM_GETNSID;
-	hdr->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	hdr->nlmsg_flags = NLM_F_REQUEST;
 	hdr->nlmsg_pid = 0;
-	hdr->nlmsg_seq = RTM_GETNSID;
+	hdr->nlmsg_seq = seq;
 	msg->rtgen_family = AF_UNSPEC;
 
 	addattr(hdr, 1024, __LXC_NETNSA_FD, &netns_fd, sizeof(__s32));
 
-	ret = netlink_transaction(fd, hdr, hdr);
-	saved_errno = errno;
-	close(fd);
-	errno = saved_errno;
+	ret = __netlink_send(fd, hdr);
 	if (ret < 0)
 		return -1;
 
+	// Skip over anything left behind by earlier requests on this socket.
+	for (;;) {
+		ret = recv(fd, buf, sizeof(buf), 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if ((size_t)ret < sizeof(struct nlmsghdr) ||
+		    hdr->nlmsg_len > (__u32)ret) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		if (hdr->nlmsg_seq == seq)
+			break;
+	}
+
+	if (hdr->nlmsg_type == NLMSG_ERROR) {
+		struct nlmsgerr *err = (struct nlmsgerr *)__NLMSG_DATA(hdr);
+		errno = err->error ? -err->error : EINVAL;
+		return -1;
+	}
+
 	msg = __NLMSG_DATA(hdr);
 	len = hdr->nlmsg_len - NLMSG_SPACE(sizeof(*msg));
 	if (len < 0)
@@ -296,3 +429,28 @@ __unused static __s32 netns_get_nsid(__s32 netns_fd)
 
 	return -1;
 }
+
+__unused static __s32 netns_get_nsid(__s32 netns_fd)
+{
+	int fd, saved_errno;
+	__s32 ret;
+
+	fd = netlink_open(NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	ret = __netns_get_nsid(fd, RTM_GETNSID, netns_fd);
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+
+	return ret;
+}
+
+// Same as netns_get_nsid() but reuses the socket of an open netlink handle.
+__unused static __s32 netns_get_nsid_handle(struct netlink_handle *handle,
+					    __s32 netns_fd)
+{
+	return __netns_get_nsid(handle->fd, netlink_handle_next_seq(handle),
+				netns_fd);
+}
@@ -9,13 +9,20 @@ package netutils
 import "C"
 
 import (
+	"bytes"
 	"fmt"
 	"io"
 	"net"
+	"net/netip"
 	"os"
+	"runtime"
+	"strconv"
 	"strings"
+	"sync/atomic"
 	"unsafe"
 
+	"golang.org/x/sys/unix"
+
 	"github.com/canonical/lxd/shared/api"
 )
 
@@ -61,46 +68,318 @@ const UnixFdsReceivedMore uint = C.UNIX_FDS_RECEIVED_MORE
 // UnixFdsReceivedNone indicates that no fds have been received.
 const UnixFdsReceivedNone uint = C.UNIX_FDS_RECEIVED_NONE
 
+// netlinkRcvBuf is the socket receive buffer size requested for pooled netlink handles.
+// A large buffer lets dumps of hosts with many interfaces be queued without
+// the kernel having to wait for userspace between parts.
+var netlinkRcvBuf atomic.Int64
+
+func init() {
+	netlinkRcvBuf.Store(1024 * 1024)
+}
+
+// SetNetlinkReceiveBuffer sets the socket receive buffer size requested for the netlink sockets
+// used to retrieve network interfaces, 0 leaving the system default. It applies to the sockets
+// opened afterwards, the idle pooled ones are closed.
+func SetNetlinkReceiveBuffer(size int) {
+	netlinkRcvBuf.Store(int64(size))
+
+	for {
+		select {
+		case handle := <-netlinkHandles:
+			C.netlink_handle_close(handle)
+		default:
+			return
+		}
+	}
+}
+
+// netlinkHandles holds idle persistent netlink sockets for reuse by NetnsGetifaddrs.
+// It is bounded so that bursts of concurrent callers don't leave a large
+// number of idle sockets behind.
+var netlinkHandles = make(chan *C.struct_netlink_handle, runtime.NumCPU())
+
+// getNetlinkHandle returns an idle netlink handle from the pool or opens a new one.
+func getNetlinkHandle() (*C.struct_netlink_handle, error) {
+	select {
+	case handle := <-netlinkHandles:
+		return handle, nil
+	default:
+	}
+
+	handle := &C.struct_netlink_handle{}
+	ret, err := C.netlink_handle_open(handle, C.int(netlinkRcvBuf.Load()))
+	if ret < 0 {
+		return nil, fmt.Errorf("Failed to open netlink socket: %w", err)
+	}
+
+	return handle, nil
+}
+
+// putNetlinkHandle returns a netlink handle to the pool.
+// Handles that saw a failed request are closed instead as they may still have
+// an unfinished dump pending.
+func putNetlinkHandle(handle *C.struct_netlink_handle, healthy bool) {
+	if healthy {
+		select {
+		case netlinkHandles <- handle:
+			return
+		default:
+		}
+	}
+
+	C.netlink_handle_close(handle)
+}
+
+// netnsGetNsid returns the nsid of a process' network namespace or -1 for the caller's namespace.
+func netnsGetNsid(handle *C.struct_netlink_handle, initPID int32) (C.__s32, error) {
+	if initPID <= 0 {
+		return -1, nil
+	}
+
+	f, err := os.Open(fmt.Sprintf("/proc/%d/ns/net", initPID))
+	if err != nil {
+		return -1, err
+	}
+
+	defer func() { _ = f.Close() }()
+
+	netnsID := C.netns_get_nsid_handle(handle, C.__s32(f.Fd()))
+	if netnsID < 0 {
+		return -1, fmt.Errorf("Failed to retrieve network namespace id")
+	}
+
+	return netnsID, nil
+}
+
+// netnsGetArena dumps the interfaces and addresses of a network namespace into arena.
+// On success the caller must free the arena. On failure the handle must not be reused.
+func netnsGetArena(handle *C.struct_netlink_handle, netnsID C.__s32, arena *C.struct_netns_ifaddrs_arena) error {
+	var netnsidAware C.bool
+
+	ret := C.netns_getifaddrs_arena_handle(handle, arena, netnsID, &netnsidAware)
+	if ret < 0 {
+		return fmt.Errorf("Failed to retrieve network interfaces and addresses")
+	}
+
+	if netnsID >= 0 && !netnsidAware {
+		C.netns_ifaddrs_arena_free(arena)
+		return fmt.Errorf("Netlink requests are not fully network namespace id aware")
+	}
+
+	return nil
+}
+
 // NetnsGetifaddrs returns a map of InstanceStateNetwork for a particular process.
 func NetnsGetifaddrs(initPID int32, hostInterfaces []net.Interface) (map[string]api.InstanceStateNetwork, error) {
+	return netnsGetifaddrs(initPID, hostInterfaces, nil, nil)
+}
+
+// netnsGetifaddrs implements NetnsGetifaddrs. If peers isn't nil it's filled with the index of
+// the host side peer of each interface. If resolved isn't nil it's called with the nsid of the
+// namespace (-1 for the caller's) before the interfaces are enumerated.
+func netnsGetifaddrs(initPID int32, hostInterfaces []net.Interface, peers map[string]int, resolved func(nsid int32)) (map[string]api.InstanceStateNetwork, error) {
+	var arena C.struct_netns_ifaddrs_arena
+
+	handle, err := getNetlinkHandle()
+	if err != nil {
+		return nil, err
+	}
+
+	healthy := true
+	defer func() { putNetlinkHandle(handle, healthy) }()
+
+	netnsID, err := netnsGetNsid(handle, initPID)
+	if err != nil {
+		return nil, err
+	}
+
+	if resolved != nil {
+		resolved(int32(netnsID))
+	}
+
+	err = netnsGetArena(handle, netnsID, &arena)
+	if err != nil {
+		healthy = false
+		return nil, err
+	}
+
+	defer C.netns_ifaddrs_arena_free(&arena)
+
+	return netnsArenaToNetworks(&arena, initPID, hostInterfaces, peers), nil
+}
+
+// NetnsGetifstats returns the counters of all interfaces of a process' network namespace, keyed by
+// interface name. It's considerably cheaper than NetnsGetifaddrs as addresses aren't retrieved.
+func NetnsGetifstats(initPID int32) (map[string]api.InstanceStateNetworkCounters, error) {
+	var list C.struct_netns_ifstats_list
 	var netnsidAware C.bool
-	var ifaddrs *C.struct_netns_ifaddrs
-	var netnsID C.__s32
 
-	if initPID > 0 {
-		f, err := os.Open(fmt.Sprintf("/proc/%d/ns/net", initPID))
-		if err != nil {
-			return nil, err
-		}
+	handle, err := getNetlinkHandle()
+	if err != nil {
+		return nil, err
+	}
 
-		defer func() { _ = f.Close() }()
+	healthy := true
+	defer func() { putNetlinkHandle(handle, healthy) }()
 
-		netnsID = C.netns_get_nsid(C.__s32(f.Fd()))
-		if netnsID < 0 {
-			return nil, fmt.Errorf("Failed to retrieve network namespace id")
-		}
-	} else {
-		netnsID = -1
+	netnsID, err := netnsGetNsid(handle, initPID)
+	if err != nil {
+		return nil, err
 	}
 
-	ret := C.netns_getifaddrs(&ifaddrs, netnsID, &netnsidAware)
+	ret := C.netns_getifstats_handle(handle, &list, netnsID, &netnsidAware)
 	if ret < 0 {
-		return nil, fmt.Errorf("Failed to retrieve network interfaces and addresses")
+		healthy = false
+		return nil, fmt.Errorf("Failed to retrieve network interface counters")
 	}
 
-	defer C.netns_freeifaddrs(ifaddrs)
+	defer C.netns_ifstats_list_free(&list)
 
 	if netnsID >= 0 && !netnsidAware {
 		return nil, fmt.Errorf("Netlink requests are not fully network namespace id aware")
 	}
 
+	counters := make(map[string]api.InstanceStateNetworkCounters, list.nr_stats)
+	if list.nr_stats == 0 {
+		return counters, nil
+	}
+
+	for _, st := range unsafe.Slice(list.stats, list.nr_stats) {
+		ifCounters := api.InstanceStateNetworkCounters{}
+		if st.stats_type == C.IFLA_STATS64 {
+			ifCounters.BytesReceived = int64(st.stats64.rx_bytes)
+			ifCounters.BytesSent = int64(st.stats64.tx_bytes)
+			ifCounters.PacketsReceived = int64(st.stats64.rx_packets)
+			ifCounters.PacketsSent = int64(st.stats64.tx_packets)
+			ifCounters.ErrorsReceived = int64(st.stats64.rx_errors)
+			ifCounters.ErrorsSent = int64(st.stats64.tx_errors)
+			ifCounters.PacketsDroppedInbound = int64(st.stats64.rx_dropped)
+			ifCounters.PacketsDroppedOutbound = int64(st.stats64.tx_dropped)
+		}
+
+		counters[C.GoString(&st.name[0])] = ifCounters
+	}
+
+	return counters, nil
+}
+
+// NetnsIfaddrsResult holds the outcome of NetnsGetifaddrsBatch for a single process.
+type NetnsIfaddrsResult struct {
+	PID      int32
+	Networks map[string]api.InstanceStateNetwork
+	Err      error
+
+	// Network namespace id the namespace was queried with, -1 for the caller's.
+	nsid int32
+
+	// Index of the host side peer of each interface, only filled for NetnsIfaddrsCache.
+	peers map[string]int
+}
+
+// NetnsGetifaddrsBatch returns the InstanceStateNetwork maps of several processes.
+// All the lookups are done in a single cgo call over one netlink socket which is
+// considerably cheaper than calling NetnsGetifaddrs for each process.
+// The results are returned in the same order as initPIDs. A failure for one
+// process is reported in its result and doesn't affect the others.
+func NetnsGetifaddrsBatch(initPIDs []int32, hostInterfaces []net.Interface) ([]NetnsIfaddrsResult, error) {
+	return netnsGetifaddrsBatch(initPIDs, hostInterfaces, false)
+}
+
+// netnsGetifaddrsBatch implements NetnsGetifaddrsBatch. If withPeers is set, the peers of each
+// result are filled with the index of the host side peer of each interface.
+func netnsGetifaddrsBatch(initPIDs []int32, hostInterfaces []net.Interface, withPeers bool) ([]NetnsIfaddrsResult, error) {
+	results := make([]NetnsIfaddrsResult, len(initPIDs))
+	if len(initPIDs) == 0 {
+		return results, nil
+	}
+
+	handle, err := getNetlinkHandle()
+	if err != nil {
+		return nil, err
+	}
+
+	cResults := make([]C.struct_netns_ifaddrs_result, len(initPIDs))
+	for i, initPID := range initPIDs {
+		results[i].PID = initPID
+		results[i].nsid = -1
+		cResults[i].netns_fd = -1
+
+		if initPID <= 0 {
+			continue
+		}
+
+		f, err := os.Open(fmt.Sprintf("/proc/%d/ns/net", initPID))
+		if err != nil {
+			results[i].Err = err
+			continue
+		}
+
+		defer func() { _ = f.Close() }()
+
+		cResults[i].netns_fd = C.__s32(f.Fd())
+	}
+
+	C.netns_getifaddrs_batch(handle, &cResults[0], C.size_t(len(cResults)))
+	putNetlinkHandle(handle, handle.fd >= 0)
+
+	for i := range cResults {
+		cRes := &cResults[i]
+		res := &results[i]
+
+		defer C.netns_ifaddrs_arena_free(&cRes.arena)
+
+		if res.Err != nil {
+			continue
+		}
+
+		if cRes.error != 0 {
+			res.Err = fmt.Errorf("Failed to retrieve network interfaces and addresses: %w", unix.Errno(cRes.error))
+			continue
+		}
+
+		if cRes.netns_fd >= 0 && !cRes.netnsid_aware {
+			res.Err = fmt.Errorf("Netlink requests are not fully network namespace id aware")
+			continue
+		}
+
+		if withPeers {
+			res.peers = map[string]int{}
+		}
+
+		res.nsid = int32(cRes.netns_id)
+		res.Networks = netnsArenaToNetworks(&cRes.arena, res.PID, hostInterfaces, res.peers)
+	}
+
+	return results, nil
+}
+
+// netnsArenaToNetworks converts the records of a netns_ifaddrs_arena into a map of InstanceStateNetwork.
+// The records carry raw addresses so everything is decoded on the Go side.
+// If peers isn't nil, it's filled with the index of the host side peer of each interface.
+func netnsArenaToNetworks(arena *C.struct_netns_ifaddrs_arena, initPID int32, hostInterfaces []net.Interface, peers map[string]int) map[string]api.InstanceStateNetwork {
 	// We're using the interface name as key here but we should really
 	// switch to the ifindex at some point to handle ip aliasing correctly.
 	networks := map[string]api.InstanceStateNetwork{}
 
-	for addr := ifaddrs; addr != nil; addr = addr.ifa_next {
-		var address [C.INET6_ADDRSTRLEN]C.char
-		addNetwork, networkExists := networks[C.GoString(addr.ifa_name)]
+	if arena.nr_records == 0 {
+		return networks
+	}
+
+	records := unsafe.Slice(arena.records, arena.nr_records)
+	strtab := unsafe.Slice((*byte)(unsafe.Pointer(arena.strtab)), arena.strtab_len)
+
+	for i := range records {
+		rec := &records[i]
+
+		nameBytes := strtab[rec.name_off:]
+		nameLen := bytes.IndexByte(nameBytes, 0)
+		if nameLen >= 0 {
+			nameBytes = nameBytes[:nameLen]
+		}
+
+		ifName := string(nameBytes)
+
+		addNetwork, networkExists := networks[ifName]
 		if !networkExists {
 			addNetwork = api.InstanceStateNetwork{
 				Addresses: []api.InstanceStateNetworkAddress{},
@@ -112,57 +391,51 @@ func NetnsGetifaddrs(initPID int32, hostInterfaces []net.Interface) (map[string]
 		netState := "down"
 		netType := "unknown"
 
-		if (addr.ifa_flags & C.IFF_BROADCAST) > 0 {
+		if (rec.flags & C.IFF_BROADCAST) > 0 {
 			netType = "broadcast"
 		}
 
-		if (addr.ifa_flags & C.IFF_LOOPBACK) > 0 {
+		if (rec.flags & C.IFF_LOOPBACK) > 0 {
 			netType = "loopback"
 		}
 
-		if (addr.ifa_flags & C.IFF_POINTOPOINT) > 0 {
+		if (rec.flags & C.IFF_POINTOPOINT) > 0 {
 			netType = "point-to-point"
 		}
 
-		if (addr.ifa_flags & C.IFF_UP) > 0 {
+		if (rec.flags & C.IFF_UP) > 0 {
 			netState = "up"
 		}
 
 		addNetwork.State = netState
 		addNetwork.Type = netType
-		addNetwork.Mtu = int(addr.ifa_mtu)
+		addNetwork.Mtu = int(rec.mtu)
+
+		if peers != nil && int(rec.ifindex_peer) > 0 {
+			peers[ifName] = int(rec.ifindex_peer)
+		}
 
-		if initPID != 0 && int(addr.ifa_ifindex_peer) > 0 {
+		if initPID != 0 && int(rec.ifindex_peer) > 0 {
 			for _, hostInterface := range hostInterfaces {
-				if hostInterface.Index == int(addr.ifa_ifindex_peer) {
+				if hostInterface.Index == int(rec.ifindex_peer) {
 					addNetwork.HostName = hostInterface.Name
 					break
 				}
 			}
 		}
 
+		addrBytes := unsafe.Slice((*byte)(unsafe.Pointer(&rec.addr[0])), rec.addr_len)
+
 		// Addresses
-		if addr.ifa_addr != nil && (addr.ifa_addr.sa_family == C.AF_INET || addr.ifa_addr.sa_family == C.AF_INET6) {
+		if (rec.family == C.AF_INET && len(addrBytes) == 4) || (rec.family == C.AF_INET6 && len(addrBytes) == 16) {
 			family := "inet"
-			if addr.ifa_addr.sa_family == C.AF_INET6 {
+			ip := netip.AddrFrom4([4]byte(addrBytes))
+			if rec.family == C.AF_INET6 {
 				family = "inet6"
+				ip = netip.AddrFrom16([16]byte(addrBytes))
 			}
 
-			addrPtr := C.get_addr_ptr(addr.ifa_addr)
-			if addrPtr == nil {
-				return nil, fmt.Errorf("Failed to retrieve valid address pointer")
-			}
-
-			addressStr := C.inet_ntop(C.int(addr.ifa_addr.sa_family), addrPtr, &address[0], C.INET6_ADDRSTRLEN)
-			if addressStr == nil {
-				return nil, fmt.Errorf("Failed to retrieve address string")
-			}
-
-			if addNetwork.Addresses == nil {
-				addNetwork.Addresses = []api.InstanceStateNetworkAddress{}
-			}
-
-			goAddrString := C.GoString(addressStr)
+			goAddrString := ip.String()
 			scope := "global"
 			if strings.HasPrefix(goAddrString, "127") {
 				scope = "local"
@@ -183,40 +456,31 @@ func NetnsGetifaddrs(initPID int32, hostInterfaces []net.Interface) (map[string]
 			address := api.InstanceStateNetworkAddress{}
 			address.Family = family
 			address.Address = goAddrString
-			address.Netmask = fmt.Sprintf("%d", int(addr.ifa_prefixlen))
+			address.Netmask = strconv.Itoa(int(rec.prefixlen))
 			address.Scope = scope
 
 			addNetwork.Addresses = append(addNetwork.Addresses, address)
-		} else if addr.ifa_addr != nil && addr.ifa_addr.sa_family == C.AF_PACKET {
-			if (addr.ifa_flags & C.IFF_LOOPBACK) == 0 {
-				var buf [1024]C.char
-
-				hwaddr := C.get_packet_address(addr.ifa_addr, &buf[0], 1024)
-				if hwaddr == nil {
-					return nil, fmt.Errorf("Failed to retrieve hardware address")
-				}
-
-				addNetwork.Hwaddr = C.GoString(hwaddr)
+		} else if rec.family == C.AF_PACKET {
+			if (rec.flags & C.IFF_LOOPBACK) == 0 {
+				addNetwork.Hwaddr = net.HardwareAddr(addrBytes).String()
 			}
 		}
 
-		if addr.ifa_stats_type == C.IFLA_STATS64 {
-			addNetwork.Counters.BytesReceived = int64(addr.ifa_stats64.rx_bytes)
-			addNetwork.Counters.BytesSent = int64(addr.ifa_stats64.tx_bytes)
-			addNetwork.Counters.PacketsReceived = int64(addr.ifa_stats64.rx_packets)
-			addNetwork.Counters.PacketsSent = int64(addr.ifa_stats64.tx_packets)
-			addNetwork.Counters.ErrorsReceived = int64(addr.ifa_stats64.rx_errors)
-			addNetwork.Counters.ErrorsSent = int64(addr.ifa_stats64.tx_errors)
-			addNetwork.Counters.PacketsDroppedInbound = int64(addr.ifa_stats64.rx_dropped)
-			addNetwork.Counters.PacketsDroppedOutbound = int64(addr.ifa_stats64.tx_dropped)
+		if rec.stats_type == C.IFLA_STATS64 {
+			addNetwork.Counters.BytesReceived = int64(rec.stats64.rx_bytes)
+			addNetwork.Counters.BytesSent = int64(rec.stats64.tx_bytes)
+			addNetwork.Counters.PacketsReceived = int64(rec.stats64.rx_packets)
+			addNetwork.Counters.PacketsSent = int64(rec.stats64.tx_packets)
+			addNetwork.Counters.ErrorsReceived = int64(rec.stats64.rx_errors)
+			addNetwork.Counters.ErrorsSent = int64(rec.stats64.tx_errors)
+			addNetwork.Counters.PacketsDroppedInbound = int64(rec.stats64.rx_dropped)
+			addNetwork.Counters.PacketsDroppedOutbound = int64(rec.stats64.tx_dropped)
 		}
 
-		ifName := C.GoString(addr.ifa_name)
-
 		networks[ifName] = addNetwork
 	}
 
-	return networks, nil
+	return networks
 }
 
 // AbstractUnixSendFd sends a Unix file descriptor over a Unix socket.
@@ -231,6 +495,30 @@ func AbstractUnixSendFd(sockFD int, sendFD int) error {
 	return nil
 }
 
+// AbstractUnixSendFds sends Unix file descriptors along with some data in a single message over a Unix socket.
+func AbstractUnixSendFds(sockFD int, sendFDs []int, data []byte) error {
+	if len(sendFDs) == 0 || len(sendFDs) >= C.KERNEL_SCM_MAX_FD {
+		return fmt.Errorf("Invalid number of file descriptors to send: %d", len(sendFDs))
+	}
+
+	fds := make([]C.int, len(sendFDs))
+	for i, fd := range sendFDs {
+		fds[i] = C.int(fd)
+	}
+
+	var buf unsafe.Pointer
+	if len(data) > 0 {
+		buf = unsafe.Pointer(&data[0])
+	}
+
+	ret, errno := C.lxc_abstract_unix_send_fds(C.int(sockFD), &fds[0], C.int(len(fds)), buf, C.size_t(len(data)))
+	if ret < 0 {
+		return fmt.Errorf("Failed to send file descriptors via abstract unix socket: %w", errno)
+	}
+
+	return nil
+}
+
 // AbstractUnixReceiveFd receives a Unix file descriptor from a Unix socket.
 func AbstractUnixReceiveFd(sockFD int, flags uint) (*os.File, error) {
 	skFd := C.int(sockFD)
@@ -250,6 +538,82 @@ func AbstractUnixReceiveFd(sockFD int, flags uint) (*os.File, error) {
 	return file, nil
 }
 
+// AbstractUnixFdsBatchMax is the largest number of messages received by a single batched receive.
+const AbstractUnixFdsBatchMax int = C.UNIX_FDS_BATCH_MAX
+
+// AbstractUnixFdsBatch receives several queued messages carrying file descriptors with a single
+// syscall. Its buffers are allocated once and reused by every receive, it must be freed once done.
+type AbstractUnixFdsBatch struct {
+	batch *C.struct_unix_fds_batch
+	fds   []C.struct_unix_fds
+	iovs  []*C.struct_iovec
+	sizes []C.size_t
+}
+
+// NewAbstractUnixFdsBatch creates a batch receiving numFds file descriptors per message with the
+// given expectations.
+func NewAbstractUnixFdsBatch(numFds int, flags uint) (*AbstractUnixFdsBatch, error) {
+	if numFds >= C.KERNEL_SCM_MAX_FD {
+		return nil, fmt.Errorf("Excessive number of file descriptors requested")
+	}
+
+	batch := C.lxc_abstract_unix_fds_batch_new(C.__u32(numFds), C.__u32(flags))
+	if batch == nil {
+		return nil, fmt.Errorf("Failed to allocate receive batch")
+	}
+
+	return &AbstractUnixFdsBatch{
+		batch: batch,
+		fds:   make([]C.struct_unix_fds, AbstractUnixFdsBatchMax),
+		iovs:  make([]*C.struct_iovec, AbstractUnixFdsBatchMax),
+		sizes: make([]C.size_t, AbstractUnixFdsBatchMax),
+	}, nil
+}
+
+// Free releases the buffers of the batch.
+func (b *AbstractUnixFdsBatch) Free() {
+	C.lxc_abstract_unix_fds_batch_free(b.batch)
+	b.batch = nil
+}
+
+// Receive receives up to one message per iovec array, waiting for the first one only. Each of iovs
+// points to an array of iovLen C iovecs. It returns the number of messages received, io.EOF once
+// the peer went away. The failure of a message following received ones is reported by the next call.
+func (b *AbstractUnixFdsBatch) Receive(sockFD int, iovs []unsafe.Pointer, iovLen int) (int, error) {
+	if len(iovs) == 0 || len(iovs) > AbstractUnixFdsBatchMax {
+		return 0, fmt.Errorf("Invalid number of messages requested: %d", len(iovs))
+	}
+
+	for i, iov := range iovs {
+		b.iovs[i] = (*C.struct_iovec)(iov)
+	}
+
+	ret := C.lxc_abstract_unix_recv_fds_batch(C.int(sockFD), b.batch, &b.fds[0], &b.iovs[0], C.size_t(iovLen), C.uint(len(iovs)), &b.sizes[0])
+	if ret < 0 {
+		return 0, fmt.Errorf("Failed to receive file descriptors via abstract unix socket: %w", unix.Errno(-ret))
+	}
+
+	if ret == 0 {
+		return 0, io.EOF
+	}
+
+	return int(ret), nil
+}
+
+// Size returns the number of bytes of the i-th message received.
+func (b *AbstractUnixFdsBatch) Size(i int) uint64 {
+	return uint64(b.sizes[i])
+}
+
+// Fd returns the j-th file descriptor of the i-th message received, or -1 if it received less.
+func (b *AbstractUnixFdsBatch) Fd(i int, j int) int {
+	if j >= int(b.fds[i].fd_count_ret) {
+		return -1
+	}
+
+	return int(b.fds[i].fd[j])
+}
+
 // AbstractUnixReceiveFdData is a low level function to receive a file descriptor over a unix socket.
 func AbstractUnixReceiveFdData(sockFD int, numFds int, flags uint, iov unsafe.Pointer, iovLen int32) (uint64, []C.int, error) {
 	fds := C.struct_unix_fds{}
@@ -262,9 +626,9 @@ func AbstractUnixReceiveFdData(sockFD int, numFds int, flags uint, iov unsafe.Po
 	fds.flags = C.__u32(flags)
 
 	skFd := C.int(sockFD)
-	ret, errno := C.lxc_abstract_unix_recv_fds_iov(skFd, &fds, (*C.struct_iovec)(iov), C.size_t(iovLen))
+	ret := C.lxc_abstract_unix_recv_fds_iov(skFd, &fds, (*C.struct_iovec)(iov), C.size_t(iovLen))
 	if ret < 0 {
-		return 0, []C.int{-C.EBADF}, fmt.Errorf("Failed to receive file descriptor via abstract unix socket: errno=%d", errno)
+		return 0, []C.int{-C.EBADF}, fmt.Errorf("Failed to receive file descriptor via abstract unix socket: %w", unix.Errno(-ret))
 	}
 
 	if ret == 0 {
@@ -0,0 +1,381 @@
+//go:build linux && cgo
+
+package netutils
+
+import (
+	"bufio"
+	"flag"
+	"fmt"
+	"io"
+	"math"
+	"net"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"runtime"
+	"strings"
+	"sync/atomic"
+	"syscall"
+	"testing"
+	"unsafe"
+
+	"github.com/stretchr/testify/require"
+	"golang.org/x/sys/unix"
+
+	"github.com/canonical/lxd/shared/benchutil"
+)
+
+var benchVeths = flag.Int("netutils.veths", 10000, "Number of veth devices in the network namespace of BenchmarkNetnsGetifaddrs")
+
+// testNetnsCount numbers the host side veth devices of the test network namespaces.
+var testNetnsCount atomic.Int32
+
+// testNetns starts a process in a new network namespace holding (about) the given number of veth
+// devices and returns its PID along with the name of the host side peer of its eth0 device. The
+// process is killed once the test is done.
+func testNetns(tb testing.TB, veths int) (int32, string, error) {
+	if os.Geteuid() != 0 {
+		tb.Skip("Creating network namespaces requires root")
+	}
+
+	// Like for an instance, the loopback device has addresses and one of the veth devices has its
+	// peer on the host.
+	hostName := fmt.Sprintf("lxdt%dn%d", os.Getpid(), testNetnsCount.Add(1))
+
+	batch := &strings.Builder{}
+	_, _ = fmt.Fprintf(batch, "link set lo up\n")
+	_, _ = fmt.Fprintf(batch, "link add eth0 type veth peer name %s netns %d\n", hostName, os.Getpid())
+	for i := 0; i < veths/2; i++ {
+		_, _ = fmt.Fprintf(batch, "link add benchveth%da type veth peer name benchveth%db\n", i, i)
+	}
+
+	script := filepath.Join(tb.TempDir(), "veths")
+	err := os.WriteFile(script, []byte(batch.String()), 0600)
+	if err != nil {
+		return -1, "", err
+	}
+
+	cmd := exec.Command("sh", "-c", `ip -batch "$1" && echo ready && exec sleep infinity`, "sh", script)
+	cmd.SysProcAttr = &syscall.SysProcAttr{Cloneflags: syscall.CLONE_NEWNET}
+	cmd.Stderr = os.Stderr
+
+	stdout, err := cmd.StdoutPipe()
+	if err != nil {
+		return -1, "", err
+	}
+
+	err = cmd.Start()
+	if err != nil {
+		return -1, "", err
+	}
+
+	tb.Cleanup(func() {
+		_ = cmd.Process.Kill()
+		_ = cmd.Wait()
+	})
+
+	line, err := bufio.NewReader(stdout).ReadString('\n')
+	if err != nil || line != "ready\n" {
+		return -1, "", fmt.Errorf("Failed to create the veth devices: %v", err)
+	}
+
+	// The kernel only assigns the namespace an id once the host peer gets dumped.
+	err = exec.Command("ip", "link", "show", "dev", hostName).Run()
+	if err != nil {
+		return -1, "", fmt.Errorf("Failed to assign a network namespace id: %w", err)
+	}
+
+	return int32(cmd.Process.Pid), hostName, nil
+}
+
+// testNetnsRun runs an ip command in the network namespace of a process.
+func testNetnsRun(tb testing.TB, pid int32, args ...string) {
+	out, err := exec.Command("nsenter", append([]string{fmt.Sprintf("--net=/proc/%d/ns/net", pid), "ip"}, args...)...).CombinedOutput()
+	if err != nil {
+		tb.Fatalf("Failed to run ip %v: %v (%s)", args, err, out)
+	}
+}
+
+func TestNetnsGetifaddrsBatch(t *testing.T) {
+	pidA, hostA, err := testNetns(t, 4)
+	require.NoError(t, err)
+
+	pidB, hostB, err := testNetns(t, 0)
+	require.NoError(t, err)
+
+	testNetnsRun(t, pidB, "addr", "add", "192.0.2.1/24", "dev", "eth0")
+
+	hostInterfaces, err := net.Interfaces()
+	require.NoError(t, err)
+
+	// The last process doesn't exist.
+	results, err := NetnsGetifaddrsBatch([]int32{pidA, -1, pidB, math.MaxInt32}, hostInterfaces)
+	require.NoError(t, err)
+	require.Len(t, results, 4)
+
+	for i, pid := range []int32{pidA, -1, pidB} {
+		require.Equal(t, pid, results[i].PID)
+		require.NoError(t, results[i].Err)
+
+		// The batch returns the same as the individual lookups.
+		networks, err := NetnsGetifaddrs(pid, hostInterfaces)
+		require.NoError(t, err)
+		require.Equal(t, len(networks), len(results[i].Networks))
+
+		for name, network := range networks {
+			require.Equal(t, network.HostName, results[i].Networks[name].HostName)
+			require.Equal(t, network.Addresses, results[i].Networks[name].Addresses)
+		}
+	}
+
+	require.Len(t, results[0].Networks, 6)
+	require.Equal(t, hostA, results[0].Networks["eth0"].HostName)
+	require.Equal(t, hostB, results[2].Networks["eth0"].HostName)
+	require.Equal(t, "192.0.2.1", results[2].Networks["eth0"].Addresses[0].Address)
+	require.Error(t, results[3].Err)
+}
+
+func TestSetNetlinkReceiveBuffer(t *testing.T) {
+	if os.Geteuid() != 0 {
+		t.Skip("Raising the socket buffer limit requires root")
+	}
+
+	defer SetNetlinkReceiveBuffer(int(netlinkRcvBuf.Load()))
+
+	SetNetlinkReceiveBuffer(256 * 1024)
+
+	handle, err := getNetlinkHandle()
+	require.NoError(t, err)
+
+	defer putNetlinkHandle(handle, false)
+
+	// The kernel doubles the requested size to account for its bookkeeping.
+	size, err := unix.GetsockoptInt(int(handle.fd), unix.SOL_SOCKET, unix.SO_RCVBUF)
+	require.NoError(t, err)
+	require.Equal(t, 2*256*1024, size)
+}
+
+func BenchmarkNetnsGetifaddrs(b *testing.B) {
+	b.Run("host", func(b *testing.B) {
+		benchutil.Run(b, func() {
+			_, err := NetnsGetifaddrs(-1, nil)
+			if err != nil {
+				b.Fatal(err)
+			}
+		})
+	})
+
+	// The namespace is shared by the runs of the sub-benchmark.
+	var pid int32
+	var setupErr error
+
+	b.Run(fmt.Sprintf("veths=%d", *benchVeths), func(sb *testing.B) {
+		if os.Geteuid() != 0 {
+			sb.Skip("Creating network namespaces requires root")
+		}
+
+		if pid == 0 && setupErr == nil {
+			pid, _, setupErr = testNetns(b, *benchVeths)
+		}
+
+		if setupErr != nil {
+			sb.Skip(setupErr)
+		}
+
+		benchutil.Run(sb, func() {
+			_, err := NetnsGetifaddrs(pid, nil)
+			if err != nil {
+				sb.Fatal(err)
+			}
+		})
+	})
+}
+
+func BenchmarkAbstractUnixSendReceiveFd(b *testing.B) {
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	defer func() {
+		_ = unix.Close(fds[0])
+		_ = unix.Close(fds[1])
+	}()
+
+	devNull, err := os.Open("/dev/null")
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	defer func() { _ = devNull.Close() }()
+
+	benchutil.Run(b, func() {
+		err := AbstractUnixSendFd(fds[0], int(devNull.Fd()))
+		if err != nil {
+			b.Fatal(err)
+		}
+
+		file, err := AbstractUnixReceiveFd(fds[1], 0)
+		if err != nil {
+			b.Fatal(err)
+		}
+
+		_ = file.Close()
+	})
+}
+
+// testSocketpair returns a connected pair of unix seqpacket sockets closed once the test is done.
+func testSocketpair(t *testing.T) [2]int {
+	fds, err := unix.Socketpair(unix.AF_UNIX, unix.SOCK_SEQPACKET|unix.SOCK_CLOEXEC, 0)
+	require.NoError(t, err)
+
+	t.Cleanup(func() {
+		_ = unix.Close(fds[0])
+		_ = unix.Close(fds[1])
+	})
+
+	return [2]int{fds[0], fds[1]}
+}
+
+// testIovecs returns count single buffer iovec arrays, pinned so they can be handed to C.
+func testIovecs(t *testing.T, count int) []unsafe.Pointer {
+	pinner := &runtime.Pinner{}
+	t.Cleanup(pinner.Unpin)
+
+	iovs := make([]unsafe.Pointer, count)
+	for i := range iovs {
+		buf := make([]byte, 16)
+		iov := &unix.Iovec{Base: &buf[0]}
+		iov.SetLen(len(buf))
+
+		pinner.Pin(&buf[0])
+		pinner.Pin(iov)
+		iovs[i] = unsafe.Pointer(iov)
+	}
+
+	return iovs
+}
+
+// testOpenFds returns the number of file descriptors open in the process.
+func testOpenFds(t *testing.T) int {
+	entries, err := os.ReadDir("/proc/self/fd")
+	require.NoError(t, err)
+
+	return len(entries)
+}
+
+// testSendFds sends one message per entry of counts, carrying that many copies of fd.
+func testSendFds(t *testing.T, sock int, fd int, counts ...int) {
+	for _, count := range counts {
+		fds := make([]int, count)
+		for i := range fds {
+			fds[i] = fd
+		}
+
+		err := AbstractUnixSendFds(sock, fds, []byte("data"))
+		require.NoError(t, err)
+	}
+}
+
+// testRequireDrained checks that no message is left queued on the socket.
+func testRequireDrained(t *testing.T, sock int) {
+	_, _, _, _, err := unix.Recvmsg(sock, make([]byte, 16), nil, unix.MSG_DONTWAIT)
+	require.ErrorIs(t, err, unix.EAGAIN)
+}
+
+func TestAbstractUnixFdsBatch(t *testing.T) {
+	devNull, err := os.Open("/dev/null")
+	require.NoError(t, err)
+
+	defer func() { _ = devNull.Close() }()
+
+	t.Run("Held back error", func(t *testing.T) {
+		socks := testSocketpair(t)
+		openFds := testOpenFds(t)
+
+		batch, err := NewAbstractUnixFdsBatch(1, UnixFdsAcceptExact)
+		require.NoError(t, err)
+
+		defer batch.Free()
+
+		// The second message carries too many file descriptors.
+		testSendFds(t, socks[0], int(devNull.Fd()), 1, 2, 1, 1)
+
+		n, err := batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.NoError(t, err)
+		require.Equal(t, 1, n)
+		require.Equal(t, uint64(len("data")), batch.Size(0))
+		require.NotEqual(t, -1, batch.Fd(0, 0))
+		require.NoError(t, unix.Close(batch.Fd(0, 0)))
+
+		// The failure is reported by the next call, the file descriptors of the messages
+		// received along with it got closed.
+		_, err = batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.ErrorIs(t, err, unix.EINVAL)
+		require.Equal(t, openFds, testOpenFds(t))
+		testRequireDrained(t, socks[1])
+
+		// Only reported once.
+		testSendFds(t, socks[0], int(devNull.Fd()), 1)
+
+		n, err = batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.NoError(t, err)
+		require.Equal(t, 1, n)
+		require.NoError(t, unix.Close(batch.Fd(0, 0)))
+	})
+
+	t.Run("EOF", func(t *testing.T) {
+		socks := testSocketpair(t)
+		openFds := testOpenFds(t)
+
+		batch, err := NewAbstractUnixFdsBatch(1, UnixFdsAcceptExact)
+		require.NoError(t, err)
+
+		defer batch.Free()
+
+		testSendFds(t, socks[0], int(devNull.Fd()), 1, 1)
+		require.NoError(t, unix.Shutdown(socks[0], unix.SHUT_WR))
+
+		// The messages queued before the peer went away are handled.
+		n, err := batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.NoError(t, err)
+		require.Equal(t, 2, n)
+
+		for i := 0; i < n; i++ {
+			require.NoError(t, unix.Close(batch.Fd(i, 0)))
+		}
+
+		_, err = batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.ErrorIs(t, err, io.EOF)
+		require.Equal(t, openFds, testOpenFds(t))
+	})
+
+	t.Run("Truncated", func(t *testing.T) {
+		socks := testSocketpair(t)
+		openFds := testOpenFds(t)
+
+		batch, err := NewAbstractUnixFdsBatch(1, UnixFdsAcceptMore)
+		require.NoError(t, err)
+
+		defer batch.Free()
+
+		// More file descriptors than fit in the control buffer.
+		testSendFds(t, socks[0], int(devNull.Fd()), 16, 1)
+
+		_, err = batch.Receive(socks[1], testIovecs(t, 4), 1)
+		require.ErrorIs(t, err, unix.EFBIG)
+		require.Equal(t, openFds, testOpenFds(t))
+		testRequireDrained(t, socks[1])
+	})
+
+	t.Run("Single receive", func(t *testing.T) {
+		socks := testSocketpair(t)
+		openFds := testOpenFds(t)
+
+		testSendFds(t, socks[0], int(devNull.Fd()), 2)
+
+		_, _, err := AbstractUnixReceiveFdData(socks[1], 1, UnixFdsAcceptExact, testIovecs(t, 1)[0], 1)
+		require.ErrorIs(t, err, unix.EINVAL)
+		require.Equal(t, openFds, testOpenFds(t))
+	})
+}
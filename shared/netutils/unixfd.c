@@ -58,51 +58,55 @@ int lxc_abstract_unix_send_fds(int fd, int *sendfds, int num_sendfds,
 	return sendmsg(fd, &msg, MSG_NOSIGNAL);
 }
 
-ssize_t lxc_abstract_unix_recv_fds_iov(int fd, struct unix_fds *ret_fds,
-				       struct iovec *ret_iov, size_t size_ret_iov)
+static int unix_fds_check(const struct unix_fds *ret_fds)
 {
-	__do_free char *cmsgbuf = NULL;
-	ssize_t ret;
-	struct msghdr msg = {};
-	struct cmsghdr *cmsg = NULL;
-	size_t cmsgbufsize = CMSG_SPACE(sizeof(struct ucred)) +
-			     CMSG_SPACE(ret_fds->fd_count_max * sizeof(int));
-
 	if (ret_fds->flags & ~UNIX_FDS_ACCEPT_MASK)
-		return ret_errno(EINVAL);
+		return -EINVAL;
 
 	if (hweight32((ret_fds->flags & ~UNIX_FDS_ACCEPT_NONE)) > 1)
-		return ret_errno(EINVAL);
+		return -EINVAL;
 
 	if (ret_fds->fd_count_max >= KERNEL_SCM_MAX_FD)
-		return ret_errno(EINVAL);
+		return -EINVAL;
 
 	if (ret_fds->fd_count_ret != 0)
-		return ret_errno(EINVAL);
+		return -EINVAL;
 
-	cmsgbuf = zalloc(cmsgbufsize);
-	if (!cmsgbuf)
-		return ret_errno(ENOMEM);
+	return 0;
+}
 
-	msg.msg_control		= cmsgbuf;
-	msg.msg_controllen	= cmsgbufsize;
+static size_t unix_fds_cmsgbuf_size(__u32 fd_count_max)
+{
+	return CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(fd_count_max * sizeof(int));
+}
 
-	msg.msg_iov	= ret_iov;
-	msg.msg_iovlen	= size_ret_iov;
+// unix_fds_close_msg closes the file descriptors of a received message which won't get handled.
+static void unix_fds_close_msg(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg = NULL;
 
-again:
-	ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
-	if (ret < 0) {
-		if (errno == EINTR)
-			goto again;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+			int *fds_raw = (int *)CMSG_DATA(cmsg);
+#pragma GCC diagnostic pop
+			__u32 num_raw = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
 
-		return -errno;
+			for (__u32 idx = 0; idx < num_raw; idx++)
+				close(fds_raw[idx]);
+		}
 	}
-	if (ret == 0)
-		return 0;
+}
+
+// unix_fds_from_msg extracts the file descriptors of a received message according to the
+// expectations of the caller.
+static int unix_fds_from_msg(struct msghdr *msg, struct unix_fds *ret_fds)
+{
+	struct cmsghdr *cmsg = NULL;
 
 	/* If SO_PASSCRED is set we will always get a ucred message. */
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
                 if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
 			__u32 idx;
 			/*
@@ -129,7 +133,7 @@ again:
 				return -EFBIG;
 			}
 
-			if (msg.msg_flags & MSG_CTRUNC) {
+			if (msg->msg_flags & MSG_CTRUNC) {
 				for (idx = 0; idx < num_raw; idx++)
 					close(fds_raw[idx]);
 
@@ -194,9 +198,148 @@ again:
 			return -EINVAL;
 	}
 
+	return 0;
+}
+
+ssize_t lxc_abstract_unix_recv_fds_iov(int fd, struct unix_fds *ret_fds,
+				       struct iovec *ret_iov, size_t size_ret_iov)
+{
+	__do_free char *cmsgbuf = NULL;
+	ssize_t ret;
+	int err;
+	struct msghdr msg = {};
+	size_t cmsgbufsize = unix_fds_cmsgbuf_size(ret_fds->fd_count_max);
+
+	err = unix_fds_check(ret_fds);
+	if (err < 0)
+		return ret_errno(-err);
+
+	cmsgbuf = zalloc(cmsgbufsize);
+	if (!cmsgbuf)
+		return ret_errno(ENOMEM);
+
+	msg.msg_control		= cmsgbuf;
+	msg.msg_controllen	= cmsgbufsize;
+
+	msg.msg_iov	= ret_iov;
+	msg.msg_iovlen	= size_ret_iov;
+
+again:
+	ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto again;
+
+		return -errno;
+	}
+	if (ret == 0)
+		return 0;
+
+	err = unix_fds_from_msg(&msg, ret_fds);
+	if (err < 0)
+		return ret_errno(-err);
+
 	return ret;
 }
 
+struct unix_fds_batch *lxc_abstract_unix_fds_batch_new(__u32 fd_count_max, __u32 flags)
+{
+	__do_free struct unix_fds_batch *batch = NULL;
+
+	batch = zalloc(sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->fd_count_max = fd_count_max;
+	batch->flags = flags;
+	batch->cmsgbuf_size = unix_fds_cmsgbuf_size(fd_count_max);
+
+	batch->cmsgbuf = zalloc(UNIX_FDS_BATCH_MAX * batch->cmsgbuf_size);
+	if (!batch->cmsgbuf)
+		return NULL;
+
+	return move_ptr(batch);
+}
+
+void lxc_abstract_unix_fds_batch_free(struct unix_fds_batch *batch)
+{
+	if (!batch)
+		return;
+
+	free(batch->cmsgbuf);
+	free(batch);
+}
+
+ssize_t lxc_abstract_unix_recv_fds_batch(int fd, struct unix_fds_batch *batch,
+					 struct unix_fds *ret_fds,
+					 struct iovec *const *ret_iovs,
+					 size_t size_ret_iov, unsigned int vlen,
+					 size_t *ret_sizes)
+{
+	struct mmsghdr msgs[UNIX_FDS_BATCH_MAX] = {};
+	int ret;
+	unsigned int n;
+
+	if (vlen == 0 || vlen > UNIX_FDS_BATCH_MAX)
+		return ret_errno(EINVAL);
+
+	// Report the failure of a message the previous call couldn't handle.
+	if (batch->error) {
+		ret = batch->error;
+		batch->error = 0;
+		return ret_errno(ret);
+	}
+
+	for (unsigned int i = 0; i < vlen; i++) {
+		ret_fds[i].fd_count_max = batch->fd_count_max;
+		ret_fds[i].fd_count_ret = 0;
+		ret_fds[i].flags = batch->flags;
+
+		ret = unix_fds_check(&ret_fds[i]);
+		if (ret < 0)
+			return ret_errno(-ret);
+
+		msgs[i].msg_hdr.msg_control	= batch->cmsgbuf + i * batch->cmsgbuf_size;
+		msgs[i].msg_hdr.msg_controllen	= batch->cmsgbuf_size;
+		msgs[i].msg_hdr.msg_iov		= ret_iovs[i];
+		msgs[i].msg_hdr.msg_iovlen	= size_ret_iov;
+	}
+
+	// Block for the first message only and take whatever else is queued.
+	do {
+		ret = recvmmsg(fd, msgs, vlen, MSG_CMSG_CLOEXEC | MSG_WAITFORONE, NULL);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	n = ret;
+	for (unsigned int i = 0; i < n; i++) {
+		if (msgs[i].msg_len == 0) {
+			// The peer went away, the messages before it still get handled.
+			for (unsigned int j = i + 1; j < n; j++)
+				unix_fds_close_msg(&msgs[j].msg_hdr);
+
+			return i;
+		}
+
+		ret = unix_fds_from_msg(&msgs[i].msg_hdr, &ret_fds[i]);
+		if (ret < 0) {
+			for (unsigned int j = i + 1; j < n; j++)
+				unix_fds_close_msg(&msgs[j].msg_hdr);
+
+			if (i == 0)
+				return ret_errno(-ret);
+
+			batch->error = -ret;
+			return i;
+		}
+
+		ret_sizes[i] = msgs[i].msg_len;
+	}
+
+	return n;
+}
+
 ssize_t lxc_abstract_unix_recv_fds(int fd, struct unix_fds *ret_fds,
 				   void *ret_data, size_t size_ret_data)
 {
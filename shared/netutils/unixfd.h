@@ -28,6 +28,23 @@ struct unix_fds {
 	__s32 fd[KERNEL_SCM_MAX_FD];
 } __attribute__((aligned(8)));
 
+/* Largest number of messages received with a single call. */
+#define UNIX_FDS_BATCH_MAX 16
+
+/*
+ * State of batched receives, the control buffers are allocated once and
+ * reused by every call.
+ */
+struct unix_fds_batch {
+	__u32 fd_count_max;
+	__u32 flags;
+	size_t cmsgbuf_size;
+	char *cmsgbuf;
+
+	/* Failure of a message held back until the ones before it got handled. */
+	int error;
+};
+
 extern int lxc_abstract_unix_send_fds(int fd, int *sendfds, int num_sendfds,
 				      void *data, size_t size);
 
@@ -38,4 +55,15 @@ extern ssize_t lxc_abstract_unix_recv_fds_iov(int fd, struct unix_fds *ret_fds,
 extern ssize_t lxc_abstract_unix_recv_fds(int fd, struct unix_fds *ret_fds,
 					  void *ret_data, size_t size_ret_data);
 
+extern struct unix_fds_batch *lxc_abstract_unix_fds_batch_new(__u32 fd_count_max,
+							      __u32 flags);
+
+extern void lxc_abstract_unix_fds_batch_free(struct unix_fds_batch *batch);
+
+extern ssize_t lxc_abstract_unix_recv_fds_batch(int fd, struct unix_fds_batch *batch,
+						struct unix_fds *ret_fds,
+						struct iovec *const *ret_iovs,
+						size_t size_ret_iov, unsigned int vlen,
+						size_t *ret_sizes);
+
 #endif // LXD_UNIXFD_H
@@ -408,6 +408,7 @@ var APIExtensions = []string{
 	"device_usb_serial",
 	"network_allocate_external_ips",
 	"explicit_trust_token",
+	"proxy_reuseport_listeners",
 }
 
 // APIExtensionsCount returns the number of available API extensions.